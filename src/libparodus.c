@@ -19,18 +19,27 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <limits.h>
 #include <errno.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/time.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include <nanomsg/nn.h>
 #include <nanomsg/pipeline.h>
 #include "libparodus.h"
 #include "libparodus_private.h"
 #include "libparodus_time.h"
-#include "libparodus_test_timing.h"
+#include "libparodus_hist.h"
 #include <pthread.h>
 #include "libparodus_queues.h"
+#include "libparodus_msgpack.h"
+#include "libparodus_reqs.h"
+#include "libparodus_spool.h"
 
 //#define PARODUS_SERVICE_REQUIRES_REGISTRATION 1
 
@@ -44,50 +53,230 @@
 
 #define URL_SIZE 32
 
+// an encoded wrp msg waiting on the async send queue
+typedef struct send_item {
+	void *msg_bytes;
+	ssize_t msg_len;
+	size_t buf_size;	// bytes allocated at msg_bytes, kept when pooled
+	struct send_item *next;	// link in the instance free list
+	bool pooled;	// part of inst->send_items, so not freed
+} send_item_t;
+
+// one buffer holding a chunk of libparodus_send_batch msgs, encoded 
+// back to back. Kept by the instance for the next batch.
+typedef struct {
+	size_t size;	// bytes allocated at bytes
+	uint8_t bytes[];
+} encode_arena_t;
+
+// a received msg whose payload points into the nanomsg receive buffer
+typedef struct zc_msg {
+	wrp_msg_t msg;	// must be first. This is what the application sees.
+	wrp_msg_t *decoded;	// owns everything but the payload
+	void *nn_buf;	// owns the payload, NULL if no payload
+	struct zc_pool *pool;
+	struct zc_msg *next;	// link in the pool free list
+} zc_msg_t;
+
+// most msgs timed by one libparodus_receive_batch call
+#define RCV_BATCH_STAMPS	32
+
+// most zero copy msgs kept for reuse
+#define ZC_POOL_MAX 64
+
+typedef struct zc_pool {
+	pthread_mutex_t mutex;
+	zc_msg_t *free_list;
+	unsigned free_count;
+	unsigned refs;	// the instance, plus each msg in use
+} zc_pool_t;
+
+// zero copy decode buffer. Each decoding thread has its own.
+typedef struct {
+	uint8_t *buf;
+	size_t size;
+} decode_buf_t;
+
+// a service name registered by the instance, in the service table
+typedef struct {
+	const char *name;	// NULL for an empty slot
+	size_t name_len;
+	libpd_mq_t *wrp_queue;	// receive queue of the service
+} svc_entry_t;
+
+// one of cfg.extra_services
+typedef struct {
+	char *wrp_queue_name;
+	libpd_mq_t wrp_queue;
+} service_t;
 
 typedef struct {
 	int run_state;
 	const char *parodus_url;
 	const char *client_url;
-	int keep_alive_count;
-	int reconnect_count;
+	libpd_stats_t stats;	// updated atomically, see STAT_ADD
 	libpd_cfg_t cfg;
 	bool connect_on_every_send; // always false, currently
 	int rcv_sock;
-	int stop_rcv_sock;
+	int rcv_fd;	// polls readable when a msg can be received on rcv_sock
+	int wake_fd;	// readable when the receiver thread is woken
+	int wake_wfd;	// write end, when a pipe stands in for eventfd
+	int conn_state;	// LIBPD_CONN_UP or DOWN, only used by the receiver thread
+	bool reconnect_requested;	// by libparodus_reconnect
+	unsigned reconnect_attempts;	// failed, since the connection went down
+	uint64_t reconnect_at_ms;	// when the next attempt is due, monotonic
+	uint64_t down_ms;	// when the connection went down, monotonic
+	unsigned backoff_seed;	// for reconnect jitter
+	int liveness;	// LIBPD_LIVENESS_ALIVE, SUSPECT or DOWN
+	uint64_t last_rcv_ms;	// when any msg was last received, monotonic
 	int send_sock;
+	int send_timeout_ms;	// cfg.send_timeout_ms, or the default
 	char *wrp_queue_name;
 	libpd_mq_t wrp_queue;
 	extra_err_info_t rcv_err_info;
 	pthread_t wrp_receiver_tid;
 	pthread_mutex_t send_mutex;
 	bool auth_received;
+	libpd_mq_t send_queue;	// only used for async sends
+	pthread_t wrp_sender_tid;
+	int send_pending;	// async sends queued or in progress
+	pthread_cond_t send_flush_cond;
+	send_item_t *send_items;	// preallocated async send items
+	send_item_t *send_free_items;
+	pthread_mutex_t send_items_mutex;
+	encode_arena_t *batch_arena;	// kept between send batches, exchanged atomically
+	zc_pool_t *zc_pool;	// only used for zero copy receive
+	libpd_hist_t *hists[LIBPD_NUM_HISTS];	// only used for latency_histograms
+	service_t *services;	// extra_services, NULL if none
+	unsigned num_services;
+	svc_entry_t *svc_table;	// open addressed, all service names by hash
+	unsigned svc_table_mask;
+	struct decoder *decoders;	// rcv_decode_threads, NULL if none
+	libpd_reqs_t *reqs;	// libparodus_request calls waiting, only with receive
+	libpd_spool_t *spool;	// only with send_spool_path
+	pthread_t spool_tid;
+	pthread_mutex_t spool_mutex;
+	pthread_cond_t spool_cond;	// signaled when msgs are spooled, and at stop
+	bool spool_stop;
 } __instance_t;
 
+// stats are read by libparodus_get_stats while other threads update them
+#define STAT_ADD(inst, field, n) \
+	__atomic_add_fetch (&(inst)->stats.field, (n), __ATOMIC_RELAXED)
+#define STAT_GET(inst, field) \
+	__atomic_load_n (&(inst)->stats.field, __ATOMIC_RELAXED)
+
 #define SOCK_SEND_TIMEOUT_MS 2000
 
+#define SPOOL_DEFAULT_BYTES (1024 * 1024)
+// with a send spool, how long a send waits for parodus before the msg
+// is spooled instead
+#define SPOOL_SEND_TIMEOUT_MS 10
+// how long the spool thread waits after parodus did not take a msg
+#define SPOOL_RETRY_MS 500
+
 #define MAX_RECONNECT_RETRY_DELAY_SECS 63
+// the first reconnect attempt is quick, then the delay doubles from
+// RECONNECT_BASE_DELAY_MS, each jittered between half and all of it
+#define RECONNECT_FIRST_DELAY_MS 100
+#define RECONNECT_BASE_DELAY_MS 1000
 
-#define END_MSG "---END-PARODUS---\n"
-static const char *end_msg = END_MSG;
+#define CLOSED_MSG "---CLOSED---\n"
 
-static char *closed_msg = "---CLOSED---\n";
+// queued by libparodus_close_receiver. Never freed.
+static wrp_msg_t closed_wrp_msg = {
+	.msg_type = WRP_MSG_TYPE__REQ,
+	.u.req.transaction_uuid = CLOSED_MSG,
+	.u.req.source = CLOSED_MSG,
+	.u.req.dest = CLOSED_MSG,
+	.u.req.payload = (void*) CLOSED_MSG,
+	.u.req.payload_size = sizeof(CLOSED_MSG) - 1
+};
 
 typedef struct {
 	int len;
 	char *msg;
 } raw_msg_t;
 
+// a raw msg handed from the receiver thread to a decode thread
+typedef struct decode_item {
+	raw_msg_t raw_msg;
+	int route;	// peek_raw_msg result, 1 or 2
+	svc_entry_t *service;	// when route is 1
+	uint64_t rcv_ns;
+	struct decode_item *next;	// link in the decoder free list
+	bool pooled;	// part of decoder items, so not freed
+} decode_item_t;
+
+// one of the rcv_decode_threads
+typedef struct decoder {
+	__instance_t *inst;
+	libpd_mq_t queue;	// decode items, only sent by the receiver thread
+	pthread_t tid;
+	bool started;
+	decode_item_t *items;	// preallocated decode items
+	decode_item_t *free_items;
+	pthread_mutex_t items_mutex;
+	decode_buf_t hdr_buf;
+} decoder_t;
+
+#define DECODE_QUEUE_NAME "/LIBPD_DECODE_QUEUE"
+#define DECODE_QUEUE_SIZE 64
+// short, so that a decode thread that falls behind does not hold up the
+// receiver thread and keep alive handling for the other sources
+#define DECODE_QUEUE_SEND_TIMEOUT_MS 10
+
+// queued by shutdown to stop a decode thread
+static decode_item_t decode_stop_item;
+
 #define WRP_QUEUE_SEND_TIMEOUT_MS	2000
 #define WRP_QNAME_HDR "/LIBPD_WRP_QUEUE"
 #define WRP_QUEUE_SIZE 50
 
+#if LIBPD_MAX_RCV_LANES != LIBPD_QMAX_LANES
+#error "LIBPD_MAX_RCV_LANES must match LIBPD_QMAX_LANES"
+#endif
+
+#define SEND_QUEUE_NAME "/LIBPD_SEND_QUEUE"
+
+// msgs encoded and sent per send_mutex lock by libparodus_send_batch
+#define SEND_BATCH_MAX 64
+
+// pooled send items keep encode buffers up to this size for the next msg
+#define SEND_ITEM_KEEP_BYTES 4096
+
+// the batch encode arena is kept for the next batch up to this size
+#define BATCH_ARENA_KEEP_BYTES (64 * 1024)
+
+// most fields of a msg encoded by wrp_fast_fields
+#define WRP_FAST_FIELDS 7
+
+// flags for sock_send_msgs
+#define SEND_COUNT_ERRORS	0x1	// count failed sends in the send error stats
+#define SEND_NN_MSGS	0x2	// msg_bytes are nn_allocmsg buffers
+
+// queued by shutdown to stop the sender thread
+static send_item_t send_stop_item = {NULL, 0, 0, NULL, false};
+
 const char *wrp_qname_hdr = WRP_QNAME_HDR;
 
 int flush_wrp_queue (libpd_mq_t wrp_queue, uint32_t delay_ms, int *exterr);
-static int wrp_sock_send (__instance_t *inst, wrp_msg_t *msg, extra_err_info_t *err_info);
+static int flush_wrp_queue__ (libpd_mq_t wrp_queue, uint32_t delay_ms,
+	free_msg_func_t *free_msg_func, int *oserr);
+static int wrp_sock_send (__instance_t *inst, wrp_msg_t *msg, int timeout_ms,
+	bool spool, extra_err_info_t *err_info);
+static int wrp_sock_send_bytes (__instance_t *inst, void *msg_bytes, ssize_t msg_len,
+	extra_err_info_t *err_info);
 static void *wrp_receiver_thread (void *arg);
+static void *wrp_sender_thread (void *arg);
+static void *wrp_decoder_thread (void *arg);
+static char *find_wrp_msg_uuid (wrp_msg_t *wrp_msg);
+static void **wrp_msg_payload (wrp_msg_t *msg, size_t **payload_size);
 static void libparodus_shutdown__ (__instance_t *inst, extra_err_info_t *err_info);
+static int start_spool (__instance_t *inst, int *oserr);
+static void stop_spool (__instance_t *inst);
+static zc_pool_t *zc_pool_create (void);
+static void zc_pool_release (zc_pool_t *pool);
 
 #define RUN_STATE_RUNNING		1234
 #define RUN_STATE_DONE			-1234
@@ -111,6 +300,10 @@ err_table_item_t error_msg_table[] = {
 			 "Error on libparodus init. Could not create receive queue."},
 		{ LIBPD_ERROR_INIT_REGISTER,
 			 "Error on libparodus init. Registration failed."},
+		{ LIBPD_ERROR_INIT_SEND_THREAD,
+			 "Error on libparodus init. Could not create sender thread."},
+		{ LIBPD_ERROR_INIT_SPOOL,
+			 "Error on libparodus init. Could not open send spool."},
 		{ LIBPD_ERROR_RCV_NULL_INST,
 			 "Error on libparodus receive. Null instance given."},
 		{ LIBPD_ERROR_RCV_STATE,
@@ -121,6 +314,8 @@ err_table_item_t error_msg_table[] = {
 			 "Error on libparodus receive. Error receiveing from receive queue."},
 		{ LIBPD_ERROR_RCV_THR_LIMIT,
 			 "Error on libparodus receive. Thread limit exceeded."},
+		{ LIBPD_ERROR_RCV_SERVICE,
+			 "Error on libparodus receive. Unknown service name."},
 		{ LIBPD_ERROR_CLOSE_RCV_NULL_INST,
 			 "Error on libparodus close receiver. Null instance given."},
 		{ LIBPD_ERROR_CLOSE_RCV_STATE,
@@ -142,7 +337,31 @@ err_table_item_t error_msg_table[] = {
 		{ LIBPD_ERROR_SEND_SOCKET,
 			 "Error on libparodus send. Socket send error."},
 		{ LIBPD_ERROR_SEND_THR_LIMIT,
-			 "Error on libparodus send. Thread limit exceeded."}
+			 "Error on libparodus send. Thread limit exceeded."},
+		{ LIBPD_ERROR_SEND_QUEUE_FULL,
+			 "Error on libparodus send. Send queue full."},
+		{ LIBPD_ERROR_SEND_WOULD_BLOCK,
+			 "Error on libparodus send. Send would block."},
+		{ LIBPD_ERROR_SEND_SPOOL_FULL,
+			 "Error on libparodus send. Send spool full."},
+		{ LIBPD_ERROR_STATS_NULL_INST,
+			 "Error on libparodus get stats. Null instance given."},
+		{ LIBPD_ERROR_STATS_CFG,
+			 "Error on libparodus get latency. Histograms not configured or invalid histogram."},
+		{ LIBPD_ERROR_REQ_NULL_INST,
+			 "Error on libparodus request. Null instance given."},
+		{ LIBPD_ERROR_REQ_STATE,
+			 "Error on libparodus request. Run state error."},
+		{ LIBPD_ERROR_REQ_CFG,
+			 "Error on libparodus request. Not configured for receive."},
+		{ LIBPD_ERROR_REQ_WRP_MSG,
+			 "Error on libparodus request. Invalid request msg."},
+		{ LIBPD_ERROR_REQ_DUP_ID,
+			 "Error on libparodus request. Transaction uuid already waiting."},
+		{ LIBPD_ERROR_REQ_ALLOC,
+			 "Error on libparodus request. Unable to allocate request."},
+		{ LIBPD_ERROR_REQ_SEND,
+			 "Error on libparodus request. Send error."}
 };
 
 
@@ -182,6 +401,43 @@ static void getParodusUrl(__instance_t *inst)
   libpd_log (LEVEL_INFO, ("LIBPARODUS: client url is  %s\n", inst->client_url));
 }
 
+static bool create_hists (__instance_t *inst)
+{
+	int i;
+
+	for (i=0; i<LIBPD_NUM_HISTS; i++) {
+		inst->hists[i] = libpd_hist_create ();
+		if (NULL == inst->hists[i])
+			return false;
+	}
+	return true;
+}
+
+static void destroy_hists (__instance_t *inst)
+{
+	int i;
+
+	for (i=0; i<LIBPD_NUM_HISTS; i++) {
+		libpd_hist_destroy (inst->hists[i]);
+		inst->hists[i] = NULL;
+	}
+}
+
+// returns the start time for hist_record, or 0 if not timing
+static uint64_t hist_start (__instance_t *inst)
+{
+	if (NULL == inst->hists[0])
+		return 0;
+	return get_monotonic_ns ();
+}
+
+static void hist_record (__instance_t *inst, libpd_hist_id_t id, uint64_t start_ns)
+{
+	if ((NULL == inst->hists[id]) || (0 == start_ns))
+		return;
+	libpd_hist_record (inst->hists[id], get_monotonic_ns () - start_ns);
+}
+
 static __instance_t *make_new_instance (libpd_cfg_t *cfg)
 {
 	size_t qname_len;
@@ -196,15 +452,148 @@ static __instance_t *make_new_instance (libpd_cfg_t *cfg)
 		return NULL;
 	}
 	memset ((void*) inst, 0, sizeof(__instance_t));
+	inst->wake_fd = -1;
+	inst->wake_wfd = -1;
+	inst->backoff_seed = (unsigned) get_monotonic_ns () ^ 
+		(unsigned) (uintptr_t) inst;
+	if (cfg->latency_histograms && !create_hists (inst)) {
+		destroy_hists (inst);
+		free (wrp_queue_name);
+		free (inst);
+		return NULL;
+	}
+	if (cfg->receive && cfg->zero_copy_receive) {
+		inst->zc_pool = zc_pool_create ();
+		if (NULL == inst->zc_pool) {
+			destroy_hists (inst);
+			free (wrp_queue_name);
+			free (inst);
+			return NULL;
+		}
+	}
+	if (cfg->receive) {
+		inst->reqs = libpd_reqs_create ();
+		if (NULL == inst->reqs) {
+			zc_pool_release (inst->zc_pool);
+			destroy_hists (inst);
+			free (wrp_queue_name);
+			free (inst);
+			return NULL;
+		}
+	}
 	inst->wrp_queue_name = wrp_queue_name;
 	pthread_mutex_init (&inst->send_mutex, NULL);
+	init_timed_cond (&inst->send_flush_cond);
+	pthread_mutex_init (&inst->send_items_mutex, NULL);
+	pthread_mutex_init (&inst->spool_mutex, NULL);
+	init_timed_cond (&inst->spool_cond);
 	//inst->cfg = *cfg;
 	memcpy (&inst->cfg, cfg, sizeof(libpd_cfg_t));
+	inst->send_timeout_ms = SOCK_SEND_TIMEOUT_MS;
+	if (cfg->send_timeout_ms > 0)
+		inst->send_timeout_ms = (cfg->send_timeout_ms > INT_MAX) ?
+			INT_MAX : (int) cfg->send_timeout_ms;
 	getParodusUrl (inst);
 	sprintf (inst->wrp_queue_name, "%s.%s", wrp_qname_hdr, cfg->service_name);
 	return inst;
 }
 
+static uint32_t service_hash (const char *name, size_t len)
+{
+	uint32_t hash = 2166136261u;	// FNV-1a
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t) name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static svc_entry_t *find_service (__instance_t *inst, const char *name, size_t len)
+{
+	uint32_t i = service_hash (name, len) & inst->svc_table_mask;
+	svc_entry_t *entry;
+
+	// the table is never more than half full, so there is an empty slot
+	for (entry = &inst->svc_table[i]; NULL != entry->name; 
+	     entry = &inst->svc_table[i]) {
+		if ((entry->name_len == len) && (memcmp (entry->name, name, len) == 0))
+			return entry;
+		i = (i + 1) & inst->svc_table_mask;
+	}
+	return NULL;
+}
+
+// returns false if the name is already in the table
+static bool add_service (__instance_t *inst, const char *name, libpd_mq_t *wrp_queue)
+{
+	size_t len = strlen (name);
+	uint32_t i = service_hash (name, len) & inst->svc_table_mask;
+
+	if (NULL != find_service (inst, name, len))
+		return false;
+	while (NULL != inst->svc_table[i].name)
+		i = (i + 1) & inst->svc_table_mask;
+	inst->svc_table[i].name = name;
+	inst->svc_table[i].name_len = len;
+	inst->svc_table[i].wrp_queue = wrp_queue;
+	return true;
+}
+
+// Sets up the service table with service_name and extra_services.
+// returns 0, LIBPD_ERR_INIT_INST, or LIBPD_ERR_INIT_SERVICES
+static int build_services (__instance_t *inst)
+{
+	const char **names = inst->cfg.extra_services;
+	unsigned i, n = 0, table_size = 4;
+	size_t qname_len;
+
+	if (NULL != names)
+		while (NULL != names[n])
+			n++;
+	while (table_size < 2 * (n + 1))
+		table_size *= 2;
+	inst->svc_table = (svc_entry_t *) calloc (table_size, sizeof(svc_entry_t));
+	if (NULL == inst->svc_table)
+		return LIBPD_ERR_INIT_INST;
+	inst->svc_table_mask = table_size - 1;
+	add_service (inst, inst->cfg.service_name, &inst->wrp_queue);
+	if (0 == n)
+		return 0;
+	inst->services = (service_t *) calloc (n, sizeof(service_t));
+	if (NULL == inst->services)
+		return LIBPD_ERR_INIT_INST;
+	inst->num_services = n;
+	for (i = 0; i < n; i++) {
+		if ((names[i][0] == '\0') || (NULL != strchr (names[i], '/')) ||
+		    !add_service (inst, names[i], &inst->services[i].wrp_queue)) {
+			libpd_log (LEVEL_ERROR, ("LIBPARODUS: invalid or duplicate service %s\n",
+				names[i]));
+			return LIBPD_ERR_INIT_SERVICES;
+		}
+		qname_len = strlen(wrp_qname_hdr) + strlen(names[i]) + 1;
+		inst->services[i].wrp_queue_name = (char*) malloc (qname_len+1);
+		if (NULL == inst->services[i].wrp_queue_name)
+			return LIBPD_ERR_INIT_INST;
+		sprintf (inst->services[i].wrp_queue_name, "%s.%s", wrp_qname_hdr, names[i]);
+	}
+	return 0;
+}
+
+static void destroy_services (__instance_t *inst)
+{
+	unsigned i;
+
+	for (i = 0; i < inst->num_services; i++)
+		free (inst->services[i].wrp_queue_name);
+	free (inst->services);
+	free (inst->svc_table);
+	inst->services = NULL;
+	inst->num_services = 0;
+	inst->svc_table = NULL;
+}
+
 static void destroy_instance (libpd_instance_t *instance)
 {
 	__instance_t *inst;
@@ -213,7 +602,16 @@ static void destroy_instance (libpd_instance_t *instance)
 		if (NULL != inst) {
 			if (NULL != inst->wrp_queue_name)
 				free (inst->wrp_queue_name);
+			destroy_services (inst);
 			pthread_mutex_destroy (&inst->send_mutex);
+			pthread_cond_destroy (&inst->send_flush_cond);
+			pthread_mutex_destroy (&inst->send_items_mutex);
+			free (inst->batch_arena);
+			pthread_mutex_destroy (&inst->spool_mutex);
+			pthread_cond_destroy (&inst->spool_cond);
+			zc_pool_release (inst->zc_pool);
+			libpd_reqs_destroy (inst->reqs);
+			destroy_hists (inst);
 			free (inst);
 			*instance = NULL;
 		}
@@ -253,22 +651,21 @@ typedef enum {
 	CONN_RCV_ERR_CREATE = -0x40,
 	/** 
 	 * @brief Error on connect_receiver
-	 * error setting socket option
+	 * error binding to socket
 	 */
-	CONN_RCV_ERR_SETOPT = -0x80,
+	CONN_RCV_ERR_BIND = -0xC0,
 	/** 
-	 * @brief Error on connect_receiver
-	 * error binding to socket
+	 * @brief Error on get_sock_rcv_fd
+	 * error getting the socket receive fd
 	 */
-	CONN_RCV_ERR_BIND = -0xC0
+	CONN_RCV_ERR_RCVFD = -0x100
 } conn_rcv_error_t;
 
 /**
  * Open receive socket and bind to it.
  */
-int connect_receiver (const char *rcv_url, int keepalive_timeout_secs, int *oserr)
+int connect_receiver (const char *rcv_url, int *oserr)
 {
-	int rcv_timeout;
 	int sock;
 
 	*oserr = 0;
@@ -281,16 +678,6 @@ int connect_receiver (const char *rcv_url, int keepalive_timeout_secs, int *oser
 		libpd_log_err (LEVEL_ERROR, errno, ("Unable to create rcv socket %s\n", rcv_url));
  		return CONN_RCV_ERR_CREATE;
 	}
-	if (keepalive_timeout_secs > 0) { 
-		rcv_timeout = keepalive_timeout_secs * 1000;
-		if (nn_setsockopt (sock, NN_SOL_SOCKET, NN_RCVTIMEO, 
-					&rcv_timeout, sizeof (rcv_timeout)) < 0) {
-			*oserr = errno;
-			libpd_log_err (LEVEL_ERROR, errno, ("Unable to set socket timeout: %s\n", rcv_url));
-			shutdown_socket (&sock);
- 			return CONN_RCV_ERR_SETOPT;
-		}
-	}
   if (nn_bind (sock, rcv_url) < 0) {
 		*oserr = errno;
 		libpd_log_err (LEVEL_ERROR, errno, ("Unable to bind to receive socket %s\n", rcv_url));
@@ -300,6 +687,21 @@ int connect_receiver (const char *rcv_url, int keepalive_timeout_secs, int *oser
 	return sock;
 }
 
+// the fd that polls readable when a msg can be received on sock.
+// returns 0 or CONN_RCV_ERR_RCVFD
+static int get_sock_rcv_fd (int sock, int *fd, int *oserr)
+{
+	size_t fd_size = sizeof(*fd);
+
+	*oserr = 0;
+	if (nn_getsockopt (sock, NN_SOL_SOCKET, NN_RCVFD, fd, &fd_size) < 0) {
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to get receive socket fd\n"));
+		return CONN_RCV_ERR_RCVFD;
+	}
+	return 0;
+}
+
 typedef enum {
 	/** 
 	 * @brief Error on connect_sender
@@ -326,10 +728,10 @@ typedef enum {
 /**
  * Open send socket and connect to it.
  */
-int connect_sender (const char *send_url, int *oserr)
+int connect_sender (const char *send_url, int send_timeout_ms, int *oserr)
 {
 	int sock;
-	int send_timeout = SOCK_SEND_TIMEOUT_MS;
+	int send_timeout = send_timeout_ms;
 
 	*oserr = 0;
 	if (NULL == send_url) {
@@ -359,9 +761,9 @@ int connect_sender (const char *send_url, int *oserr)
 }
 
 static int create_thread (pthread_t *tid, void *(*thread_func) (void*),
-	__instance_t *inst)
+	void *arg)
 {
-	int rtn = pthread_create (tid, NULL, thread_func, (void*) inst);
+	int rtn = pthread_create (tid, NULL, thread_func, arg);
 	if (rtn != 0) {
 		libpd_log_err (LEVEL_ERROR, rtn, ("Unable to create thread\n"));
 	}
@@ -370,8 +772,7 @@ static int create_thread (pthread_t *tid, void *(*thread_func) (void*),
 
 static bool is_closed_msg (wrp_msg_t *msg)
 {
-	return (msg->msg_type == WRP_MSG_TYPE__REQ) &&
-		(strcmp (msg->u.req.dest, closed_msg) == 0);
+	return msg == &closed_wrp_msg;
 }
 
 static void wrp_free (void *msg)
@@ -380,12 +781,111 @@ static void wrp_free (void *msg)
 	if (NULL == msg)
 		return;
 	wrp_msg = (wrp_msg_t *) msg;
-	if (is_closed_msg (wrp_msg))
-		free (wrp_msg);
-	else
+	if (!is_closed_msg (wrp_msg))
 		wrp_free_struct (wrp_msg);
 }
 
+// Caches freed zero copy msgs for reuse by the receiver thread.
+// Freed when the instance and every msg allocated from it are done with it.
+static zc_pool_t *zc_pool_create (void)
+{
+	zc_pool_t *pool = (zc_pool_t *) malloc (sizeof(zc_pool_t));
+	if (NULL == pool)
+		return NULL;
+	memset ((void *) pool, 0, sizeof(zc_pool_t));
+	pthread_mutex_init (&pool->mutex, NULL);
+	pool->refs = 1;
+	return pool;
+}
+
+// called with the pool mutex held, which is released
+static void zc_pool_unref (zc_pool_t *pool)
+{
+	zc_msg_t *zc_msg;
+	bool done = (--pool->refs == 0);
+
+	pthread_mutex_unlock (&pool->mutex);
+	if (!done)
+		return;
+	while (NULL != pool->free_list) {
+		zc_msg = pool->free_list;
+		pool->free_list = zc_msg->next;
+		free (zc_msg);
+	}
+	pthread_mutex_destroy (&pool->mutex);
+	free (pool);
+}
+
+static void zc_pool_release (zc_pool_t *pool)
+{
+	if (NULL == pool)
+		return;
+	pthread_mutex_lock (&pool->mutex);
+	zc_pool_unref (pool);
+}
+
+static zc_msg_t *zc_msg_get (zc_pool_t *pool)
+{
+	zc_msg_t *zc_msg;
+
+	pthread_mutex_lock (&pool->mutex);
+	zc_msg = pool->free_list;
+	if (NULL != zc_msg) {
+		pool->free_list = zc_msg->next;
+		pool->free_count--;
+	} else {
+		zc_msg = (zc_msg_t *) malloc (sizeof(zc_msg_t));
+	}
+	if (NULL != zc_msg) {
+		zc_msg->pool = pool;
+		pool->refs++;
+	}
+	pthread_mutex_unlock (&pool->mutex);
+	return zc_msg;
+}
+
+static void zc_msg_put (zc_msg_t *zc_msg)
+{
+	zc_pool_t *pool = zc_msg->pool;
+
+	pthread_mutex_lock (&pool->mutex);
+	if (pool->free_count < ZC_POOL_MAX) {
+		zc_msg->next = pool->free_list;
+		pool->free_list = zc_msg;
+		pool->free_count++;
+	} else {
+		free (zc_msg);
+	}
+	zc_pool_unref (pool);
+}
+
+static void wrp_free_zc (void *msg)
+{
+	zc_msg_t *zc_msg;
+	if (NULL == msg)
+		return;
+	if (is_closed_msg ((wrp_msg_t *) msg))
+		return;
+	zc_msg = (zc_msg_t *) msg;
+	wrp_free_struct (zc_msg->decoded);
+	if (NULL != zc_msg->nn_buf)
+		nn_freemsg (zc_msg->nn_buf);
+	zc_msg_put (zc_msg);
+}
+
+// false when not receiving, or when msgs go to rcv_func
+static bool uses_wrp_queue (__instance_t *inst)
+{
+	return inst->cfg.receive && (NULL == inst->cfg.rcv_func);
+}
+
+static free_msg_func_t *rcv_msg_free_func (__instance_t *inst)
+{
+	if (inst->cfg.zero_copy_receive)
+		return &wrp_free_zc;
+	return &wrp_free;
+}
+
 typedef enum {
 	/** 
 	 * @brief Error on sock_send
@@ -428,121 +928,625 @@ typedef enum {
 	WRP_SEND_ERR_NN = -0x840
 } wrp_sock_send_error_t;
 
-static int send_registration_msg (__instance_t *inst, extra_err_info_t *err)
+// registers service_name and each of extra_services
+// timeout_ms is as for sock_send_msgs: 0 does not wait for the send lock 
+// or the socket, -1 is send_timeout_ms
+static int send_registration_msg (__instance_t *inst, int timeout_ms, 
+	extra_err_info_t *err)
 {
 	wrp_msg_t reg_msg;
+	unsigned i;
+	int rtn;
+
 	reg_msg.msg_type = WRP_MSG_TYPE__SVC_REGISTRATION;
 	reg_msg.u.reg.service_name = (char *) inst->cfg.service_name;
 	reg_msg.u.reg.url = (char *) inst->client_url;
-	return wrp_sock_send (inst, &reg_msg, err);
+	rtn = wrp_sock_send (inst, &reg_msg, timeout_ms, false, err);
+	for (i = 0; (rtn == 0) && (i < inst->num_services); i++) {
+		reg_msg.u.reg.service_name = (char *) inst->cfg.extra_services[i];
+		rtn = wrp_sock_send (inst, &reg_msg, timeout_ms, false, err);
+	}
+	return rtn;
 }
 
 static bool show_options (libpd_cfg_t *cfg)
 {
 	libpd_log (LEVEL_DEBUG, 
-		("LIBPARODUS Options: Rcv: %d, KA Timeout: %d\n",
-		cfg->receive, cfg->keepalive_timeout_secs));
+		("LIBPARODUS Options: Rcv: %d, KA Timeout: %d, Single Rcvr: %d, Zero Copy: %d, "
+		"Rcv fd: %d, Rcv func: %d, Latency Hists: %d, Rcv Overflow: %u, "
+		"Rcv Queue Size: %u, Max Size: %u, Max Bytes: %zu, Lanes: %u, "
+		"Decode Threads: %u, Liveness Grace: %d, Probe: %d, Send Timeout: %u, "
+		"Send Spool: %s\n",
+		cfg->receive, cfg->keepalive_timeout_secs, cfg->single_receiver,
+		cfg->zero_copy_receive, cfg->receive_fd, (NULL != cfg->rcv_func),
+		cfg->latency_histograms, cfg->rcv_queue_overflow,
+		cfg->rcv_queue_size, cfg->rcv_queue_max_size, cfg->rcv_queue_max_bytes,
+		cfg->rcv_queue_lanes, cfg->rcv_decode_threads, 
+		cfg->liveness_grace_secs, cfg->liveness_probe, cfg->send_timeout_ms,
+		(NULL != cfg->send_spool_path) ? cfg->send_spool_path : "none"));
 	return cfg->receive;
 }
 
-// define ABORT FLAGS
-#define ABORT_RCV_SOCK	1
-#define ABORT_QUEUE			2
-#define ABORT_SEND_SOCK	4
-#define ABORT_STOP_RCV_SOCK	8
+// priority of a received msg, for LIBPD_RCV_OVERFLOW_DROP_PRIORITY
+static int wrp_msg_prio (void *msg)
+{
+	wrp_msg_t *wrp_msg = (wrp_msg_t *) msg;
 
+	if (is_closed_msg (wrp_msg))
+		return LIBPD_QPRIO_KEEP;
+	switch (wrp_msg->msg_type) {
+		case WRP_MSG_TYPE__REQ:
+			return 3;
+		case WRP_MSG_TYPE__CREATE:
+		case WRP_MSG_TYPE__RETREIVE:
+		case WRP_MSG_TYPE__UPDATE:
+		case WRP_MSG_TYPE__DELETE:
+			return 2;
+		case WRP_MSG_TYPE__EVENT:
+			return 1;
+		default:
+			return 0;
+	}
+}
 
-static void abort_init (__instance_t *inst, unsigned opt)
+// lane of a received msg, when rcv_queue_lanes > 1
+static unsigned wrp_msg_lane (void *msg, void *lane_arg)
 {
-	if (opt & ABORT_RCV_SOCK)
-		shutdown_socket (&inst->rcv_sock);
-	if (opt & ABORT_QUEUE)
-		libpd_qdestroy (&inst->wrp_queue, &wrp_free);
-	if (opt & ABORT_SEND_SOCK)
-		shutdown_socket(&inst->send_sock);
-	if (opt & ABORT_STOP_RCV_SOCK)
-			shutdown_socket(&inst->stop_rcv_sock);
+	__instance_t *inst = (__instance_t *) lane_arg;
+	wrp_msg_t *wrp_msg = (wrp_msg_t *) msg;
+
+	if (is_closed_msg (wrp_msg))
+		return LIBPD_MAX_RCV_LANES - 1;
+	if (NULL != inst->cfg.rcv_lane_func)
+		return inst->cfg.rcv_lane_func ((libpd_instance_t) inst, wrp_msg);
+	switch (wrp_msg->msg_type) {
+		case WRP_MSG_TYPE__REQ:
+			return 0;
+		case WRP_MSG_TYPE__CREATE:
+		case WRP_MSG_TYPE__RETREIVE:
+		case WRP_MSG_TYPE__UPDATE:
+		case WRP_MSG_TYPE__DELETE:
+			return 1;
+		case WRP_MSG_TYPE__EVENT:
+			return 2;
+		default:
+			return 3;
+	}
 }
 
-int libparodus_init_dbg (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg,
-    extra_err_info_t *err_info)
+static size_t wrp_msg_size (void *msg);
+
+static int create_wrp_queue (__instance_t *inst, libpd_mq_t *wrp_queue,
+	const char *wrp_queue_name, bool event_fd, int *oserr)
 {
-	bool need_to_send_registration;
+	libpd_qcfg_t qcfg;
+
+	memset ((void *) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = (inst->cfg.rcv_queue_size > 0) ? 
+		inst->cfg.rcv_queue_size : WRP_QUEUE_SIZE;
+	qcfg.overflow = inst->cfg.rcv_queue_overflow;
+	qcfg.prio_func = wrp_msg_prio;
+	qcfg.grow_max_msgs = inst->cfg.rcv_queue_max_size;
+	qcfg.max_bytes = inst->cfg.rcv_queue_max_bytes;
+	qcfg.size_func = wrp_msg_size;
+	qcfg.lanes = inst->cfg.rcv_queue_lanes;
+	memcpy ((void *) qcfg.lane_weights, (void *) inst->cfg.rcv_lane_weights, 
+		sizeof(qcfg.lane_weights));
+	qcfg.lane_func = wrp_msg_lane;
+	qcfg.lane_arg = (void *) inst;
+	// with more than one decode thread, each of them queues msgs
+	if (inst->cfg.single_receiver)
+		qcfg.flags |= (inst->cfg.rcv_decode_threads > 1) ? 
+			LIBPD_QFLAG_MPSC : LIBPD_QFLAG_SPSC;
+	if (event_fd)
+		qcfg.flags |= LIBPD_QFLAG_EVENT_FD;
+	if (inst->cfg.latency_histograms)
+		qcfg.flags |= LIBPD_QFLAG_STAMP;
+	return libpd_qcreate_cfg (wrp_queue, wrp_queue_name, &qcfg, oserr);
+}
+
+static void destroy_wrp_queues (__instance_t *inst)
+{
+	unsigned i;
+
+	libpd_qdestroy (&inst->wrp_queue, rcv_msg_free_func (inst));
+	for (i = 0; i < inst->num_services; i++)
+		libpd_qdestroy (&inst->services[i].wrp_queue, rcv_msg_free_func (inst));
+}
+
+// the receive queue of service_name, then one for each of extra_services.
+// Only the first has the receive_fd event fd.
+static int create_wrp_queues (__instance_t *inst, int *oserr)
+{
+	unsigned i;
 	int err;
-	int oserr = 0;
-	__instance_t *inst = make_new_instance (libpd_cfg);
-#define SETERR(oserr_,err_) \
-	err_info->err_detail = err_; \
-	err_info->oserr = oserr_; \
-	// errno = oserr
-#define CONNECT_ERR(oserr) \
-	(oserr == EINVAL) ? LIBPD_ERROR_INIT_CFG : LIBPD_ERROR_INIT_CONNECT
 
-	// err_list->num_threads will now be 1
-	if (NULL == inst) {
-		libpd_log (LEVEL_ERROR, ("LIBPARODUS: unable to allocate new instance\n"));
-		SETERR (0, LIBPD_ERR_INIT_INST);
-		return LIBPD_ERROR_INIT_INST;
+	err = create_wrp_queue (inst, &inst->wrp_queue, inst->wrp_queue_name,
+		inst->cfg.receive_fd, oserr);
+	for (i = 0; (err == 0) && (i < inst->num_services); i++)
+		err = create_wrp_queue (inst, &inst->services[i].wrp_queue, 
+			inst->services[i].wrp_queue_name, false, oserr);
+	if (err != 0)
+		destroy_wrp_queues (inst);
+	return err;
+}
+
+// One item per queue slot, plus the one the sender thread is working on,
+// so steady state async sends malloc neither an item nor an encode buffer.
+static void create_send_items (__instance_t *inst)
+{
+	unsigned i, n = inst->cfg.async_send_queue_size + 1;
+
+	inst->send_items = (send_item_t *) malloc (n * sizeof(send_item_t));
+	if (NULL == inst->send_items)
+		return;	// items will be malloced
+	for (i=0; i<n; i++) {
+		inst->send_items[i].msg_bytes = NULL;
+		inst->send_items[i].buf_size = 0;
+		inst->send_items[i].pooled = true;
+		inst->send_items[i].next = (i+1 < n) ? &inst->send_items[i+1] : NULL;
 	}
-	*instance = (libpd_instance_t) inst;
+	inst->send_free_items = inst->send_items;
+}
 
-	if (inst->cfg.test_flags & CFG_TEST_CONNECT_ON_EVERY_SEND)
-		inst->connect_on_every_send = true;
+static send_item_t *get_send_item (__instance_t *inst)
+{
+	send_item_t *item;
 
-	show_options (libpd_cfg);
-	if (inst->cfg.receive) {
-		libpd_log (LEVEL_INFO, ("LIBPARODUS: connecting receiver to %s\n",  inst->client_url));
-		err = connect_receiver (inst->client_url, inst->cfg.keepalive_timeout_secs, &oserr);
-		if (err < 0) {
-			SETERR(oserr, LIBPD_ERR_INIT_RCV + err); 
-			return CONNECT_ERR (oserr);
-		}
-		inst->rcv_sock = err;
+	pthread_mutex_lock (&inst->send_items_mutex);
+	item = inst->send_free_items;
+	if (NULL != item)
+		inst->send_free_items = item->next;
+	pthread_mutex_unlock (&inst->send_items_mutex);
+	if (NULL != item)
+		return item;
+	item = (send_item_t *) malloc (sizeof(send_item_t));
+	if (NULL != item) {
+		item->msg_bytes = NULL;
+		item->buf_size = 0;
+		item->pooled = false;
 	}
-	if (!inst->connect_on_every_send) {
-		//libpd_log (LEVEL_INFO, ("LIBPARODUS: connecting sender to %s\n", inst->parodus_url));
-		err = connect_sender (inst->parodus_url, &oserr);
-		if (err < 0) {
-			abort_init (inst, ABORT_RCV_SOCK);
-			SETERR (oserr, LIBPD_ERR_INIT_SEND + err); 
-			return CONNECT_ERR (oserr);
-		}
-		inst->send_sock = err;
-		libpd_log (LEVEL_INFO, ("LIBPARODUS: connected sender to %s (%d)\n", 
-			inst->parodus_url, inst->send_sock));
+	return item;
+}
+
+// makes room for msg_len bytes at item->msg_bytes
+static int size_send_item (send_item_t *item, size_t msg_len)
+{
+	if (item->buf_size >= msg_len)
+		return 0;
+	free (item->msg_bytes);
+	item->buf_size = 0;
+	item->msg_bytes = malloc (msg_len);
+	if (NULL == item->msg_bytes)
+		return -1;
+	item->buf_size = msg_len;
+	return 0;
+}
+
+static void put_send_item (__instance_t *inst, send_item_t *item)
+{
+	if (!item->pooled) {
+		free (item->msg_bytes);
+		free (item);
+		return;
 	}
-	if (inst->cfg.receive) {
-		// We use the stop_rcv_sock to send a stop msg to our own receive socket.
-		err = connect_sender (inst->client_url, &oserr);
-		if (err < 0) {
-			abort_init (inst, ABORT_RCV_SOCK | ABORT_SEND_SOCK);
-			SETERR (oserr, LIBPD_ERR_INIT_TERMSOCK + err); 
-			return CONNECT_ERR (oserr);
-		}
-		inst->stop_rcv_sock = err;
-		libpd_log (LEVEL_INFO, ("LIBPARODUS: Opened sockets\n"));
-		err = libpd_qcreate (&inst->wrp_queue, inst->wrp_queue_name, WRP_QUEUE_SIZE, &oserr);
-		if (err != 0) {
-			abort_init (inst, ABORT_RCV_SOCK | ABORT_SEND_SOCK | ABORT_STOP_RCV_SOCK);
-			SETERR (oserr, LIBPD_ERR_INIT_QUEUE + err); 
-			return LIBPD_ERROR_INIT_QUEUE;
-		}
-		libpd_log (LEVEL_INFO, ("LIBPARODUS: Created queues\n"));
-		err = create_thread (&inst->wrp_receiver_tid, wrp_receiver_thread,
-				inst);
-		if (err != 0) {
-			abort_init (inst, ABORT_RCV_SOCK | ABORT_QUEUE | ABORT_SEND_SOCK | ABORT_STOP_RCV_SOCK); 
-			SETERR (err, LIBPD_ERR_INIT_RCV_THREAD_PCR);
-			return LIBPD_ERROR_INIT_RCV_THREAD;
-		}
+	if (item->buf_size > SEND_ITEM_KEEP_BYTES) {
+		free (item->msg_bytes);
+		item->msg_bytes = NULL;
+		item->buf_size = 0;
 	}
+	pthread_mutex_lock (&inst->send_items_mutex);
+	item->next = inst->send_free_items;
+	inst->send_free_items = item;
+	pthread_mutex_unlock (&inst->send_items_mutex);
+}
 
+static int start_wrp_sender (__instance_t *inst, int *oserr)
+{
+	int err;
+	libpd_qcfg_t qcfg;
 
-#ifdef TEST_SOCKET_TIMING
-	sst_init_totals ();
-#endif
+	memset ((void *) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = inst->cfg.async_send_queue_size;
+	qcfg.flags = LIBPD_QFLAG_MPSC;
+	err = libpd_qcreate_cfg (&inst->send_queue, SEND_QUEUE_NAME, &qcfg, oserr);
+	if (err != 0)
+		return LIBPD_ERR_INIT_SEND_QUEUE + err;
+	create_send_items (inst);
+	err = create_thread (&inst->wrp_sender_tid, wrp_sender_thread, inst);
+	if (err != 0) {
+		libpd_qdestroy (&inst->send_queue, NULL);
+		free (inst->send_items);
+		inst->send_items = NULL;
+		*oserr = err;
+		return LIBPD_ERR_INIT_SEND_THREAD_PCR;
+	}
+	return 0;
+}
 
-	inst->run_state = RUN_STATE_RUNNING;
+// used when destroying the send queue. Pooled items are freed
+// with inst->send_items.
+static void free_send_item (void *msg)
+{
+	send_item_t *item = (send_item_t *) msg;
+	if ((item == &send_stop_item) || item->pooled)
+		return;
+	free (item->msg_bytes);
+	free (item);
+}
+
+// sends everything already queued, then stops the sender thread
+static void stop_wrp_sender (__instance_t *inst)
+{
+	int rtn, oserr;
+	unsigned i;
+
+	if (NULL == inst->send_queue)
+		return;
+	// the sender thread keeps draining, so this only waits
+	// while the queue is full
+	do {
+		rtn = libpd_qsend (inst->send_queue, (void *) &send_stop_item, 
+			SOCK_SEND_TIMEOUT_MS, &oserr);
+	} while (rtn == 1);
+	if (rtn == 0) {
+		rtn = pthread_join (inst->wrp_sender_tid, NULL);
+		if (rtn != 0) {
+			libpd_log_err (LEVEL_ERROR, rtn, ("Error terminating wrp sender thread\n"));
+		}
+	}
+	libpd_qdestroy (&inst->send_queue, &free_send_item);
+	if (NULL != inst->send_items) {
+		for (i = 0; i <= inst->cfg.async_send_queue_size; i++)
+			free (inst->send_items[i].msg_bytes);
+	}
+	free (inst->send_items);
+	inst->send_items = NULL;
+	inst->send_free_items = NULL;
+}
+
+// One item per queue slot, plus the one the decode thread is working on
+// and the one the receiver thread is filling.
+static void create_decode_items (decoder_t *dec)
+{
+	unsigned i, n = DECODE_QUEUE_SIZE + 2;
+
+	dec->items = (decode_item_t *) malloc (n * sizeof(decode_item_t));
+	if (NULL == dec->items)
+		return;	// items will be malloced
+	for (i=0; i<n; i++) {
+		dec->items[i].pooled = true;
+		dec->items[i].next = (i+1 < n) ? &dec->items[i+1] : NULL;
+	}
+	dec->free_items = dec->items;
+}
+
+static decode_item_t *get_decode_item (decoder_t *dec)
+{
+	decode_item_t *item;
+
+	pthread_mutex_lock (&dec->items_mutex);
+	item = dec->free_items;
+	if (NULL != item)
+		dec->free_items = item->next;
+	pthread_mutex_unlock (&dec->items_mutex);
+	if (NULL != item)
+		return item;
+	item = (decode_item_t *) malloc (sizeof(decode_item_t));
+	if (NULL != item)
+		item->pooled = false;
+	return item;
+}
+
+static void put_decode_item (decoder_t *dec, decode_item_t *item)
+{
+	if (!item->pooled) {
+		free (item);
+		return;
+	}
+	pthread_mutex_lock (&dec->items_mutex);
+	item->next = dec->free_items;
+	dec->free_items = item;
+	pthread_mutex_unlock (&dec->items_mutex);
+}
+
+// used when destroying a decode queue. Pooled items are freed
+// with the decoder items.
+static void free_decode_item (void *msg)
+{
+	decode_item_t *item = (decode_item_t *) msg;
+	if (item == &decode_stop_item)
+		return;
+	nn_freemsg (item->raw_msg.msg);
+	if (!item->pooled)
+		free (item);
+}
+
+// decodes everything already queued, then stops the decode threads
+static void stop_decoders (__instance_t *inst)
+{
+	unsigned i;
+	int rtn, oserr;
+	decoder_t *dec;
+
+	if (NULL == inst->decoders)
+		return;
+	for (i = 0; i < inst->cfg.rcv_decode_threads; i++) {
+		dec = &inst->decoders[i];
+		if (dec->started) {
+			do {
+				rtn = libpd_qsend (dec->queue, (void *) &decode_stop_item, 
+					WRP_QUEUE_SEND_TIMEOUT_MS, &oserr);
+			} while (rtn == 1);
+			if (rtn == 0) {
+				rtn = pthread_join (dec->tid, NULL);
+				if (rtn != 0) {
+					libpd_log_err (LEVEL_ERROR, rtn, ("Error terminating decode thread\n"));
+				}
+			}
+		}
+		libpd_qdestroy (&dec->queue, &free_decode_item);
+		free (dec->items);
+		pthread_mutex_destroy (&dec->items_mutex);
+		free (dec->hdr_buf.buf);
+	}
+	free (inst->decoders);
+	inst->decoders = NULL;
+}
+
+static int start_decoders (__instance_t *inst, int *oserr)
+{
+	unsigned i, n = inst->cfg.rcv_decode_threads;
+	libpd_qcfg_t qcfg;
+	decoder_t *dec;
+	int err;
+
+	inst->decoders = (decoder_t *) malloc (n * sizeof(decoder_t));
+	if (NULL == inst->decoders) {
+		*oserr = ENOMEM;
+		return LIBPD_ERR_INIT_DECODE_QUEUE;
+	}
+	memset ((void *) inst->decoders, 0, n * sizeof(decoder_t));
+	for (i = 0; i < n; i++)
+		pthread_mutex_init (&inst->decoders[i].items_mutex, NULL);
+	memset ((void *) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = DECODE_QUEUE_SIZE;
+	qcfg.flags = LIBPD_QFLAG_SPSC;
+	for (i = 0; i < n; i++) {
+		dec = &inst->decoders[i];
+		dec->inst = inst;
+		err = libpd_qcreate_cfg (&dec->queue, DECODE_QUEUE_NAME, &qcfg, oserr);
+		if (err != 0) {
+			stop_decoders (inst);
+			return LIBPD_ERR_INIT_DECODE_QUEUE + err;
+		}
+		create_decode_items (dec);
+		err = create_thread (&dec->tid, wrp_decoder_thread, dec);
+		if (err != 0) {
+			stop_decoders (inst);
+			*oserr = err;
+			return LIBPD_ERR_INIT_DECODE_THREAD_PCR;
+		}
+		dec->started = true;
+	}
+	return 0;
+}
+
+// returns 0 or errno
+static int open_wake_fd (__instance_t *inst)
+{
+#ifdef __linux__
+	inst->wake_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	inst->wake_wfd = inst->wake_fd;
+	return (inst->wake_fd < 0) ? errno : 0;
+#else
+	int fds[2];
+	if (pipe (fds) != 0)
+		return errno;
+	fcntl (fds[0], F_SETFL, O_NONBLOCK);
+	fcntl (fds[1], F_SETFL, O_NONBLOCK);
+	inst->wake_fd = fds[0];
+	inst->wake_wfd = fds[1];
+	return 0;
+#endif
+}
+
+static void close_wake_fd (__instance_t *inst)
+{
+	if (inst->wake_fd < 0)
+		return;
+	if (inst->wake_wfd != inst->wake_fd)
+		close (inst->wake_wfd);
+	close (inst->wake_fd);
+	inst->wake_fd = -1;
+	inst->wake_wfd = -1;
+}
+
+// wakes the receiver thread, which then checks run_state and
+// reconnect_requested.
+// returns 0 or errno
+static int wake_receiver (__instance_t *inst)
+{
+	uint64_t one = 1;
+
+	if (write (inst->wake_wfd, &one, sizeof(one)) < 0) {
+		libpd_log_err (LEVEL_ERROR, errno, ("Error waking receiver thread\n"));
+		return errno;
+	}
+	return 0;
+}
+
+// called by the receiver thread when woken
+static void clear_wake_fd (__instance_t *inst)
+{
+	uint64_t count;
+
+	while (read (inst->wake_fd, &count, sizeof(count)) > 0)
+		;
+}
+
+// waits up to timeout_ms for wake_receiver.
+// returns true if woken
+static bool wait_wake_fd (__instance_t *inst, int timeout_ms)
+{
+	struct pollfd fd;
+
+	fd.fd = inst->wake_fd;
+	fd.events = POLLIN;
+	if (poll (&fd, 1, timeout_ms) <= 0)
+		return false;
+	clear_wake_fd (inst);
+	return true;
+}
+
+// define ABORT FLAGS
+#define ABORT_RCV_SOCK	1
+#define ABORT_QUEUE			2
+#define ABORT_SEND_SOCK	4
+#define ABORT_WAKE_FD	8
+#define ABORT_SENDER	16
+#define ABORT_DECODERS	32
+#define ABORT_SPOOL	64
+
+
+static void abort_init (__instance_t *inst, unsigned opt)
+{
+	if (opt & ABORT_RCV_SOCK)
+		shutdown_socket (&inst->rcv_sock);
+	if (opt & ABORT_DECODERS)
+		stop_decoders (inst);
+	if (opt & ABORT_QUEUE)
+		destroy_wrp_queues (inst);
+	if (opt & ABORT_SEND_SOCK)
+		shutdown_socket(&inst->send_sock);
+	if (opt & ABORT_WAKE_FD)
+		close_wake_fd (inst);
+	if (opt & ABORT_SENDER)
+		stop_wrp_sender (inst);
+	if (opt & ABORT_SPOOL)
+		stop_spool (inst);
+}
+
+int libparodus_init_dbg (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg,
+    extra_err_info_t *err_info)
+{
+	bool need_to_send_registration;
+	int err;
+	int oserr = 0;
+	__instance_t *inst = make_new_instance (libpd_cfg);
+#define SETERR(oserr_,err_) \
+	err_info->err_detail = err_; \
+	err_info->oserr = oserr_; \
+	// errno = oserr
+#define CONNECT_ERR(oserr) \
+	(oserr == EINVAL) ? LIBPD_ERROR_INIT_CFG : LIBPD_ERROR_INIT_CONNECT
+
+	// err_list->num_threads will now be 1
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: unable to allocate new instance\n"));
+		SETERR (0, LIBPD_ERR_INIT_INST);
+		return LIBPD_ERROR_INIT_INST;
+	}
+	*instance = (libpd_instance_t) inst;
+
+	err = build_services (inst);
+	if (err != 0) {
+		SETERR (0, err);
+		return (err == LIBPD_ERR_INIT_SERVICES) ? 
+			LIBPD_ERROR_INIT_CFG : LIBPD_ERROR_INIT_INST;
+	}
+
+	if (inst->cfg.test_flags & CFG_TEST_CONNECT_ON_EVERY_SEND)
+		inst->connect_on_every_send = true;
+
+	show_options (libpd_cfg);
+	if (inst->cfg.receive) {
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: connecting receiver to %s\n",  inst->client_url));
+		err = connect_receiver (inst->client_url, &oserr);
+		if (err < 0) {
+			SETERR(oserr, LIBPD_ERR_INIT_RCV + err); 
+			return CONNECT_ERR (oserr);
+		}
+		inst->rcv_sock = err;
+		err = get_sock_rcv_fd (inst->rcv_sock, &inst->rcv_fd, &oserr);
+		if (err != 0) {
+			abort_init (inst, ABORT_RCV_SOCK);
+			SETERR (oserr, LIBPD_ERR_INIT_RCV + err);
+			return LIBPD_ERROR_INIT_CONNECT;
+		}
+		inst->conn_state = LIBPD_CONN_UP;
+		inst->last_rcv_ms = get_monotonic_ms ();
+	}
+	if (!inst->connect_on_every_send) {
+		//libpd_log (LEVEL_INFO, ("LIBPARODUS: connecting sender to %s\n", inst->parodus_url));
+		err = connect_sender (inst->parodus_url, inst->send_timeout_ms, &oserr);
+		if (err < 0) {
+			abort_init (inst, ABORT_RCV_SOCK);
+			SETERR (oserr, LIBPD_ERR_INIT_SEND + err); 
+			return CONNECT_ERR (oserr);
+		}
+		inst->send_sock = err;
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: connected sender to %s (%d)\n", 
+			inst->parodus_url, inst->send_sock));
+	}
+	if (inst->cfg.async_send_queue_size > 0) {
+		err = start_wrp_sender (inst, &oserr);
+		if (err != 0) {
+			abort_init (inst, ABORT_RCV_SOCK | ABORT_SEND_SOCK);
+			SETERR (oserr, err);
+			return (err == LIBPD_ERR_INIT_SEND_THREAD_PCR) ? 
+				LIBPD_ERROR_INIT_SEND_THREAD : LIBPD_ERROR_INIT_QUEUE;
+		}
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: Started async sender\n"));
+	}
+	if (NULL != inst->cfg.send_spool_path) {
+		err = start_spool (inst, &oserr);
+		if (err != 0) {
+			abort_init (inst, ABORT_RCV_SOCK | ABORT_SENDER | ABORT_SEND_SOCK);
+			SETERR (oserr, err);
+			return LIBPD_ERROR_INIT_SPOOL;
+		}
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: Started send spool\n"));
+	}
+	if (inst->cfg.receive) {
+		// written at shutdown to wake the receiver thread
+		err = open_wake_fd (inst);
+		if (err != 0) {
+			abort_init (inst, ABORT_RCV_SOCK | ABORT_SENDER | ABORT_SPOOL | ABORT_SEND_SOCK);
+			SETERR (err, LIBPD_ERR_INIT_WAKE_FD); 
+			return LIBPD_ERROR_INIT_RCV_THREAD;
+		}
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: Opened sockets\n"));
+		if (uses_wrp_queue (inst)) {
+			err = create_wrp_queues (inst, &oserr);
+			if (err != 0) {
+				abort_init (inst, ABORT_RCV_SOCK | ABORT_SENDER | ABORT_SPOOL | ABORT_SEND_SOCK | ABORT_WAKE_FD);
+				SETERR (oserr, LIBPD_ERR_INIT_QUEUE + err); 
+				return LIBPD_ERROR_INIT_QUEUE;
+			}
+			libpd_log (LEVEL_INFO, ("LIBPARODUS: Created queues\n"));
+		}
+		if (inst->cfg.rcv_decode_threads > 0) {
+			err = start_decoders (inst, &oserr);
+			if (err != 0) {
+				abort_init (inst, ABORT_RCV_SOCK | ABORT_QUEUE | ABORT_SENDER | ABORT_SPOOL | ABORT_SEND_SOCK | ABORT_WAKE_FD);
+				SETERR (oserr, err);
+				return (err == LIBPD_ERR_INIT_DECODE_THREAD_PCR) ? 
+					LIBPD_ERROR_INIT_RCV_THREAD : LIBPD_ERROR_INIT_QUEUE;
+			}
+			libpd_log (LEVEL_INFO, ("LIBPARODUS: Started %u decode threads\n",
+				inst->cfg.rcv_decode_threads));
+		}
+		err = create_thread (&inst->wrp_receiver_tid, wrp_receiver_thread,
+				inst);
+		if (err != 0) {
+			abort_init (inst, ABORT_RCV_SOCK | ABORT_DECODERS | ABORT_QUEUE | ABORT_SENDER | ABORT_SPOOL | ABORT_SEND_SOCK | ABORT_WAKE_FD); 
+			SETERR (err, LIBPD_ERR_INIT_RCV_THREAD_PCR);
+			return LIBPD_ERROR_INIT_RCV_THREAD;
+		}
+	}
+
+	inst->run_state = RUN_STATE_RUNNING;
 
 #ifdef PARODUS_SERVICE_REQUIRES_REGISTRATION
 	need_to_send_registration = true;
@@ -556,7 +1560,7 @@ int libparodus_init_dbg (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg,
 
 	if (need_to_send_registration) {
 		libpd_log (LEVEL_INFO, ("LIBPARODUS: sending registration msg\n"));
-		err = send_registration_msg (inst, err_info);
+		err = send_registration_msg (inst, -1, err_info);
 		if (err != 0) {
 			libpd_log (LEVEL_ERROR, ("LIBPARODUS: error sending registration msg\n"));
 			oserr = err_info->oserr;
@@ -578,16 +1582,27 @@ int libparodus_init (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg)
   return libparodus_init_dbg (instance, libpd_cfg, &err);
 }
 
-// When msg_len is given as -1, then msg is a null terminated string
-static int sock_send (int sock, const char *msg, int msg_len, int *oserr)
+// When msg_len is given as -1, then msg is a null terminated string.
+// With nn_msg, msg is an nn_allocmsg buffer, freed by nanomsg once sent.
+// Returns -0x41 when the msg could not be sent within the send timeout,
+// or at once with NN_DONTWAIT.
+static int sock_send (int sock, const char *msg, int msg_len, bool nn_msg,
+	int flags, int *oserr)
 {
   int bytes;
 	*oserr = 0;
 	if (msg_len < 0)
 		msg_len = strlen (msg) + 1; // include terminating null
-	bytes = nn_send (sock, msg, msg_len, 0);
+	if (nn_msg)
+		bytes = nn_send (sock, &msg, NN_MSG, flags);
+	else
+		bytes = nn_send (sock, msg, msg_len, flags);
   if (bytes < 0) {
 		*oserr = errno; 
+		if ((errno == EAGAIN) || (errno == ETIMEDOUT)) {
+			libpd_log (LEVEL_DEBUG, ("Send would block\n"));
+			return -0x41;
+		}
 		libpd_log_err (LEVEL_ERROR, errno, ("Error sending msg\n"));
 		return -0x40;
 	}
@@ -598,17 +1613,18 @@ static int sock_send (int sock, const char *msg, int msg_len, int *oserr)
 	return 0;
 }
 
-// returns 0 OK, 1 timedout, -1 error
-static int sock_receive (int rcv_sock, raw_msg_t *msg, int *oserr)
+// returns 0 OK, 1 no msg (timed out, or none waiting with NN_DONTWAIT),
+// -1 error
+static int sock_receive (int rcv_sock, raw_msg_t *msg, int flags, int *oserr)
 {
 	char *buf = NULL;
-  msg->len = nn_recv (rcv_sock, &buf, NN_MSG, 0);
+  msg->len = nn_recv (rcv_sock, &buf, NN_MSG, flags);
 
 	*oserr = 0;
   if (msg->len < 0) {
-		libpd_log_err (LEVEL_ERROR, errno, ("Error receiving msg\n"));
-		if (errno == ETIMEDOUT)
+		if ((errno == ETIMEDOUT) || (errno == EAGAIN))
 			return 1;
+		libpd_log_err (LEVEL_ERROR, errno, ("Error receiving msg\n"));
 		*oserr = errno; 
 		return -1;
 	}
@@ -616,30 +1632,108 @@ static int sock_receive (int rcv_sock, raw_msg_t *msg, int *oserr)
 	return 0;
 }
 
+// Waits for a msg on the receive socket, for up to timeout_ms (-1 for
+// no timeout), or until wake_receiver.
+// returns 0 OK, 1 timed out, 2 woken, -1 error
+static int wait_rcv_msg (__instance_t *inst, raw_msg_t *msg, int timeout_ms,
+	int *oserr)
+{
+	struct pollfd fds[2];
+	uint64_t end_ms = 0, now_ms;
+	int rtn;
+
+	*oserr = 0;
+	if (timeout_ms > 0)
+		end_ms = get_monotonic_ms () + (uint64_t) timeout_ms;
+	fds[0].fd = inst->wake_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = inst->rcv_fd;
+	fds[1].events = POLLIN;
+	while (1) {
+		rtn = poll (fds, 2, timeout_ms);
+		if ((rtn < 0) && (errno != EINTR)) {
+			*oserr = errno;
+			libpd_log_err (LEVEL_ERROR, errno, ("Error polling receive socket\n"));
+			return -1;
+		}
+		if (rtn > 0) {
+			if (fds[0].revents != 0) {
+				clear_wake_fd (inst);
+				return 2;
+			}
+			// the socket fd can be readable with no msg left
+			rtn = sock_receive (inst->rcv_sock, msg, NN_DONTWAIT, oserr);
+			if (rtn != 1)
+				return rtn;
+		}
+		if (timeout_ms < 0)
+			continue;
+		if (timeout_ms == 0)
+			return 1;
+		now_ms = get_monotonic_ms ();
+		if (now_ms >= end_ms)
+			return 1;
+		timeout_ms = (int) (end_ms - now_ms);
+	}
+}
+
+#ifdef TEST_ENVIRONMENT
+static void log_hists (__instance_t *inst)
+{
+	static const char *hist_names[LIBPD_NUM_HISTS] = 
+		{"Encode", "Send", "Rcv Queue", "Rcv Latency"};
+	libpd_latency_t lat;
+	int i;
+
+	if (NULL == inst->hists[0])
+		return;
+	for (i=0; i<LIBPD_NUM_HISTS; i++) {
+		libparodus_get_latency ((libpd_instance_t) inst, (libpd_hist_id_t) i, &lat);
+		libpd_log (LEVEL_INFO, ("LIBPARODUS %s ns: Count %llu, Mean %llu, "
+			"P50 %llu, P99 %llu, P999 %llu, Max %llu\n", hist_names[i],
+			(unsigned long long) lat.count, (unsigned long long) lat.mean_ns,
+			(unsigned long long) lat.p50_ns, (unsigned long long) lat.p99_ns,
+			(unsigned long long) lat.p999_ns, (unsigned long long) lat.max_ns));
+	}
+}
+#endif
+
 static void libparodus_shutdown__ (__instance_t *inst, extra_err_info_t *err_info)
 {
+	unsigned i;
 	int rtn;
-#ifdef TEST_SOCKET_TIMING
-	sst_display_totals ();
+
+#ifdef TEST_ENVIRONMENT
+	log_hists (inst);
 #endif
 
 	inst->run_state = RUN_STATE_DONE;
 	libpd_log (LEVEL_INFO, ("LIBPARODUS: Shutting Down\n"));
 	if (inst->cfg.receive) {
-		sock_send (inst->stop_rcv_sock, end_msg, -1, &err_info->oserr);
+		err_info->oserr = wake_receiver (inst);
 	 	rtn = pthread_join (inst->wrp_receiver_tid, NULL);
 		if (rtn != 0) {
 			libpd_log_err (LEVEL_ERROR, rtn, ("Error terminating wrp receiver thread\n"));
 		}
 		shutdown_socket(&inst->rcv_sock);
-		libpd_log (LEVEL_INFO, ("LIBPARODUS: Flushing wrp queue\n"));
-		flush_wrp_queue (inst->wrp_queue, 5, &err_info->oserr);
-		libpd_qdestroy (&inst->wrp_queue, &wrp_free);
+		stop_decoders (inst);
+		libpd_reqs_cancel_all (inst->reqs);
+		if (uses_wrp_queue (inst)) {
+			libpd_log (LEVEL_INFO, ("LIBPARODUS: Flushing wrp queue\n"));
+			flush_wrp_queue__ (inst->wrp_queue, 5, rcv_msg_free_func (inst), 
+				&err_info->oserr);
+			for (i = 0; i < inst->num_services; i++)
+				flush_wrp_queue__ (inst->services[i].wrp_queue, 5, 
+					rcv_msg_free_func (inst), &err_info->oserr);
+			destroy_wrp_queues (inst);
+		}
 	}
+	stop_wrp_sender (inst);
+	stop_spool (inst);
 	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Shut down send sock %d\n", inst->send_sock));
 	shutdown_socket(&inst->send_sock);
 	if (inst->cfg.receive) {
-		shutdown_socket(&inst->stop_rcv_sock);
+		close_wake_fd (inst);
 	}
 	inst->run_state = 0;
 	inst->auth_received = false;
@@ -680,12 +1774,14 @@ int libparodus_shutdown (libpd_instance_t *instance)
 // returns 0 OK
 //  1 timed out
 static int timed_wrp_queue_receive (libpd_mq_t wrp_queue,	wrp_msg_t **msg, 
-	unsigned timeout_ms, int *oserr)
+	libpd_qstamp_t *stamp, uint64_t timeout_ns, int *oserr)
 {
 	int rtn;
+	unsigned count;
 	void *raw_msg;
 
-	rtn = libpd_qreceive (wrp_queue, &raw_msg, timeout_ms, oserr);
+	rtn = libpd_qreceive_stamp (wrp_queue, &raw_msg, stamp, 1, timeout_ns, 
+		&count, oserr);
 	if (rtn == 1) // timed out
 		return 1;
 	if (rtn != 0) {
@@ -697,31 +1793,39 @@ static int timed_wrp_queue_receive (libpd_mq_t wrp_queue,	wrp_msg_t **msg,
 	return 0;
 }
 
-static wrp_msg_t *make_closed_msg (void)
-{
-	wrp_msg_t *msg = (wrp_msg_t *) malloc (sizeof (wrp_msg_t));
-	if (NULL == msg)
-		return NULL;
-	msg->msg_type = WRP_MSG_TYPE__REQ;
-	msg->u.req.transaction_uuid = closed_msg;
-	msg->u.req.source = closed_msg;
-	msg->u.req.dest = closed_msg;
-	msg->u.req.payload = (void*) closed_msg;
-	msg->u.req.payload_size = strlen(closed_msg);
-	return msg;
-}
-
 // returns 0 OK
 //  2 closed msg received
 //  1 timed out
 //  LIBPD_ERR_RCV_ ... on error
-int libparodus_receive__ (libpd_mq_t wrp_queue, wrp_msg_t **msg, 
-	uint32_t ms, int *oserr)
+// records the time msgs spent on the receive queue, 
+// and since they were received on the socket
+static void record_rcv_times (__instance_t *inst, wrp_msg_t **msgs,
+	const libpd_qstamp_t *stamps, unsigned count)
+{
+	uint64_t now;
+	unsigned i;
+
+	if ((NULL == inst) || (NULL == inst->hists[0]))
+		return;
+	now = get_monotonic_ns ();
+	for (i=0; i<count; i++) {
+		if (is_closed_msg (msgs[i]) || (0 == stamps[i].sent_ns))
+			continue;
+		libpd_hist_record (inst->hists[LIBPD_HIST_RCV_QUEUE], 
+			now - stamps[i].queued_ns);
+		libpd_hist_record (inst->hists[LIBPD_HIST_RCV_LATENCY], 
+			now - stamps[i].sent_ns);
+	}
+}
+
+static int receive_ns__ (__instance_t *inst, libpd_mq_t wrp_queue, 
+	wrp_msg_t **msg, uint64_t ns, int *oserr)
 {
 	int err;
 	wrp_msg_t *msg__;
+	libpd_qstamp_t stamp;
 
-	err = timed_wrp_queue_receive (wrp_queue, msg, ms, oserr);
+	err = timed_wrp_queue_receive (wrp_queue, msg, &stamp, ns, oserr);
 	if (err == 1) // timed out
 		return 1;
 	if (err != 0)
@@ -732,6 +1836,7 @@ int libparodus_receive__ (libpd_mq_t wrp_queue, wrp_msg_t **msg,
 		return LIBPD_ERR_RCV_NULL_MSG;
 	}
 	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received msg type %d\n", msg__->msg_type));
+	record_rcv_times (inst, msg, &stamp, 1);
 	if (is_closed_msg (msg__)) {
 		wrp_free (msg__);
 		libpd_log (LEVEL_INFO, ("LIBPARODUS: closed msg received\n"));
@@ -740,12 +1845,18 @@ int libparodus_receive__ (libpd_mq_t wrp_queue, wrp_msg_t **msg,
 	return 0;
 }
 
+int libparodus_receive__ (libpd_mq_t wrp_queue, wrp_msg_t **msg, 
+	uint32_t ms, int *oserr)
+{
+	return receive_ns__ (NULL, wrp_queue, msg, (uint64_t) ms * NS_PER_MS, oserr);
+}
+
 // returns 0 OK
 //  2 closed msg received
 //  1 timed out
 // LIBPD_ERR_RCV_ ... on error
-int libparodus_receive_dbg (libpd_instance_t instance, wrp_msg_t **msg, 
-    uint32_t ms, extra_err_info_t *err_info)
+int libparodus_receive_ns_dbg (libpd_instance_t instance, wrp_msg_t **msg, 
+    uint64_t ns, extra_err_info_t *err_info)
 {
 	int rtn;
 	__instance_t *inst = (__instance_t *) instance;
@@ -758,8 +1869,8 @@ int libparodus_receive_dbg (libpd_instance_t instance, wrp_msg_t **msg,
 		return LIBPD_ERROR_RCV_NULL_INST;
 	}
 
-	if (!inst->cfg.receive) {
-		libpd_log (LEVEL_ERROR, ("No receive option on libparodus_receive\n"));
+	if (!uses_wrp_queue (inst)) {
+		libpd_log (LEVEL_ERROR, ("No receive queue on libparodus_receive\n"));
 		err_info->err_detail = LIBPD_ERR_RCV_CFG;
 		return LIBPD_ERROR_RCV_CFG;
 	}
@@ -768,7 +1879,7 @@ int libparodus_receive_dbg (libpd_instance_t instance, wrp_msg_t **msg,
 		err_info->err_detail = LIBPD_ERR_RCV_STATE;
 		return LIBPD_ERROR_RCV_STATE;
 	}
-	rtn = libparodus_receive__ (inst->wrp_queue, msg, ms, &err_info->oserr);
+	rtn = receive_ns__ (inst, inst->wrp_queue, msg, ns, &err_info->oserr);
 	if (rtn >= 0)
 		return rtn;
 	err_info->err_detail = rtn;
@@ -776,53 +1887,282 @@ int libparodus_receive_dbg (libpd_instance_t instance, wrp_msg_t **msg,
 	return LIBPD_ERROR_RCV_RCV;
 }
 
+int libparodus_receive_dbg (libpd_instance_t instance, wrp_msg_t **msg, 
+    uint32_t ms, extra_err_info_t *err_info)
+{
+	return libparodus_receive_ns_dbg (instance, msg, 
+		(uint64_t) ms * NS_PER_MS, err_info);
+}
+
 int libparodus_receive (libpd_instance_t instance, wrp_msg_t **msg, uint32_t ms)
 {
   extra_err_info_t err;
   return libparodus_receive_dbg (instance, msg, ms, &err);
 }
 
-int libparodus_close_receiver__ (libpd_mq_t wrp_queue, int *oserr)
+int libparodus_receive_ns (libpd_instance_t instance, wrp_msg_t **msg, uint64_t ns)
 {
-	wrp_msg_t *closed_msg_ptr =	make_closed_msg ();
-	int rtn = libpd_qsend (wrp_queue, (void *) closed_msg_ptr, 
-				WRP_QUEUE_SEND_TIMEOUT_MS, oserr);
-	if (rtn == 1) // timed out
-		return 1;
-	if (rtn != 0) {
-		return LIBPD_ERR_CLOSE_RCV + rtn;
-	}
-	libpd_log (LEVEL_INFO, ("LIBPARODUS: Sent closed msg\n"));
-	return 0;
+  extra_err_info_t err;
+  return libparodus_receive_ns_dbg (instance, msg, ns, &err);
 }
 
-int libparodus_close_receiver_dbg (libpd_instance_t instance,
-    extra_err_info_t *err_info)
+int libparodus_receive_service_dbg (libpd_instance_t instance, 
+	const char *service_name, wrp_msg_t **msg, uint32_t ms, 
+	extra_err_info_t *err_info)
 {
 	int rtn;
 	__instance_t *inst = (__instance_t *) instance;
+	svc_entry_t *service;
 
 	err_info->err_detail = 0;
 	err_info->oserr = 0;
 	if (NULL == inst) {
-		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_close_receiver\n"));
-		err_info->err_detail = LIBPD_ERR_CLOSE_RCV_NULL_INST;
-		return LIBPD_ERROR_CLOSE_RCV_NULL_INST;
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_receive_service\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_NULL_INST;
+		return LIBPD_ERROR_RCV_NULL_INST;
 	}
-	if (!inst->cfg.receive) {
-		libpd_log (LEVEL_ERROR, ("No receive option on libparodus_close_receiver\n"));
-		err_info->err_detail = LIBPD_ERR_CLOSE_RCV_CFG;
-		return LIBPD_ERROR_CLOSE_RCV_CFG;
+	if (!uses_wrp_queue (inst)) {
+		libpd_log (LEVEL_ERROR, ("No receive queue on libparodus_receive_service\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_CFG;
+		return LIBPD_ERROR_RCV_CFG;
 	}
 	if (RUN_STATE_RUNNING != inst->run_state) {
-		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at close receiver\n"));
-		err_info->err_detail = LIBPD_ERR_CLOSE_RCV_STATE;
-		return LIBPD_ERROR_CLOSE_RCV_STATE;
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at receive service\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_STATE;
+		return LIBPD_ERROR_RCV_STATE;
 	}
-	rtn = libparodus_close_receiver__ (inst->wrp_queue, &err_info->oserr);
-	if (rtn == 0)
-		return 0;
-	if (rtn == 1) {
+	service = (NULL == service_name) ? NULL :
+		find_service (inst, service_name, strlen (service_name));
+	if (NULL == service) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: unknown service on receive service\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_SERVICE;
+		return LIBPD_ERROR_RCV_SERVICE;
+	}
+	rtn = receive_ns__ (inst, *service->wrp_queue, msg, (uint64_t) ms * NS_PER_MS, 
+		&err_info->oserr);
+	if (rtn >= 0)
+		return rtn;
+	err_info->err_detail = rtn;
+	return LIBPD_ERROR_RCV_RCV;
+}
+
+int libparodus_receive_service (libpd_instance_t instance, 
+	const char *service_name, wrp_msg_t **msg, uint32_t ms)
+{
+  extra_err_info_t err;
+  return libparodus_receive_service_dbg (instance, service_name, msg, ms, &err);
+}
+
+int libparodus_get_rcv_fd (libpd_instance_t instance)
+{
+	__instance_t *inst = (__instance_t *) instance;
+
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_get_rcv_fd\n"));
+		return LIBPD_ERROR_RCV_NULL_INST;
+	}
+	if (!uses_wrp_queue (inst) || !inst->cfg.receive_fd) {
+		libpd_log (LEVEL_ERROR, ("No receive_fd option on libparodus_get_rcv_fd\n"));
+		return LIBPD_ERROR_RCV_CFG;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at get_rcv_fd\n"));
+		return LIBPD_ERROR_RCV_STATE;
+	}
+	return libpd_qevent_fd (inst->wrp_queue);
+}
+
+int libparodus_reconnect (libpd_instance_t instance)
+{
+	__instance_t *inst = (__instance_t *) instance;
+
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_reconnect\n"));
+		return LIBPD_ERROR_RCV_NULL_INST;
+	}
+	if (!inst->cfg.receive) {
+		libpd_log (LEVEL_ERROR, ("No receive option on libparodus_reconnect\n"));
+		return LIBPD_ERROR_RCV_CFG;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at reconnect\n"));
+		return LIBPD_ERROR_RCV_STATE;
+	}
+	__atomic_store_n (&inst->reconnect_requested, true, __ATOMIC_SEQ_CST);
+	wake_receiver (inst);
+	return 0;
+}
+
+int libparodus_get_liveness (libpd_instance_t instance, 
+	libpd_liveness_t *liveness)
+{
+	__instance_t *inst = (__instance_t *) instance;
+	uint64_t now_ms, last_ms;
+
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_get_liveness\n"));
+		return LIBPD_ERROR_RCV_NULL_INST;
+	}
+	if (!inst->cfg.receive) {
+		libpd_log (LEVEL_ERROR, ("No receive option on libparodus_get_liveness\n"));
+		return LIBPD_ERROR_RCV_CFG;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at get_liveness\n"));
+		return LIBPD_ERROR_RCV_STATE;
+	}
+	liveness->state = __atomic_load_n (&inst->liveness, __ATOMIC_RELAXED);
+	last_ms = __atomic_load_n (&inst->last_rcv_ms, __ATOMIC_RELAXED);
+	now_ms = get_monotonic_ms ();
+	liveness->idle_ms = (now_ms > last_ms) ? (now_ms - last_ms) : 0;
+	return 0;
+}
+
+void libparodus_free_msg (libpd_instance_t instance, wrp_msg_t *msg)
+{
+	__instance_t *inst = (__instance_t *) instance;
+
+	if ((NULL != inst) && inst->cfg.zero_copy_receive)
+		wrp_free_zc (msg);
+	else if (NULL != msg)
+		wrp_free_struct (msg);
+}
+
+// returns 0 OK
+//  2 closed msg received
+//  1 timed out
+//  LIBPD_ERR_RCV_ ... on error
+static int receive_batch__ (__instance_t *inst, libpd_mq_t wrp_queue, 
+	wrp_msg_t **msgs, size_t max_msgs, uint32_t ms, size_t *count, 
+	free_msg_func_t *free_msg_func, int *oserr)
+{
+	int err;
+	unsigned i, n;
+	unsigned max__ = (max_msgs > UINT_MAX) ? UINT_MAX : (unsigned) max_msgs;
+	libpd_qstamp_t stamps[RCV_BATCH_STAMPS];
+
+	*count = 0;
+	if ((NULL != inst) && (NULL != inst->hists[0])) {
+		// timed batches are limited to the stamps we have room for
+		if (max__ > RCV_BATCH_STAMPS)
+			max__ = RCV_BATCH_STAMPS;
+		err = libpd_qreceive_stamp (wrp_queue, (void **) msgs, stamps, max__,
+			(uint64_t) ms * NS_PER_MS, &n, oserr);
+	} else {
+		err = libpd_qreceive_batch (wrp_queue, (void **) msgs, max__, ms, &n, oserr);
+	}
+	if (err == 1) // timed out
+		return 1;
+	if (err != 0)
+		return LIBPD_ERR_RCV_QUEUE + err;
+	if ((NULL != inst) && (NULL != inst->hists[0]))
+		record_rcv_times (inst, msgs, stamps, n);
+	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received batch of %u msgs\n", n));
+	for (i=0; i<n; i++) {
+		if (!is_closed_msg (msgs[i]))
+			continue;
+		// the receiver is closing, so drop anything queued behind the close
+		*count = i;
+		for (; i<n; i++)
+			free_msg_func (msgs[i]);
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: closed msg received\n"));
+		return 2;
+	}
+	*count = n;
+	return 0;
+}
+
+int libparodus_receive_batch__ (libpd_mq_t wrp_queue, wrp_msg_t **msgs, 
+	size_t max_msgs, uint32_t ms, size_t *count, int *oserr)
+{
+	return receive_batch__ (NULL, wrp_queue, msgs, max_msgs, ms, count, 
+		&wrp_free, oserr);
+}
+
+int libparodus_receive_batch_dbg (libpd_instance_t instance, wrp_msg_t **msgs, 
+	size_t max_msgs, uint32_t ms, size_t *count, extra_err_info_t *err_info)
+{
+	int rtn;
+	__instance_t *inst = (__instance_t *) instance;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	*count = 0;
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_receive_batch\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_NULL_INST;
+		return LIBPD_ERROR_RCV_NULL_INST;
+	}
+
+	if (!uses_wrp_queue (inst)) {
+		libpd_log (LEVEL_ERROR, ("No receive queue on libparodus_receive_batch\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_CFG;
+		return LIBPD_ERROR_RCV_CFG;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at receive batch\n"));
+		err_info->err_detail = LIBPD_ERR_RCV_STATE;
+		return LIBPD_ERROR_RCV_STATE;
+	}
+	rtn = receive_batch__ (inst, inst->wrp_queue, msgs, max_msgs, ms, 
+		count, rcv_msg_free_func (inst), &err_info->oserr);
+	if (rtn >= 0)
+		return rtn;
+	err_info->err_detail = rtn;
+	return LIBPD_ERROR_RCV_RCV;
+}
+
+int libparodus_receive_batch (libpd_instance_t instance, wrp_msg_t **msgs, 
+	size_t max_msgs, uint32_t ms, size_t *count)
+{
+  extra_err_info_t err;
+  return libparodus_receive_batch_dbg (instance, msgs, max_msgs, ms, count, &err);
+}
+
+int libparodus_close_receiver__ (libpd_mq_t wrp_queue, int *oserr)
+{
+	int rtn = libpd_qsend (wrp_queue, (void *) &closed_wrp_msg, 
+				WRP_QUEUE_SEND_TIMEOUT_MS, oserr);
+	if (rtn == 1) // timed out
+		return 1;
+	if (rtn != 0) {
+		return LIBPD_ERR_CLOSE_RCV + rtn;
+	}
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: Sent closed msg\n"));
+	return 0;
+}
+
+int libparodus_close_receiver_dbg (libpd_instance_t instance,
+    extra_err_info_t *err_info)
+{
+	unsigned i;
+	int rtn;
+	__instance_t *inst = (__instance_t *) instance;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_close_receiver\n"));
+		err_info->err_detail = LIBPD_ERR_CLOSE_RCV_NULL_INST;
+		return LIBPD_ERROR_CLOSE_RCV_NULL_INST;
+	}
+	if (!uses_wrp_queue (inst)) {
+		libpd_log (LEVEL_ERROR, ("No receive queue on libparodus_close_receiver\n"));
+		err_info->err_detail = LIBPD_ERR_CLOSE_RCV_CFG;
+		return LIBPD_ERROR_CLOSE_RCV_CFG;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at close receiver\n"));
+		err_info->err_detail = LIBPD_ERR_CLOSE_RCV_STATE;
+		return LIBPD_ERROR_CLOSE_RCV_STATE;
+	}
+	rtn = libparodus_close_receiver__ (inst->wrp_queue, &err_info->oserr);
+	for (i = 0; (rtn == 0) && (i < inst->num_services); i++)
+		rtn = libparodus_close_receiver__ (inst->services[i].wrp_queue, 
+			&err_info->oserr);
+	if (rtn == 0)
+		return 0;
+	if (rtn == 1) {
 		err_info->err_detail = LIBPD_ERR_CLOSE_RCV_TIMEDOUT;
 		return LIBPD_ERROR_CLOSE_RCV_TIMEDOUT;
 	}
@@ -836,98 +2176,1230 @@ int libparodus_close_receiver (libpd_instance_t instance)
   return libparodus_close_receiver_dbg (instance, &err);
 }
 
-static int wrp_sock_send (__instance_t *inst, wrp_msg_t *msg, extra_err_info_t *err_info)
+// encodes the msg, returns length or -0x1001
+static ssize_t wrp_encode (wrp_msg_t *msg, void **msg_bytes)
 {
-	int rtn;
-	ssize_t msg_len;
-	void *msg_bytes;
-#ifdef TEST_SOCKET_TIMING
-	sst_times_t sst_times;
-#define SST(func) func
-#else
-#define SST(func)
-#endif
-
-	err_info->err_detail = 0;
-	err_info->oserr = 0;
-	pthread_mutex_lock (&inst->send_mutex);
-	msg_len = wrp_struct_to (msg, WRP_BYTES, &msg_bytes);
+	ssize_t msg_len = wrp_struct_to (msg, WRP_BYTES, msg_bytes);
 	if (msg_len < 1) {
 		libpd_log (LEVEL_ERROR, ("LIBPARODUS: error converting WRP to bytes\n"));
-		pthread_mutex_unlock (&inst->send_mutex);
 		return -0x1001;
 	}
+	return msg_len;
+}
+
+// adds a str field, left out when null as wrp-c does
+static unsigned add_str_field (libpd_mp_kv_t *kvs, unsigned n, 
+	const char *key, const char *val)
+{
+	if (NULL == val)
+		return n;
+	kvs[n].key = key;
+	kvs[n].type = LIBPD_MP_STR;
+	kvs[n].val = val;
+	kvs[n].len = strlen (val);
+	return n + 1;
+}
+
+// Gets the fields of the msgs sent most, so that they are encoded 
+// without wrp-c: registrations, and events and requests with no partner
+// ids, headers, metadata or spans.
+// Returns the number of fields, or 0 if wrp_encode must be used.
+static unsigned wrp_fast_fields (const wrp_msg_t *msg, libpd_mp_kv_t *kvs)
+{
+	const void *payload = NULL;
+	size_t payload_size = 0;
+	unsigned n = 1;
+
+	if (NULL == msg)
+		return 0;
+	kvs[0].key = "msg_type";
+	kvs[0].type = LIBPD_MP_INT;
+	kvs[0].ival = (int) msg->msg_type;
+	switch (msg->msg_type) {
+		case WRP_MSG_TYPE__EVENT:
+			if ((NULL != msg->u.event.partner_ids) || 
+			    (NULL != msg->u.event.headers) ||
+			    (NULL != msg->u.event.metadata))
+				return 0;
+			n = add_str_field (kvs, n, "source", msg->u.event.source);
+			n = add_str_field (kvs, n, "dest", msg->u.event.dest);
+			n = add_str_field (kvs, n, "content_type", msg->u.event.content_type);
+			payload = msg->u.event.payload;
+			payload_size = msg->u.event.payload_size;
+			break;
+		case WRP_MSG_TYPE__REQ:
+			if ((NULL != msg->u.req.partner_ids) || 
+			    (NULL != msg->u.req.headers) ||
+			    (NULL != msg->u.req.metadata) ||
+			    msg->u.req.include_spans || (msg->u.req.spans.count > 0))
+				return 0;
+			n = add_str_field (kvs, n, "transaction_uuid", 
+				msg->u.req.transaction_uuid);
+			n = add_str_field (kvs, n, "source", msg->u.req.source);
+			n = add_str_field (kvs, n, "dest", msg->u.req.dest);
+			n = add_str_field (kvs, n, "content_type", msg->u.req.content_type);
+			payload = msg->u.req.payload;
+			payload_size = msg->u.req.payload_size;
+			break;
+		case WRP_MSG_TYPE__SVC_REGISTRATION:
+			n = add_str_field (kvs, n, "service_name", msg->u.reg.service_name);
+			return add_str_field (kvs, n, "url", msg->u.reg.url);
+		default:
+			return 0;
+	}
+	if (NULL != payload) {
+		if (payload_size > UINT32_MAX)
+			return 0;
+		kvs[n].key = "payload";
+		kvs[n].type = LIBPD_MP_BIN;
+		kvs[n].val = payload;
+		kvs[n].len = payload_size;
+		n++;
+	}
+	return n;
+}
+
+// Encodes the msg into an nn_allocmsg buffer, which nn_send takes without
+// a copy, and sets *send_flags to SEND_NN_MSGS. Msgs wrp_fast_fields 
+// does not handle are encoded by wrp-c into a malloced buffer.
+// Returns length or -0x1001.
+static ssize_t wrp_encode_nn (wrp_msg_t *msg, void **msg_bytes, 
+	unsigned *send_flags)
+{
+	libpd_mp_kv_t kvs[WRP_FAST_FIELDS];
+	unsigned n = wrp_fast_fields (msg, kvs);
+	size_t msg_len;
+
+	*send_flags = 0;
+	if (0 == n)
+		return wrp_encode (msg, msg_bytes);
+	msg_len = libpd_mp_map_len (kvs, n);
+	*msg_bytes = nn_allocmsg (msg_len, 0);
+	if (NULL == *msg_bytes)
+		return wrp_encode (msg, msg_bytes);
+	libpd_mp_write_map (kvs, n, (uint8_t *) *msg_bytes);
+	*send_flags = SEND_NN_MSGS;
+	return (ssize_t) msg_len;
+}
+
+// frees what wrp_encode_nn encoded, unless nanomsg took it
+static void free_encoded_nn (void *msg_bytes, unsigned send_flags)
+{
+	if (0 == (send_flags & SEND_NN_MSGS))
+		free (msg_bytes);
+	else if (NULL != msg_bytes)
+		nn_freemsg (msg_bytes);
+}
+
+// pthread_mutex_clocklock, from glibc 2.30, waits on the monotonic clock.
+// pthread_mutex_timedlock only uses the realtime clock, which may jump.
+#ifdef __GLIBC_PREREQ
+#if __GLIBC_PREREQ(2,30)
+#define HAVE_MUTEX_CLOCKLOCK 1
+#endif
+#endif
+#ifdef HAVE_MUTEX_CLOCKLOCK
+#define SEND_LOCK_CLOCK CLOCK_MONOTONIC
+#else
+#define SEND_LOCK_CLOCK CLOCK_REALTIME
+#endif
+
+// locks send_mutex. With timeout_ms >= 0, waits at most that long,
+// returning non-zero if not locked.
+static int lock_send_mutex (__instance_t *inst, int timeout_ms)
+{
+#ifndef __APPLE__
+	struct timespec ts;
+#endif
+
+	if (timeout_ms < 0)
+		return pthread_mutex_lock (&inst->send_mutex);
+	if (timeout_ms == 0)
+		return pthread_mutex_trylock (&inst->send_mutex);
+#ifdef __APPLE__
+	// no pthread_mutex_timedlock, so only the socket send is timed
+	return pthread_mutex_lock (&inst->send_mutex);
+#else
+	clock_gettime (SEND_LOCK_CLOCK, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec += 1;
+		ts.tv_nsec -= 1000000000L;
+	}
+#ifdef HAVE_MUTEX_CLOCKLOCK
+	return pthread_mutex_clocklock (&inst->send_mutex, SEND_LOCK_CLOCK, &ts);
+#else
+	return pthread_mutex_timedlock (&inst->send_mutex, &ts);
+#endif
+#endif
+}
+
+// sets the send timeout of the send socket, for one timed send
+static void set_send_timeout (__instance_t *inst, int timeout_ms)
+{
+	if (nn_setsockopt (inst->send_sock, NN_SOL_SOCKET, NN_SNDTIMEO, 
+			&timeout_ms, sizeof (timeout_ms)) < 0) {
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to set socket timeout\n"));
+	}
+}
 
-	SST (sst_start_total_timing (&sst_times);)
+// sends encoded msgs back to back, taking send_mutex once.
+// With timeout_ms >= 0, all the msgs must be sent within that many msecs,
+// else within the send timeout each.
+// *sent is set to the number of msgs sent before any error.
+// Failed sends are counted in the send error stats only with 
+// SEND_COUNT_ERRORS, not when the caller spools or retries the msgs.
+// With SEND_NN_MSGS, msg_bytes are nn_allocmsg buffers, each set to NULL
+// once sent; the caller frees those left.
+static int sock_send_msgs (__instance_t *inst, void **msg_bytes, 
+	const ssize_t *msg_lens, size_t n, int timeout_ms, unsigned send_flags,
+	size_t *sent, extra_err_info_t *err_info)
+{
+	int rtn = 0;
+	int flags = 0;
+	bool timed = false;
+	size_t i;
+	uint64_t bytes = 0;
+	uint64_t start_ns;
+	uint64_t now_ms;
+	uint64_t deadline_ms = 0;
+
+	*sent = 0;
+	if (timeout_ms > 0)
+		deadline_ms = get_monotonic_ms () + (uint64_t) timeout_ms;
+	if (lock_send_mutex (inst, timeout_ms) != 0) {
+		if (send_flags & SEND_COUNT_ERRORS)
+			STAT_ADD (inst, send_errors_timeout, 1);
+		return -0x1003;
+	}
 
 	if (inst->connect_on_every_send) {
-		rtn = connect_sender (inst->parodus_url, &err_info->oserr);
+		rtn = connect_sender (inst->parodus_url, inst->send_timeout_ms,
+			&err_info->oserr);
 		if (rtn < 0) {
-			free (msg_bytes);
 			pthread_mutex_unlock (&inst->send_mutex);
 			return -0x1200 + rtn;
 		}
 		inst->send_sock = rtn;
+		rtn = 0;
 	}
 
-	SST (sst_start_send_timing (&sst_times);)
-	rtn = sock_send (inst->send_sock, (const char *)msg_bytes, msg_len, 
-	    &err_info->oserr);
-	SST (sst_update_send_time (&sst_times);)
+	if (timeout_ms == 0)
+		flags = NN_DONTWAIT;
+	for (i = 0; i < n; i++) {
+		if (timeout_ms > 0) {
+			now_ms = get_monotonic_ms ();
+			if (now_ms >= deadline_ms) {
+				flags = NN_DONTWAIT;	// one last try
+			} else {
+				set_send_timeout (inst, (int) (deadline_ms - now_ms));
+				timed = true;
+			}
+		}
+		start_ns = hist_start (inst);
+		rtn = sock_send (inst->send_sock, (const char *)msg_bytes[i], 
+			(int) msg_lens[i], (send_flags & SEND_NN_MSGS) != 0, flags, 
+			&err_info->oserr);
+		hist_record (inst, LIBPD_HIST_SEND, start_ns);
+		if (rtn != 0)
+			break;
+		if (send_flags & SEND_NN_MSGS)
+			msg_bytes[i] = NULL;
+		bytes += (uint64_t) msg_lens[i];
+	}
 
 	if (inst->connect_on_every_send) {
 		shutdown_socket (&inst->send_sock);
+	} else if (timed) {
+		set_send_timeout (inst, inst->send_timeout_ms);
+	}
+
+	pthread_mutex_unlock (&inst->send_mutex);
+	*sent = i;
+	STAT_ADD (inst, msgs_sent, i);
+	STAT_ADD (inst, bytes_out, bytes);
+	if (rtn == 0)
+		return 0;
+	if (send_flags & SEND_COUNT_ERRORS) {
+		if (rtn == -0x41)
+			STAT_ADD (inst, send_errors_timeout, 1);
+		else
+			STAT_ADD (inst, send_errors_socket, 1);
+	}
+	return -0x1800 + rtn;
+}
+
+static void wake_spool_thread (__instance_t *inst)
+{
+	pthread_mutex_lock (&inst->spool_mutex);
+	pthread_cond_signal (&inst->spool_cond);
+	pthread_mutex_unlock (&inst->spool_mutex);
+}
+
+// sends encoded msgs like sock_send_msgs. With a send spool, the msgs
+// parodus does not take within SPOOL_SEND_TIMEOUT_MS are spooled instead,
+// and so are all msgs while earlier ones are still spooled, keeping them
+// in order. Spooled msgs count as sent.
+// send_flags may have SEND_NN_MSGS.
+static int send_or_spool (__instance_t *inst, void **msg_bytes, 
+	const ssize_t *msg_lens, size_t n, int timeout_ms, unsigned send_flags,
+	size_t *sent, extra_err_info_t *err_info)
+{
+	int rtn = 0;
+	size_t i;
+	unsigned dropped;
+
+	if (NULL == inst->spool)
+		return sock_send_msgs (inst, msg_bytes, msg_lens, n, timeout_ms, 
+			send_flags | SEND_COUNT_ERRORS, sent, err_info);
+	*sent = 0;
+	if (libpd_spool_count (inst->spool) == 0) {
+		if ((timeout_ms < 0) || (timeout_ms > SPOOL_SEND_TIMEOUT_MS))
+			timeout_ms = SPOOL_SEND_TIMEOUT_MS;
+		if (sock_send_msgs (inst, msg_bytes, msg_lens, n, timeout_ms, 
+				send_flags, sent, err_info) == 0)
+			return 0;
+		err_info->oserr = 0;
+	}
+	for (i = *sent; i < n; i++) {
+		rtn = libpd_spool_append (inst->spool, msg_bytes[i], (size_t) msg_lens[i],
+			&dropped);
+		STAT_ADD (inst, spool_drops, dropped);
+		if (rtn != 0) {
+			STAT_ADD (inst, spool_drops, 1);
+			rtn = -0x1004;
+			break;
+		}
+		STAT_ADD (inst, spooled, 1);
+	}
+	if (i > *sent)
+		wake_spool_thread (inst);
+	*sent = i;
+	return rtn;
+}
+
+// sends the spooled msgs in order, whenever parodus takes them
+static void *spool_thread (void *arg)
+{
+	__instance_t *inst = (__instance_t*) arg;
+	extra_err_info_t send_err;
+	struct timespec ts;
+	void *msg_bytes;
+	ssize_t msg_len;
+	size_t len, sent;
+	uint64_t seq;
+	unsigned wait_ms = 0;
+	bool stop;
+
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: Starting spool thread\n"));
+	while (true) {
+		pthread_mutex_lock (&inst->spool_mutex);
+		if (wait_ms > 0) {
+			// more msgs being spooled don't end the wait
+			get_expire_time (wait_ms, &ts);
+			while (!inst->spool_stop && (pthread_cond_timedwait (&inst->spool_cond, 
+					&inst->spool_mutex, &ts) != ETIMEDOUT))
+				;
+		}
+		while (!inst->spool_stop && (libpd_spool_count (inst->spool) == 0))
+			pthread_cond_wait (&inst->spool_cond, &inst->spool_mutex);
+		stop = inst->spool_stop;
+		pthread_mutex_unlock (&inst->spool_mutex);
+		if (stop)
+			break;
+		wait_ms = SPOOL_RETRY_MS;
+		if (libpd_spool_peek (inst->spool, &msg_bytes, &len, &seq) != 0)
+			continue;
+		msg_len = (ssize_t) len;
+		send_err.err_detail = 0;
+		send_err.oserr = 0;
+		if (sock_send_msgs (inst, &msg_bytes, &msg_len, 1, -1, 0, &sent, 
+				&send_err) == 0) {
+			libpd_spool_remove (inst->spool, seq);
+			STAT_ADD (inst, spool_replays, 1);
+			wait_ms = 0;
+		} else {
+			STAT_ADD (inst, spool_replay_errors, 1);
+		}
+		free (msg_bytes);
+	}
+	libpd_log (LEVEL_INFO, ("Ended spool thread\n"));
+	return NULL;
+}
+
+static int start_spool (__instance_t *inst, int *oserr)
+{
+	int err;
+	size_t max_bytes = inst->cfg.send_spool_max_bytes;
+
+	if (0 == max_bytes)
+		max_bytes = SPOOL_DEFAULT_BYTES;
+	inst->spool = libpd_spool_open (inst->cfg.send_spool_path, max_bytes,
+		(LIBPD_SPOOL_OVERFLOW_DROP_OLDEST == inst->cfg.send_spool_overflow),
+		oserr);
+	if (NULL == inst->spool)
+		return LIBPD_ERR_INIT_SPOOL;
+	err = create_thread (&inst->spool_tid, spool_thread, inst);
+	if (err != 0) {
+		libpd_spool_close (inst->spool);
+		inst->spool = NULL;
+		*oserr = err;
+		return LIBPD_ERR_INIT_SPOOL_THREAD_PCR;
+	}
+	return 0;
+}
+
+// stops the spool thread. Msgs still spooled stay in the spool file.
+static void stop_spool (__instance_t *inst)
+{
+	int rtn;
+
+	if (NULL == inst->spool)
+		return;
+	pthread_mutex_lock (&inst->spool_mutex);
+	inst->spool_stop = true;
+	pthread_cond_signal (&inst->spool_cond);
+	pthread_mutex_unlock (&inst->spool_mutex);
+	rtn = pthread_join (inst->spool_tid, NULL);
+	if (rtn != 0) {
+		libpd_log_err (LEVEL_ERROR, rtn, ("Error terminating spool thread\n"));
+	}
+	libpd_spool_close (inst->spool);
+	inst->spool = NULL;
+}
+
+static int wrp_sock_send_bytes (__instance_t *inst, void *msg_bytes, ssize_t msg_len,
+	extra_err_info_t *err_info)
+{
+	size_t sent;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	return send_or_spool (inst, &msg_bytes, &msg_len, 1, -1, 0, &sent, 
+		err_info);
+}
+
+static int wrp_sock_send (__instance_t *inst, wrp_msg_t *msg, int timeout_ms,
+	bool spool, extra_err_info_t *err_info)
+{
+	int rtn;
+	void *msg_bytes;
+	ssize_t msg_len;
+	size_t sent;
+	unsigned send_flags;
+	uint64_t start_ns = hist_start (inst);
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	msg_len = wrp_encode_nn (msg, &msg_bytes, &send_flags);
+	hist_record (inst, LIBPD_HIST_ENCODE, start_ns);
+	if (msg_len < 0)
+		return (int) msg_len;
+	if (spool)
+		rtn = send_or_spool (inst, &msg_bytes, &msg_len, 1, timeout_ms, 
+			send_flags, &sent, err_info);
+	else
+		rtn = sock_send_msgs (inst, &msg_bytes, &msg_len, 1, timeout_ms, 
+			send_flags | SEND_COUNT_ERRORS, &sent, err_info);
+	free_encoded_nn (msg_bytes, send_flags);
+	return rtn;
+}
+
+// grows arena to at least size bytes. Returns NULL, and frees arena,
+// when out of memory.
+static encode_arena_t *size_batch_arena (encode_arena_t *arena, size_t size)
+{
+	encode_arena_t *grown;
+
+	if ((NULL != arena) && (arena->size >= size))
+		return arena;
+	grown = (encode_arena_t *) realloc (arena, sizeof(encode_arena_t) + size);
+	if (NULL == grown) {
+		free (arena);
+		return NULL;
+	}
+	grown->size = size;
+	return grown;
+}
+
+// keeps the arena for the next batch, unless it is large. Another batch
+// may have put back its own arena meanwhile, which is freed.
+static void put_batch_arena (__instance_t *inst, encode_arena_t *arena)
+{
+	if ((NULL != arena) && (arena->size <= BATCH_ARENA_KEEP_BYTES))
+		arena = __atomic_exchange_n (&inst->batch_arena, arena, __ATOMIC_ACQ_REL);
+	free (arena);
+}
+
+// Encodes msgs in chunks of SEND_BATCH_MAX, and sends each chunk
+// under one send_mutex lock. The msgs wrp_fast_fields handles are sized
+// first, then encoded back to back into one arena, so a chunk needs no
+// allocation once the arena is big enough. Others are encoded by wrp-c.
+static int wrp_sock_send_batch (__instance_t *inst, wrp_msg_t **msgs, size_t n,
+	size_t *sent, extra_err_info_t *err_info)
+{
+	void *msg_bytes[SEND_BATCH_MAX];
+	ssize_t msg_lens[SEND_BATCH_MAX];
+	bool in_arena[SEND_BATCH_MAX];
+	libpd_mp_kv_t kvs[WRP_FAST_FIELDS];
+	encode_arena_t *arena;
+	uint8_t *pos;
+	size_t i, count, chunk_sent, arena_len;
+	unsigned nfields;
+	int send_rtn, rtn = 0;
+	uint64_t start_ns;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	*sent = 0;
+	arena = __atomic_exchange_n (&inst->batch_arena, NULL, __ATOMIC_ACQ_REL);
+	while ((rtn == 0) && (*sent < n)) {
+		arena_len = 0;
+		for (count = 0; (count < SEND_BATCH_MAX) && (*sent + count < n); count++) {
+			if (NULL == msgs[*sent + count]) {
+				rtn = -0x1001;
+				break;
+			}
+			nfields = wrp_fast_fields (msgs[*sent + count], kvs);
+			in_arena[count] = (nfields != 0);
+			if (in_arena[count]) {
+				msg_lens[count] = (ssize_t) libpd_mp_map_len (kvs, nfields);
+				arena_len += (size_t) msg_lens[count];
+				continue;
+			}
+			start_ns = hist_start (inst);
+			msg_lens[count] = wrp_encode (msgs[*sent + count], &msg_bytes[count]);
+			hist_record (inst, LIBPD_HIST_ENCODE, start_ns);
+			if (msg_lens[count] < 0) {
+				rtn = (int) msg_lens[count];
+				break;
+			}
+		}
+		if (count == 0)
+			break;
+		arena = size_batch_arena (arena, arena_len);
+		if (NULL == arena) {
+			libpd_log (LEVEL_ERROR, ("LIBPARODUS: no memory for send batch\n"));
+			for (i = 0; i < count; i++)
+				if (!in_arena[i])
+					free (msg_bytes[i]);
+			rtn = -0x1001;
+			break;
+		}
+		pos = arena->bytes;
+		for (i = 0; i < count; i++) {
+			if (!in_arena[i])
+				continue;
+			start_ns = hist_start (inst);
+			libpd_mp_write_map (kvs, wrp_fast_fields (msgs[*sent + i], kvs), pos);
+			hist_record (inst, LIBPD_HIST_ENCODE, start_ns);
+			msg_bytes[i] = pos;
+			pos += msg_lens[i];
+		}
+		send_rtn = send_or_spool (inst, msg_bytes, msg_lens, count, -1, 0,
+			&chunk_sent, err_info);
+		*sent += chunk_sent;
+		for (i = 0; i < count; i++)
+			if (!in_arena[i])
+				free (msg_bytes[i]);
+		if (send_rtn != 0)
+			rtn = send_rtn;	// failed before any encode error
+	}
+	put_batch_arena (inst, arena);
+	return rtn;
+}
+
+// puts an item with encoded msg bytes on the async send queue,
+// waiting up to timeout_ms while the queue is full
+static int queue_send_item (__instance_t *inst, send_item_t *item, 
+	unsigned timeout_ms, extra_err_info_t *err_info)
+{
+	int rtn;
+
+	__atomic_add_fetch (&inst->send_pending, 1, __ATOMIC_SEQ_CST);
+	rtn = libpd_qsend (inst->send_queue, (void *) item, timeout_ms, 
+		&err_info->oserr);
+	if (rtn == 0)
+		return 0;
+	__atomic_sub_fetch (&inst->send_pending, 1, __ATOMIC_SEQ_CST);
+	put_send_item (inst, item);
+	if (rtn == 1)
+		return -0x2002;	// queue full
+	return rtn;
+}
+
+// encodes the msg into the item buffer and puts it on the async send queue
+static int wrp_queue_send (__instance_t *inst, wrp_msg_t *msg, 
+	unsigned timeout_ms, extra_err_info_t *err_info)
+{
+	send_item_t *item;
+	libpd_mp_kv_t kvs[WRP_FAST_FIELDS];
+	void *msg_bytes;
+	ssize_t msg_len;
+	unsigned n;
+	uint64_t start_ns;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	item = get_send_item (inst);
+	if (NULL == item)
+		return -0x2003;
+	start_ns = hist_start (inst);
+	n = wrp_fast_fields (msg, kvs);
+	if (n > 0) {
+		msg_len = (ssize_t) libpd_mp_map_len (kvs, n);
+		if (size_send_item (item, (size_t) msg_len) != 0) {
+			put_send_item (inst, item);
+			return -0x2003;
+		}
+		libpd_mp_write_map (kvs, n, (uint8_t *) item->msg_bytes);
+	} else {
+		msg_len = wrp_encode (msg, &msg_bytes);
+		if (msg_len < 0) {
+			put_send_item (inst, item);
+			return -0x1001;
+		}
+		// the item keeps the buffer wrp-c allocated
+		free (item->msg_bytes);
+		item->msg_bytes = msg_bytes;
+		item->buf_size = (size_t) msg_len;
+	}
+	item->msg_len = msg_len;
+	hist_record (inst, LIBPD_HIST_ENCODE, start_ns);
+	return queue_send_item (inst, item, timeout_ms, err_info);
+}
+
+// copies already encoded msg bytes to the async send queue
+static int bytes_queue_send (__instance_t *inst, const void *msg_bytes, 
+	size_t msg_len, extra_err_info_t *err_info)
+{
+	send_item_t *item;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	item = get_send_item (inst);
+	if (NULL == item)
+		return -0x2003;
+	if (size_send_item (item, msg_len) != 0) {
+		put_send_item (inst, item);
+		return -0x2003;
+	}
+	memcpy (item->msg_bytes, msg_bytes, msg_len);
+	item->msg_len = (ssize_t) msg_len;
+	return queue_send_item (inst, item, 0, err_info);
+}
+
+// encodes msgs and puts them on the async send queue, in order
+static int wrp_queue_send_batch (__instance_t *inst, wrp_msg_t **msgs, size_t n,
+	size_t *sent, extra_err_info_t *err_info)
+{
+	int rtn;
+
+	for (*sent = 0; *sent < n; (*sent)++) {
+		if (NULL == msgs[*sent])
+			return -0x1001;
+		rtn = wrp_queue_send (inst, msgs[*sent], 0, err_info);
+		if (rtn != 0)
+			return rtn;
+	}
+	return 0;
+}
+
+static void *wrp_sender_thread (void *arg)
+{
+	int rtn, status;
+	void *msg;
+	send_item_t *item;
+	__instance_t *inst = (__instance_t*) arg;
+	extra_err_info_t send_err;
+
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: Starting wrp sender thread\n"));
+	while (true) {
+		rtn = libpd_qreceive (inst->send_queue, &msg, SOCK_SEND_TIMEOUT_MS,
+			&send_err.oserr);
+		if (rtn == 1)
+			continue;
+		if (rtn != 0)
+			break;
+		item = (send_item_t *) msg;
+		if (item == &send_stop_item)
+			break;
+		rtn = wrp_sock_send_bytes (inst, item->msg_bytes, item->msg_len, &send_err);
+		status = (rtn == 0) ? 0 : LIBPD_ERROR_SEND_SOCKET;
+		if (NULL != inst->cfg.send_done_func)
+			inst->cfg.send_done_func ((libpd_instance_t) inst, status, 
+				item->msg_bytes, (size_t) item->msg_len);
+		put_send_item (inst, item);
+		if (__atomic_sub_fetch (&inst->send_pending, 1, __ATOMIC_SEQ_CST) == 0) {
+			pthread_mutex_lock (&inst->send_mutex);
+			pthread_cond_broadcast (&inst->send_flush_cond);
+			pthread_mutex_unlock (&inst->send_mutex);
+		}
+	}
+	libpd_log (LEVEL_INFO, ("Ended wrp sender thread\n"));
+	return NULL;
+}
+
+// returns 0, or the LIBPD_ERR_SEND code for a send error
+static int send_result (__instance_t *inst, int rtn)
+{
+	if (rtn == 0)
+		return 0;
+	rtn = LIBPD_ERR_SEND + rtn;
+	if ((rtn == LIBPD_ERR_SEND_CONVERT) || (rtn == LIBPD_ERR_SEND_BYTES))
+		STAT_ADD (inst, send_errors_encode, 1);
+	else if (rtn == LIBPD_ERR_SEND_QUEUE_FULL)
+		STAT_ADD (inst, send_errors_queue_full, 1);
+	return rtn;
+}
+
+// the libparodus_send error for a LIBPD_ERR_SEND code
+static int send_error (int rtn)
+{
+	if ((rtn == LIBPD_ERR_SEND_CONVERT) || (rtn == LIBPD_ERR_SEND_BYTES))
+		return LIBPD_ERROR_SEND_WRP_MSG;
+	if (rtn == LIBPD_ERR_SEND_QUEUE_FULL)
+		return LIBPD_ERROR_SEND_QUEUE_FULL;
+	if (rtn == LIBPD_ERR_SEND_SPOOL_FULL)
+		return LIBPD_ERROR_SEND_SPOOL_FULL;
+	// errno = inst->exterr;
+	return LIBPD_ERROR_SEND_SOCKET;
+}
+
+// sends the msg, or queues it for async send.
+// With timeout_ms >= 0, waits at most that long, and never spools the msg.
+static int send_msg (__instance_t *inst, wrp_msg_t *msg, int timeout_ms,
+	extra_err_info_t *err_info)
+{
+	int rtn;
+
+	if (NULL != inst->send_queue)
+		rtn = wrp_queue_send (inst, msg, 
+			(timeout_ms > 0) ? (unsigned) timeout_ms : 0, err_info);
+	else
+		rtn = wrp_sock_send (inst, msg, timeout_ms, (timeout_ms < 0), err_info);
+	return send_result (inst, rtn);
+}
+
+int libparodus_send__ (libpd_instance_t instance, wrp_msg_t *msg, 
+    extra_err_info_t *err_info)
+{
+	return send_msg ((__instance_t *) instance, msg, -1, err_info);
+}
+
+int libparodus_send_dbg (libpd_instance_t instance, wrp_msg_t *msg,
+    extra_err_info_t *err_info)
+{
+	int rtn;
+	__instance_t *inst = (__instance_t *) instance;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_send\n"));
+		err_info->err_detail = LIBPD_ERR_SEND_NULL_INST;
+		return LIBPD_ERROR_SEND_NULL_INST;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at send\n"));
+		err_info->err_detail = LIBPD_ERR_SEND_STATE;
+		return LIBPD_ERR_SEND_STATE;
+	}
+	rtn = libparodus_send__ (instance, msg, err_info);
+	if (rtn == 0)
+		return 0;
+	err_info->err_detail = rtn;
+	return send_error (rtn);
+}
+
+int libparodus_send (libpd_instance_t instance, wrp_msg_t *msg)
+{
+  extra_err_info_t err;
+  return libparodus_send_dbg (instance, msg, &err);
+}
+
+int libparodus_send_timed_dbg (libpd_instance_t instance, wrp_msg_t *msg,
+	uint32_t timeout_ms, extra_err_info_t *err_info)
+{
+	int rtn;
+	__instance_t *inst = (__instance_t *) instance;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_send_timed\n"));
+		err_info->err_detail = LIBPD_ERR_SEND_NULL_INST;
+		return LIBPD_ERROR_SEND_NULL_INST;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at send timed\n"));
+		err_info->err_detail = LIBPD_ERR_SEND_STATE;
+		return LIBPD_ERROR_SEND_STATE;
+	}
+	if (timeout_ms > INT_MAX)
+		timeout_ms = INT_MAX;
+	rtn = send_msg (inst, msg, (int) timeout_ms, err_info);
+	if (rtn == 0)
+		return 0;
+	err_info->err_detail = rtn;
+	if ((rtn == LIBPD_ERR_SEND_TIMEDOUT) || (rtn == LIBPD_ERR_SEND_LOCK_TIMEDOUT) ||
+	    (rtn == LIBPD_ERR_SEND_QUEUE_FULL))
+		return LIBPD_ERROR_SEND_WOULD_BLOCK;
+	return send_error (rtn);
+}
+
+int libparodus_send_timed (libpd_instance_t instance, wrp_msg_t *msg,
+	uint32_t timeout_ms)
+{
+  extra_err_info_t err;
+  return libparodus_send_timed_dbg (instance, msg, timeout_ms, &err);
+}
+
+int libparodus_send_bytes_dbg (libpd_instance_t instance, const void *msg_bytes,
+	size_t msg_len, extra_err_info_t *err_info)
+{
+	int rtn;
+	libpd_wrp_peek_t peek;
+	__instance_t *inst = (__instance_t *) instance;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_send_bytes\n"));
+		err_info->err_detail = LIBPD_ERR_SEND_NULL_INST;
+		return LIBPD_ERROR_SEND_NULL_INST;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at send bytes\n"));
+		err_info->err_detail = LIBPD_ERR_SEND_STATE;
+		return LIBPD_ERROR_SEND_STATE;
+	}
+	// a cheap check that the bytes are an encoded wrp msg
+	if ((NULL == msg_bytes) || (msg_len > INT_MAX) ||
+	    (libpd_wrp_peek (msg_bytes, msg_len, &peek) != 0) || (peek.msg_type < 0))
+		rtn = -0x1002;
+	else if (NULL != inst->send_queue)
+		rtn = bytes_queue_send (inst, msg_bytes, msg_len, err_info);
+	else
+		rtn = wrp_sock_send_bytes (inst, (void *) msg_bytes, (ssize_t) msg_len,
+			err_info);
+	rtn = send_result (inst, rtn);
+	if (rtn == 0)
+		return 0;
+	err_info->err_detail = rtn;
+	return send_error (rtn);
+}
+
+int libparodus_send_bytes (libpd_instance_t instance, const void *msg_bytes,
+	size_t msg_len)
+{
+  extra_err_info_t err;
+  return libparodus_send_bytes_dbg (instance, msg_bytes, msg_len, &err);
+}
+
+int libparodus_send_batch_dbg (libpd_instance_t instance, wrp_msg_t **msgs,
+	size_t n, size_t *sent, extra_err_info_t *err_info)
+{
+	int rtn;
+	size_t msgs_sent = 0;
+	__instance_t *inst = (__instance_t *) instance;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	if (NULL != sent)
+		*sent = 0;
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_send_batch\n"));
+		err_info->err_detail = LIBPD_ERR_SEND_NULL_INST;
+		return LIBPD_ERROR_SEND_NULL_INST;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at send batch\n"));
+		err_info->err_detail = LIBPD_ERR_SEND_STATE;
+		return LIBPD_ERROR_SEND_STATE;
+	}
+	if ((NULL == msgs) && (n > 0))
+		rtn = -0x1001;
+	else if (NULL != inst->send_queue)
+		rtn = wrp_queue_send_batch (inst, msgs, n, &msgs_sent, err_info);
+	else
+		rtn = wrp_sock_send_batch (inst, msgs, n, &msgs_sent, err_info);
+	if (NULL != sent)
+		*sent = msgs_sent;
+	rtn = send_result (inst, rtn);
+	if (rtn == 0)
+		return 0;
+	err_info->err_detail = rtn;
+	return send_error (rtn);
+}
+
+int libparodus_send_batch (libpd_instance_t instance, wrp_msg_t **msgs,
+	size_t n, size_t *sent)
+{
+  extra_err_info_t err;
+  return libparodus_send_batch_dbg (instance, msgs, n, sent, &err);
+}
+
+// the template keys replaced on each libparodus_template_encode
+#define TEMPLATE_KEY_UUID	0
+#define TEMPLATE_KEY_PAYLOAD	1
+
+struct libpd_wrp_template {
+	void *msg_bytes;	// the msg encoded with placeholder values
+	libpd_mp_splice_t splice;
+};
+
+libpd_wrp_template_t *libparodus_template_create (const wrp_msg_t *msg)
+{
+	static const char *keys[2] = {"transaction_uuid", "payload"};
+	libpd_wrp_template_t *tmpl;
+	wrp_msg_t tmp_msg;
+	void **payload;
+	size_t *payload_size;
+	ssize_t msg_len;
+	unsigned num_keys = 2;
+
+	if (NULL == msg)
+		return NULL;
+	tmp_msg = *msg;
+	// wrp-c leaves out empty fields, so give them placeholder values
+	payload = wrp_msg_payload (&tmp_msg, &payload_size);
+	if (NULL == payload)
+		return NULL;
+	*payload = (void *) "-";
+	*payload_size = 1;
+	if (WRP_MSG_TYPE__REQ == tmp_msg.msg_type)
+		tmp_msg.u.req.transaction_uuid = "-";
+	else if (WRP_MSG_TYPE__EVENT == tmp_msg.msg_type)
+		num_keys = 1;	// events have no transaction uuid
+	else
+		tmp_msg.u.crud.transaction_uuid = "-";
+	tmpl = (libpd_wrp_template_t *) malloc (sizeof (libpd_wrp_template_t));
+	if (NULL == tmpl)
+		return NULL;
+	msg_len = wrp_struct_to (&tmp_msg, WRP_BYTES, &tmpl->msg_bytes);
+	if (msg_len < 1) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: error converting WRP template to bytes\n"));
+		free (tmpl);
+		return NULL;
+	}
+	if (libpd_mp_splice_init (&tmpl->splice, tmpl->msg_bytes, (size_t) msg_len,
+			(num_keys == 1) ? &keys[TEMPLATE_KEY_PAYLOAD] : keys, num_keys) != 0) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: unexpected WRP template encoding\n"));
+		libparodus_template_destroy (tmpl);
+		return NULL;
+	}
+	return tmpl;
+}
+
+ssize_t libparodus_template_encode (const libpd_wrp_template_t *tmpl,
+	const char *transaction_uuid, const void *payload, size_t payload_size,
+	void **msg_bytes)
+{
+	const void *vals[2] = {NULL, NULL};
+	size_t val_lens[2] = {0, 0};
+	size_t msg_len;
+	unsigned first = 0;
+
+	*msg_bytes = NULL;
+	if (NULL == tmpl)
+		return -1;
+	if (tmpl->splice.num_vals == 2) {
+		if (NULL == transaction_uuid)
+			return -1;
+		vals[0] = transaction_uuid;
+		val_lens[0] = strlen (transaction_uuid);
+	} else
+		first = 1;	// events have only the payload
+	vals[1] = payload;
+	val_lens[1] = (NULL == payload) ? 0 : payload_size;
+	if ((val_lens[0] > UINT32_MAX) || (val_lens[1] > UINT32_MAX))
+		return -1;
+	msg_len = libpd_mp_splice_len (&tmpl->splice, &val_lens[first]);
+	*msg_bytes = malloc (msg_len);
+	if (NULL == *msg_bytes)
+		return -1;
+	libpd_mp_splice (&tmpl->splice, &vals[first], &val_lens[first], 
+		(uint8_t *) *msg_bytes);
+	return (ssize_t) msg_len;
+}
+
+void libparodus_template_destroy (libpd_wrp_template_t *tmpl)
+{
+	if (NULL == tmpl)
+		return;
+	free (tmpl->msg_bytes);
+	free (tmpl);
+}
+
+int libparodus_send_flush (libpd_instance_t instance, uint32_t ms)
+{
+	int rtn = 0;
+	struct timespec ts;
+	__instance_t *inst = (__instance_t *) instance;
+
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_send_flush\n"));
+		return LIBPD_ERROR_SEND_NULL_INST;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at send flush\n"));
+		return LIBPD_ERROR_SEND_STATE;
+	}
+	if (NULL == inst->send_queue)
+		return 0;
+	if (get_expire_time (ms, &ts) != 0)
+		return LIBPD_ERROR_SEND_SOCKET;
+	pthread_mutex_lock (&inst->send_mutex);
+	while (__atomic_load_n (&inst->send_pending, __ATOMIC_SEQ_CST) > 0) {
+		rtn = pthread_cond_timedwait (&inst->send_flush_cond, &inst->send_mutex, &ts);
+		if (rtn != 0)
+			break;
+	}
+	pthread_mutex_unlock (&inst->send_mutex);
+	if (rtn == ETIMEDOUT)
+		return 1;
+	if (rtn != 0)
+		return LIBPD_ERROR_SEND_SOCKET;
+	return 0;
+}
+
+// an async request, the done_arg of its libpd_req_t
+typedef struct {
+	__instance_t *inst;
+	libpd_resp_func_t *resp_func;
+	void *arg;
+} async_req_t;
+
+static void async_req_done (void *resp, int status, void *arg)
+{
+	async_req_t *async_req = (async_req_t *) arg;
+
+	async_req->resp_func ((libpd_instance_t) async_req->inst, status,
+		(wrp_msg_t *) resp, async_req->arg);
+	free (async_req);
+}
+
+// returns 0, or the LIBPD_ERR_REQ code
+static int check_request (__instance_t *inst, wrp_msg_t *req_msg, char **uuid)
+{
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_request\n"));
+		return LIBPD_ERR_REQ_NULL_INST;
+	}
+	if (!inst->cfg.receive) {
+		libpd_log (LEVEL_ERROR, ("No receive option on libparodus_request\n"));
+		return LIBPD_ERR_REQ_CFG;
+	}
+	if (RUN_STATE_RUNNING != inst->run_state) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at request\n"));
+		return LIBPD_ERR_REQ_STATE;
+	}
+	*uuid = (NULL == req_msg) ? NULL : find_wrp_msg_uuid (req_msg);
+	if ((NULL == *uuid) || ('\0' == **uuid)) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: request msg without transaction uuid\n"));
+		return LIBPD_ERR_REQ_WRP_MSG;
+	}
+	return 0;
+}
+
+// Adds the request to the table, so the response can't come back
+// before it is there, then sends it.
+// returns 0, or the LIBPD_ERR_REQ or LIBPD_ERR_SEND code
+static int send_request (__instance_t *inst, wrp_msg_t *req_msg, 
+	const char *uuid, uint32_t timeout_ms, libpd_req_done_func_t *done_func,
+	void *done_arg, libpd_req_t **req, extra_err_info_t *err_info)
+{
+	int err;
+
+	*req = libpd_reqs_add (inst->reqs, uuid, strlen (uuid), timeout_ms,
+		done_func, done_arg, &err);
+	if (NULL == *req)
+		return (err == 1) ? LIBPD_ERR_REQ_DUP_ID : LIBPD_ERR_REQ_ALLOC;
+	if (err == 2)	// the receiver thread may be waiting with no timeout
+		wake_receiver (inst);
+	err = libparodus_send__ ((libpd_instance_t) inst, req_msg, err_info);
+	if (err == 0)
+		return 0;
+	if (!libpd_reqs_remove (inst->reqs, *req) && (NULL != done_func))
+		return 0;	// already timed out, and reported to done_func
+	return err;
+}
+
+static int request_error (int err)
+{
+	switch (err) {
+		case LIBPD_ERR_REQ_NULL_INST:
+			return LIBPD_ERROR_REQ_NULL_INST;
+		case LIBPD_ERR_REQ_STATE:
+			return LIBPD_ERROR_REQ_STATE;
+		case LIBPD_ERR_REQ_CFG:
+			return LIBPD_ERROR_REQ_CFG;
+		case LIBPD_ERR_REQ_WRP_MSG:
+			return LIBPD_ERROR_REQ_WRP_MSG;
+		case LIBPD_ERR_REQ_DUP_ID:
+			return LIBPD_ERROR_REQ_DUP_ID;
+		case LIBPD_ERR_REQ_ALLOC:
+			return LIBPD_ERROR_REQ_ALLOC;
+		default:	// LIBPD_ERR_SEND code
+			return LIBPD_ERROR_REQ_SEND;
 	}
-	SST (sst_update_total_time (&sst_times);)
+}
 
-	free (msg_bytes);
-	pthread_mutex_unlock (&inst->send_mutex);
+int libparodus_request_dbg (libpd_instance_t instance, wrp_msg_t *req_msg,
+	wrp_msg_t **resp, uint32_t timeout_ms, extra_err_info_t *err_info)
+{
+	__instance_t *inst = (__instance_t *) instance;
+	libpd_req_t *req;
+	char *uuid;
+	void *resp_msg;
+	int rtn;
+
+	err_info->err_detail = 0;
+	err_info->oserr = 0;
+	*resp = NULL;
+	rtn = check_request (inst, req_msg, &uuid);
 	if (rtn == 0)
-		return 0;
-	return -0x1800 + rtn;
+		rtn = send_request (inst, req_msg, uuid, timeout_ms, NULL, NULL, 
+			&req, err_info);
+	if (rtn != 0) {
+		err_info->err_detail = rtn;
+		return request_error (rtn);
+	}
+	rtn = libpd_reqs_wait (inst->reqs, req, &resp_msg);
+	if (rtn == LIBPD_REQ_TIMEDOUT)
+		STAT_ADD (inst, request_timeouts, 1);
+	*resp = (wrp_msg_t *) resp_msg;
+	return rtn;
 }
 
-int libparodus_send__ (libpd_instance_t instance, wrp_msg_t *msg, 
-    extra_err_info_t *err_info)
+int libparodus_request (libpd_instance_t instance, wrp_msg_t *req,
+	wrp_msg_t **resp, uint32_t timeout_ms)
 {
-	int rtn = wrp_sock_send ((__instance_t *) instance, msg, err_info);
-	if (rtn == 0)
-		return 0;
-	return LIBPD_ERR_SEND + rtn;
+  extra_err_info_t err;
+  return libparodus_request_dbg (instance, req, resp, timeout_ms, &err);
 }
 
-int libparodus_send_dbg (libpd_instance_t instance, wrp_msg_t *msg,
-    extra_err_info_t *err_info)
+int libparodus_request_async_dbg (libpd_instance_t instance, wrp_msg_t *req_msg,
+	libpd_resp_func_t *resp_func, void *arg, uint32_t timeout_ms,
+	extra_err_info_t *err_info)
 {
-	int rtn;
 	__instance_t *inst = (__instance_t *) instance;
+	async_req_t *async_req;
+	libpd_req_t *req;
+	char *uuid;
+	int rtn;
 
 	err_info->err_detail = 0;
 	err_info->oserr = 0;
-	if (NULL == inst) {
-		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_send\n"));
-		err_info->err_detail = LIBPD_ERR_SEND_NULL_INST;
-		return LIBPD_ERROR_SEND_NULL_INST;
+	rtn = check_request (inst, req_msg, &uuid);
+	if ((rtn == 0) && (NULL == resp_func))
+		rtn = LIBPD_ERR_REQ_WRP_MSG;
+	if (rtn != 0) {
+		err_info->err_detail = rtn;
+		return request_error (rtn);
 	}
-	if (RUN_STATE_RUNNING != inst->run_state) {
-		libpd_log (LEVEL_ERROR, ("LIBPARODUS: not running at send\n"));
-		err_info->err_detail = LIBPD_ERR_SEND_STATE;
-		return LIBPD_ERR_SEND_STATE;
+	async_req = (async_req_t *) malloc (sizeof (async_req_t));
+	if (NULL == async_req) {
+		err_info->err_detail = LIBPD_ERR_REQ_ALLOC;
+		return LIBPD_ERROR_REQ_ALLOC;
 	}
-	rtn = libparodus_send__ (instance, msg, err_info);
-	if (rtn == 0)
-		return 0;
-	err_info->err_detail = rtn;
-	if (rtn == LIBPD_ERR_SEND_CONVERT)
-		return LIBPD_ERROR_SEND_WRP_MSG;
-	// errno = inst->exterr;
-  return LIBPD_ERROR_SEND_SOCKET;
+	async_req->inst = inst;
+	async_req->resp_func = resp_func;
+	async_req->arg = arg;
+	rtn = send_request (inst, req_msg, uuid, timeout_ms, async_req_done,
+		(void *) async_req, &req, err_info);
+	if (rtn != 0) {
+		free (async_req);
+		err_info->err_detail = rtn;
+		return request_error (rtn);
+	}
+	return 0;
 }
 
-int libparodus_send (libpd_instance_t instance, wrp_msg_t *msg)
+int libparodus_request_async (libpd_instance_t instance, wrp_msg_t *req,
+	libpd_resp_func_t *resp_func, void *arg, uint32_t timeout_ms)
 {
   extra_err_info_t err;
-  return libparodus_send_dbg (instance, msg, &err);
+  return libparodus_request_async_dbg (instance, req, resp_func, arg, 
+  	timeout_ms, &err);
+}
+
+int libparodus_get_stats (libpd_instance_t instance, libpd_stats_t *stats)
+{
+	__instance_t *inst = (__instance_t *) instance;
+	unsigned i;
+
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_get_stats\n"));
+		return LIBPD_ERROR_STATS_NULL_INST;
+	}
+	stats->msgs_received = STAT_GET (inst, msgs_received);
+	stats->msgs_decoded = STAT_GET (inst, msgs_decoded);
+	stats->msgs_delivered = STAT_GET (inst, msgs_delivered);
+	stats->drops_decode = STAT_GET (inst, drops_decode);
+	stats->drops_service = STAT_GET (inst, drops_service);
+	stats->drops_queue_full = STAT_GET (inst, drops_queue_full);
+	stats->drops_queue_oldest = STAT_GET (inst, drops_queue_oldest);
+	stats->drops_queue_priority = STAT_GET (inst, drops_queue_priority);
+	stats->bytes_in = STAT_GET (inst, bytes_in);
+	stats->bytes_out = STAT_GET (inst, bytes_out);
+	stats->msgs_sent = STAT_GET (inst, msgs_sent);
+	stats->send_errors_encode = STAT_GET (inst, send_errors_encode);
+	stats->send_errors_socket = STAT_GET (inst, send_errors_socket);
+	stats->send_errors_queue_full = STAT_GET (inst, send_errors_queue_full);
+	stats->rcv_queue_depth = (uint32_t) libpd_qcount (inst->wrp_queue);
+	for (i = 0; i < inst->num_services; i++)
+		stats->rcv_queue_depth += (uint32_t) libpd_qcount (inst->services[i].wrp_queue);
+	stats->rcv_queue_high_water = STAT_GET (inst, rcv_queue_high_water);
+	stats->rcv_queue_capacity = (uint32_t) libpd_qcapacity (inst->wrp_queue);
+	for (i = 0; i < inst->num_services; i++)
+		stats->rcv_queue_capacity += 
+			(uint32_t) libpd_qcapacity (inst->services[i].wrp_queue);
+	stats->keep_alives = STAT_GET (inst, keep_alives);
+	stats->reconnects = STAT_GET (inst, reconnects);
+	stats->reconnect_ms = STAT_GET (inst, reconnect_ms);
+	stats->liveness_probes = STAT_GET (inst, liveness_probes);
+	stats->responses = STAT_GET (inst, responses);
+	stats->request_timeouts = STAT_GET (inst, request_timeouts);
+	stats->send_errors_timeout = STAT_GET (inst, send_errors_timeout);
+	stats->spooled = STAT_GET (inst, spooled);
+	stats->spool_replays = STAT_GET (inst, spool_replays);
+	stats->spool_drops = STAT_GET (inst, spool_drops);
+	stats->spool_replay_errors = STAT_GET (inst, spool_replay_errors);
+	stats->spool_depth = libpd_spool_count (inst->spool);
+	stats->drops_decode_queue = STAT_GET (inst, drops_decode_queue);
+	stats->liveness_probe_errors = STAT_GET (inst, liveness_probe_errors);
+	return 0;
+}
+
+int libparodus_get_latency (libpd_instance_t instance, libpd_hist_id_t hist,
+	libpd_latency_t *latency)
+{
+	static const double pcts[4] = {50.0, 90.0, 99.0, 99.9};
+	uint64_t values[4];
+	libpd_hist_summary_t summary;
+	__instance_t *inst = (__instance_t *) instance;
+
+	if (NULL == inst) {
+		libpd_log (LEVEL_ERROR, ("Null instance on libparodus_get_latency\n"));
+		return LIBPD_ERROR_STATS_NULL_INST;
+	}
+	if (((unsigned) hist >= LIBPD_NUM_HISTS) || (NULL == inst->hists[0])) {
+		libpd_log (LEVEL_ERROR, ("No latency histogram on libparodus_get_latency\n"));
+		return LIBPD_ERROR_STATS_CFG;
+	}
+	libpd_hist_read (inst->hists[hist], &summary, pcts, values, 4);
+	latency->count = summary.count;
+	latency->min_ns = summary.min;
+	latency->max_ns = summary.max;
+	latency->mean_ns = summary.mean;
+	latency->p50_ns = values[0];
+	latency->p90_ns = values[1];
+	latency->p99_ns = values[2];
+	latency->p999_ns = values[3];
+	return 0;
 }
 
 static char *find_wrp_msg_dest (wrp_msg_t *wrp_msg)
@@ -947,135 +3419,611 @@ static char *find_wrp_msg_dest (wrp_msg_t *wrp_msg)
 	return NULL;
 }
 
+// returns the transaction uuid of msg types that have one, else NULL
+static char *find_wrp_msg_uuid (wrp_msg_t *wrp_msg)
+{
+	switch (wrp_msg->msg_type) {
+		case WRP_MSG_TYPE__REQ:
+			return wrp_msg->u.req.transaction_uuid;
+		case WRP_MSG_TYPE__CREATE:
+		case WRP_MSG_TYPE__RETREIVE:
+		case WRP_MSG_TYPE__UPDATE:
+		case WRP_MSG_TYPE__DELETE:
+			return wrp_msg->u.crud.transaction_uuid;
+		default:
+			return NULL;
+	}
+}
+
+// the shorter of two waits, where -1 is no limit
+static int min_wait_ms (int wait1_ms, int wait2_ms)
+{
+	if (wait1_ms < 0)
+		return wait2_ms;
+	if ((wait2_ms < 0) || (wait1_ms < wait2_ms))
+		return wait1_ms;
+	return wait2_ms;
+}
+
+// backoff before the next reconnect attempt
+static uint32_t reconnect_delay_ms (__instance_t *inst)
+{
+	unsigned n = inst->reconnect_attempts;
+	uint32_t delay = MAX_RECONNECT_RETRY_DELAY_SECS * 1000;
+
+	if (n == 0)
+		return RECONNECT_FIRST_DELAY_MS;
+	if (n <= 6)
+		delay = RECONNECT_BASE_DELAY_MS << (n - 1);
+	return delay/2 + (uint32_t) rand_r (&inst->backoff_seed) % (delay/2 + 1);
+}
+
+static void set_liveness (__instance_t *inst, int liveness)
+{
+	__atomic_store_n (&inst->liveness, liveness, __ATOMIC_RELAXED);
+}
+
+// ms until nothing received makes the connection suspect, or makes a
+// suspect connection down. -1 when there is no keepalive_timeout_secs.
+static int liveness_wait_ms (__instance_t *inst)
+{
+	uint64_t deadline_ms, now_ms;
+
+	if (inst->cfg.keepalive_timeout_secs <= 0)
+		return -1;
+	deadline_ms = inst->last_rcv_ms + 
+		(uint64_t) inst->cfg.keepalive_timeout_secs * 1000;
+	if (LIBPD_LIVENESS_SUSPECT == inst->liveness)
+		deadline_ms += (uint64_t) inst->cfg.liveness_grace_secs * 1000;
+	now_ms = get_monotonic_ms ();
+	return (now_ms >= deadline_ms) ? 0 : (int) (deadline_ms - now_ms);
+}
+
+// called when liveness_wait_ms runs out.
+// returns true when the connection is down and must be reconnected
+static bool liveness_expired (__instance_t *inst, extra_err_info_t *err_info)
+{
+	if ((LIBPD_LIVENESS_SUSPECT == inst->liveness) || 
+	    (inst->cfg.liveness_grace_secs <= 0))
+		return true;
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: nothing received for %d secs, "
+		"connection suspect\n", inst->cfg.keepalive_timeout_secs));
+	set_liveness (inst, LIBPD_LIVENESS_SUSPECT);
+	if (inst->cfg.liveness_probe) {
+		// parodus answers a registration with an AUTH msg.
+		// Not waiting, so the receiver thread is not held up.
+		STAT_ADD (inst, liveness_probes, 1);
+		if (send_registration_msg (inst, 0, err_info) != 0)
+			STAT_ADD (inst, liveness_probe_errors, 1);
+	}
+	return false;
+}
+
+// called by the receiver thread for every msg received
+static void liveness_received (__instance_t *inst)
+{
+	__atomic_store_n (&inst->last_rcv_ms, get_monotonic_ms (), __ATOMIC_RELAXED);
+	if (LIBPD_LIVENESS_ALIVE != inst->liveness) {
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: suspect connection is alive\n"));
+		set_liveness (inst, LIBPD_LIVENESS_ALIVE);
+	}
+}
+
+static void set_conn_state (__instance_t *inst, int state)
+{
+	inst->conn_state = state;
+	if (NULL != inst->cfg.conn_func)
+		inst->cfg.conn_func ((libpd_instance_t) inst, state);
+}
+
+static bool take_reconnect_request (__instance_t *inst)
+{
+	return __atomic_exchange_n (&inst->reconnect_requested, false, 
+		__ATOMIC_SEQ_CST);
+}
+
+// drops the receive socket and schedules the first reconnect attempt,
+// at once when requested by libparodus_reconnect
+static void start_reconnect (__instance_t *inst, bool at_once)
+{
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: receive connection down, reconnecting\n"));
+	shutdown_socket (&inst->rcv_sock);
+	inst->reconnect_attempts = 0;
+	inst->down_ms = get_monotonic_ms ();
+	inst->reconnect_at_ms = inst->down_ms;
+	if (!at_once)
+		inst->reconnect_at_ms += reconnect_delay_ms (inst);
+	set_liveness (inst, LIBPD_LIVENESS_DOWN);
+	set_conn_state (inst, LIBPD_CONN_DOWN);
+}
+
+// One step of reconnecting, called by the receiver thread while the
+// connection is down. Waits until the next attempt is due, then tries 
+// to reconnect and register. The wait ends early on shutdown, or on 
+// libparodus_reconnect, which retries at once.
 static void wrp_receiver_reconnect (__instance_t *inst, extra_err_info_t *err_info)
 {
-	int p = 2;
-	int retry_delay = 0;
+	uint64_t now_ms = get_monotonic_ms ();
+	int wait_ms;
 
-	while (true)
-	{
-		shutdown_socket (&inst->rcv_sock);
-		if (retry_delay < MAX_RECONNECT_RETRY_DELAY_SECS) {
-			p = p+p;
-			retry_delay = p-1;
+	if (now_ms < inst->reconnect_at_ms) {
+		wait_ms = min_wait_ms ((int) (inst->reconnect_at_ms - now_ms),
+			libpd_reqs_next_expiry_ms (inst->reqs));
+		if (wait_wake_fd (inst, wait_ms)) {
+			if (!take_reconnect_request (inst))
+				return;	// the caller checks run_state
+		} else if (get_monotonic_ms () < inst->reconnect_at_ms)
+			return;	// woken early to time out requests
+		if (RUN_STATE_RUNNING != inst->run_state)
+			return;
+	}
+	libpd_log (LEVEL_DEBUG, ("Retrying receiver connection\n"));
+	shutdown_socket (&inst->rcv_sock);
+	inst->rcv_sock = connect_receiver (inst->client_url, &err_info->oserr);
+	if ((inst->rcv_sock >= 0) &&
+	    (get_sock_rcv_fd (inst->rcv_sock, &inst->rcv_fd, &err_info->oserr) == 0) &&
+	    (send_registration_msg (inst, -1, err_info) == 0)) {
+		inst->auth_received = false;
+		liveness_received (inst);
+		STAT_ADD (inst, reconnects, 1);
+		STAT_ADD (inst, reconnect_ms, get_monotonic_ms () - inst->down_ms);
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: receive connection up\n"));
+		set_conn_state (inst, LIBPD_CONN_UP);
+		return;
+	}
+	inst->reconnect_attempts++;
+	inst->reconnect_at_ms = get_monotonic_ms () + reconnect_delay_ms (inst);
+}
+
+// returns the payload fields of msg types that have a payload, else NULL
+static void **wrp_msg_payload (wrp_msg_t *msg, size_t **payload_size)
+{
+	switch (msg->msg_type) {
+		case WRP_MSG_TYPE__REQ:
+			*payload_size = &msg->u.req.payload_size;
+			return &msg->u.req.payload;
+		case WRP_MSG_TYPE__EVENT:
+			*payload_size = &msg->u.event.payload_size;
+			return &msg->u.event.payload;
+		case WRP_MSG_TYPE__CREATE:
+		case WRP_MSG_TYPE__RETREIVE:
+		case WRP_MSG_TYPE__UPDATE:
+		case WRP_MSG_TYPE__DELETE:
+			*payload_size = &msg->u.crud.payload_size;
+			return &msg->u.crud.payload;
+		default:
+			return NULL;
+	}
+}
+
+// size of a received msg, for rcv_queue_max_bytes
+static size_t wrp_msg_size (void *msg)
+{
+	size_t *payload_size;
+
+	if (is_closed_msg ((wrp_msg_t *) msg) ||
+	    (NULL == wrp_msg_payload ((wrp_msg_t *) msg, &payload_size)))
+		return sizeof(wrp_msg_t);
+	return sizeof(wrp_msg_t) + *payload_size;
+}
+
+// Decodes everything but the payload, which is left in the nanomsg
+// buffer. The buffer is kept until the msg is freed with wrp_free_zc.
+// returns 0 on success, -1 on error. raw_msg is consumed either way.
+static int decode_raw_msg_zc (zc_pool_t *pool, decode_buf_t *hdr_buf,
+	raw_msg_t *raw_msg, wrp_msg_t **msg)
+{
+	const uint8_t *raw = (const uint8_t *) raw_msg->msg;
+	const uint8_t *val, *val_end = NULL;
+	size_t val_len, val_offset = 0, hdr_len;
+	const char *payload = NULL;
+	size_t payload_size = 0;
+	uint8_t *hdr;
+	void **msg_payload;
+	size_t *msg_payload_size;
+	ssize_t rtn;
+	zc_msg_t *zc_msg = zc_msg_get (pool);
+
+	if (NULL == zc_msg) {
+		nn_freemsg (raw_msg->msg);
+		return -1;
+	}
+	zc_msg->nn_buf = NULL;
+	if (libpd_mp_find_key (raw, (size_t) raw_msg->len, "payload", 
+			&val, &val_len) == 0) {
+		val_end = val + val_len;
+		val_offset = (size_t) (val - raw);
+		if (libpd_mp_read_str (&val, val_end, &payload, &payload_size) != 0)
+			payload = NULL;
+	}
+	if (NULL == payload) {
+		rtn = wrp_to_struct (raw, raw_msg->len, WRP_BYTES, &zc_msg->decoded);
+		nn_freemsg (raw_msg->msg);
+	} else {
+		// decode a copy with an empty bin in place of the payload
+		hdr_len = (size_t) raw_msg->len - val_len + 2;
+		if (hdr_len > hdr_buf->size) {
+			hdr = (uint8_t *) realloc (hdr_buf->buf, hdr_len);
+			if (NULL == hdr) {
+				zc_msg_put (zc_msg);
+				nn_freemsg (raw_msg->msg);
+				return -1;
+			}
+			hdr_buf->buf = hdr;
+			hdr_buf->size = hdr_len;
 		}
-		sleep (retry_delay);
-		libpd_log (LEVEL_DEBUG, ("Retrying receiver connection\n"));
-		inst->rcv_sock = connect_receiver 
-			(inst->client_url, inst->cfg.keepalive_timeout_secs, 
-			 &err_info->oserr);
-		if (inst->rcv_sock < 0)
-			continue;
-		if (send_registration_msg (inst, err_info) != 0)
+		hdr = hdr_buf->buf;
+		memcpy (hdr, raw, val_offset);
+		hdr[val_offset] = 0xC4;
+		hdr[val_offset+1] = 0;
+		memcpy (hdr + val_offset + 2, val_end, hdr_len - val_offset - 2);
+		rtn = wrp_to_struct (hdr, hdr_len, WRP_BYTES, &zc_msg->decoded);
+		zc_msg->nn_buf = raw_msg->msg;
+	}
+	if (rtn < 1) {
+		if (NULL != zc_msg->nn_buf)
+			nn_freemsg (zc_msg->nn_buf);
+		zc_msg_put (zc_msg);
+		return -1;
+	}
+	if (NULL != zc_msg->nn_buf) {
+		msg_payload = wrp_msg_payload (zc_msg->decoded, &msg_payload_size);
+		if (NULL == msg_payload) {
+			nn_freemsg (zc_msg->nn_buf);
+			zc_msg->nn_buf = NULL;
+		} else {
+			if (NULL != *msg_payload)
+				free (*msg_payload);
+			*msg_payload = (void *) payload;
+			*msg_payload_size = payload_size;
+		}
+	}
+	zc_msg->msg = *zc_msg->decoded;
+	// the payload now belongs to nn_buf
+	if (NULL != zc_msg->nn_buf) {
+		msg_payload = wrp_msg_payload (zc_msg->decoded, &msg_payload_size);
+		*msg_payload = NULL;
+		*msg_payload_size = 0;
+	}
+	*msg = &zc_msg->msg;
+	return 0;
+}
+
+// hdr_buf belongs to the calling thread.
+// returns 0 on success, -1 on error. raw_msg is consumed either way.
+static int decode_raw_msg (__instance_t *inst, decode_buf_t *hdr_buf,
+	raw_msg_t *raw_msg, wrp_msg_t **msg)
+{
+	int msg_len;
+
+	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Converting bytes to WRP\n")); 
+	if (inst->cfg.zero_copy_receive)
+		return decode_raw_msg_zc (inst->zc_pool, hdr_buf, raw_msg, msg);
+ 	msg_len = (int) wrp_to_struct (raw_msg->msg, raw_msg->len, WRP_BYTES, msg);
+	nn_freemsg (raw_msg->msg);
+	if (msg_len < 1)
+		return -1;
+	return 0;
+}
+
+static void free_rcv_msg (__instance_t *inst, wrp_msg_t *msg)
+{
+	rcv_msg_free_func (inst) (msg);
+}
+
+// dest is "<scheme>:<device id>/<service>[/...]"
+// returns the service the msg is for, NULL if not one of ours
+static svc_entry_t *find_dest_service (__instance_t *inst, const char *dest, 
+	size_t dest_len)
+{
+	const char *msg_service = memchr (dest, '/', dest_len);
+	const char *tmp;
+	size_t len;
+
+	if (NULL == msg_service)
+		return NULL;
+	msg_service++;
+	len = dest_len - (size_t) (msg_service - dest);
+	tmp = memchr (msg_service, '/', len);
+	if (NULL != tmp)
+		len = (uintptr_t)tmp - (uintptr_t)msg_service;
+	return find_service (inst, msg_service, len);
+}
+
+static void update_rcv_queue_depth (__instance_t *inst, libpd_mq_t wrp_queue)
+{
+	uint32_t depth = (uint32_t) libpd_qcount (wrp_queue);
+	uint32_t high = STAT_GET (inst, rcv_queue_high_water);
+
+	// decode threads may raise the high water mark at the same time
+	while (depth > high) {
+		if (__atomic_compare_exchange_n (&inst->stats.rcv_queue_high_water, 
+				&high, depth, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+	}
+}
+
+// passes a response to the libparodus_request waiting for it.
+// returns false if no request has the transaction uuid of the msg
+static bool answer_request (__instance_t *inst, wrp_msg_t *wrp_msg)
+{
+	char *uuid = find_wrp_msg_uuid (wrp_msg);
+
+	if ((NULL == uuid) || 
+	    !libpd_reqs_answer (inst->reqs, uuid, strlen (uuid), (void *) wrp_msg))
+		return false;
+	STAT_ADD (inst, responses, 1);
+	return true;
+}
+
+// rcv_ns is when the msg was received on the socket, 0 if not timing
+static void queue_wrp_msg (__instance_t *inst, svc_entry_t *service, 
+	wrp_msg_t *wrp_msg, uint64_t rcv_ns)
+{
+	libpd_mq_t wrp_queue = *service->wrp_queue;
+	void *evicted;
+	int rtn;
+
+	if (answer_request (inst, wrp_msg))
+		return;
+	libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received msg directed to service %s\n",
+		service->name));
+	if (NULL != inst->cfg.rcv_func) {
+		STAT_ADD (inst, msgs_delivered, 1);
+		hist_record (inst, LIBPD_HIST_RCV_LATENCY, rcv_ns);
+		inst->cfg.rcv_func ((libpd_instance_t) inst, wrp_msg);
+		return;
+	}
+	rtn = libpd_qsend_evict (wrp_queue, (void *) wrp_msg, rcv_ns,
+		(uint64_t) WRP_QUEUE_SEND_TIMEOUT_MS * NS_PER_MS, &evicted,
+		&inst->rcv_err_info.oserr);
+	if (NULL != evicted) {
+		libpd_log (LEVEL_DEBUG, ("LIBPARODUS: receive queue full, queued msg dropped\n"));
+		if (inst->cfg.rcv_queue_overflow == LIBPD_RCV_OVERFLOW_DROP_OLDEST)
+			STAT_ADD (inst, drops_queue_oldest, 1);
+		else
+			STAT_ADD (inst, drops_queue_priority, 1);
+		free_rcv_msg (inst, (wrp_msg_t *) evicted);
+	}
+	if (rtn != 0) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: receive queue full, msg dropped\n"));
+		STAT_ADD (inst, drops_queue_full, 1);
+		free_rcv_msg (inst, wrp_msg);
+		return;
+	}
+	STAT_ADD (inst, msgs_delivered, 1);
+	update_rcv_queue_depth (inst, wrp_queue);
+}
+
+// Routes a raw msg from msg_type and dest, without decoding it.
+// returns 0 if the msg was handled or is not for one of our services,
+// 1 if it should be decoded and queued for *service,
+// 2 if it could not be scanned and must be decoded to be routed.
+// peek gets the fields scanned.
+static int peek_raw_msg (__instance_t *inst, raw_msg_t *raw_msg,
+	libpd_wrp_peek_t *peek, svc_entry_t **service)
+{
+	if (libpd_wrp_peek (raw_msg->msg, (size_t) raw_msg->len, peek) != 0)
+		return 2;
+	switch (peek->msg_type) {
+		case WRP_MSG_TYPE__AUTH:
+			libpd_log (LEVEL_INFO, ("LIBPARODUS: AUTH msg received\n"));
+			inst->auth_received = true;
+			return 0;
+		case WRP_MSG_TYPE__SVC_ALIVE:
+			libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received keep alive message\n"));
+			STAT_ADD (inst, keep_alives, 1);
+			return 0;
+		case WRP_MSG_TYPE__REQ:
+		case WRP_MSG_TYPE__EVENT:
+		case WRP_MSG_TYPE__CREATE:
+		case WRP_MSG_TYPE__RETREIVE:
+		case WRP_MSG_TYPE__UPDATE:
+		case WRP_MSG_TYPE__DELETE:
+			if (NULL == peek->dest)
+				return 2;
+			*service = find_dest_service (inst, peek->dest, peek->dest_len);
+			if (NULL == *service) {
+				STAT_ADD (inst, drops_service, 1);
+				return 0;
+			}
+			return 1;
+		default:
+			return 2;
+	}
+}
+
+// Decodes a msg that peek_raw_msg returned route 1 or 2 for,
+// and queues it for its service. hdr_buf belongs to the calling thread.
+static void deliver_raw_msg (__instance_t *inst, decode_buf_t *hdr_buf,
+	raw_msg_t *raw_msg, int route, svc_entry_t *service, uint64_t rcv_ns)
+{
+	wrp_msg_t *wrp_msg;
+	char *msg_dest;
+
+	if (decode_raw_msg (inst, hdr_buf, raw_msg, &wrp_msg) != 0) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: error converting bytes to WRP\n"));
+		STAT_ADD (inst, drops_decode, 1);
+		return;
+	}
+	STAT_ADD (inst, msgs_decoded, 1);
+	if (route == 1) {	// already routed by peek_raw_msg
+		queue_wrp_msg (inst, service, wrp_msg, rcv_ns);
+		return;
+	}
+	if (wrp_msg->msg_type == WRP_MSG_TYPE__AUTH) {
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: AUTH msg received\n"));
+		inst->auth_received = true;
+		free_rcv_msg (inst, wrp_msg);
+		return;
+	}
+
+	if (wrp_msg->msg_type == WRP_MSG_TYPE__SVC_ALIVE) {
+		libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received keep alive message\n"));
+		STAT_ADD (inst, keep_alives, 1);
+		free_rcv_msg (inst, wrp_msg);
+		return;
+	}
+
+	// Pass thru REQ, EVENT, and CRUD if dest matches the selected service
+	msg_dest = find_wrp_msg_dest (wrp_msg);
+	if (NULL == msg_dest) {
+		libpd_log (LEVEL_ERROR, ("LIBPARADOS: Unprocessed msg type %d received\n",
+			wrp_msg->msg_type));
+		free_rcv_msg (inst, wrp_msg);
+		return;
+	}
+	service = find_dest_service (inst, msg_dest, strlen (msg_dest));
+	if (NULL == service) {
+		STAT_ADD (inst, drops_service, 1);
+		free_rcv_msg (inst, wrp_msg);
+		return;
+	}
+	queue_wrp_msg (inst, service, wrp_msg, rcv_ns);
+}
+
+// Hands a raw msg to a decode thread, picked by the hash of its source
+// so that msgs from one source are decoded and delivered in order.
+// Msgs without a source all go to the first decode thread.
+static void queue_raw_msg (__instance_t *inst, raw_msg_t *raw_msg, 
+	libpd_wrp_peek_t *peek, int route, svc_entry_t *service, uint64_t rcv_ns)
+{
+	decoder_t *dec = &inst->decoders[0];
+	decode_item_t *item;
+	int oserr;
+
+	if (NULL != peek->source)
+		dec = &inst->decoders[service_hash (peek->source, peek->source_len) 
+			% inst->cfg.rcv_decode_threads];
+	item = get_decode_item (dec);
+	if (NULL == item) {
+		nn_freemsg (raw_msg->msg);
+		STAT_ADD (inst, drops_decode, 1);
+		return;
+	}
+	item->raw_msg = *raw_msg;
+	item->route = route;
+	item->service = service;
+	item->rcv_ns = rcv_ns;
+	if (libpd_qsend (dec->queue, (void *) item, DECODE_QUEUE_SEND_TIMEOUT_MS,
+			&oserr) != 0) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: decode queue full, msg dropped\n"));
+		STAT_ADD (inst, drops_decode_queue, 1);
+		nn_freemsg (raw_msg->msg);
+		put_decode_item (dec, item);
+	}
+}
+
+static void *wrp_decoder_thread (void *arg)
+{
+	int rtn, oserr;
+	void *msg;
+	decode_item_t *item;
+	decoder_t *dec = (decoder_t *) arg;
+	__instance_t *inst = dec->inst;
+
+	libpd_log (LEVEL_INFO, ("LIBPARODUS: Starting decode thread\n"));
+	while (true) {
+		rtn = libpd_qreceive (dec->queue, &msg, WRP_QUEUE_SEND_TIMEOUT_MS, &oserr);
+		if (rtn == 1)
 			continue;
-		break;
+		if (rtn != 0)
+			break;
+		item = (decode_item_t *) msg;
+		if (item == &decode_stop_item)
+			break;
+		if (RUN_STATE_RUNNING != inst->run_state)
+			nn_freemsg (item->raw_msg.msg);
+		else
+			deliver_raw_msg (inst, &dec->hdr_buf, &item->raw_msg, item->route,
+				item->service, item->rcv_ns);
+		put_decode_item (dec, item);
 	}
-	inst->auth_received = false;
-	inst->reconnect_count++;
-	return;
+	libpd_log (LEVEL_INFO, ("Ended decode thread\n"));
+	return NULL;
 }
 
 static void *wrp_receiver_thread (void *arg)
 {
-	int rtn, msg_len;
+	int rtn;
 	raw_msg_t raw_msg;
-	wrp_msg_t *wrp_msg;
-	int end_msg_len = strlen(end_msg);
 	__instance_t *inst = (__instance_t*) arg;
 	extra_err_info_t *rcv_err = &inst->rcv_err_info;
-	char *msg_dest, *msg_service;
+	libpd_wrp_peek_t peek;
+	svc_entry_t *service = NULL;
+	decode_buf_t hdr_buf = {NULL, 0};
+	uint64_t rcv_ns;
 
 	libpd_log (LEVEL_INFO, ("LIBPARODUS: Starting wrp receiver thread\n"));
 	while (1) {
-		rtn = sock_receive (inst->rcv_sock, &raw_msg, &rcv_err->oserr);
-		if (rtn != 0) {
-			if (rtn == 1) { // timed out
-				if (RUN_STATE_RUNNING != inst->run_state) {
-					break;
-				}
-				wrp_receiver_reconnect (inst, rcv_err);
-				continue;
-			}
-			break;
-		}
-		if (raw_msg.len >= end_msg_len) {
-			if (strncmp (raw_msg.msg, end_msg, end_msg_len) == 0) {
-				nn_freemsg (raw_msg.msg);
+		STAT_ADD (inst, request_timeouts, libpd_reqs_expire (inst->reqs));
+		if (LIBPD_CONN_DOWN == inst->conn_state) {
+			if (RUN_STATE_RUNNING != inst->run_state)
 				break;
-			}
-		}
-		if (RUN_STATE_RUNNING != inst->run_state) {
-			nn_freemsg (raw_msg.msg);
-			continue;
-		}
-		libpd_log (LEVEL_DEBUG, ("LIBPARODUS: Converting bytes to WRP\n")); 
- 		msg_len = (int) wrp_to_struct (raw_msg.msg, raw_msg.len, WRP_BYTES, &wrp_msg);
-		nn_freemsg (raw_msg.msg);
-		if (msg_len < 1) {
-			libpd_log (LEVEL_ERROR, ("LIBPARODUS: error converting bytes to WRP\n"));
-			continue;
-		}
-		if (wrp_msg->msg_type == WRP_MSG_TYPE__AUTH) {
-			libpd_log (LEVEL_INFO, ("LIBPARODUS: AUTH msg received\n"));
-			inst->auth_received = true;
-			wrp_free_struct (wrp_msg);
-			continue;
-		}
-
-		if (wrp_msg->msg_type == WRP_MSG_TYPE__SVC_ALIVE) {
-			libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received keep alive message\n"));
-			inst->keep_alive_count++;
-			wrp_free_struct (wrp_msg);
+			wrp_receiver_reconnect (inst, rcv_err);
 			continue;
 		}
-
-		// Pass thru REQ, EVENT, and CRUD if dest matches the selected service
-		msg_dest = find_wrp_msg_dest (wrp_msg);
-		if (NULL == msg_dest) {
-			libpd_log (LEVEL_ERROR, ("LIBPARADOS: Unprocessed msg type %d received\n",
-				wrp_msg->msg_type));
-			wrp_free_struct (wrp_msg);
+		rtn = wait_rcv_msg (inst, &raw_msg, min_wait_ms (liveness_wait_ms (inst),
+			libpd_reqs_next_expiry_ms (inst->reqs)), &rcv_err->oserr);
+		rcv_ns = hist_start (inst);
+		if (rtn != 0) {
+			if (RUN_STATE_RUNNING != inst->run_state)
+				break;
+			if (rtn == 1) {	// nothing received in time
+				if ((liveness_wait_ms (inst) == 0) && 
+				    liveness_expired (inst, rcv_err))
+					start_reconnect (inst, false);
+			} else if ((rtn == 2) && take_reconnect_request (inst))
+				start_reconnect (inst, true);
+			else if (rtn < 0)
+				break;
 			continue;
 		}
-		msg_service = strchr (msg_dest, '/');
-		if (NULL == msg_service) {
-			wrp_free_struct (wrp_msg);
+		if (RUN_STATE_RUNNING != inst->run_state) {
+			nn_freemsg (raw_msg.msg);
 			continue;
 		}
-                msg_service++;
-                size_t len = strlen(msg_service);
-                char *tmp = strchr (msg_service, '/');
-                if (NULL != tmp) {
-                    len = (uintptr_t)tmp - (uintptr_t)msg_service;
-                }
-		if (strncmp (msg_service, inst->cfg.service_name, len) != 0) {
-			wrp_free_struct (wrp_msg);
+		liveness_received (inst);
+		STAT_ADD (inst, msgs_received, 1);
+		STAT_ADD (inst, bytes_in, (uint64_t) raw_msg.len);
+		rtn = peek_raw_msg (inst, &raw_msg, &peek, &service);
+		if (rtn == 0) {
+			nn_freemsg (raw_msg.msg);
 			continue;
 		}
-		libpd_log (LEVEL_DEBUG, ("LIBPARODUS: received msg directed to service %s\n",
-			inst->cfg.service_name));
-		libpd_qsend (inst->wrp_queue, (void *) wrp_msg, WRP_QUEUE_SEND_TIMEOUT_MS, 
-			&rcv_err->oserr);
+		if (NULL != inst->decoders)
+			queue_raw_msg (inst, &raw_msg, &peek, rtn, service, rcv_ns);
+		else
+			deliver_raw_msg (inst, &hdr_buf, &raw_msg, rtn, service, rcv_ns);
 	}
+	free (hdr_buf.buf);
 	libpd_log (LEVEL_INFO, ("Ended wrp receiver thread\n"));
 	return NULL;
 }
 
 
 int flush_wrp_queue (libpd_mq_t wrp_queue, uint32_t delay_ms, int *oserr)
+{
+	return flush_wrp_queue__ (wrp_queue, delay_ms, &wrp_free, oserr);
+}
+
+static int flush_wrp_queue__ (libpd_mq_t wrp_queue, uint32_t delay_ms,
+	free_msg_func_t *free_msg_func, int *oserr)
 {
 	wrp_msg_t *wrp_msg = NULL;
+	libpd_qstamp_t stamp;
 	int count = 0;
 	int err;
 
 	while (1) {
-		err = timed_wrp_queue_receive (wrp_queue, &wrp_msg, delay_ms, oserr);
+		err = timed_wrp_queue_receive (wrp_queue, &wrp_msg, &stamp,
+			(uint64_t) delay_ms * NS_PER_MS, oserr);
 		if (err == 1)	// timed out
 			break;
 		if (err != 0)
 			return err;
 		count++;
-		wrp_free (wrp_msg);
+		free_msg_func (wrp_msg);
 	}
 	libpd_log (LEVEL_INFO, ("LIBPARODUS: flushed %d messages out of WRP Queue\n", 
 		count));
@@ -1108,6 +4056,34 @@ int test_send_wrp_queue_ok (libpd_mq_t wrp_queue, int *oserr)
 		WRP_QUEUE_SEND_TIMEOUT_MS, oserr);
 }
 
+void *test_create_zc_pool (void)
+{
+	return (void *) zc_pool_create ();
+}
+
+void test_release_zc_pool (void *pool)
+{
+	zc_pool_release ((zc_pool_t *) pool);
+}
+
+int test_decode_zc_msg (void *pool, void *nn_buf, int len, wrp_msg_t **msg)
+{
+	raw_msg_t raw_msg;
+	decode_buf_t hdr_buf = {NULL, 0};
+	int rtn;
+
+	raw_msg.msg = (char *) nn_buf;
+	raw_msg.len = len;
+	rtn = decode_raw_msg_zc ((zc_pool_t *) pool, &hdr_buf, &raw_msg, msg);
+	free (hdr_buf.buf);
+	return rtn;
+}
+
+void test_free_zc_msg (wrp_msg_t *msg)
+{
+	wrp_free_zc (msg);
+}
+
 int test_close_receiver (libpd_mq_t wrp_queue, int *oserr)
 {
 	return libparodus_close_receiver__ (wrp_queue, oserr);
@@ -1117,7 +4093,21 @@ void test_get_counts (libpd_instance_t instance,
 	int *keep_alive_count, int *reconnect_count)
 {
 	__instance_t *inst = (__instance_t *) instance;
-	*keep_alive_count = inst->keep_alive_count;
-	*reconnect_count = inst->reconnect_count;
+	*keep_alive_count = (int) STAT_GET (inst, keep_alives);
+	*reconnect_count = (int) STAT_GET (inst, reconnects);
+}
+
+// the backoff after attempts failed reconnects, drawn with *seed
+uint32_t test_reconnect_delay_ms (unsigned attempts, unsigned *seed)
+{
+	__instance_t inst;
+	uint32_t delay;
+
+	memset ((void *) &inst, 0, sizeof(inst));
+	inst.reconnect_attempts = attempts;
+	inst.backoff_seed = *seed;
+	delay = reconnect_delay_ms (&inst);
+	*seed = inst.backoff_seed;
+	return delay;
 }
 
@@ -17,6 +17,7 @@
 #ifndef  _LIBPARODUS_H
 #define  _LIBPARODUS_H
 
+#include <stdint.h>
 #include <wrp-c/wrp-c.h>
 #include "libparodus_log.h"
 
@@ -25,6 +26,99 @@
  * to the parodus service.
  */ 
 
+typedef void *libpd_instance_t;
+
+/**
+ * Called from the sender thread when an async send completes.
+ *
+ * @param instance instance object
+ * @param status 0 on success, else LIBPD_ERROR_SEND_SOCKET
+ * @param msg_bytes the encoded wrp message. Only valid during the call.
+ * @param msg_len length of msg_bytes
+ */
+typedef void libpd_send_done_func_t (libpd_instance_t instance, int status,
+	const void *msg_bytes, size_t msg_len);
+
+/**
+ * Called from the receiver thread with each msg received for this service,
+ * when configured as rcv_func.
+ *
+ * @param instance instance object
+ * @param msg the received msg. The callee owns it and must free it
+ *   with libparodus_free_msg.
+ *
+ * @note the receiver thread does nothing else until this returns,
+ * so it should not block. With rcv_decode_threads > 1 it is called from
+ * the decode threads, and may be called for different sources at once.
+ */
+typedef void libpd_rcv_func_t (libpd_instance_t instance, wrp_msg_t *msg);
+
+/**
+ * What the receiver thread does when the receive queue is full.
+ * Used in libpd_cfg_t rcv_queue_overflow.
+ */
+// wait for room, up to 2 seconds, then drop the new msg (default)
+#define LIBPD_RCV_OVERFLOW_BLOCK	0
+// drop the new msg without waiting
+#define LIBPD_RCV_OVERFLOW_DROP_NEWEST	1
+// drop the oldest queued msg to make room
+#define LIBPD_RCV_OVERFLOW_DROP_OLDEST	2
+// drop the oldest queued msg of lower priority than the new msg,
+// else the new msg. Requests rank above CRUD msgs, then events, then others.
+#define LIBPD_RCV_OVERFLOW_DROP_PRIORITY	3
+
+/**
+ * What a send does when the send spool is full.
+ * Used in libpd_cfg_t send_spool_overflow.
+ */
+// fail with LIBPD_ERROR_SEND_SPOOL_FULL (default)
+#define LIBPD_SPOOL_OVERFLOW_DROP_NEWEST	0
+// drop the oldest spooled msgs to make room
+#define LIBPD_SPOOL_OVERFLOW_DROP_OLDEST	1
+
+// Maximum number of receive queue lanes, see rcv_queue_lanes
+#define LIBPD_MAX_RCV_LANES	4
+
+/**
+ * Assigns a received msg to a receive queue lane, 0 being the highest
+ * priority. Called on the receiver thread.
+ */
+typedef unsigned libpd_rcv_lane_func_t (libpd_instance_t instance, 
+	const wrp_msg_t *msg);
+
+/**
+ * State of the receive connection to parodus, passed to conn_func.
+ */
+// lost, and reconnecting. Sends may fail until it is back up.
+#define LIBPD_CONN_DOWN	0
+// reconnected, and registered again
+#define LIBPD_CONN_UP	1
+
+/**
+ * Called from the receiver thread when the receive connection to 
+ * parodus is lost (keepalive timeout, or libparodus_reconnect), and
+ * again when it is back up.
+ *
+ * @param instance instance object
+ * @param state LIBPD_CONN_DOWN or LIBPD_CONN_UP
+ */
+typedef void libpd_conn_func_t (libpd_instance_t instance, int state);
+
+/**
+ * Called once with the outcome of libparodus_request_async, from the 
+ * thread that received the response (the receiver thread, or a decode
+ * thread), or from the receiver thread on timeout, or from the thread
+ * calling libparodus_shutdown.
+ *
+ * @param instance instance object
+ * @param status 0 response received, 1 timed out, 2 instance shut down
+ * @param resp the response when status is 0, else NULL. Free it as a 
+ *   received msg, see libparodus_free_msg.
+ * @param arg arg given to libparodus_request_async
+ */
+typedef void libpd_resp_func_t (libpd_instance_t instance, int status,
+	wrp_msg_t *resp, void *arg);
+
 typedef struct {
 	const char *service_name;
 	bool receive;
@@ -32,9 +126,171 @@ typedef struct {
 	const char *parodus_url;
 	const char *client_url;
 	unsigned test_flags;  // always 0 except when testing
+	// set when only one application thread calls libparodus_receive.
+	// A lock-free receive queue is then used.
+	bool single_receiver;
+	// when > 0, libparodus_send only encodes the message and puts it
+	// on a send queue of this size. A sender thread does the socket send.
+	unsigned async_send_queue_size;
+	// optional, called when each async send completes
+	libpd_send_done_func_t *send_done_func;
+	// when set, the payload of a received msg points into the
+	// socket receive buffer instead of being copied.
+	// Received msgs must then be freed with libparodus_free_msg.
+	bool zero_copy_receive;
+	// when set, libparodus_get_rcv_fd provides an fd that can be
+	// polled for received msgs
+	bool receive_fd;
+	// when set (with receive), received msgs are passed to this function
+	// on the receiver thread instead of being queued for libparodus_receive.
+	// libparodus_receive and libparodus_close_receiver are then not used.
+	libpd_rcv_func_t *rcv_func;
+	// when set, latency histograms are kept. See libparodus_get_latency.
+	bool latency_histograms;
+	// LIBPD_RCV_OVERFLOW_ ... DROP_OLDEST and DROP_PRIORITY can't be 
+	// used with single_receiver.
+	unsigned rcv_queue_overflow;
+	// number of msgs the receive queue holds, 0 for the default of 50
+	unsigned rcv_queue_size;
+	// when > rcv_queue_size, the receive queue grows under load, doubling
+	// up to this many msgs, and shrinks back as it drains.
+	// Can't be used with single_receiver.
+	unsigned rcv_queue_max_size;
+	// when > 0, the receive queue is also full when the queued msgs
+	// would take more than this many bytes (wrp_msg_t plus payload).
+	// Can't be used with single_receiver.
+	size_t rcv_queue_max_bytes;
+	// when > 1, the receive queue has this many priority lanes, up to 
+	// LIBPD_MAX_RCV_LANES, and libparodus_receive takes msgs from lane 0 
+	// first. Can't be used with single_receiver.
+	unsigned rcv_queue_lanes;
+	// when rcv_lane_weights[0] > 0, libparodus_receive takes up to 
+	// rcv_lane_weights[i] msgs from lane i in turn, instead of strictly
+	// by priority.
+	unsigned rcv_lane_weights[LIBPD_MAX_RCV_LANES];
+	// optional. By default requests go in lane 0, CRUD msgs in lane 1,
+	// events in lane 2 and other msgs in lane 3, or the last lane.
+	libpd_rcv_lane_func_t *rcv_lane_func;
+	// optional NULL terminated list of more service names registered 
+	// by this instance, sharing its sockets and receiver thread.
+	// Each has its own receive queue, read with libparodus_receive_service,
+	// unless rcv_func is set. The names must stay valid until shutdown.
+	const char **extra_services;
+	// when > 0 (with receive), this many decode threads convert received
+	// msgs to wrp_msg_t, while the receiver thread only reads the socket
+	// and routes. Msgs from the same source are decoded by the same 
+	// thread, so they are delivered in order. A msg whose decode thread 
+	// is too far behind is dropped, and counted in drops_decode_queue.
+	unsigned rcv_decode_threads;
+	// optional, called when the receive connection goes down or up
+	libpd_conn_func_t *conn_func;
+	// when > 0 (with keepalive_timeout_secs), nothing received for
+	// keepalive_timeout_secs only makes the connection suspect, and it is
+	// reconnected when still nothing is received for this many more secs.
+	int liveness_grace_secs;
+	// when set (with liveness_grace_secs), the registration msg is sent
+	// again when the connection becomes suspect. Parodus answers it.
+	// A probe parodus can not take at once is counted in
+	// liveness_probe_errors, and not retried.
+	bool liveness_probe;
+	// msecs a send may wait for parodus to take a msg, 0 for the 
+	// default of 2000. libparodus_send_timed sets its own limit.
+	unsigned send_timeout_ms;
+	// optional file for a send spool. When set, a msg that parodus does
+	// not take within a few msecs is appended to the spool instead, and 
+	// so is every msg sent while the spool is not empty. A spool thread
+	// sends the spooled msgs in order once parodus takes them again.
+	// Msgs still spooled at shutdown are sent after the next init.
+	// Without an async send queue, libparodus_send_timed does not spool.
+	const char *send_spool_path;
+	// size of the send spool file, 0 for the default of 1 MB
+	size_t send_spool_max_bytes;
+	// LIBPD_SPOOL_OVERFLOW_ ...
+	unsigned send_spool_overflow;
 } libpd_cfg_t;
 
-typedef void *libpd_instance_t;
+/**
+ * Runtime statistics of an instance, returned by libparodus_get_stats.
+ * All counts are totals since libparodus_init.
+ */
+typedef struct {
+	uint64_t msgs_received;	// msgs read from the receive socket
+	uint64_t msgs_decoded;	// msgs converted to wrp_msg_t
+	uint64_t msgs_delivered;	// msgs queued for receive, or passed to rcv_func
+	uint64_t drops_decode;	// msgs dropped because they could not be decoded
+	uint64_t drops_service;	// msgs dropped because they are for another service
+	uint64_t drops_queue_full;	// new msgs dropped because the receive queue was full
+	uint64_t drops_queue_oldest;	// queued msgs dropped by LIBPD_RCV_OVERFLOW_DROP_OLDEST
+	uint64_t drops_queue_priority;	// queued msgs dropped by LIBPD_RCV_OVERFLOW_DROP_PRIORITY
+	uint64_t bytes_in;	// bytes read from the receive socket
+	uint64_t bytes_out;	// bytes written to the send socket
+	uint64_t msgs_sent;	// msgs written to the send socket
+	uint64_t send_errors_encode;	// sends failed converting the wrp msg
+	uint64_t send_errors_socket;	// sends failed on the socket
+	uint64_t send_errors_queue_full;	// sends failed because the async send queue was full
+	uint32_t rcv_queue_depth;	// msgs currently on the receive queues
+	uint32_t rcv_queue_high_water;	// most msgs ever on one receive queue
+	uint32_t rcv_queue_capacity;	// msgs the receive queues can hold now
+	uint32_t keep_alives;	// keep alive msgs received
+	uint32_t reconnects;	// receive socket reconnects
+	uint64_t reconnect_ms;	// total time spent reconnecting
+	uint32_t liveness_probes;	// probes sent to a suspect connection
+	uint64_t responses;	// responses passed to libparodus_request callers
+	uint32_t request_timeouts;	// libparodus_request calls that timed out
+	uint64_t send_errors_timeout;	// sends failed because the send timeout passed
+	uint64_t spooled;	// msgs appended to the send spool
+	uint64_t spool_replays;	// spooled msgs sent by the spool thread
+	uint64_t spool_drops;	// msgs dropped because the send spool was full
+	uint32_t spool_depth;	// msgs currently in the send spool
+	uint64_t drops_decode_queue;	// msgs dropped because a decode thread queue was full
+	uint64_t spool_replay_errors;	// spooled msg sends that failed, to be retried
+	uint32_t liveness_probe_errors;	// probes that could not be sent at once
+} libpd_stats_t;
+
+/**
+ * Liveness of the receive connection, in libpd_liveness_t state
+ */
+// something received within keepalive_timeout_secs
+#define LIBPD_LIVENESS_ALIVE	0
+// nothing received for keepalive_timeout_secs, in liveness_grace_secs
+#define LIBPD_LIVENESS_SUSPECT	1
+// reconnecting
+#define LIBPD_LIVENESS_DOWN	2
+
+/**
+ * Liveness of the receive connection, returned by libparodus_get_liveness
+ */
+typedef struct {
+	int state;	// LIBPD_LIVENESS_ALIVE, SUSPECT or DOWN
+	uint64_t idle_ms;	// since any msg was last received from parodus
+} libpd_liveness_t;
+
+/**
+ * Latency histograms, kept when latency_histograms is configured
+ */
+typedef enum {
+	LIBPD_HIST_ENCODE = 0,	// converting a wrp msg for libparodus_send
+	LIBPD_HIST_SEND,	// socket send
+	LIBPD_HIST_RCV_QUEUE,	// time a received msg waits on the receive queue
+	LIBPD_HIST_RCV_LATENCY,	// socket receive until taken by libparodus_receive,
+				// or passed to rcv_func
+	LIBPD_NUM_HISTS
+} libpd_hist_id_t;
+
+/**
+ * Latency summary of one histogram, returned by libparodus_get_latency.
+ * Percentiles are accurate to about 6%.
+ */
+typedef struct {
+	uint64_t count;	// number of times recorded
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t mean_ns;
+	uint64_t p50_ns;
+	uint64_t p90_ns;
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+} libpd_latency_t;
 
 
 /** 
@@ -72,6 +328,16 @@ typedef enum {
 	 * error sending registration msg
 	 */
 	LIBPD_ERROR_INIT_REGISTER = -106,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error creating wrp sender thread
+	 */
+	LIBPD_ERROR_INIT_SEND_THREAD = -107,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error opening the send spool or creating its thread
+	 */
+	LIBPD_ERROR_INIT_SPOOL = -108,
 	/** 
 	 * @brief Error on libparodus_receive
 	 * null instance given
@@ -97,6 +363,11 @@ typedef enum {
 	 * thread limit exceeded
 	 */
 	LIBPD_ERROR_RCV_THR_LIMIT = -205,
+	/** 
+	 * @brief Error on libparodus_receive_service
+	 * service name not registered by this instance
+	 */
+	LIBPD_ERROR_RCV_SERVICE = -206,
 	/** 
 	 * @brief Error on libparodus_close_receiver
 	 * null instance given
@@ -151,7 +422,67 @@ typedef enum {
 	 * @brief Error on libparodus_send
 	 * thread limit exceeded
 	 */
-	LIBPD_ERROR_SEND_THR_LIMIT = -405
+	LIBPD_ERROR_SEND_THR_LIMIT = -405,
+	/** 
+	 * @brief Error on libparodus_send
+	 * async send queue full
+	 */
+	LIBPD_ERROR_SEND_QUEUE_FULL = -406,
+	/** 
+	 * @brief Error on libparodus_send_timed
+	 * the msg could not be sent within the timeout
+	 */
+	LIBPD_ERROR_SEND_WOULD_BLOCK = -407,
+	/** 
+	 * @brief Error on libparodus_send
+	 * parodus is not taking msgs and the send spool is full
+	 */
+	LIBPD_ERROR_SEND_SPOOL_FULL = -408,
+	/** 
+	 * @brief Error on libparodus_get_stats
+	 * null instance given
+	 */
+	LIBPD_ERROR_STATS_NULL_INST = -501,
+	/** 
+	 * @brief Error on libparodus_get_latency
+	 * latency_histograms not configured, or invalid histogram
+	 */
+	LIBPD_ERROR_STATS_CFG = -502,
+	/** 
+	 * @brief Error on libparodus_request
+	 * null instance given
+	 */
+	LIBPD_ERROR_REQ_NULL_INST = -601,
+	/** 
+	 * @brief Error on libparodus_request
+	 * run state error
+	 */
+	LIBPD_ERROR_REQ_STATE = -602,
+	/** 
+	 * @brief Error on libparodus_request
+	 * not configured for receive
+	 */
+	LIBPD_ERROR_REQ_CFG = -603,
+	/** 
+	 * @brief Error on libparodus_request
+	 * not a REQ or CRUD msg with a transaction_uuid, or no resp_func
+	 */
+	LIBPD_ERROR_REQ_WRP_MSG = -604,
+	/** 
+	 * @brief Error on libparodus_request
+	 * a request with the same transaction_uuid is already waiting
+	 */
+	LIBPD_ERROR_REQ_DUP_ID = -605,
+	/** 
+	 * @brief Error on libparodus_request
+	 * unable to allocate request
+	 */
+	LIBPD_ERROR_REQ_ALLOC = -606,
+	/** 
+	 * @brief Error on libparodus_request
+	 * send error
+	 */
+	LIBPD_ERROR_REQ_SEND = -607
 } libpd_error_t;
 
 /**
@@ -167,6 +498,8 @@ typedef enum {
  *		LIBPD_ERROR_INIT_RCV_THREAD = -104, error creating wrp receiver thread
  *		LIBPD_ERROR_INIT_QUEUE = -105, error creating wrp msg receive queue
  *		LIBPD_ERROR_INIT_REGISTER = -106, error sending registration msg
+ *		LIBPD_ERROR_INIT_SEND_THREAD = -107, error creating wrp sender thread
+ *		LIBPD_ERROR_INIT_SPOOL = -108, error opening send spool
  *
  * @note libparodus_shutdown must be called even if there is an error
  * on libparodus_init   
@@ -187,15 +520,124 @@ int libparodus_init (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg);
  *  @return 0 on success, 2 if closed msg received, 1 if timed out, else:
  *		LIBPD_ERROR_RCV_NULL_INST = -201, null instance given
  *		LIBPD_ERROR_RCV_STATE = -202, run state error, not running
- *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive
+ *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive, or rcv_func set
  *		LIBPD_ERROR_RCV_RCV = -204, receive error
  *
  *  @note don't free the msg when return is 2. 
+ *  @note when zero_copy_receive is configured, free the msg with
+ *  libparodus_free_msg, not wrp_free_struct.
  */
 int libparodus_receive (libpd_instance_t instance, wrp_msg_t **msg, uint32_t ms);
 
 /**
- * Sends a close message to the receiver
+ *  Same as libparodus_receive, except the timeout is in nanoseconds.
+ *
+ *  Timeouts are measured on the monotonic clock, so setting the time
+ *  of day doesn't lengthen or shorten the wait.
+ *
+ *  @param instance instance object
+ *  @param msg the pointer to receive the next msg struct
+ *  @param ns the number of nanoseconds to wait for the next message
+ *
+ *  @return same as libparodus_receive
+ */
+int libparodus_receive_ns (libpd_instance_t instance, wrp_msg_t **msg, uint64_t ns);
+
+/**
+ *  Receives up to max_msgs messages that were sent to this service, waiting
+ *  the prescribed number of milliseconds for the first one. All messages
+ *  already queued (up to max_msgs) are taken at once.
+ *
+ *  @param instance instance object
+ *  @param msgs array of at least max_msgs pointers to receive the msg structs
+ *  @param max_msgs maximum number of messages to receive
+ *  @param ms the number of milliseconds to wait for the first message
+ *  @param count the number of messages placed in msgs
+ *
+ *  @return 0 on success, 2 if closed msg received, 1 if timed out, else:
+ *		LIBPD_ERROR_RCV_NULL_INST = -201, null instance given
+ *		LIBPD_ERROR_RCV_STATE = -202, run state error, not running
+ *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive
+ *		LIBPD_ERROR_RCV_RCV = -204, receive error
+ *
+ *  @note when the return is 2, the count messages received ahead of 
+ *  the close are still returned in msgs and must be freed.
+ */
+int libparodus_receive_batch (libpd_instance_t instance, wrp_msg_t **msgs, 
+	size_t max_msgs, uint32_t ms, size_t *count);
+
+/**
+ *  Get an fd that polls readable (select, poll or epoll) while received 
+ *  msgs are waiting. Requires the receive_fd config option.
+ *  When it is readable, libparodus_receive with a 0 timeout will
+ *  not block. Don't read from or close the fd.
+ *
+ *  @param instance instance object
+ *
+ *  @return the fd, else:
+ *		LIBPD_ERROR_RCV_NULL_INST = -201, null instance given
+ *		LIBPD_ERROR_RCV_STATE = -202, run state error, not running
+ *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive or receive_fd
+ */
+int libparodus_get_rcv_fd (libpd_instance_t instance);
+
+/**
+ *  Drops the receive connection to parodus and reconnects at once,
+ *  for example after parodus restarts. When a reconnect is already
+ *  waiting out its backoff, it retries at once instead.
+ *
+ *  @param instance instance object
+ *
+ *  @return 0 on success, else:
+ *		LIBPD_ERROR_RCV_NULL_INST = -201, null instance given
+ *		LIBPD_ERROR_RCV_STATE = -202, run state error, not running
+ *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive
+ */
+int libparodus_reconnect (libpd_instance_t instance);
+
+/**
+ *  Get the liveness of the receive connection to parodus.
+ *  May be called from any thread while the instance runs.
+ *
+ *  @param instance instance object
+ *  @param liveness the liveness is copied here
+ *
+ *  @return 0 on success, else:
+ *		LIBPD_ERROR_RCV_NULL_INST = -201, null instance given
+ *		LIBPD_ERROR_RCV_STATE = -202, run state error, not running
+ *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive
+ */
+int libparodus_get_liveness (libpd_instance_t instance, 
+	libpd_liveness_t *liveness);
+
+/**
+ *  Frees a msg received by libparodus_receive or libparodus_receive_batch.
+ *  Required when zero_copy_receive is configured, otherwise the
+ *  same as wrp_free_struct.
+ *
+ *  @param instance instance object the msg was received on
+ *  @param msg the msg to free
+ */
+void libparodus_free_msg (libpd_instance_t instance, wrp_msg_t *msg);
+
+/**
+ *  Same as libparodus_receive, for one of the service names of the
+ *  instance, service_name or one of extra_services.
+ *
+ *  @param instance instance object
+ *  @param service_name the service to receive msgs for
+ *  @param msg the pointer to receive the next msg struct
+ *  @param ms the number of milliseconds to wait for the next message
+ *
+ *  @return same as libparodus_receive, or
+ *		LIBPD_ERROR_RCV_SERVICE = -206, service_name not registered
+ */
+int libparodus_receive_service (libpd_instance_t instance, 
+	const char *service_name, wrp_msg_t **msg, uint32_t ms);
+
+/**
+ * Sends a close message to the receiver, and to the receivers of
+ * any extra_services
  *
  *  @param instance instance object
  *  @return 0 on success,  else:
@@ -223,13 +665,216 @@ int libparodus_shutdown (libpd_instance_t *instance);
  * @param msg wrp message to send
  *
  * @return 0 on success, else:
- *		LIBPD_ERROR_SEND_NULL_INST = -501, null instance given
- *		LIBPD_ERROR_SEND_STATE = -502, run state error, not running
- *		LIBPD_ERROR_SEND_WRP_MSG = -503, invalid wrp message
- *		LIBPD_ERROR_SEND_SOCKET = -504, socket send error
+ *		LIBPD_ERROR_SEND_NULL_INST = -401, null instance given
+ *		LIBPD_ERROR_SEND_STATE = -402, run state error, not running
+ *		LIBPD_ERROR_SEND_WRP_MSG = -403, invalid wrp message
+ *		LIBPD_ERROR_SEND_SOCKET = -404, socket send error
+ *		LIBPD_ERROR_SEND_QUEUE_FULL = -406, async send queue full
+ *		LIBPD_ERROR_SEND_SPOOL_FULL = -408, send spool full
+ *
+ * @note when async_send_queue_size is configured, a 0 return only means
+ * the msg was queued. The outcome is reported to send_done_func.
+ * The msg may be freed as soon as libparodus_send returns.
+ * When send_spool_path is configured, a 0 return may mean the msg was 
+ * spooled, to be sent later.
  */
 int libparodus_send (libpd_instance_t instance, wrp_msg_t *msg);
 
+/**
+ * Send a wrp message to the parodus service, waiting at most timeout_ms
+ * for another send in progress and for parodus to take the msg.
+ *
+ * @param instance instance object
+ * @param msg wrp message to send
+ * @param timeout_ms the maximum number of milliseconds to wait. 
+ * 0 never waits.
+ *
+ * @return 0 on success, else the same errors as libparodus_send, or
+ *		LIBPD_ERROR_SEND_WOULD_BLOCK = -407, not sent within timeout_ms
+ *
+ * @note when async_send_queue_size is configured, timeout_ms is how
+ * long to wait while the send queue is full, and 
+ * LIBPD_ERROR_SEND_WOULD_BLOCK is returned when it stays full.
+ * Otherwise the send spool is not used: LIBPD_ERROR_SEND_WOULD_BLOCK is
+ * returned even when send_spool_path is configured, and the msg may be
+ * sent ahead of msgs still spooled.
+ */
+int libparodus_send_timed (libpd_instance_t instance, wrp_msg_t *msg,
+	uint32_t timeout_ms);
+
+/**
+ * Send an already encoded wrp message to the parodus service, as made
+ * by wrp_struct_to or libparodus_template_encode
+ *
+ * @param instance instance object
+ * @param msg_bytes encoded wrp message
+ * @param msg_len length of msg_bytes
+ *
+ * @return 0 on success, else the same errors as libparodus_send.
+ *		LIBPD_ERROR_SEND_WRP_MSG = -403 if the bytes are not a wrp msg
+ *
+ * @note when async_send_queue_size is configured, the bytes are copied
+ * to the send queue.
+ */
+int libparodus_send_bytes (libpd_instance_t instance, const void *msg_bytes,
+	size_t msg_len);
+
+/**
+ * Send several wrp messages to the parodus service, in order.
+ * The msgs are encoded and sent in chunks, each under one lock,
+ * instead of locking for every msg. Most msgs are encoded back to back 
+ * into one buffer, kept by the instance for the next batch.
+ *
+ * @param instance instance object
+ * @param msgs wrp messages to send
+ * @param n number of msgs
+ * @param sent set to the number of msgs sent (or queued) before any
+ * error. May be NULL.
+ *
+ * @return 0 on success, else the same errors as libparodus_send,
+ * for the first msg that was not sent
+ *
+ * @note when async_send_queue_size is configured, each msg is queued
+ * and reported to send_done_func as for libparodus_send. If the queue
+ * fills, LIBPD_ERROR_SEND_QUEUE_FULL is returned and the rest of the
+ * batch may be sent again from msgs[*sent].
+ */
+int libparodus_send_batch (libpd_instance_t instance, wrp_msg_t **msgs,
+	size_t n, size_t *sent);
+
+/**
+ * A wrp msg encoded once, then encoded again for each send with only
+ * its transaction_uuid and payload replaced
+ */
+typedef struct libpd_wrp_template libpd_wrp_template_t;
+
+/**
+ * Create a template from a REQ, EVENT or CRUD msg. Its transaction_uuid 
+ * and payload are ignored. Everything else, such as source, dest,
+ * content_type and headers, is encoded once.
+ *
+ * @param msg the msg
+ *
+ * @return the template, or NULL if the msg can't be encoded or has no payload
+ */
+libpd_wrp_template_t *libparodus_template_create (const wrp_msg_t *msg);
+
+/**
+ * Encode a msg from a template, for libparodus_send_bytes.
+ * May be called from many threads at once.
+ *
+ * @param tmpl the template
+ * @param transaction_uuid of the msg. Ignored for an event.
+ * @param payload of the msg
+ * @param payload_size of the payload
+ * @param msg_bytes set to the encoded msg, to be freed with free
+ *
+ * @return length of the encoded msg, or -1 if out of memory or no 
+ * transaction_uuid given for a REQ or CRUD template
+ */
+ssize_t libparodus_template_encode (const libpd_wrp_template_t *tmpl,
+	const char *transaction_uuid, const void *payload, size_t payload_size,
+	void **msg_bytes);
+
+/**
+ * Destroy a template
+ *
+ * @param tmpl the template, may be NULL
+ */
+void libparodus_template_destroy (libpd_wrp_template_t *tmpl);
+
+/**
+ * Wait until all async sends queued so far have completed
+ *
+ * @param instance instance object
+ * @param ms the maximum number of milliseconds to wait
+ *
+ * @return 0 on success, 1 if timed out, else:
+ *		LIBPD_ERROR_SEND_NULL_INST = -401, null instance given
+ *		LIBPD_ERROR_SEND_STATE = -402, run state error, not running
+ *		LIBPD_ERROR_SEND_SOCKET = -404, error waiting
+ *
+ * @note returns 0 immediately if async sends are not configured.
+ */
+int libparodus_send_flush (libpd_instance_t instance, uint32_t ms);
+
+/**
+ * Send a request and wait for its response, the msg received with the
+ * same transaction_uuid. Any number of threads may have requests 
+ * waiting at once. The response is not queued for libparodus_receive
+ * or passed to rcv_func. A response that comes after the timeout is.
+ *
+ * Requires the receive config option. The source of the request must 
+ * name a service of the instance, so that parodus routes the response
+ * back to it.
+ *
+ * @param instance instance object
+ * @param req REQ or CRUD msg with a transaction_uuid
+ * @param resp set to the response, or NULL if none
+ * @param timeout_ms the maximum number of milliseconds to wait
+ *
+ * @return 0 on success, 1 if timed out, 2 if shut down while waiting, else:
+ *		LIBPD_ERROR_REQ_NULL_INST = -601, null instance given
+ *		LIBPD_ERROR_REQ_STATE = -602, run state error, not running
+ *		LIBPD_ERROR_REQ_CFG = -603, not configured for receive
+ *		LIBPD_ERROR_REQ_WRP_MSG = -604, invalid request msg
+ *		LIBPD_ERROR_REQ_DUP_ID = -605, transaction_uuid already waiting
+ *		LIBPD_ERROR_REQ_ALLOC = -606, unable to allocate request
+ *		LIBPD_ERROR_REQ_SEND = -607, send error
+ *
+ * @note free the response as a received msg, see libparodus_free_msg.
+ */
+int libparodus_request (libpd_instance_t instance, wrp_msg_t *req,
+	wrp_msg_t **resp, uint32_t timeout_ms);
+
+/**
+ * Send a request without waiting. resp_func is called once with the
+ * response, or when timeout_ms passes without one.
+ *
+ * @param instance instance object
+ * @param req REQ or CRUD msg with a transaction_uuid
+ * @param resp_func called with the outcome
+ * @param arg passed to resp_func
+ * @param timeout_ms the maximum number of milliseconds to wait for the 
+ *   response, to within about 10 ms
+ *
+ * @return 0 if sent, else the same errors as libparodus_request.
+ *   resp_func is only called when 0 is returned.
+ */
+int libparodus_request_async (libpd_instance_t instance, wrp_msg_t *req,
+	libpd_resp_func_t *resp_func, void *arg, uint32_t timeout_ms);
+
+/**
+ * Get the runtime statistics of an instance
+ *
+ * The counters are kept while the instance runs, and may be read 
+ * from any thread.
+ *
+ * @param instance instance object
+ * @param stats the statistics are copied here
+ *
+ * @return 0 on success, else:
+ *		LIBPD_ERROR_STATS_NULL_INST = -501, null instance given
+ */
+int libparodus_get_stats (libpd_instance_t instance, libpd_stats_t *stats);
+
+/**
+ * Get the latency summary of one histogram
+ *
+ * May be called from any thread while the instance runs.
+ *
+ * @param instance instance object
+ * @param hist which histogram
+ * @param latency the summary is copied here
+ *
+ * @return 0 on success, else:
+ *		LIBPD_ERROR_STATS_NULL_INST = -501, null instance given
+ *		LIBPD_ERROR_STATS_CFG = -502, latency_histograms not configured,
+ *		or invalid hist
+ */
+int libparodus_get_latency (libpd_instance_t instance, libpd_hist_id_t hist,
+	libpd_latency_t *latency);
+
 /**
  * Return the string value of a libparodus error code
  *
@@ -0,0 +1,137 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "libparodus_hist.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define SUB_BITS	4
+#define SUB_COUNT	(1u << SUB_BITS)
+#define MAX_BITS	40
+#define MAX_VALUE	((1ULL << MAX_BITS) - 1)
+// values below SUB_COUNT each get a bucket, then SUB_COUNT 
+// buckets for each power of 2 up to 2^MAX_BITS
+#define NUM_BUCKETS	((MAX_BITS - SUB_BITS + 1) * SUB_COUNT)
+
+struct libpd_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[NUM_BUCKETS];
+};
+
+static unsigned bucket_index (uint64_t value)
+{
+	unsigned msb;
+
+	if (value < SUB_COUNT)
+		return (unsigned) value;
+	msb = 63 - (unsigned) __builtin_clzll (value);
+	return ((msb - SUB_BITS + 1) * SUB_COUNT) 
+		+ (unsigned) ((value >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+// highest value that falls in the bucket
+static uint64_t bucket_value (unsigned index)
+{
+	unsigned shift;
+
+	if (index < SUB_COUNT)
+		return index;
+	shift = (index / SUB_COUNT) - 1;
+	return ((uint64_t) (SUB_COUNT + (index % SUB_COUNT) + 1) << shift) - 1;
+}
+
+libpd_hist_t *libpd_hist_create (void)
+{
+	libpd_hist_t *hist = (libpd_hist_t *) malloc (sizeof(libpd_hist_t));
+
+	if (NULL == hist)
+		return NULL;
+	memset ((void *) hist, 0, sizeof(libpd_hist_t));
+	hist->min = UINT64_MAX;
+	return hist;
+}
+
+void libpd_hist_destroy (libpd_hist_t *hist)
+{
+	free (hist);
+}
+
+void libpd_hist_record (libpd_hist_t *hist, uint64_t value)
+{
+	uint64_t old;
+
+	if (value > MAX_VALUE)
+		value = MAX_VALUE;
+	__atomic_add_fetch (&hist->buckets[bucket_index (value)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&hist->sum, value, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&hist->count, 1, __ATOMIC_RELAXED);
+	old = __atomic_load_n (&hist->min, __ATOMIC_RELAXED);
+	while ((value < old) && !__atomic_compare_exchange_n (&hist->min, &old, value,
+			true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	old = __atomic_load_n (&hist->max, __ATOMIC_RELAXED);
+	while ((value > old) && !__atomic_compare_exchange_n (&hist->max, &old, value,
+			true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void libpd_hist_read (libpd_hist_t *hist, libpd_hist_summary_t *summary,
+	const double *pcts, uint64_t *values, unsigned num_pcts)
+{
+	uint64_t buckets[NUM_BUCKETS];
+	uint64_t total = 0, target, seen;
+	double rank;
+	unsigned i, p;
+
+	// total comes from the snapshot, not hist->count, so the 
+	// percentiles agree with the buckets they are read from
+	for (i=0; i<NUM_BUCKETS; i++) {
+		buckets[i] = __atomic_load_n (&hist->buckets[i], __ATOMIC_RELAXED);
+		total += buckets[i];
+	}
+	memset ((void *) summary, 0, sizeof(libpd_hist_summary_t));
+	memset ((void *) values, 0, num_pcts * sizeof(uint64_t));
+	if (0 == total)
+		return;
+	summary->count = total;
+	summary->min = __atomic_load_n (&hist->min, __ATOMIC_RELAXED);
+	summary->max = __atomic_load_n (&hist->max, __ATOMIC_RELAXED);
+	summary->mean = __atomic_load_n (&hist->sum, __ATOMIC_RELAXED) / total;
+	for (p=0; p<num_pcts; p++) {
+		rank = (pcts[p] / 100.0) * (double) total;
+		target = (uint64_t) rank;
+		if ((double) target < rank)
+			target++;
+		if (target < 1)
+			target = 1;
+		if (target > total)
+			target = total;
+		seen = 0;
+		for (i=0; i<NUM_BUCKETS; i++) {
+			seen += buckets[i];
+			if (seen >= target)
+				break;
+		}
+		values[p] = bucket_value (i);
+		if (values[p] > summary->max)
+			values[p] = summary->max;
+	}
+}
@@ -0,0 +1,79 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_HIST_H
+#define  _LIBPARODUS_HIST_H
+
+#include <stdint.h>
+
+/**
+ * Log-linear latency histogram.
+ * Each power of 2 range is split into 16 linear buckets, so a recorded
+ * value is reported within about 6%. Recording is lock-free and may be
+ * done from any number of threads while the histogram is being read.
+ * Values of 2^40 (about 18 minutes in ns) and over are recorded as 2^40-1.
+ */
+typedef struct libpd_hist libpd_hist_t;
+
+/**
+ * Create a histogram
+ *
+ * @return the histogram, or NULL if out of memory
+ */
+libpd_hist_t *libpd_hist_create (void);
+
+/**
+ * Destroy a histogram
+ *
+ * @param hist  histogram, may be NULL
+ */
+void libpd_hist_destroy (libpd_hist_t *hist);
+
+/**
+ * Record a value
+ *
+ * @param hist  histogram
+ * @param value  value to record
+ */
+void libpd_hist_record (libpd_hist_t *hist, uint64_t value);
+
+/**
+ * Summary of the values recorded
+ */
+typedef struct {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t mean;
+} libpd_hist_summary_t;
+
+/**
+ * Get the count, min, max and mean of the values recorded,
+ * and the values at a set of percentiles
+ *
+ * The percentiles are read from one snapshot of the buckets, and each
+ * is the highest value of its bucket, capped at max.
+ *
+ * @param hist  histogram
+ * @param summary  receives count, min, max and mean. All 0 if empty.
+ * @param pcts  percentiles wanted, each from 0.0 to 100.0
+ * @param values  receives the value at each percentile
+ * @param num_pcts  number of entries in pcts and values
+ */
+void libpd_hist_read (libpd_hist_t *hist, libpd_hist_summary_t *summary,
+	const double *pcts, uint64_t *values, unsigned num_pcts);
+
+#endif
@@ -0,0 +1,475 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "libparodus_msgpack.h"
+#include <string.h>
+
+// arrays and maps nested deeper than this are treated as malformed
+#define MAX_NESTING	32
+
+static uint32_t get_be (const uint8_t *p, unsigned nbytes)
+{
+	uint32_t v = 0;
+	unsigned i;
+
+	for (i=0; i<nbytes; i++)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+// reads the header of a str or bin object
+static int read_str (const uint8_t **p, const uint8_t *end,
+	const char **str, size_t *str_len)
+{
+	const uint8_t *s = *p;
+	unsigned hdr_len;
+	size_t n;
+
+	if (s >= end)
+		return -1;
+	if ((s[0] & 0xE0) == 0xA0) {	// fixstr
+		hdr_len = 1;
+		n = s[0] & 0x1F;
+	} else if (s[0] == 0xD9 || s[0] == 0xC4) {
+		hdr_len = 2;
+	} else if (s[0] == 0xDA || s[0] == 0xC5) {
+		hdr_len = 3;
+	} else if (s[0] == 0xDB || s[0] == 0xC6) {
+		hdr_len = 5;
+	} else {
+		return -1;
+	}
+	if ((size_t) (end - s) < hdr_len)
+		return -1;
+	if (hdr_len > 1)
+		n = get_be (s+1, hdr_len-1);
+	if ((size_t) (end - s) - hdr_len < n)
+		return -1;
+	*str = (const char *) (s + hdr_len);
+	*str_len = n;
+	*p = s + hdr_len + n;
+	return 0;
+}
+
+// reads an integer object that fits in an int
+static int read_int (const uint8_t **p, const uint8_t *end, int *val)
+{
+	const uint8_t *s = *p;
+	unsigned nbytes;
+	uint32_t v;
+
+	if (s >= end)
+		return -1;
+	if (s[0] <= 0x7F) {
+		*val = s[0];
+		*p = s + 1;
+		return 0;
+	}
+	if (s[0] >= 0xE0) {	// negative fixint
+		*val = (int) (int8_t) s[0];
+		*p = s + 1;
+		return 0;
+	}
+	switch (s[0]) {
+		case 0xCC: case 0xD0: nbytes = 1; break;
+		case 0xCD: case 0xD1: nbytes = 2; break;
+		case 0xCE: case 0xD2: nbytes = 4; break;
+		default: return -1;
+	}
+	if ((size_t) (end - s) < nbytes + 1)
+		return -1;
+	v = get_be (s+1, nbytes);
+	if (s[0] == 0xD0)
+		*val = (int8_t) v;
+	else if (s[0] == 0xD1)
+		*val = (int16_t) v;
+	else if (v > INT32_MAX && s[0] == 0xCE)
+		return -1;
+	else
+		*val = (int) v;
+	*p = s + 1 + nbytes;
+	return 0;
+}
+
+// reads the header of a map object
+static int read_map_size (const uint8_t **p, const uint8_t *end, uint32_t *count)
+{
+	const uint8_t *s = *p;
+
+	if (s >= end)
+		return -1;
+	if ((s[0] & 0xF0) == 0x80) {
+		*count = s[0] & 0x0F;
+		*p = s + 1;
+		return 0;
+	}
+	if (s[0] == 0xDE && end - s >= 3) {
+		*count = get_be (s+1, 2);
+		*p = s + 3;
+		return 0;
+	}
+	if (s[0] == 0xDF && end - s >= 5) {
+		*count = get_be (s+1, 4);
+		*p = s + 5;
+		return 0;
+	}
+	return -1;
+}
+
+static int skip (const uint8_t **p, const uint8_t *end, int depth)
+{
+	const uint8_t *s = *p;
+	uint8_t c;
+	size_t n = 0;		// bytes of data after the header
+	uint64_t count = 0;	// nested objects after the header
+	unsigned hdr_len = 1;
+
+	if (s >= end || depth > MAX_NESTING)
+		return -1;
+	c = s[0];
+	if (c <= 0x7F || c >= 0xE0 || c == 0xC0 || c == 0xC2 || c == 0xC3) {
+		;
+	} else if ((c & 0xE0) == 0xA0) {
+		n = c & 0x1F;
+	} else if ((c & 0xF0) == 0x90) {
+		count = c & 0x0F;
+	} else if ((c & 0xF0) == 0x80) {
+		count = 2 * (uint32_t) (c & 0x0F);
+	} else {
+		switch (c) {
+			case 0xCC: case 0xD0: n = 1; break;
+			case 0xCD: case 0xD1: n = 2; break;
+			case 0xCA: case 0xCE: case 0xD2: n = 4; break;
+			case 0xCB: case 0xCF: case 0xD3: n = 8; break;
+			case 0xD4: n = 2; break;	// fixext, including type byte
+			case 0xD5: n = 3; break;
+			case 0xD6: n = 5; break;
+			case 0xD7: n = 9; break;
+			case 0xD8: n = 17; break;
+			case 0xC4: case 0xD9: hdr_len = 2; break;
+			case 0xC5: case 0xDA: hdr_len = 3; break;
+			case 0xC6: case 0xDB: hdr_len = 5; break;
+			case 0xC7: hdr_len = 2; n = 1; break;	// ext, plus type byte
+			case 0xC8: hdr_len = 3; n = 1; break;
+			case 0xC9: hdr_len = 5; n = 1; break;
+			case 0xDC: case 0xDE: hdr_len = 3; break;
+			case 0xDD: case 0xDF: hdr_len = 5; break;
+			default: return -1;
+		}
+		if ((size_t) (end - s) < hdr_len)
+			return -1;
+		if (hdr_len > 1) {
+			uint32_t v = get_be (s+1, hdr_len-1);
+			if (c == 0xDC || c == 0xDD)
+				count = v;
+			else if (c == 0xDE || c == 0xDF)
+				count = 2 * (uint64_t) v;
+			else
+				n += v;
+		}
+	}
+	if ((size_t) (end - s) - hdr_len < n)
+		return -1;
+	s += hdr_len + n;
+	while (count > 0) {
+		if (skip (&s, end, depth+1) != 0)
+			return -1;
+		count--;
+	}
+	*p = s;
+	return 0;
+}
+
+int libpd_mp_skip (const uint8_t **p, const uint8_t *end)
+{
+	return skip (p, end, 0);
+}
+
+int libpd_mp_read_str (const uint8_t **p, const uint8_t *end,
+	const char **str, size_t *str_len)
+{
+	return read_str (p, end, str, str_len);
+}
+
+static bool key_is (const char *key, size_t key_len, const char *name)
+{
+	return (strlen (name) == key_len) && (memcmp (key, name, key_len) == 0);
+}
+
+int libpd_mp_find_key (const void *bytes, size_t len, const char *key,
+	const uint8_t **val, size_t *val_len)
+{
+	const uint8_t *p = (const uint8_t *) bytes;
+	const uint8_t *end = p + len;
+	const uint8_t *v;
+	const char *k;
+	size_t k_len;
+	uint32_t count;
+
+	if (read_map_size (&p, end, &count) != 0)
+		return -1;
+	while (count > 0) {
+		if (read_str (&p, end, &k, &k_len) != 0)
+			return -1;
+		v = p;
+		if (skip (&p, end, 1) != 0)
+			return -1;
+		if (key_is (k, k_len, key)) {
+			*val = v;
+			*val_len = (size_t) (p - v);
+			return 0;
+		}
+		count--;
+	}
+	return 1;
+}
+
+int libpd_mp_splice_init (libpd_mp_splice_t *splice, const void *bytes, 
+	size_t len, const char **keys, unsigned num_keys)
+{
+	const uint8_t *val;
+	size_t val_len;
+	unsigned i, j;
+	int rtn;
+
+	if (num_keys > LIBPD_MP_MAX_SPLICE)
+		return -1;
+	splice->bytes = (const uint8_t *) bytes;
+	splice->len = len;
+	splice->num_vals = 0;
+	for (i = 0; i < num_keys; i++) {
+		rtn = libpd_mp_find_key (bytes, len, keys[i], &val, &val_len);
+		if (rtn != 0)
+			return rtn;
+		if ((val[0] & 0xE0) != 0xA0 && (val[0] < 0xC4 || val[0] > 0xC6) && 
+		    (val[0] < 0xD9 || val[0] > 0xDB))
+			return 1;
+		// insert by offset
+		for (j = splice->num_vals; 
+		     j > 0 && splice->vals[j-1].offset > (size_t) (val - splice->bytes); j--)
+			splice->vals[j] = splice->vals[j-1];
+		splice->vals[j].offset = (size_t) (val - splice->bytes);
+		splice->vals[j].len = val_len;
+		splice->vals[j].bin = (val[0] >= 0xC4 && val[0] <= 0xC6);
+		splice->vals[j].key = i;
+		splice->num_vals++;
+	}
+	return 0;
+}
+
+static unsigned str_header_len (bool bin, size_t len)
+{
+	if (!bin && len < 32)
+		return 1;
+	if (len < 256)
+		return 2;
+	if (len < 65536)
+		return 3;
+	return 5;
+}
+
+static uint8_t *write_str_header (uint8_t *p, bool bin, size_t len)
+{
+	unsigned i, n = str_header_len (bin, len);
+
+	if (n == 1) {
+		*p++ = (uint8_t) (0xA0 | len);
+		return p;
+	}
+	if (n == 2)
+		*p++ = bin ? 0xC4 : 0xD9;
+	else if (n == 3)
+		*p++ = bin ? 0xC5 : 0xDA;
+	else
+		*p++ = bin ? 0xC6 : 0xDB;
+	for (i = n - 1; i > 0; i--)
+		*p++ = (uint8_t) (len >> (8 * (i - 1)));
+	return p;
+}
+
+size_t libpd_mp_splice_len (const libpd_mp_splice_t *splice, 
+	const size_t *val_lens)
+{
+	size_t len = splice->len;
+	size_t n;
+	unsigned i;
+
+	for (i = 0; i < splice->num_vals; i++) {
+		n = val_lens[splice->vals[i].key];
+		len = len - splice->vals[i].len + 
+			str_header_len (splice->vals[i].bin, n) + n;
+	}
+	return len;
+}
+
+void libpd_mp_splice (const libpd_mp_splice_t *splice, const void **vals,
+	const size_t *val_lens, uint8_t *out)
+{
+	size_t pos = 0, n;
+	unsigned i, key;
+
+	for (i = 0; i < splice->num_vals; i++) {
+		memcpy (out, splice->bytes + pos, splice->vals[i].offset - pos);
+		out += splice->vals[i].offset - pos;
+		key = splice->vals[i].key;
+		n = val_lens[key];
+		out = write_str_header (out, splice->vals[i].bin, n);
+		if (n > 0)
+			memcpy (out, vals[key], n);
+		out += n;
+		pos = splice->vals[i].offset + splice->vals[i].len;
+	}
+	memcpy (out, splice->bytes + pos, splice->len - pos);
+}
+
+static unsigned int_len (int val)
+{
+	if ((val >= -32) && (val <= 127))
+		return 1;
+	if ((val >= 0) && (val <= 255))
+		return 2;
+	if ((val >= -128) && (val <= 127))
+		return 2;
+	if ((val >= -32768) && (val <= 65535))
+		return 3;
+	return 5;
+}
+
+static uint8_t *write_be (uint8_t *p, uint32_t v, unsigned nbytes)
+{
+	while (nbytes > 0) {
+		nbytes--;
+		*p++ = (uint8_t) (v >> (8 * nbytes));
+	}
+	return p;
+}
+
+static uint8_t *write_int (uint8_t *p, int val)
+{
+	if ((val >= -32) && (val <= 127)) {
+		*p++ = (uint8_t) val;	// positive or negative fixint
+	} else if ((val >= 0) && (val <= 255)) {
+		*p++ = 0xCC;
+		*p++ = (uint8_t) val;
+	} else if ((val >= -128) && (val <= 127)) {
+		*p++ = 0xD0;
+		*p++ = (uint8_t) val;
+	} else if ((val >= 0) && (val <= 65535)) {
+		*p++ = 0xCD;
+		p = write_be (p, (uint32_t) val, 2);
+	} else if ((val >= -32768) && (val <= 32767)) {
+		*p++ = 0xD1;
+		p = write_be (p, (uint32_t) val, 2);
+	} else {
+		*p++ = (val < 0) ? 0xD2 : 0xCE;
+		p = write_be (p, (uint32_t) val, 4);
+	}
+	return p;
+}
+
+static unsigned map_header_len (unsigned count)
+{
+	if (count < 16)
+		return 1;
+	if (count < 65536)
+		return 3;
+	return 5;
+}
+
+size_t libpd_mp_map_len (const libpd_mp_kv_t *kvs, unsigned num_kvs)
+{
+	size_t len = map_header_len (num_kvs);
+	size_t key_len;
+	unsigned i;
+
+	for (i = 0; i < num_kvs; i++) {
+		key_len = strlen (kvs[i].key);
+		len += str_header_len (false, key_len) + key_len;
+		if (kvs[i].type == LIBPD_MP_INT)
+			len += int_len (kvs[i].ival);
+		else
+			len += str_header_len (kvs[i].type == LIBPD_MP_BIN, kvs[i].len) +
+				kvs[i].len;
+	}
+	return len;
+}
+
+void libpd_mp_write_map (const libpd_mp_kv_t *kvs, unsigned num_kvs, 
+	uint8_t *out)
+{
+	size_t key_len;
+	unsigned i, n = map_header_len (num_kvs);
+
+	if (n == 1)
+		*out++ = (uint8_t) (0x80 | num_kvs);
+	else {
+		*out++ = (n == 3) ? 0xDE : 0xDF;
+		out = write_be (out, num_kvs, n - 1);
+	}
+	for (i = 0; i < num_kvs; i++) {
+		key_len = strlen (kvs[i].key);
+		out = write_str_header (out, false, key_len);
+		memcpy (out, kvs[i].key, key_len);
+		out += key_len;
+		if (kvs[i].type == LIBPD_MP_INT) {
+			out = write_int (out, kvs[i].ival);
+			continue;
+		}
+		out = write_str_header (out, kvs[i].type == LIBPD_MP_BIN, kvs[i].len);
+		if (kvs[i].len > 0)
+			memcpy (out, kvs[i].val, kvs[i].len);
+		out += kvs[i].len;
+	}
+}
+
+int libpd_wrp_peek (const void *bytes, size_t len, libpd_wrp_peek_t *peek)
+{
+	const uint8_t *p = (const uint8_t *) bytes;
+	const uint8_t *end = p + len;
+	const uint8_t *v;
+	const char *k;
+	size_t k_len;
+	uint32_t count;
+
+	peek->msg_type = -1;
+	peek->dest = NULL;
+	peek->dest_len = 0;
+	peek->source = NULL;
+	peek->source_len = 0;
+	if (read_map_size (&p, end, &count) != 0)
+		return -1;
+	while (count > 0) {
+		if (read_str (&p, end, &k, &k_len) != 0)
+			return -1;
+		v = p;
+		if (key_is (k, k_len, "msg_type")) {
+			if (read_int (&v, end, &peek->msg_type) != 0)
+				return -1;
+		} else if (key_is (k, k_len, "dest")) {
+			if (read_str (&v, end, &peek->dest, &peek->dest_len) != 0)
+				return -1;
+		} else if (key_is (k, k_len, "source")) {
+			if (read_str (&v, end, &peek->source, &peek->source_len) != 0)
+				return -1;
+		}
+		// keep scanning so that a truncated msg is reported
+		if (skip (&p, end, 1) != 0)
+			return -1;
+		count--;
+	}
+	return 0;
+}
@@ -0,0 +1,175 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_MSGPACK_H
+#define  _LIBPARODUS_MSGPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Minimal msgpack scanner for encoded wrp msgs.
+ * Nothing is allocated. Strings returned point into the encoded bytes
+ * and are not null terminated.
+ */
+
+/**
+ * Fields found by libpd_wrp_peek
+ */
+typedef struct {
+	int msg_type;	// -1 if not present
+	const char *dest;	// NULL if not present
+	size_t dest_len;
+	const char *source;	// NULL if not present
+	size_t source_len;
+} libpd_wrp_peek_t;
+
+/**
+ * Skip over one msgpack object
+ *
+ * @param p  pointer to start of object, advanced past it on success
+ * @param end  end of buffer
+ * @return 0 on success, -1 if malformed or truncated
+ */
+int libpd_mp_skip (const uint8_t **p, const uint8_t *end);
+
+/**
+ * Read a str or bin object
+ *
+ * @param p  pointer to start of object, advanced past it on success
+ * @param end  end of buffer
+ * @param str  set to the start of the string data
+ * @param str_len  set to the length of the string data
+ * @return 0 on success, -1 if not a str or bin, or truncated
+ */
+int libpd_mp_read_str (const uint8_t **p, const uint8_t *end,
+	const char **str, size_t *str_len);
+
+/**
+ * Find the value of a string key in the top level msgpack map
+ *
+ * @param bytes  encoded msgpack map
+ * @param len  length of bytes
+ * @param key  null terminated key to look for
+ * @param val  set to the start of the encoded value
+ * @param val_len  set to the encoded length of the value
+ * @return 0 if found, 1 if not found, -1 if malformed or truncated
+ */
+int libpd_mp_find_key (const void *bytes, size_t len, const char *key,
+	const uint8_t **val, size_t *val_len);
+
+// most values replaced by one libpd_mp_splice_t
+#define LIBPD_MP_MAX_SPLICE	2
+
+/**
+ * An encoded msgpack map, and where the str or bin values of some of 
+ * its keys are, so that they can be replaced without encoding it again.
+ */
+typedef struct {
+	const uint8_t *bytes;	// not copied
+	size_t len;
+	unsigned num_vals;
+	struct {
+		size_t offset;	// of the encoded value in bytes
+		size_t len;	// encoded length of the value
+		bool bin;	// a bin value, else a str
+		unsigned key;	// index in the keys given to libpd_mp_splice_init
+	} vals[LIBPD_MP_MAX_SPLICE];	// in the order found in bytes
+} libpd_mp_splice_t;
+
+/**
+ * Find the values to be replaced in an encoded msgpack map
+ *
+ * @param splice  receives where the values are
+ * @param bytes  encoded msgpack map, which must outlive splice
+ * @param len  length of bytes
+ * @param keys  null terminated keys, each with a str or bin value
+ * @param num_keys  number of keys, up to LIBPD_MP_MAX_SPLICE
+ * @return 0 on success, 1 if a key is not found or its value is not
+ *  a str or bin, -1 if malformed or truncated
+ */
+int libpd_mp_splice_init (libpd_mp_splice_t *splice, const void *bytes, 
+	size_t len, const char **keys, unsigned num_keys);
+
+/**
+ * Get the encoded length of the map with its values replaced
+ *
+ * @param splice  from libpd_mp_splice_init
+ * @param val_lens  length of the new value for each key, each below 2^32
+ * @return encoded length
+ */
+size_t libpd_mp_splice_len (const libpd_mp_splice_t *splice, 
+	const size_t *val_lens);
+
+/**
+ * Encode the map with its values replaced. Each new value keeps the
+ * type, str or bin, of the value it replaces.
+ *
+ * @param splice  from libpd_mp_splice_init
+ * @param vals  the new value for each key
+ * @param val_lens  length of the new value for each key, each below 2^32
+ * @param out  receives libpd_mp_splice_len bytes
+ */
+void libpd_mp_splice (const libpd_mp_splice_t *splice, const void **vals,
+	const size_t *val_lens, uint8_t *out);
+
+// value types of libpd_mp_kv_t
+#define LIBPD_MP_STR	0
+#define LIBPD_MP_BIN	1
+#define LIBPD_MP_INT	2
+
+/**
+ * A key and its value, for writing a msgpack map
+ */
+typedef struct {
+	const char *key;	// null terminated, below 2^32 bytes
+	int type;	// LIBPD_MP_STR, LIBPD_MP_BIN or LIBPD_MP_INT
+	const void *val;	// str or bin value
+	size_t len;	// length of a str or bin value, below 2^32
+	int ival;	// int value
+} libpd_mp_kv_t;
+
+/**
+ * Get the encoded length of a msgpack map
+ *
+ * @param kvs  the keys and values of the map
+ * @param num_kvs  number of keys
+ * @return encoded length
+ */
+size_t libpd_mp_map_len (const libpd_mp_kv_t *kvs, unsigned num_kvs);
+
+/**
+ * Encode a msgpack map, with its keys in the order given
+ *
+ * @param kvs  the keys and values of the map
+ * @param num_kvs  number of keys
+ * @param out  receives libpd_mp_map_len bytes
+ */
+void libpd_mp_write_map (const libpd_mp_kv_t *kvs, unsigned num_kvs, 
+	uint8_t *out);
+
+/**
+ * Extract msg_type, dest and source from an encoded wrp msg without decoding it.
+ *
+ * @param bytes  encoded wrp msg
+ * @param len  length of bytes
+ * @param peek  receives the fields found
+ * @return 0 on success, -1 if bytes are not a well formed msgpack map
+ */
+int libpd_wrp_peek (const void *bytes, size_t len, libpd_wrp_peek_t *peek);
+
+#endif
@@ -33,6 +33,11 @@ typedef enum {
 	 * could not create new instance
 	 */
 	LIBPD_ERR_INIT_INST = -0x40001,
+	/** 
+	 * @brief Error on libparodus_init
+	 * empty, duplicate or invalid name in extra_services
+	 */
+	LIBPD_ERR_INIT_SERVICES = -0x40002,
 	/** 
 	 * @brief Error on libparodus_init
 	 * error connecting receiver
@@ -62,6 +67,12 @@ typedef enum {
 	 * error binding to socket
 	 */
 	LIBPD_ERR_INIT_RCV_BIND = -0x420C0,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error connecting receiver
+	 * error getting the socket receive fd
+	 */
+	LIBPD_ERR_INIT_RCV_FD = -0x42100,
 	/** 
 	 * @brief Error on libparodus_init
 	 * error connecting sender
@@ -93,42 +104,37 @@ typedef enum {
 	LIBPD_ERR_INIT_SEND_CONN = -0x430C0,
 	/** 
 	 * @brief Error on libparodus_init
-	 * error connecting termination socket
+	 * error creating the eventfd that wakes the receiver thread
 	 */
-	LIBPD_ERR_INIT_TERMSOCK = -0x44000,
+	LIBPD_ERR_INIT_WAKE_FD = -0x44000,
 	/** 
-	 * @brief Error on connect termination socket
-	 * null url specified
-	 */
-	LIBPD_ERR_INIT_TERMSO_NULL = -0x44001,
-	/** 
-	 * @brief Error on connect termination socket
-	 * error creating socket
+	 * @brief Error on libparodus_init
+	 * error creating wrp receiver thread
 	 */
-	LIBPD_ERR_INIT_TERMSO_CREATE = -0x44040,
+	LIBPD_ERR_INIT_RCV_THREAD = -0x45000,
 	/** 
 	 * @brief Error on libparodus_init
-	 * error connecting termination socket
-	 * error setting socket option
+	 * error creating wrp receiver thread
+	 * pthread_create error
 	 */
-	LIBPD_ERR_INIT_TERMSO_SETOPT = -0x44080,
+	LIBPD_ERR_INIT_RCV_THREAD_PCR = -0x45040,
 	/** 
 	 * @brief Error on libparodus_init
-	 * error connecting termination socket
-	 * error connecting to socket
+	 * error creating wrp sender thread
+	 * pthread_create error
 	 */
-	LIBPD_ERR_INIT_TERMSO_CONN = -0x440C0,
+	LIBPD_ERR_INIT_SEND_THREAD_PCR = -0x46040,
 	/** 
 	 * @brief Error on libparodus_init
-	 * error creating wrp receiver thread
+	 * error creating a decode thread
+	 * pthread_create error
 	 */
-	LIBPD_ERR_INIT_RCV_THREAD = -0x45000,
+	LIBPD_ERR_INIT_DECODE_THREAD_PCR = -0x47040,
 	/** 
 	 * @brief Error on libparodus_init
-	 * error creating wrp receiver thread
-	 * pthread_create error
+	 * error creating the spool thread, pthread_create
 	 */
-	LIBPD_ERR_INIT_RCV_THREAD_PCR = -0x45040,
+	LIBPD_ERR_INIT_SPOOL_THREAD_PCR = -0x48040,
 	/** 
 	 * @brief Error on libparodus_init
 	 * error creating wrp msg rcv queue
@@ -154,6 +160,21 @@ typedef enum {
 	 * unable to allocate rcv q msg array
 	 */
 	LIBPD_ERR_INIT_QCREATE_ALLOC_2 = -0x51003,
+	/** 
+	 * @brief Error on libparodus init
+	 * invalid rcv_queue_overflow, or not supported with single_receiver
+	 */
+	LIBPD_ERR_INIT_QCREATE_OVERFLOW = -0x51004,
+	/** 
+	 * @brief Error on libparodus init
+	 * rcv_queue_max_size or rcv_queue_max_bytes not supported with single_receiver
+	 */
+	LIBPD_ERR_INIT_QCREATE_LIMITS = -0x51005,
+	/** 
+	 * @brief Error on libparodus init
+	 * invalid rcv_queue_lanes, or not supported with single_receiver
+	 */
+	LIBPD_ERR_INIT_QCREATE_LANES = -0x51006,
 	/** 
 	 * @brief Error on libparodus init
 	 * unable to create mutex for rcv queue
@@ -169,6 +190,31 @@ typedef enum {
 	 * unable to create not_full cond var for rcv queue
 	 */
 	LIBPD_ERR_INIT_QCREATE_NFCOND = -0x510C0,
+	/** 
+	 * @brief Error on libparodus init
+	 * unable to create event fd for rcv queue
+	 */
+	LIBPD_ERR_INIT_QCREATE_EVENT_FD = -0x51100,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error creating async send queue
+	 */
+	LIBPD_ERR_INIT_SEND_QUEUE = -0x54000,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error creating async send queue, libpd_qcreate
+	 */
+	LIBPD_ERR_INIT_SEND_QCREATE = -0x55000,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error creating a decode queue
+	 */
+	LIBPD_ERR_INIT_DECODE_QUEUE = -0x56000,
+	/** 
+	 * @brief Error on libparodus_init
+	 * error opening the send spool file
+	 */
+	LIBPD_ERR_INIT_SPOOL = -0x57000,
 	/** 
 	 * @brief Error on libparodus_init
 	 * error sending registration msg
@@ -248,6 +294,11 @@ typedef enum {
 	 * null msg received from wrp queue
 	 */
 	LIBPD_ERR_RCV_NULL_MSG = -0xA0004,
+	/** 
+	 * @brief Error on libparodus_receive_service
+	 * service name not registered
+	 */
+	LIBPD_ERR_RCV_SERVICE = -0xA0005,
 	/** 
 	 * @brief Error on libparodus_receive
 	 * wrp queue receive error
@@ -263,6 +314,11 @@ typedef enum {
 	 * internal error, null queue id
 	 */
 	LIBPD_ERR_RCV_QUEUE_NULL = -0xB3001,
+	/** 
+	 * @brief Error on libparodus receive batch
+	 * zero batch size given
+	 */
+	LIBPD_ERR_RCV_QUEUE_BATCH_SZ = -0xB3002,
 	/** 
 	 * @brief Error on libparodus receive
 	 * error on queue cond wait var
@@ -350,6 +406,21 @@ typedef enum {
 	 * convert to struct error
 	 */
 	LIBPD_ERR_SEND_CONVERT = -0x141001,
+	/** 
+	 * @brief Error on libparodus_send_bytes
+	 * bytes are not an encoded wrp msg
+	 */
+	LIBPD_ERR_SEND_BYTES = -0x141002,
+	/** 
+	 * @brief Error on libparodus_send
+	 * timed out waiting for another send to finish
+	 */
+	LIBPD_ERR_SEND_LOCK_TIMEDOUT = -0x141003,
+	/** 
+	 * @brief Error on libparodus_send
+	 * the send spool is full
+	 */
+	LIBPD_ERR_SEND_SPOOL_FULL = -0x141004,
 	/** 
 	 * @brief Error on libparodus_send
 	 * connect sender error
@@ -377,6 +448,21 @@ typedef enum {
 	 * error connecting to socket
 	 */
 	LIBPD_ERR_SEND_CONN_CONN = -0x1412C0,
+	/** 
+	 * @brief Error on libparodus_send
+	 * async send queue error
+	 */
+	LIBPD_ERR_SEND_QUEUE = -0x142000,
+	/** 
+	 * @brief Error on libparodus_send
+	 * async send queue full
+	 */
+	LIBPD_ERR_SEND_QUEUE_FULL = -0x142002,
+	/** 
+	 * @brief Error on libparodus_send
+	 * unable to allocate async send queue entry
+	 */
+	LIBPD_ERR_SEND_QUEUE_ALLOC = -0x142003,
 	/** 
 	 * @brief Error on libparodus_send
 	 * socket send error
@@ -392,6 +478,46 @@ typedef enum {
 	 * nanomsg send error
 	 */
 	LIBPD_ERR_SEND_NN = -0x141840,
+	/** 
+	 * @brief Error on libparodus_send
+	 * nanomsg send would block, or the send timeout passed
+	 */
+	LIBPD_ERR_SEND_TIMEDOUT = -0x141841,
+	/** 
+	 * @brief Error on libparodus_request
+	 * send errors are the LIBPD_ERR_SEND codes
+	 */
+	LIBPD_ERR_REQ = -0x180000,
+	/** 
+	 * @brief Error on libparodus_request
+	 * null instance given
+	 */
+	LIBPD_ERR_REQ_NULL_INST = -0x180001,
+	/** 
+	 * @brief Error on libparodus_request
+	 * run state error
+	 */
+	LIBPD_ERR_REQ_STATE = -0x180002,
+	/** 
+	 * @brief Error on libparodus_request
+	 * not configured for receive
+	 */
+	LIBPD_ERR_REQ_CFG = -0x180003,
+	/** 
+	 * @brief Error on libparodus_request
+	 * invalid request msg, or no resp_func
+	 */
+	LIBPD_ERR_REQ_WRP_MSG = -0x180004,
+	/** 
+	 * @brief Error on libparodus_request
+	 * transaction_uuid already waiting
+	 */
+	LIBPD_ERR_REQ_DUP_ID = -0x180005,
+	/** 
+	 * @brief Error on libparodus_request
+	 * unable to allocate request
+	 */
+	LIBPD_ERR_REQ_ALLOC = -0x180006,
 } __libpd_err_t;
 
 
@@ -426,6 +552,7 @@ typedef struct {
  *		LIBPD_ERROR_INIT_RCV_THREAD = -104, error creating wrp receiver thread
  *		LIBPD_ERROR_INIT_QUEUE = -105, error creating wrp msg receive queue
  *		LIBPD_ERROR_INIT_REGISTER = -106, error sending registration msg
+ *		LIBPD_ERROR_INIT_SEND_THREAD = -107, error creating wrp sender thread
  *
  * @note this is the same as libparodus_init (defined in libparpdus.h)
  * except extra error information is returned. This function should not
@@ -465,6 +592,52 @@ int libparodus_init_dbg (libpd_instance_t *instance, libpd_cfg_t *libpd_cfg,
 int libparodus_receive_dbg (libpd_instance_t instance, wrp_msg_t **msg, 
     uint32_t ms, extra_err_info_t *err_info);
 
+/**
+ *  Same as libparodus_receive_dbg, except the timeout is in nanoseconds.
+ *
+ * @note this is the same as libparodus_receive_ns (defined in libparpdus.h)
+ * except extra error information is returned. This function should not
+ * be used in production code.
+ */
+int libparodus_receive_ns_dbg (libpd_instance_t instance, wrp_msg_t **msg, 
+    uint64_t ns, extra_err_info_t *err_info);
+
+/**
+ *  Same as libparodus_receive_dbg, for one of the service names of the 
+ *  instance.
+ *
+ * @note this is the same as libparodus_receive_service (defined in 
+ * libparpdus.h) except extra error information is returned. This function
+ * should not be used in production code.
+ */
+int libparodus_receive_service_dbg (libpd_instance_t instance, 
+	const char *service_name, wrp_msg_t **msg, uint32_t ms, 
+	extra_err_info_t *err_info);
+
+/**
+ *  Receives up to max_msgs messages that were sent to this service, waiting
+ *  the prescribed number of milliseconds for the first one.
+ *
+ *  @param instance instance object
+ *  @param msgs array of at least max_msgs pointers to receive the msg structs
+ *  @param max_msgs maximum number of messages to receive
+ *  @param ms the number of milliseconds to wait for the first message
+ *  @param count the number of messages placed in msgs
+ *  @param err_info extra error information for debugging.
+ *
+ *  @return 0 on success, 2 if closed msg received, 1 if timed out, else:
+ *		LIBPD_ERROR_RCV_NULL_INST = -201, null instance given
+ *		LIBPD_ERROR_RCV_STATE = -202, run state error, not running
+ *		LIBPD_ERROR_RCV_CFG = -203, not configured for receive
+ *		LIBPD_ERROR_RCV_RCV = -204, receive error
+ *
+ * @note this is the same as libparodus_receive_batch (defined in libparpdus.h)
+ * except extra error information is returned. This function should not
+ * be used in production code.
+ */
+int libparodus_receive_batch_dbg (libpd_instance_t instance, wrp_msg_t **msgs, 
+	size_t max_msgs, uint32_t ms, size_t *count, extra_err_info_t *err_info);
+
 /**
  * Sends a close message to the receiver
  *
@@ -511,10 +684,12 @@ int libparodus_shutdown_dbg (libpd_instance_t *instance,
  * @param err_info extra error information for debugging.
  *
  * @return 0 on success, else:
- *		LIBPD_ERROR_SEND_NULL_INST = -501, null instance given
- *		LIBPD_ERROR_SEND_STATE = -502, run state error, not running
- *		LIBPD_ERROR_SEND_WRP_MSG = -503, invalid wrp message
- *		LIBPD_ERROR_SEND_SOCKET = -504, socket send error
+ *		LIBPD_ERROR_SEND_NULL_INST = -401, null instance given
+ *		LIBPD_ERROR_SEND_STATE = -402, run state error, not running
+ *		LIBPD_ERROR_SEND_WRP_MSG = -403, invalid wrp message
+ *		LIBPD_ERROR_SEND_SOCKET = -404, socket send error
+ *		LIBPD_ERROR_SEND_QUEUE_FULL = -406, async send queue full
+ *		LIBPD_ERROR_SEND_SPOOL_FULL = -408, send spool full
  * 
  * @note this is the same as libparodus_send (defined in libparpdus.h)
  * except extra error information is returned. This function should not
@@ -525,6 +700,43 @@ int libparodus_shutdown_dbg (libpd_instance_t *instance,
 int libparodus_send_dbg (libpd_instance_t instance, wrp_msg_t *msg,
     extra_err_info_t *err_info);
 
+/**
+ * Same as libparodus_send_timed, except extra error information is returned.
+ * This function should not be used in production code.
+ */
+int libparodus_send_timed_dbg (libpd_instance_t instance, wrp_msg_t *msg,
+	uint32_t timeout_ms, extra_err_info_t *err_info);
+
+/**
+ * Same as libparodus_send_bytes, except extra error information is returned.
+ * This function should not be used in production code.
+ */
+int libparodus_send_bytes_dbg (libpd_instance_t instance, const void *msg_bytes,
+	size_t msg_len, extra_err_info_t *err_info);
+
+/**
+ * Same as libparodus_send_batch, except extra error information is returned.
+ * This function should not be used in production code.
+ */
+int libparodus_send_batch_dbg (libpd_instance_t instance, wrp_msg_t **msgs,
+	size_t n, size_t *sent, extra_err_info_t *err_info);
+
+/**
+ * Same as libparodus_request, except extra error information is returned.
+ * When the send fails, err_detail is the LIBPD_ERR_SEND code.
+ * This function should not be used in production code.
+ */
+int libparodus_request_dbg (libpd_instance_t instance, wrp_msg_t *req,
+	wrp_msg_t **resp, uint32_t timeout_ms, extra_err_info_t *err_info);
+
+/**
+ * Same as libparodus_request_async, except extra error information 
+ * is returned. This function should not be used in production code.
+ */
+int libparodus_request_async_dbg (libpd_instance_t instance, wrp_msg_t *req,
+	libpd_resp_func_t *resp_func, void *arg, uint32_t timeout_ms,
+	extra_err_info_t *err_info);
+
 
 /**
  * Config test flags
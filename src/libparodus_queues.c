@@ -20,9 +20,46 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include <pthread.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 #include "libparodus_log.h"
 
+#define QUEUE_CACHE_LINE	64
+#define CACHE_ALIGNED __attribute__ ((aligned (QUEUE_CACHE_LINE)))
+
+/*
+ * Lock-free ring with a single consumer.
+ * Each cell carries a sequence number, so producers claim a cell
+ * with one compare and swap on tail and publish it by bumping the
+ * sequence. This works for one producer thread (LIBPD_QFLAG_SPSC),
+ * which then never contends, as well as for several (LIBPD_QFLAG_MPSC).
+ * head and tail are kept on separate cache lines so the consumer and
+ * producers don't bounce the same line on every message.
+ * The queue mutex and cond vars are only used to park a thread when
+ * the ring is empty (consumer) or full (producer), and the other side
+ * only takes the mutex to wake it when it is actually parked.
+ */
+typedef struct {
+	unsigned seq;
+	void *msg;
+} ring_cell_t;
+
+typedef struct {
+	ring_cell_t *cells;
+	unsigned mask;
+	CACHE_ALIGNED unsigned head;
+	int consumer_parked;
+	CACHE_ALIGNED unsigned tail;
+	int producers_parked;
+	int event_count;	// only kept when there is an event fd
+} ring_t;
+
 typedef struct queue {
 	const char *queue_name;
 	unsigned max_msgs;
@@ -33,13 +70,146 @@ typedef struct queue {
 	void **msg_array;
 	int head_index;
 	int tail_index;
+	ring_t *ring;	// NULL unless LIBPD_QFLAG_SPSC or LIBPD_QFLAG_MPSC
+	int event_fd;	// -1 unless LIBPD_QFLAG_EVENT_FD
+	int event_wfd;	// write end, when a pipe stands in for eventfd
+	bool event_set;
+	libpd_qstamp_t *stamps;	// NULL unless LIBPD_QFLAG_STAMP, one per slot
+	unsigned overflow;	// LIBPD_QOVERFLOW_ ...
+	libpd_qprio_func_t *prio_func;
+	unsigned min_msgs;	// size the queue shrinks back to, when it grows
+	unsigned grow_max_msgs;	// 0 unless elastic
+	size_t max_bytes;	// 0 if no byte limit
+	size_t bytes;	// size of queued messages, when max_bytes
+	libpd_qsize_func_t *size_func;
+	int send_waiters;	// senders waiting on not_full_cond
+	unsigned lanes;	// 1 unless lanes configured
+	unsigned char *lane_ids;	// NULL unless lanes > 1, one per slot
+	unsigned lane_counts[LIBPD_QMAX_LANES];
+	unsigned lane_weights[LIBPD_QMAX_LANES];	// all 0 for strict priority
+	unsigned cur_lane;	// weighted lane being dequeued
+	unsigned lane_credit;	// msgs cur_lane may still dequeue
+	libpd_qlane_func_t *lane_func;
+	void *lane_arg;
 } queue_t;
 
+/*
+ * The event fd is level triggered: it is readable exactly while the
+ * queue holds messages. It is only written or read when the queue goes
+ * from empty to non-empty or back, always with the queue mutex held.
+ */
+static int event_fd_open (queue_t *q)
+{
+#ifdef __linux__
+	q->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+	q->event_wfd = q->event_fd;
+	return (q->event_fd < 0) ? errno : 0;
+#else
+	int fds[2];
+	if (pipe (fds) != 0)
+		return errno;
+	fcntl (fds[0], F_SETFL, O_NONBLOCK);
+	fcntl (fds[1], F_SETFL, O_NONBLOCK);
+	q->event_fd = fds[0];
+	q->event_wfd = fds[1];
+	return 0;
+#endif
+}
+
+static void event_fd_close (queue_t *q)
+{
+	if (q->event_fd < 0)
+		return;
+	if (q->event_wfd != q->event_fd)
+		close (q->event_wfd);
+	close (q->event_fd);
+	q->event_fd = -1;
+}
+
+// called with the queue mutex held
+static void event_fd_sync (queue_t *q, int msg_count)
+{
+	uint64_t val = 1;
+	ssize_t rtn;
+
+	if ((msg_count > 0) && !q->event_set) {
+		rtn = write (q->event_wfd, &val, sizeof(val));
+		q->event_set = true;
+	} else if ((msg_count <= 0) && q->event_set) {
+		rtn = read (q->event_fd, &val, sizeof(val));
+		q->event_set = false;
+	} else {
+		return;
+	}
+	if (rtn < 0) {
+		libpd_log_err (LEVEL_ERROR, errno, ("Error updating event fd for queue %s\n",
+			q->queue_name));
+	}
+}
+
+// Ring mode: event_count can briefly go negative, when the consumer pops
+// a msg before its producer has counted it. Only a change that crosses
+// from empty to non-empty, or back, needs a sync under the mutex.
+static void ring_event_add (queue_t *q, int n)
+{
+	int old = __atomic_fetch_add (&q->ring->event_count, n, __ATOMIC_SEQ_CST);
+	int new = old + n;
+
+	if ((old > 0) == (new > 0))
+		return;
+	pthread_mutex_lock (&q->mutex);
+	event_fd_sync (q, __atomic_load_n (&q->ring->event_count, __ATOMIC_SEQ_CST));
+	pthread_mutex_unlock (&q->mutex);
+}
+
+static unsigned ring_size (unsigned max_msgs)
+{
+	unsigned size = 2;
+	while (size < max_msgs)
+		size += size;
+	return size;
+}
+
+static ring_t *ring_create (unsigned size)
+{
+	unsigned i;
+	ring_t *ring;
+	if (posix_memalign ((void **) &ring, QUEUE_CACHE_LINE, sizeof(ring_t)) != 0)
+		return NULL;
+	memset ((void *) ring, 0, sizeof(ring_t));
+	ring->cells = (ring_cell_t *) malloc (size * sizeof(ring_cell_t));
+	if (NULL == ring->cells) {
+		free (ring);
+		return NULL;
+	}
+	for (i=0; i<size; i++)
+		ring->cells[i].seq = i;
+	ring->mask = size - 1;
+	return ring;
+}
+
+static void ring_destroy (ring_t *ring)
+{
+	free (ring->cells);
+	free (ring);
+}
+
 int libpd_qcreate (libpd_mq_t *mq, const char *queue_name, 
 	unsigned max_msgs, int *exterr)
+{
+	libpd_qcfg_t qcfg;
+
+	memset ((void *) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = max_msgs;
+	return libpd_qcreate_cfg (mq, queue_name, &qcfg, exterr);
+}
+
+int libpd_qcreate_cfg (libpd_mq_t *mq, const char *queue_name, 
+	const libpd_qcfg_t *qcfg, int *exterr)
 {
 	int err;
-	unsigned array_size;
+	unsigned i, array_size;
+	unsigned max_msgs = qcfg->max_msgs;
 	queue_t *newq;
 
 	*exterr = 0;
@@ -50,7 +220,35 @@ int libpd_qcreate (libpd_mq_t *mq, const char *queue_name,
 			queue_name, max_msgs));
 		return LIBPD_QERR_CREATE_INVAL_SZ;
 	}
+	if ((qcfg->overflow > LIBPD_QOVERFLOW_DROP_PRIORITY) ||
+	    ((qcfg->overflow == LIBPD_QOVERFLOW_DROP_PRIORITY) && (NULL == qcfg->prio_func)) ||
+	    ((qcfg->overflow >= LIBPD_QOVERFLOW_DROP_OLDEST) && 
+	     (qcfg->flags & (LIBPD_QFLAG_SPSC | LIBPD_QFLAG_MPSC)))) {
+		libpd_log (LEVEL_ERROR, 
+			("Error creating queue %s: overflow policy %u not supported\n",
+			queue_name, qcfg->overflow));
+		return LIBPD_QERR_CREATE_OVERFLOW;
+	}
+	if (((qcfg->grow_max_msgs > max_msgs) && 
+	     (qcfg->flags & (LIBPD_QFLAG_SPSC | LIBPD_QFLAG_MPSC))) ||
+	    ((qcfg->max_bytes > 0) && 
+	     ((NULL == qcfg->size_func) || (qcfg->flags & (LIBPD_QFLAG_SPSC | LIBPD_QFLAG_MPSC))))) {
+		libpd_log (LEVEL_ERROR, 
+			("Error creating queue %s: grow_max_msgs or max_bytes not supported\n",
+			queue_name));
+		return LIBPD_QERR_CREATE_LIMITS;
+	}
+	if ((qcfg->lanes > LIBPD_QMAX_LANES) ||
+	    ((qcfg->lanes > 1) && 
+	     ((NULL == qcfg->lane_func) || (qcfg->flags & (LIBPD_QFLAG_SPSC | LIBPD_QFLAG_MPSC))))) {
+		libpd_log (LEVEL_ERROR, 
+			("Error creating queue %s: %u lanes not supported\n",
+			queue_name, qcfg->lanes));
+		return LIBPD_QERR_CREATE_LANES;
+	}
 		
+	if (qcfg->flags & (LIBPD_QFLAG_SPSC | LIBPD_QFLAG_MPSC))
+		max_msgs = ring_size (max_msgs);
 	array_size = max_msgs * sizeof(void*);
 	newq = (queue_t*) malloc (sizeof(queue_t));
 
@@ -65,6 +263,30 @@ int libpd_qcreate (libpd_mq_t *mq, const char *queue_name,
 	newq->msg_count = 0;
 	newq->head_index = -1;
 	newq->tail_index = -1;
+	newq->msg_array = NULL;
+	newq->ring = NULL;
+	newq->event_fd = -1;
+	newq->event_wfd = -1;
+	newq->event_set = false;
+	newq->stamps = NULL;
+	newq->overflow = qcfg->overflow;
+	newq->prio_func = qcfg->prio_func;
+	newq->min_msgs = max_msgs;
+	newq->grow_max_msgs = (qcfg->grow_max_msgs > max_msgs) ? qcfg->grow_max_msgs : 0;
+	newq->max_bytes = qcfg->max_bytes;
+	newq->bytes = 0;
+	newq->size_func = qcfg->size_func;
+	newq->send_waiters = 0;
+	newq->lanes = (qcfg->lanes > 1) ? qcfg->lanes : 1;
+	newq->lane_ids = NULL;
+	memset ((void *) newq->lane_counts, 0, sizeof(newq->lane_counts));
+	memset ((void *) newq->lane_weights, 0, sizeof(newq->lane_weights));
+	for (i = 0; (i < newq->lanes) && (qcfg->lane_weights[0] > 0); i++)
+		newq->lane_weights[i] = (qcfg->lane_weights[i] > 0) ? qcfg->lane_weights[i] : 1;
+	newq->cur_lane = 0;
+	newq->lane_credit = newq->lane_weights[0];
+	newq->lane_func = qcfg->lane_func;
+	newq->lane_arg = qcfg->lane_arg;
 
 	err = pthread_mutex_init (&newq->mutex, NULL);
 	if (err != 0) {
@@ -75,7 +297,7 @@ int libpd_qcreate (libpd_mq_t *mq, const char *queue_name,
 		return LIBPD_QERR_CREATE_MUTEX;
 	}
 
-	err = pthread_cond_init (&newq->not_empty_cond, NULL);
+	err = init_timed_cond (&newq->not_empty_cond);
 	if (err != 0) {
 		*exterr = err;
 		libpd_log_err (LEVEL_ERROR, err, ("Error creating not_empty_cond for queue %s\n",
@@ -85,7 +307,7 @@ int libpd_qcreate (libpd_mq_t *mq, const char *queue_name,
 		return LIBPD_QERR_CREATE_NECOND;
 	}
 
-	err = pthread_cond_init (&newq->not_full_cond, NULL);
+	err = init_timed_cond (&newq->not_full_cond);
 	if (err != 0) {
 		*exterr = err;
 		libpd_log_err (LEVEL_ERROR, err, ("Error creating not_full_cond for queue %s\n",
@@ -96,48 +318,271 @@ int libpd_qcreate (libpd_mq_t *mq, const char *queue_name,
 		return LIBPD_QERR_CREATE_NFCOND;
 	}
 
-	newq->msg_array = malloc (array_size);
-	if (NULL == newq->msg_array) {
+	if (qcfg->flags & (LIBPD_QFLAG_SPSC | LIBPD_QFLAG_MPSC))
+		newq->ring = ring_create (max_msgs);
+	else
+		newq->msg_array = malloc (array_size);
+	if (qcfg->flags & LIBPD_QFLAG_STAMP)
+		newq->stamps = (libpd_qstamp_t *) malloc (max_msgs * sizeof(libpd_qstamp_t));
+	if (newq->lanes > 1)
+		newq->lane_ids = (unsigned char *) malloc (max_msgs);
+	if (((NULL == newq->msg_array) && (NULL == newq->ring)) ||
+	    ((qcfg->flags & LIBPD_QFLAG_STAMP) && (NULL == newq->stamps)) ||
+	    ((newq->lanes > 1) && (NULL == newq->lane_ids))) {
 		libpd_log (LEVEL_ERROR, ("Unable to allocate memory(2) for queue %s\n",
 			queue_name));
 		pthread_mutex_destroy (&newq->mutex);
 		pthread_cond_destroy (&newq->not_empty_cond);
 		pthread_cond_destroy (&newq->not_full_cond);
+		if (NULL != newq->ring)
+			ring_destroy (newq->ring);
+		free (newq->msg_array);
+		free (newq->stamps);
+		free (newq->lane_ids);
 		free (newq);
 		return LIBPD_QERR_CREATE_ALLOC_2;
 	}
 
+	if (qcfg->flags & LIBPD_QFLAG_EVENT_FD) {
+		err = event_fd_open (newq);
+		if (err != 0) {
+			*exterr = err;
+			libpd_log_err (LEVEL_ERROR, err, ("Error creating event fd for queue %s\n",
+				queue_name));
+			pthread_mutex_destroy (&newq->mutex);
+			pthread_cond_destroy (&newq->not_empty_cond);
+			pthread_cond_destroy (&newq->not_full_cond);
+			if (NULL != newq->ring)
+				ring_destroy (newq->ring);
+			else
+				free (newq->msg_array);
+			free (newq->stamps);
+			free (newq->lane_ids);
+			free (newq);
+			return LIBPD_QERR_CREATE_EVENT_FD;
+		}
+	}
+
 	*mq = (libpd_mq_t) newq;
 	return 0;
 }
 
 
 
-static bool enqueue_msg (queue_t *q, void *msg)
+static void put_stamp (queue_t *q, unsigned slot, uint64_t sent_ns)
+{
+	q->stamps[slot].sent_ns = sent_ns;
+	q->stamps[slot].queued_ns = get_monotonic_ns ();
+}
+
+static void get_stamp (queue_t *q, unsigned slot, libpd_qstamp_t *stamp)
+{
+	if (NULL == stamp)
+		return;
+	if (NULL == q->stamps) {
+		stamp->sent_ns = 0;
+		stamp->queued_ns = 0;
+		return;
+	}
+	*stamp = q->stamps[slot];
+}
+
+// Moves the queued messages to arrays of new_max slots, starting at 0.
+// returns false, leaving the queue as it was, if they can't be allocated.
+static bool resize_queue (queue_t *q, unsigned new_max)
+{
+	void **new_array = (void **) malloc (new_max * sizeof(void*));
+	libpd_qstamp_t *new_stamps = NULL;
+	unsigned char *new_lane_ids = NULL;
+	unsigned i, slot;
+
+	if (NULL == new_array)
+		return false;
+	if (NULL != q->stamps)
+		new_stamps = (libpd_qstamp_t *) malloc (new_max * sizeof(libpd_qstamp_t));
+	if (NULL != q->lane_ids)
+		new_lane_ids = (unsigned char *) malloc (new_max);
+	if (((NULL != q->stamps) && (NULL == new_stamps)) ||
+	    ((NULL != q->lane_ids) && (NULL == new_lane_ids))) {
+		free (new_array);
+		free (new_stamps);
+		free (new_lane_ids);
+		return false;
+	}
+	for (i = 0; i < (unsigned) q->msg_count; i++) {
+		slot = ((unsigned) q->head_index + i) % q->max_msgs;
+		new_array[i] = q->msg_array[slot];
+		if (NULL != new_stamps)
+			new_stamps[i] = q->stamps[slot];
+		if (NULL != new_lane_ids)
+			new_lane_ids[i] = q->lane_ids[slot];
+	}
+	free (q->msg_array);
+	free (q->stamps);
+	free (q->lane_ids);
+	q->msg_array = new_array;
+	q->stamps = new_stamps;
+	q->lane_ids = new_lane_ids;
+	q->max_msgs = new_max;
+	q->head_index = 0;
+	q->tail_index = q->msg_count - 1;
+	libpd_log (LEVEL_DEBUG, ("Queue %s resized to %u msgs\n", 
+		q->queue_name, new_max));
+	return true;
+}
+
+static bool grow_queue (queue_t *q)
 {
+	unsigned new_max = q->max_msgs * 2;
+
+	if (q->max_msgs >= q->grow_max_msgs)
+		return false;
+	if (new_max > q->grow_max_msgs)
+		new_max = q->grow_max_msgs;
+	return resize_queue (q, new_max);
+}
+
+static void shrink_queue (queue_t *q)
+{
+	unsigned new_max = q->max_msgs / 2;
+
+	if ((q->max_msgs <= q->min_msgs) || ((unsigned) q->msg_count > q->max_msgs / 4))
+		return;
+	if (new_max < q->min_msgs)
+		new_max = q->min_msgs;
+	resize_queue (q, new_max);
+}
+
+static void put_lane (queue_t *q, unsigned slot, void *msg)
+{
+	unsigned lane = q->lane_func (msg, q->lane_arg);
+
+	if (lane >= q->lanes)
+		lane = q->lanes - 1;
+	q->lane_ids[slot] = (unsigned char) lane;
+	q->lane_counts[lane] += 1;
+}
+
+static size_t msg_bytes (queue_t *q, void *msg)
+{
+	return (q->max_bytes > 0) ? q->size_func (msg) : 0;
+}
+
+static bool enqueue_msg (queue_t *q, void *msg, uint64_t sent_ns)
+{
+	size_t size = msg_bytes (q, msg);
+
+	if ((q->msg_count > 0) && (q->max_bytes > 0) && 
+	    (q->bytes + size > q->max_bytes))
+		return false;
+	q->bytes += size;
 	if (q->msg_count == 0) {
-		q->msg_array[0] = msg;
 		q->head_index = 0;
 		q->tail_index = 0;
-		q->msg_count = 1;
-		return true;
+	} else {
+		if ((q->msg_count >= (int)q->max_msgs) && !grow_queue (q)) {
+			q->bytes -= size;
+			return false;
+		}
+		q->tail_index += 1;
+		if (q->tail_index >= (int)q->max_msgs)
+			q->tail_index = 0;
 	}
-	if (q->msg_count >= (int)q->max_msgs)
-		return false;
-	q->tail_index += 1;
-	if (q->tail_index >= (int)q->max_msgs)
-		q->tail_index = 0;
 	q->msg_array[q->tail_index] = msg;
 	q->msg_count += 1;
+	if (NULL != q->stamps)
+		put_stamp (q, (unsigned) q->tail_index, sent_ns);
+	if (NULL != q->lane_ids)
+		put_lane (q, (unsigned) q->tail_index, msg);
 	return true;
 }
 
-static void *dequeue_msg (queue_t *q)
+// slot index of the n'th message from the head
+static unsigned queue_slot (queue_t *q, unsigned n)
+{
+	return ((unsigned) q->head_index + n) % q->max_msgs;
+}
+
+static void move_slot (queue_t *q, unsigned to, unsigned from)
+{
+	q->msg_array[to] = q->msg_array[from];
+	if (NULL != q->stamps)
+		q->stamps[to] = q->stamps[from];
+	if (NULL != q->lane_ids)
+		q->lane_ids[to] = q->lane_ids[from];
+}
+
+// remove the n'th message from the head, closing the gap
+// from whichever end is nearer
+static void *remove_msg_at (queue_t *q, unsigned n)
+{
+	unsigned i;
+	unsigned slot = queue_slot (q, n);
+	void *msg = q->msg_array[slot];
+
+	q->bytes -= msg_bytes (q, msg);
+	if (NULL != q->lane_ids)
+		q->lane_counts[q->lane_ids[slot]] -= 1;
+	if (n < (unsigned) q->msg_count / 2) {
+		for (i = n; i > 0; i--)
+			move_slot (q, queue_slot (q, i), queue_slot (q, i - 1));
+		q->head_index += 1;
+		if (q->head_index >= (int)q->max_msgs)
+			q->head_index = 0;
+	} else {
+		for (i = n; i + 1 < (unsigned) q->msg_count; i++)
+			move_slot (q, queue_slot (q, i), queue_slot (q, i + 1));
+		if (q->tail_index == 0)
+			q->tail_index = (int) q->max_msgs - 1;
+		else
+			q->tail_index -= 1;
+	}
+	q->msg_count -= 1;
+	return msg;
+}
+
+// The lane to dequeue from next. The highest priority (lowest numbered)
+// lane with messages, or with lane weights, the current lane until it
+// has had its weight in messages, then the next one with messages.
+static unsigned pick_lane (queue_t *q)
+{
+	unsigned i, lane = 0;
+
+	if (q->lane_weights[0] > 0) {
+		for (i = 0; i <= q->lanes; i++) {
+			lane = q->cur_lane;
+			if ((q->lane_credit > 0) && (q->lane_counts[lane] > 0)) {
+				q->lane_credit -= 1;
+				return lane;
+			}
+			q->cur_lane = (lane + 1) % q->lanes;
+			q->lane_credit = q->lane_weights[q->cur_lane];
+		}
+	}
+	for (lane = 0; lane + 1 < q->lanes; lane++)
+		if (q->lane_counts[lane] > 0)
+			break;
+	return lane;
+}
+
+static void *dequeue_msg (queue_t *q, libpd_qstamp_t *stamp)
 {
 	void *msg;
+	unsigned n, lane;
+
 	if (q->msg_count <= 0)
 		return NULL;
+	if (NULL != q->lane_ids) {
+		lane = pick_lane (q);
+		for (n = 0; n + 1 < (unsigned) q->msg_count; n++)
+			if (q->lane_ids[queue_slot (q, n)] == lane)
+				break;
+		get_stamp (q, queue_slot (q, n), stamp);
+		return remove_msg_at (q, n);
+	}
 	msg = q->msg_array[q->head_index];
+	q->bytes -= msg_bytes (q, msg);
+	get_stamp (q, (unsigned) q->head_index, stamp);
 	q->head_index += 1;
 	if (q->head_index >= (int)q->max_msgs)
 		q->head_index = 0;
@@ -145,6 +590,90 @@ static void *dequeue_msg (queue_t *q)
 	return msg;
 }
 
+// Find the message to remove for the overflow policy.
+// Returns its position from the head, or -1 if none may be removed.
+static int find_victim (queue_t *q, void *msg)
+{
+	unsigned n;
+	int prio;
+
+	if (q->overflow == LIBPD_QOVERFLOW_DROP_OLDEST) {
+		if ((NULL != q->prio_func) && 
+		    (q->prio_func (q->msg_array[q->head_index]) == LIBPD_QPRIO_KEEP))
+			return -1;
+		return 0;
+	}
+	prio = q->prio_func (msg);
+	for (n = 0; n < (unsigned) q->msg_count; n++)
+		if (q->prio_func (q->msg_array[queue_slot (q, n)]) < prio)
+			return (int) n;
+	return -1;
+}
+
+// whether removing the n'th message leaves room for msg under max_bytes.
+// Only one message is removed per send.
+static bool victim_makes_room (queue_t *q, unsigned n, void *msg)
+{
+	if (0 == q->max_bytes)
+		return true;
+	return q->bytes - msg_bytes (q, q->msg_array[queue_slot (q, n)]) 
+		+ msg_bytes (q, msg) <= q->max_bytes;
+}
+
+static bool ring_push (queue_t *q, void *msg, uint64_t sent_ns)
+{
+	ring_t *r = q->ring;
+	ring_cell_t *cell;
+	int diff;
+	unsigned pos = __atomic_load_n (&r->tail, __ATOMIC_RELAXED);
+
+	while (true) {
+		cell = &r->cells[pos & r->mask];
+		diff = (int) (__atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE) - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n (&r->tail, &pos, pos + 1, true,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return false;	// full
+		} else {
+			pos = __atomic_load_n (&r->tail, __ATOMIC_RELAXED);
+		}
+	}
+	cell->msg = msg;
+	if (NULL != q->stamps)
+		put_stamp (q, pos & r->mask, sent_ns);
+	__atomic_store_n (&cell->seq, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static void *ring_pop (queue_t *q, libpd_qstamp_t *stamp)
+{
+	ring_t *r = q->ring;
+	void *msg;
+	unsigned pos = r->head;
+	ring_cell_t *cell = &r->cells[pos & r->mask];
+
+	if (__atomic_load_n (&cell->seq, __ATOMIC_ACQUIRE) != (pos + 1))
+		return NULL;	// empty, or producer has not published yet
+	msg = cell->msg;
+	get_stamp (q, pos & r->mask, stamp);
+	__atomic_store_n (&cell->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+	__atomic_store_n (&r->head, pos + 1, __ATOMIC_RELAXED);
+	return msg;
+}
+
+// wake the other side, but only if it is parked on the cond var
+static void ring_wake (queue_t *q, int *parked, pthread_cond_t *cond)
+{
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (__atomic_load_n (parked, __ATOMIC_SEQ_CST) == 0)
+		return;
+	pthread_mutex_lock (&q->mutex);
+	pthread_cond_broadcast (cond);
+	pthread_mutex_unlock (&q->mutex);
+}
+
 int libpd_qdestroy (libpd_mq_t *mq, free_msg_func_t *free_msg_func)
 {
 	queue_t *q = (queue_t*) *mq;
@@ -153,13 +682,24 @@ int libpd_qdestroy (libpd_mq_t *mq, free_msg_func_t *free_msg_func)
 		return 0;
 	pthread_mutex_lock (&q->mutex);
 	if (NULL != free_msg_func) {
-		msg = dequeue_msg (q);
-		while (NULL != msg) {
-			(*free_msg_func) (msg);
-			msg = dequeue_msg (q);
+		if (NULL != q->ring) {
+			while (NULL != (msg = ring_pop (q, NULL)))
+				(*free_msg_func) (msg);
+		} else {
+			msg = dequeue_msg (q, NULL);
+			while (NULL != msg) {
+				(*free_msg_func) (msg);
+				msg = dequeue_msg (q, NULL);
+			}
 		}
 	}
-	free (q->msg_array);
+	if (NULL != q->ring)
+		ring_destroy (q->ring);
+	else
+		free (q->msg_array);
+	free (q->stamps);
+	free (q->lane_ids);
+	event_fd_close (q);
 	pthread_cond_destroy (&q->not_empty_cond);
 	pthread_cond_destroy (&q->not_full_cond);
 	pthread_mutex_unlock (&q->mutex);
@@ -169,28 +709,147 @@ int libpd_qdestroy (libpd_mq_t *mq, free_msg_func_t *free_msg_func)
 	return 0;
 }
 
-int libpd_qsend (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr)
+static int ring_send (queue_t *q, void *msg, uint64_t sent_ns,
+	uint64_t timeout_ns, int *exterr)
 {
-	queue_t *q = (queue_t*) mq;
+	ring_t *r = q->ring;
 	struct timespec ts;
-	int rtn;
+	int rtn = 0;
 
-	*exterr = 0;
-	if (NULL == mq)
-		return LIBPD_QERR_SEND_NULL;
+	if (ring_push (q, msg, sent_ns)) {
+		if (q->event_fd >= 0)
+			ring_event_add (q, 1);
+		ring_wake (q, &r->consumer_parked, &q->not_empty_cond);
+		return 0;
+	}
+	if (0 == timeout_ns)
+		return 1;
+	rtn = get_expire_time_ns (timeout_ns, &ts);
+	if (rtn != 0) {
+		*exterr = rtn;
+		libpd_log_err (LEVEL_ERROR, rtn, 
+			("clock error waiting to send queue\n"));
+		return LIBPD_QERR_SEND_EXPTIME;
+	}
 	pthread_mutex_lock (&q->mutex);
-	while (true) {
-		if (enqueue_msg (q, msg))
+	__atomic_add_fetch (&r->producers_parked, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	while (!ring_push (q, msg, sent_ns)) {
+		rtn = pthread_cond_timedwait (&q->not_full_cond, &q->mutex, &ts);
+		if (rtn != 0)
 			break;
-		rtn = get_expire_time (timeout_ms, &ts);
+	}
+	__atomic_sub_fetch (&r->producers_parked, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock (&q->mutex);
+	if (rtn == ETIMEDOUT)
+		return 1;
+	if (rtn != 0) {
+		*exterr = rtn;
+		libpd_log_err (LEVEL_ERROR, rtn, 
+			("pthread_cond_timedwait error waiting for not_full_cond\n"));
+		return LIBPD_QERR_SEND_CONDWAIT;
+	}
+	if (q->event_fd >= 0)
+		ring_event_add (q, 1);
+	ring_wake (q, &r->consumer_parked, &q->not_empty_cond);
+	return 0;
+}
+
+static int ring_receive (queue_t *q, void **msgs, libpd_qstamp_t *stamps,
+	unsigned max_msgs, uint64_t timeout_ns, unsigned *count, int *exterr)
+{
+	ring_t *r = q->ring;
+	struct timespec ts;
+	void *msg__;
+	unsigned n = 0;
+	int rtn = 0;
+
+	msg__ = ring_pop (q, stamps);
+	if (NULL == msg__) {
+		if (0 == timeout_ns)
+			return 1;
+		rtn = get_expire_time_ns (timeout_ns, &ts);
 		if (rtn != 0) {
 			*exterr = rtn;
 			libpd_log_err (LEVEL_ERROR, rtn, 
-				("gettimeofday error waiting to send queue\n"));
+				("clock error waiting to receive on queue\n"));
+			return LIBPD_QERR_RCV_EXPTIME;
+		}
+		pthread_mutex_lock (&q->mutex);
+		__atomic_store_n (&r->consumer_parked, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence (__ATOMIC_SEQ_CST);
+		while (NULL == (msg__ = ring_pop (q, stamps))) {
+			rtn = pthread_cond_timedwait (&q->not_empty_cond, &q->mutex, &ts);
+			if (rtn != 0)
+				break;
+		}
+		__atomic_store_n (&r->consumer_parked, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock (&q->mutex);
+		if (NULL == msg__) {
+			if (rtn == ETIMEDOUT)
+				return 1;
+			*exterr = rtn;
+			libpd_log_err (LEVEL_ERROR, rtn, 
+				("pthread_cond_timedwait error waiting for not_empty_cond\n"));
+			return LIBPD_QERR_RCV_CONDWAIT;
+		}
+	}
+	msgs[n++] = msg__;
+	while ((n < max_msgs) && 
+	    (NULL != (msg__ = ring_pop (q, (NULL == stamps) ? NULL : &stamps[n]))))
+		msgs[n++] = msg__;
+	*count = n;
+	if (q->event_fd >= 0)
+		ring_event_add (q, -(int) n);
+	ring_wake (q, &r->producers_parked, &q->not_full_cond);
+	return 0;
+}
+
+// evicted is NULL unless called from libpd_qsend_evict
+static int queue_send (queue_t *q, void *msg, uint64_t sent_ns,
+	uint64_t timeout_ns, void **evicted, int *exterr)
+{
+	struct timespec ts;
+	bool have_expire_time = false;
+	int rtn;
+
+	if ((NULL != evicted) && (q->overflow != LIBPD_QOVERFLOW_BLOCK))
+		timeout_ns = 0;
+	if (NULL != q->ring)
+		return ring_send (q, msg, sent_ns, timeout_ns, exterr);
+	pthread_mutex_lock (&q->mutex);
+	while (true) {
+		if (enqueue_msg (q, msg, sent_ns))
+			break;
+		if ((NULL != evicted) && (q->overflow >= LIBPD_QOVERFLOW_DROP_OLDEST)) {
+			rtn = find_victim (q, msg);
+			if ((rtn < 0) || !victim_makes_room (q, (unsigned) rtn, msg)) {
+				pthread_mutex_unlock (&q->mutex);
+				return 1;
+			}
+			*evicted = remove_msg_at (q, (unsigned) rtn);
+			continue;
+		}
+		if (0 == timeout_ns) {
 			pthread_mutex_unlock (&q->mutex);
-			return LIBPD_QERR_SEND_EXPTIME;
+			return 1;
+		}
+		// the expire time is fixed on the first wait, so spurious
+		// wakeups don't extend the timeout
+		if (!have_expire_time) {
+			rtn = get_expire_time_ns (timeout_ns, &ts);
+			if (rtn != 0) {
+				*exterr = rtn;
+				libpd_log_err (LEVEL_ERROR, rtn, 
+					("clock error waiting to send queue\n"));
+				pthread_mutex_unlock (&q->mutex);
+				return LIBPD_QERR_SEND_EXPTIME;
+			}
+			have_expire_time = true;
 		}
+		q->send_waiters += 1;
 		rtn = pthread_cond_timedwait (&q->not_full_cond, &q->mutex, &ts);
+		q->send_waiters -= 1;
 		if (rtn != 0) {
 			if (rtn == ETIMEDOUT) {
 				pthread_mutex_unlock (&q->mutex);
@@ -203,34 +862,79 @@ int libpd_qsend (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr)
 			return LIBPD_QERR_SEND_CONDWAIT;
 		}
 	}
-	if (q->msg_count == 1)
+	if (q->msg_count == 1) {
 		pthread_cond_signal (&q->not_empty_cond);
+		if (q->event_fd >= 0)
+			event_fd_sync (q, q->msg_count);
+	}
 	pthread_mutex_unlock (&q->mutex);
 	return 0;
 }
 
-int libpd_qreceive (libpd_mq_t mq, void **msg, unsigned timeout_ms, int *exterr)
+int libpd_qsend_ns (libpd_mq_t mq, void *msg, uint64_t timeout_ns, int *exterr)
+{
+	*exterr = 0;
+	if (NULL == mq)
+		return LIBPD_QERR_SEND_NULL;
+	return queue_send ((queue_t*) mq, msg, 0, timeout_ns, NULL, exterr);
+}
+
+int libpd_qsend (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr)
+{
+	return libpd_qsend_ns (mq, msg, (uint64_t) timeout_ms * NS_PER_MS, exterr);
+}
+
+int libpd_qsend_stamp (libpd_mq_t mq, void *msg, uint64_t sent_ns,
+	uint64_t timeout_ns, int *exterr)
+{
+	*exterr = 0;
+	if (NULL == mq)
+		return LIBPD_QERR_SEND_NULL;
+	return queue_send ((queue_t*) mq, msg, sent_ns, timeout_ns, NULL, exterr);
+}
+
+int libpd_qsend_evict (libpd_mq_t mq, void *msg, uint64_t sent_ns,
+	uint64_t timeout_ns, void **evicted, int *exterr)
+{
+	*exterr = 0;
+	*evicted = NULL;
+	if (NULL == mq)
+		return LIBPD_QERR_SEND_NULL;
+	return queue_send ((queue_t*) mq, msg, sent_ns, timeout_ns, evicted, exterr);
+}
+
+static int queue_receive (queue_t *q, void **msgs, libpd_qstamp_t *stamps,
+	unsigned max_msgs, uint64_t timeout_ns, unsigned *count, int *exterr)
 {
-	queue_t *q = (queue_t*) mq;
 	struct timespec ts;
+	bool have_expire_time = false;
 	void *msg__;
+	unsigned n = 0;
 	int rtn;
 
-	*exterr = 0;
-	if (NULL == mq)
-		return LIBPD_QERR_RCV_NULL;
+	if (NULL != q->ring)
+		return ring_receive (q, msgs, stamps, max_msgs, timeout_ns, count, exterr);
 	pthread_mutex_lock (&q->mutex);
 	while (true) {
-		msg__ = dequeue_msg (q);
+		msg__ = dequeue_msg (q, stamps);
 		if (NULL != msg__)
 			break;
-		rtn = get_expire_time (timeout_ms, &ts);
-		if (rtn != 0) {
-			*exterr = rtn;
-			libpd_log_err (LEVEL_ERROR, rtn, 
-				("gettimeofday error waiting to receive on queue\n"));
+		if (0 == timeout_ns) {
 			pthread_mutex_unlock (&q->mutex);
-			return LIBPD_QERR_RCV_EXPTIME;
+			return 1;
+		}
+		// the expire time is fixed on the first wait, so spurious
+		// wakeups don't extend the timeout
+		if (!have_expire_time) {
+			rtn = get_expire_time_ns (timeout_ns, &ts);
+			if (rtn != 0) {
+				*exterr = rtn;
+				libpd_log_err (LEVEL_ERROR, rtn, 
+					("clock error waiting to receive on queue\n"));
+				pthread_mutex_unlock (&q->mutex);
+				return LIBPD_QERR_RCV_EXPTIME;
+			}
+			have_expire_time = true;
 		}
 		rtn = pthread_cond_timedwait (&q->not_empty_cond, &q->mutex, &ts);
 		if (rtn != 0) {
@@ -245,10 +949,98 @@ int libpd_qreceive (libpd_mq_t mq, void **msg, unsigned timeout_ms, int *exterr)
 			return LIBPD_QERR_RCV_CONDWAIT;
 		}
 	}
-	*msg = msg__;
-	if ((q->msg_count+1) == (int)q->max_msgs)
-		pthread_cond_signal (&q->not_full_cond);
+	msgs[n++] = msg__;
+	while ((n < max_msgs) && 
+	    (NULL != (msg__ = dequeue_msg (q, (NULL == stamps) ? NULL : &stamps[n]))))
+		msgs[n++] = msg__;
+	*count = n;
+	if ((q->event_fd >= 0) && (q->msg_count == 0))
+		event_fd_sync (q, 0);
+	if (q->grow_max_msgs > 0)
+		shrink_queue (q);
+	// senders only wait when the queue is full
+	if (q->send_waiters > 0) {
+		if (n == 1)
+			pthread_cond_signal (&q->not_full_cond);
+		else
+			pthread_cond_broadcast (&q->not_full_cond);
+	}
 	pthread_mutex_unlock (&q->mutex);
 	return 0;
 }
 
+int libpd_qreceive_ns (libpd_mq_t mq, void **msg, uint64_t timeout_ns, int *exterr)
+{
+	unsigned count;
+
+	*exterr = 0;
+	if (NULL == mq)
+		return LIBPD_QERR_RCV_NULL;
+	return queue_receive ((queue_t*) mq, msg, NULL, 1, timeout_ns, &count, exterr);
+}
+
+int libpd_qreceive (libpd_mq_t mq, void **msg, unsigned timeout_ms, int *exterr)
+{
+	return libpd_qreceive_ns (mq, msg, (uint64_t) timeout_ms * NS_PER_MS, exterr);
+}
+
+int libpd_qreceive_batch (libpd_mq_t mq, void **msgs, unsigned max_msgs,
+	unsigned timeout_ms, unsigned *count, int *exterr)
+{
+	*exterr = 0;
+	*count = 0;
+	if (NULL == mq)
+		return LIBPD_QERR_RCV_NULL;
+	if (0 == max_msgs)
+		return LIBPD_QERR_RCV_BATCH_SZ;
+	return queue_receive ((queue_t*) mq, msgs, NULL, max_msgs, 
+		(uint64_t) timeout_ms * NS_PER_MS, count, exterr);
+}
+
+int libpd_qreceive_stamp (libpd_mq_t mq, void **msgs, libpd_qstamp_t *stamps,
+	unsigned max_msgs, uint64_t timeout_ns, unsigned *count, int *exterr)
+{
+	*exterr = 0;
+	*count = 0;
+	if (NULL == mq)
+		return LIBPD_QERR_RCV_NULL;
+	if (0 == max_msgs)
+		return LIBPD_QERR_RCV_BATCH_SZ;
+	return queue_receive ((queue_t*) mq, msgs, stamps, max_msgs, 
+		timeout_ns, count, exterr);
+}
+
+unsigned libpd_qcount (libpd_mq_t mq)
+{
+	queue_t *q = (queue_t*) mq;
+	unsigned head, tail;
+
+	if (NULL == mq)
+		return 0;
+	if (NULL == q->ring)
+		return (unsigned) __atomic_load_n (&q->msg_count, __ATOMIC_RELAXED);
+	// tail counts cells claimed by producers that may not be published yet
+	head = __atomic_load_n (&q->ring->head, __ATOMIC_RELAXED);
+	tail = __atomic_load_n (&q->ring->tail, __ATOMIC_RELAXED);
+	if ((tail - head) > (q->ring->mask + 1))
+		return 0;
+	return tail - head;
+}
+
+unsigned libpd_qcapacity (libpd_mq_t mq)
+{
+	queue_t *q = (queue_t*) mq;
+
+	if (NULL == mq)
+		return 0;
+	if (NULL == q->ring)
+		return __atomic_load_n (&q->max_msgs, __ATOMIC_RELAXED);
+	return q->ring->mask + 1;
+}
+
+int libpd_qevent_fd (libpd_mq_t mq)
+{
+	if (NULL == mq)
+		return -1;
+	return ((queue_t*) mq)->event_fd;
+}
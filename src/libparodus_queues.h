@@ -18,9 +18,112 @@
 #define  _LIBPARODUS_QUEUES_H
 
 #include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
 
 typedef void *libpd_mq_t;
 
+/**
+ * Queue flags, used in libpd_qcfg_t
+ */
+// Lock-free single producer / single consumer ring.
+// max_msgs is rounded up to a power of 2.
+// Only one thread may call libpd_qreceive. The producer side is
+// normally a single thread, but an occasional second sender
+// (such as the close receiver message) is tolerated.
+#define LIBPD_QFLAG_SPSC	1
+// Lock-free multiple producer / single consumer ring.
+// Same as LIBPD_QFLAG_SPSC, except any number of threads may
+// call libpd_qsend.
+#define LIBPD_QFLAG_MPSC	2
+// Keep an event fd that is readable whenever the queue holds messages.
+// See libpd_qevent_fd.
+#define LIBPD_QFLAG_EVENT_FD	4
+// Keep a libpd_qstamp_t with each message.
+// See libpd_qsend_stamp and libpd_qreceive_stamp.
+#define LIBPD_QFLAG_STAMP	8
+
+/**
+ * Overflow policies, what libpd_qsend_evict does when the queue is full.
+ * Used in libpd_qcfg_t. The other send functions always wait.
+ */
+// Wait up to the send timeout for room (default)
+#define LIBPD_QOVERFLOW_BLOCK	0
+// Don't queue the message being sent. Send returns 1 right away.
+#define LIBPD_QOVERFLOW_DROP_NEWEST	1
+// libpd_qsend_evict removes the oldest message to make room, unless
+// its priority is LIBPD_QPRIO_KEEP. Not supported on SPSC/MPSC rings.
+#define LIBPD_QOVERFLOW_DROP_OLDEST	2
+// libpd_qsend_evict removes the oldest message of lower priority than
+// the one being sent, if there is one. Requires prio_func.
+// Not supported on SPSC/MPSC rings.
+#define LIBPD_QOVERFLOW_DROP_PRIORITY	3
+
+// Priority of a message that is never removed by an overflow policy
+#define LIBPD_QPRIO_KEEP	0x7FFFFFFF
+
+/**
+ * Get the priority of a message, for LIBPD_QOVERFLOW_DROP_PRIORITY
+ * and LIBPD_QOVERFLOW_DROP_OLDEST. Higher values are more important.
+ * Called with the queue locked.
+ */
+typedef int libpd_qprio_func_t (void *msg);
+
+// Maximum number of lanes in a queue
+#define LIBPD_QMAX_LANES	4
+
+/**
+ * Get the lane of a message, for queues with lanes. 
+ * Lane 0 has the highest priority. Lanes >= the number of lanes
+ * are put in the last lane. Called with the queue locked.
+ */
+typedef unsigned libpd_qlane_func_t (void *msg, void *lane_arg);
+
+/**
+ * Get the size of a message in bytes, for max_bytes.
+ * Must return the same size for a message while it is queued.
+ */
+typedef size_t libpd_qsize_func_t (void *msg);
+
+/**
+ * Queue configuration, used in libpd_qcreate_cfg
+ */
+typedef struct {
+	unsigned max_msgs;	// maximum number of messages queue can hold
+	unsigned flags;		// LIBPD_QFLAG_ ...
+	unsigned overflow;	// LIBPD_QOVERFLOW_ ...
+	libpd_qprio_func_t *prio_func;	// optional, except for DROP_PRIORITY
+	// when > max_msgs, the queue doubles in size when full, up to 
+	// grow_max_msgs, and halves again, down to max_msgs, when it drains
+	// to a quarter full. Not supported on SPSC/MPSC rings.
+	unsigned grow_max_msgs;
+	// when > 0, the queue is also full when the sizes of the queued
+	// messages would exceed max_bytes. A message is always accepted by
+	// an empty queue. Requires size_func.
+	size_t max_bytes;
+	libpd_qsize_func_t *size_func;
+	// when > 1, messages are put in lanes by lane_func, and receive
+	// takes from the highest priority lane with messages. Messages
+	// within a lane stay in order. Not supported on SPSC/MPSC rings.
+	unsigned lanes;
+	// when lane_weights[0] > 0, receive instead takes up to 
+	// lane_weights[i] messages from lane i before moving on to the 
+	// next lane with messages, so low priority lanes aren't starved.
+	// Weights of 0 count as 1.
+	unsigned lane_weights[LIBPD_QMAX_LANES];
+	libpd_qlane_func_t *lane_func;
+	void *lane_arg;	// passed to lane_func
+} libpd_qcfg_t;
+
+/**
+ * Message time stamps, kept by queues created with LIBPD_QFLAG_STAMP.
+ * Times are from get_monotonic_ns.
+ */
+typedef struct {
+	uint64_t sent_ns;	// given to libpd_qsend_stamp, 0 if sent with libpd_qsend
+	uint64_t queued_ns;	// when the message was placed on the queue
+} libpd_qstamp_t;
+
 /** 
  * @brief liboarodus error rtn codes
  * 
@@ -45,6 +148,21 @@ typedef enum {
 	 * unable to allocate q msg array
 	 */
 	LIBPD_QERR_CREATE_ALLOC_2 = -0x1003,
+	/** 
+	 * @brief Error on libpd_qcreate
+	 * invalid overflow policy, or policy not supported with flags
+	 */
+	LIBPD_QERR_CREATE_OVERFLOW = -0x1004,
+	/** 
+	 * @brief Error on libpd_qcreate
+	 * grow_max_msgs not supported with flags, or max_bytes without size_func
+	 */
+	LIBPD_QERR_CREATE_LIMITS = -0x1005,
+	/** 
+	 * @brief Error on libpd_qcreate
+	 * too many lanes, lanes without lane_func, or lanes not supported with flags
+	 */
+	LIBPD_QERR_CREATE_LANES = -0x1006,
 	/** 
 	 * @brief Error on libpd_qcreate
 	 * unable to create mutex
@@ -60,6 +178,11 @@ typedef enum {
 	 * unable to create not_full cond var
 	 */
 	LIBPD_QERR_CREATE_NFCOND = -0x10C0,
+	/** 
+	 * @brief Error on libpd_qcreate
+	 * unable to create event fd
+	 */
+	LIBPD_QERR_CREATE_EVENT_FD = -0x1100,
 	/** 
 	 * @brief Error on libpd_qsend
 	 */
@@ -76,7 +199,7 @@ typedef enum {
 	LIBPD_QERR_SEND_CONDWAIT = -0x2040,
 	/** 
 	 * @brief Error on libpd_qsend
-	 * error on get_expire_time
+	 * error getting the expire time
 	 */
 	LIBPD_QERR_SEND_EXPTIME = -0x2041,
 	/** 
@@ -95,9 +218,14 @@ typedef enum {
 	LIBPD_QERR_RCV_CONDWAIT = -0x3040,
 	/** 
 	 * @brief Error on libpd_qreceive
-	 * error on get_expire_time
+	 * error getting the expire time
 	 */
-	LIBPD_QERR_RCV_EXPTIME = -0x3041
+	LIBPD_QERR_RCV_EXPTIME = -0x3041,
+	/** 
+	 * @brief Error on libpd_qreceive_batch
+	 * max_msgs is 0
+	 */
+	LIBPD_QERR_RCV_BATCH_SZ = -0x3002
 
 } libpd_qerror_t;
 
@@ -115,6 +243,19 @@ typedef enum {
 int libpd_qcreate (libpd_mq_t *mq, const char *queue_name, 
 	unsigned max_msgs, int *exterr);
 
+/**
+ * Create a queue, with configuration options
+ *
+ * @param mq pointer to receive queue object that must be provided
+ *   to all subsequent API calls.
+ * @param queue_name name of queue
+ * @param qcfg queue configuration
+ * @param exterr extra error info
+ * @return 0 on success, valid libpd_qerror_t (LIBPD_QERR_CREATE_ ...)  otherwise. 
+ */
+int libpd_qcreate_cfg (libpd_mq_t *mq, const char *queue_name, 
+	const libpd_qcfg_t *qcfg, int *exterr);
+
 typedef void free_msg_func_t (void *msg);
 
 /**
@@ -137,6 +278,60 @@ int libpd_qdestroy (libpd_mq_t *mq, free_msg_func_t *free_msg_func);
  */
 int libpd_qsend (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr);
 
+/**
+ * Send message on queue, with a timeout in nanoseconds
+ *
+ * Timed waits are measured on the monotonic clock, so they are not
+ * affected by changes to the time of day.
+ *
+ * @param mq queue object
+ * @param msg pointer to message to be sent
+ * @param timeout_ns maximum wait time for message to be placed on the queue
+ * @param exterr extra error info
+ * @return 0 on success, 1 if timed out,
+ *    valid libpd_qerror_t (LIBPD_QERR_SEND_ ...)  otherwise. 
+ */
+int libpd_qsend_ns (libpd_mq_t mq, void *msg, uint64_t timeout_ns, int *exterr);
+
+/**
+ * Send message on queue, with a time stamp
+ *
+ * On a queue created with LIBPD_QFLAG_STAMP, sent_ns and the time the 
+ * message is placed on the queue are kept with the message. 
+ * Otherwise the same as libpd_qsend_ns.
+ *
+ * @param mq queue object
+ * @param msg pointer to message to be sent
+ * @param sent_ns caller's time stamp, such as when the message arrived
+ * @param timeout_ns maximum wait time for message to be placed on the queue
+ * @param exterr extra error info
+ * @return 0 on success, 1 if timed out,
+ *    valid libpd_qerror_t (LIBPD_QERR_SEND_ ...)  otherwise. 
+ */
+int libpd_qsend_stamp (libpd_mq_t mq, void *msg, uint64_t sent_ns,
+	uint64_t timeout_ns, int *exterr);
+
+/**
+ * Send message on queue, applying any overflow policy
+ *
+ * Same as libpd_qsend_stamp, except when the queue was created with
+ * an overflow policy other than LIBPD_QOVERFLOW_BLOCK. Then a full
+ * queue does not wait: the message is dropped (DROP_NEWEST), or
+ * a queued message is removed to make room (DROP_OLDEST, DROP_PRIORITY).
+ *
+ * @param mq queue object
+ * @param msg pointer to message to be sent
+ * @param sent_ns caller's time stamp, see libpd_qsend_stamp
+ * @param timeout_ns maximum wait time, for LIBPD_QOVERFLOW_BLOCK
+ * @param evicted set to the message removed to make room, else NULL.
+ *   The caller must free it.
+ * @param exterr extra error info
+ * @return 0 on success, 1 if timed out or the message was not queued,
+ *    valid libpd_qerror_t (LIBPD_QERR_SEND_ ...)  otherwise. 
+ */
+int libpd_qsend_evict (libpd_mq_t mq, void *msg, uint64_t sent_ns,
+	uint64_t timeout_ns, void **evicted, int *exterr);
+
 /**
  * Receive message from queue
  *
@@ -149,4 +344,88 @@ int libpd_qsend (libpd_mq_t mq, void *msg, unsigned timeout_ms, int *exterr);
  */
 int libpd_qreceive (libpd_mq_t mq, void **msg, unsigned timeout_ms, int *exterr);
 
+/**
+ * Receive message from queue, with a timeout in nanoseconds
+ *
+ * @param mq queue object  
+ * @param msg pointer to variable that will receive message pointer
+ *    this message must be freed
+ * @param timeout_ns maximum wait time for message to be placed on the queue
+ * @param exterr extra error info
+ * @return 0 on success, 1 if timed out,
+ *    valid libpd_qerror_t (LIBPD_QERR_RCV_ ...)  otherwise. 
+ */
+int libpd_qreceive_ns (libpd_mq_t mq, void **msg, uint64_t timeout_ns, int *exterr);
+
+/**
+ * Receive a batch of messages from queue
+ *
+ * Waits up to timeout_ms for the first message, then takes up to
+ * max_msgs messages that are already queued, under a single lock.
+ *
+ * @param mq queue object  
+ * @param msgs array of at least max_msgs pointers that will receive 
+ *    the message pointers. These messages must be freed
+ * @param max_msgs maximum number of messages to receive
+ * @param timeout_ms maximum wait time for the first message
+ * @param count number of messages received
+ * @param exterr extra error info
+ * @return 0 on success, 1 if timed out, 
+ *    valid libpd_qerror_t (LIBPD_QERR_RCV_ ...)  otherwise. 
+ */
+int libpd_qreceive_batch (libpd_mq_t mq, void **msgs, unsigned max_msgs,
+	unsigned timeout_ms, unsigned *count, int *exterr);
+
+/**
+ * Receive a batch of messages from queue, with their time stamps
+ *
+ * Same as libpd_qreceive_batch, with a timeout in nanoseconds. 
+ * The stamps are all 0 unless the queue was created with LIBPD_QFLAG_STAMP.
+ *
+ * @param mq queue object  
+ * @param msgs array of at least max_msgs pointers that will receive 
+ *    the message pointers. These messages must be freed
+ * @param stamps array of at least max_msgs stamps, one for each message
+ * @param max_msgs maximum number of messages to receive
+ * @param timeout_ns maximum wait time for the first message
+ * @param count number of messages received
+ * @param exterr extra error info
+ * @return 0 on success, 1 if timed out, 
+ *    valid libpd_qerror_t (LIBPD_QERR_RCV_ ...)  otherwise. 
+ */
+int libpd_qreceive_stamp (libpd_mq_t mq, void **msgs, libpd_qstamp_t *stamps,
+	unsigned max_msgs, uint64_t timeout_ns, unsigned *count, int *exterr);
+
+/**
+ * Get the number of messages in a queue
+ *
+ * This is a snapshot. Other threads may be sending or receiving.
+ *
+ * @param mq queue object  
+ * @return the message count, or 0 if mq is NULL
+ */
+unsigned libpd_qcount (libpd_mq_t mq);
+
+/**
+ * Get the number of messages a queue can currently hold
+ *
+ * Only changes on queues created with grow_max_msgs.
+ *
+ * @param mq queue object  
+ * @return the capacity, or 0 if mq is NULL
+ */
+unsigned libpd_qcapacity (libpd_mq_t mq);
+
+/**
+ * Get the event fd of a queue created with LIBPD_QFLAG_EVENT_FD
+ *
+ * The fd polls readable while the queue holds messages, and is
+ * cleared by libpd_qreceive when the queue becomes empty. 
+ * Don't read from it.
+ *
+ * @param mq queue object  
+ * @return the fd, or -1 if the queue has no event fd
+ */
+int libpd_qevent_fd (libpd_mq_t mq);
+
 #endif
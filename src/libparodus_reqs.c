@@ -0,0 +1,405 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "libparodus_reqs.h"
+#include "libparodus_time.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+// must be powers of 2
+#define NUM_BUCKETS	256
+#define WHEEL_SLOTS	256
+// timer wheel resolution. One turn of the wheel is 2.56 secs, and
+// a later timeout stays in its slot until the turn it is due.
+#define TICK_MS	10
+
+#define STATUS_PENDING	-1
+
+struct libpd_req {
+	uint32_t hash;
+	int status;	// STATUS_PENDING, or LIBPD_REQ_...
+	bool in_table;	// protected by the bucket lock
+	void *resp;
+	struct libpd_req *next;	// link in the bucket
+	// synchronous requests
+	pthread_cond_t cond;
+	struct timespec expire_ts;
+	// asynchronous requests
+	libpd_req_done_func_t *done_func;
+	void *done_arg;
+	uint64_t deadline_ms;
+	struct libpd_req *timer_next;	// link in the wheel slot
+	struct libpd_req **timer_pprev;	// NULL when not on the wheel
+	size_t id_len;
+	char id[];
+};
+
+typedef struct {
+	pthread_mutex_t mutex;
+	libpd_req_t *head;
+} bucket_t;
+
+// Lock order: the wheel lock may be held while taking a bucket lock,
+// never the other way around. A request is owned by whoever takes it
+// out of its bucket, who also takes it off the wheel before freeing it.
+struct libpd_reqs {
+	bucket_t buckets[NUM_BUCKETS];
+	pthread_mutex_t wheel_mutex;
+	libpd_req_t *wheel[WHEEL_SLOTS];
+	uint64_t wheel_tick;	// last tick expired
+	unsigned count;	// requests in the table
+	unsigned timers;	// requests on the wheel
+	unsigned users;	// synchronous requests not yet freed
+};
+
+static uint32_t id_hash (const char *id, size_t len)
+{
+	uint32_t hash = 2166136261u;	// FNV-1a
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t) id[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static bucket_t *req_bucket (libpd_reqs_t *reqs, uint32_t hash)
+{
+	return &reqs->buckets[hash & (NUM_BUCKETS - 1)];
+}
+
+libpd_reqs_t *libpd_reqs_create (void)
+{
+	unsigned i;
+	libpd_reqs_t *reqs = (libpd_reqs_t *) calloc (1, sizeof (libpd_reqs_t));
+
+	if (NULL == reqs)
+		return NULL;
+	for (i = 0; i < NUM_BUCKETS; i++)
+		pthread_mutex_init (&reqs->buckets[i].mutex, NULL);
+	pthread_mutex_init (&reqs->wheel_mutex, NULL);
+	reqs->wheel_tick = get_monotonic_ms () / TICK_MS;
+	return reqs;
+}
+
+void libpd_reqs_destroy (libpd_reqs_t *reqs)
+{
+	unsigned i;
+
+	if (NULL == reqs)
+		return;
+	for (i = 0; i < NUM_BUCKETS; i++)
+		pthread_mutex_destroy (&reqs->buckets[i].mutex);
+	pthread_mutex_destroy (&reqs->wheel_mutex);
+	free (reqs);
+}
+
+static void free_req (libpd_req_t *req)
+{
+	if (NULL == req->done_func)
+		pthread_cond_destroy (&req->cond);
+	free (req);
+}
+
+// bucket must be locked
+static libpd_req_t *find_req (bucket_t *bucket, uint32_t hash,
+	const char *id, size_t id_len)
+{
+	libpd_req_t *req;
+
+	for (req = bucket->head; NULL != req; req = req->next)
+		if ((req->hash == hash) && (req->id_len == id_len) &&
+		    (memcmp (req->id, id, id_len) == 0))
+			return req;
+	return NULL;
+}
+
+// bucket must be locked
+static void unlink_req (libpd_reqs_t *reqs, bucket_t *bucket, libpd_req_t *req)
+{
+	libpd_req_t **link = &bucket->head;
+
+	while (*link != req)
+		link = &(*link)->next;
+	*link = req->next;
+	req->in_table = false;
+	__atomic_sub_fetch (&reqs->count, 1, __ATOMIC_SEQ_CST);
+}
+
+// wheel must be locked.
+// returns true if req is the only request on the wheel
+static bool link_timer (libpd_reqs_t *reqs, libpd_req_t *req)
+{
+	// round up, so that the slot is only expired once the deadline passes
+	uint64_t tick = (req->deadline_ms + TICK_MS - 1) / TICK_MS;
+	libpd_req_t **slot;
+
+	if (tick <= reqs->wheel_tick)
+		tick = reqs->wheel_tick + 1;
+	slot = &reqs->wheel[tick & (WHEEL_SLOTS - 1)];
+	req->timer_next = *slot;
+	if (NULL != *slot)
+		(*slot)->timer_pprev = &req->timer_next;
+	*slot = req;
+	req->timer_pprev = slot;
+	return __atomic_add_fetch (&reqs->timers, 1, __ATOMIC_SEQ_CST) == 1;
+}
+
+// wheel must be locked
+static void unlink_timer (libpd_reqs_t *reqs, libpd_req_t *req)
+{
+	if (NULL == req->timer_pprev)
+		return;
+	*req->timer_pprev = req->timer_next;
+	if (NULL != req->timer_next)
+		req->timer_next->timer_pprev = req->timer_pprev;
+	req->timer_pprev = NULL;
+	__atomic_sub_fetch (&reqs->timers, 1, __ATOMIC_SEQ_CST);
+}
+
+static void remove_timer (libpd_reqs_t *reqs, libpd_req_t *req)
+{
+	pthread_mutex_lock (&reqs->wheel_mutex);
+	unlink_timer (reqs, req);
+	pthread_mutex_unlock (&reqs->wheel_mutex);
+}
+
+libpd_req_t *libpd_reqs_add (libpd_reqs_t *reqs, const char *id, size_t id_len,
+	uint32_t timeout_ms, libpd_req_done_func_t *done_func, void *done_arg,
+	int *err)
+{
+	bucket_t *bucket;
+	bool first_timer = false;
+	libpd_req_t *req = (libpd_req_t *) malloc (sizeof (libpd_req_t) + id_len);
+
+	*err = -1;
+	if (NULL == req)
+		return NULL;
+	memset ((void *) req, 0, sizeof (libpd_req_t));
+	memcpy (req->id, id, id_len);
+	req->id_len = id_len;
+	req->hash = id_hash (id, id_len);
+	req->status = STATUS_PENDING;
+	req->done_func = done_func;
+	req->done_arg = done_arg;
+	if (NULL == done_func) {
+		if (init_timed_cond (&req->cond) != 0) {
+			free (req);
+			return NULL;
+		}
+		if (get_expire_time (timeout_ms, &req->expire_ts) != 0) {
+			free_req (req);
+			return NULL;
+		}
+	} else {
+		// on the wheel before it can be answered, and so freed
+		req->deadline_ms = get_monotonic_ms () + timeout_ms;
+		pthread_mutex_lock (&reqs->wheel_mutex);
+		first_timer = link_timer (reqs, req);
+		pthread_mutex_unlock (&reqs->wheel_mutex);
+	}
+	bucket = req_bucket (reqs, req->hash);
+	pthread_mutex_lock (&bucket->mutex);
+	if (NULL != find_req (bucket, req->hash, id, id_len)) {
+		pthread_mutex_unlock (&bucket->mutex);
+		if (NULL != done_func)
+			remove_timer (reqs, req);
+		free_req (req);
+		*err = 1;
+		return NULL;
+	}
+	req->next = bucket->head;
+	bucket->head = req;
+	req->in_table = true;
+	__atomic_add_fetch (&reqs->count, 1, __ATOMIC_SEQ_CST);
+	if (NULL == done_func)
+		__atomic_add_fetch (&reqs->users, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock (&bucket->mutex);
+	*err = first_timer ? 2 : 0;
+	return req;
+}
+
+bool libpd_reqs_remove (libpd_reqs_t *reqs, libpd_req_t *req)
+{
+	bucket_t *bucket = req_bucket (reqs, req->hash);
+	bool pending;
+
+	pthread_mutex_lock (&bucket->mutex);
+	pending = req->in_table;
+	if (pending)
+		unlink_req (reqs, bucket, req);
+	pthread_mutex_unlock (&bucket->mutex);
+	if (NULL == req->done_func) {
+		free_req (req);
+		__atomic_sub_fetch (&reqs->users, 1, __ATOMIC_SEQ_CST);
+		return pending;
+	}
+	if (!pending)
+		return false;
+	remove_timer (reqs, req);
+	free_req (req);
+	return true;
+}
+
+int libpd_reqs_wait (libpd_reqs_t *reqs, libpd_req_t *req, void **resp)
+{
+	bucket_t *bucket = req_bucket (reqs, req->hash);
+	int status, rtn;
+
+	pthread_mutex_lock (&bucket->mutex);
+	while (STATUS_PENDING == req->status) {
+		rtn = pthread_cond_timedwait (&req->cond, &bucket->mutex, &req->expire_ts);
+		if ((rtn != 0) && (STATUS_PENDING == req->status)) {
+			// ETIMEDOUT, or an error we can't wait out
+			unlink_req (reqs, bucket, req);
+			req->status = LIBPD_REQ_TIMEDOUT;
+		}
+	}
+	pthread_mutex_unlock (&bucket->mutex);
+	status = req->status;
+	*resp = req->resp;
+	free_req (req);
+	__atomic_sub_fetch (&reqs->users, 1, __ATOMIC_SEQ_CST);
+	return status;
+}
+
+bool libpd_reqs_answer (libpd_reqs_t *reqs, const char *id, size_t id_len,
+	void *resp)
+{
+	uint32_t hash;
+	bucket_t *bucket;
+	libpd_req_t *req;
+
+	if (__atomic_load_n (&reqs->count, __ATOMIC_SEQ_CST) == 0)
+		return false;
+	hash = id_hash (id, id_len);
+	bucket = req_bucket (reqs, hash);
+	pthread_mutex_lock (&bucket->mutex);
+	req = find_req (bucket, hash, id, id_len);
+	if (NULL == req) {
+		pthread_mutex_unlock (&bucket->mutex);
+		return false;
+	}
+	unlink_req (reqs, bucket, req);
+	if (NULL == req->done_func) {
+		req->resp = resp;
+		req->status = LIBPD_REQ_ANSWERED;
+		pthread_cond_signal (&req->cond);
+		pthread_mutex_unlock (&bucket->mutex);
+		return true;
+	}
+	pthread_mutex_unlock (&bucket->mutex);
+	remove_timer (reqs, req);
+	req->done_func (resp, LIBPD_REQ_ANSWERED, req->done_arg);
+	free_req (req);
+	return true;
+}
+
+unsigned libpd_reqs_expire (libpd_reqs_t *reqs)
+{
+	uint64_t now_ms, now_tick, tick, ticks;
+	libpd_req_t *req, *next, *expired = NULL;
+	bucket_t *bucket;
+	bool taken;
+	unsigned count = 0;
+
+	if (__atomic_load_n (&reqs->timers, __ATOMIC_SEQ_CST) == 0)
+		return 0;
+	now_ms = get_monotonic_ms ();
+	now_tick = now_ms / TICK_MS;
+	pthread_mutex_lock (&reqs->wheel_mutex);
+	ticks = now_tick - reqs->wheel_tick;
+	if (ticks > WHEEL_SLOTS)
+		ticks = WHEEL_SLOTS;
+	for (tick = now_tick - ticks + 1; tick <= now_tick; tick++) {
+		for (req = reqs->wheel[tick & (WHEEL_SLOTS - 1)]; NULL != req; req = next) {
+			next = req->timer_next;
+			if (req->deadline_ms > now_ms)
+				continue;	// due on a later turn of the wheel
+			bucket = req_bucket (reqs, req->hash);
+			pthread_mutex_lock (&bucket->mutex);
+			taken = req->in_table;
+			if (taken)
+				unlink_req (reqs, bucket, req);
+			pthread_mutex_unlock (&bucket->mutex);
+			if (!taken)
+				continue;	// being answered, left for the answering thread
+			unlink_timer (reqs, req);
+			req->timer_next = expired;
+			expired = req;
+		}
+	}
+	reqs->wheel_tick = now_tick;
+	pthread_mutex_unlock (&reqs->wheel_mutex);
+
+	for (req = expired; NULL != req; req = next) {
+		next = req->timer_next;
+		req->done_func (NULL, LIBPD_REQ_TIMEDOUT, req->done_arg);
+		free_req (req);
+		count++;
+	}
+	return count;
+}
+
+int libpd_reqs_next_expiry_ms (libpd_reqs_t *reqs)
+{
+	uint64_t next_ms, now_ms;
+
+	if (__atomic_load_n (&reqs->timers, __ATOMIC_SEQ_CST) == 0)
+		return -1;
+	pthread_mutex_lock (&reqs->wheel_mutex);
+	next_ms = (reqs->wheel_tick + 1) * TICK_MS;
+	pthread_mutex_unlock (&reqs->wheel_mutex);
+	now_ms = get_monotonic_ms ();
+	return (now_ms >= next_ms) ? 0 : (int) (next_ms - now_ms);
+}
+
+void libpd_reqs_cancel_all (libpd_reqs_t *reqs)
+{
+	unsigned i;
+	bucket_t *bucket;
+	libpd_req_t *req, *next, *cancelled = NULL;
+
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		bucket = &reqs->buckets[i];
+		pthread_mutex_lock (&bucket->mutex);
+		for (req = bucket->head; NULL != req; req = next) {
+			next = req->next;
+			unlink_req (reqs, bucket, req);
+			if (NULL == req->done_func) {
+				req->status = LIBPD_REQ_CANCELLED;
+				pthread_cond_signal (&req->cond);
+			} else {
+				req->next = cancelled;
+				cancelled = req;
+			}
+		}
+		pthread_mutex_unlock (&bucket->mutex);
+	}
+	for (req = cancelled; NULL != req; req = next) {
+		next = req->next;
+		remove_timer (reqs, req);
+		req->done_func (NULL, LIBPD_REQ_CANCELLED, req->done_arg);
+		free_req (req);
+	}
+	// synchronous waiters free their own requests once they wake
+	while (__atomic_load_n (&reqs->users, __ATOMIC_SEQ_CST) > 0)
+		delay_ms (1);
+}
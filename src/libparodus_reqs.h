@@ -0,0 +1,154 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_REQS_H
+#define  _LIBPARODUS_REQS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Table of requests waiting for a response, keyed by request id.
+ * The table is split into buckets, each with its own lock, so requests
+ * are added and answered from many threads at once.
+ *
+ * A synchronous request is waited for with libpd_reqs_wait, which
+ * times out on its own. An asynchronous request has a done function,
+ * and its timeout is kept in a timer wheel that is run by calling
+ * libpd_reqs_expire, within libpd_reqs_next_expiry_ms.
+ */
+typedef struct libpd_reqs libpd_reqs_t;
+
+/**
+ * A request in the table
+ */
+typedef struct libpd_req libpd_req_t;
+
+/**
+ * Outcome of a request, passed to its done function or returned
+ * by libpd_reqs_wait
+ */
+#define LIBPD_REQ_ANSWERED	0
+#define LIBPD_REQ_TIMEDOUT	1
+#define LIBPD_REQ_CANCELLED	2
+
+/**
+ * Called once when an asynchronous request is answered, times out
+ * or is cancelled. The request is then gone from the table.
+ *
+ * @param resp  the response, NULL unless status is LIBPD_REQ_ANSWERED
+ * @param status  LIBPD_REQ_ANSWERED, TIMEDOUT or CANCELLED
+ * @param arg  done_arg given to libpd_reqs_add
+ */
+typedef void libpd_req_done_func_t (void *resp, int status, void *arg);
+
+/**
+ * Create a request table
+ *
+ * @return the table, or NULL if out of memory
+ */
+libpd_reqs_t *libpd_reqs_create (void);
+
+/**
+ * Destroy a request table. Call libpd_reqs_cancel_all first.
+ *
+ * @param reqs  table, may be NULL
+ */
+void libpd_reqs_destroy (libpd_reqs_t *reqs);
+
+/**
+ * Add a request
+ *
+ * @param reqs  table
+ * @param id  request id, copied
+ * @param id_len  length of id
+ * @param timeout_ms  how long to wait for the response
+ * @param done_func  NULL for a synchronous request
+ * @param done_arg  passed to done_func
+ * @param err  set to 0, or to 2 when the request is the only one on the
+ * timer wheel, so the thread running it may be waiting without a timeout
+ * and needs waking. On error set to 1 if id is already in the table, 
+ * -1 if out of memory.
+ * @return the request, or NULL on error
+ */
+libpd_req_t *libpd_reqs_add (libpd_reqs_t *reqs, const char *id, size_t id_len,
+	uint32_t timeout_ms, libpd_req_done_func_t *done_func, void *done_arg,
+	int *err);
+
+/**
+ * Take back a request that was added but not sent.
+ * A synchronous request is always freed.
+ * An asynchronous request is freed unless it has already timed out,
+ * when its done function is called instead.
+ *
+ * @param reqs  table
+ * @param req  request from libpd_reqs_add
+ * @return true if the request was still in the table
+ */
+bool libpd_reqs_remove (libpd_reqs_t *reqs, libpd_req_t *req);
+
+/**
+ * Wait for the response to a synchronous request, then free the request.
+ *
+ * @param reqs  table
+ * @param req  synchronous request from libpd_reqs_add
+ * @param resp  set to the response, NULL unless LIBPD_REQ_ANSWERED
+ * @return LIBPD_REQ_ANSWERED, TIMEDOUT or CANCELLED
+ */
+int libpd_reqs_wait (libpd_reqs_t *reqs, libpd_req_t *req, void **resp);
+
+/**
+ * Pass a response to the request with the same id, if there is one.
+ * The done function of an asynchronous request is called on this thread.
+ *
+ * @param reqs  table
+ * @param id  request id of the response
+ * @param id_len  length of id
+ * @param resp  the response
+ * @return true if a request took the response
+ */
+bool libpd_reqs_answer (libpd_reqs_t *reqs, const char *id, size_t id_len,
+	void *resp);
+
+/**
+ * Time out the asynchronous requests whose timeout has passed,
+ * calling their done functions on this thread.
+ * Only one thread may run the timer wheel.
+ *
+ * @param reqs  table
+ * @return number of requests timed out
+ */
+unsigned libpd_reqs_expire (libpd_reqs_t *reqs);
+
+/**
+ * Get the time until libpd_reqs_expire should next be called
+ *
+ * @param reqs  table
+ * @return msecs, or -1 if there are no asynchronous requests
+ */
+int libpd_reqs_next_expiry_ms (libpd_reqs_t *reqs);
+
+/**
+ * Cancel all requests. Synchronous waits return LIBPD_REQ_CANCELLED,
+ * and the done functions of asynchronous requests are called on this
+ * thread. Returns when no thread is still using a synchronous request.
+ *
+ * @param reqs  table
+ */
+void libpd_reqs_cancel_all (libpd_reqs_t *reqs);
+
+#endif
@@ -0,0 +1,280 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "libparodus_spool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libparodus_log.h"
+
+#define SPOOL_MAGIC	0x4C4F4F50	// "POOL"
+#define SPOOL_VERSION	1
+#define SPOOL_MIN_BYTES	256
+// each msg is stored as a 4 byte length, then the msg
+#define LEN_SIZE	4
+
+// At the start of the file. Positions only ever increase, and are
+// taken modulo capacity to find the offset in the msg space, so
+// head == tail is empty and tail - head == capacity is full.
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;	// bytes of msg space after the header
+	uint64_t head;	// position of the oldest msg
+	uint64_t tail;	// position after the newest msg
+	uint64_t head_seq;	// sequence number of the oldest msg
+	uint32_t count;	// msgs in the spool
+	uint32_t reserved;
+} spool_header_t;
+
+struct libpd_spool {
+	pthread_mutex_t mutex;
+	bool drop_oldest;
+	int fd;
+	size_t map_len;
+	spool_header_t *hdr;	// the mapped file
+	uint8_t *data;	// msg space, right after the header
+};
+
+static void ring_write (libpd_spool_t *spool, uint64_t pos, const void *src,
+	size_t n)
+{
+	size_t off = (size_t) (pos % spool->hdr->capacity);
+	size_t first = (size_t) spool->hdr->capacity - off;
+
+	if (first > n)
+		first = n;
+	memcpy (spool->data + off, src, first);
+	memcpy (spool->data, (const uint8_t *) src + first, n - first);
+}
+
+static void ring_read (libpd_spool_t *spool, uint64_t pos, void *dst, size_t n)
+{
+	size_t off = (size_t) (pos % spool->hdr->capacity);
+	size_t first = (size_t) spool->hdr->capacity - off;
+
+	if (first > n)
+		first = n;
+	memcpy (dst, spool->data + off, first);
+	memcpy ((uint8_t *) dst + first, spool->data, n - first);
+}
+
+static uint32_t msg_len_at (libpd_spool_t *spool, uint64_t pos)
+{
+	uint32_t len;
+
+	ring_read (spool, pos, &len, LEN_SIZE);
+	return len;
+}
+
+static void reset_header (spool_header_t *hdr, uint64_t capacity)
+{
+	memset ((void *) hdr, 0, sizeof(spool_header_t));
+	hdr->magic = SPOOL_MAGIC;
+	hdr->version = SPOOL_VERSION;
+	hdr->capacity = capacity;
+}
+
+// checks the header and msg lengths of a file opened again, keeping
+// the msgs up to the first one that does not make sense
+static void recover (libpd_spool_t *spool, uint64_t capacity)
+{
+	spool_header_t *hdr = spool->hdr;
+	uint64_t pos;
+	uint32_t len, count = 0;
+
+	if ((hdr->magic != SPOOL_MAGIC) || (hdr->version != SPOOL_VERSION) ||
+	    (hdr->capacity != capacity) || (hdr->tail < hdr->head) ||
+	    (hdr->tail - hdr->head > capacity)) {
+		if (hdr->magic != 0) {
+			libpd_log (LEVEL_INFO, ("LIBPARODUS: starting spool over\n"));
+		}
+		reset_header (hdr, capacity);
+		return;
+	}
+	for (pos = hdr->head; pos < hdr->tail; pos += LEN_SIZE + len) {
+		if (hdr->tail - pos < LEN_SIZE)
+			break;
+		len = msg_len_at (spool, pos);
+		if ((len == 0) || (len > hdr->tail - pos - LEN_SIZE))
+			break;
+		count++;
+	}
+	if (pos != hdr->tail) {
+		libpd_log (LEVEL_ERROR, ("LIBPARODUS: dropped damaged msgs at end of spool\n"));
+	}
+	hdr->tail = pos;
+	hdr->count = count;
+	if (count > 0) {
+		libpd_log (LEVEL_INFO, ("LIBPARODUS: %u msgs in spool\n", count));
+	}
+}
+
+libpd_spool_t *libpd_spool_open (const char *path, size_t max_bytes,
+	bool drop_oldest, int *oserr)
+{
+	libpd_spool_t *spool;
+	struct stat st;
+	void *map;
+	size_t map_len = sizeof(spool_header_t) + max_bytes;
+
+	*oserr = 0;
+	if ((NULL == path) || (max_bytes < SPOOL_MIN_BYTES) ||
+	    (map_len < max_bytes)) {
+		*oserr = EINVAL;
+		return NULL;
+	}
+	spool = (libpd_spool_t *) malloc (sizeof(libpd_spool_t));
+	if (NULL == spool) {
+		*oserr = ENOMEM;
+		return NULL;
+	}
+	spool->fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (spool->fd < 0) {
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to open spool file %s\n", path));
+		free (spool);
+		return NULL;
+	}
+	if ((fstat (spool->fd, &st) != 0) ||
+	    (((size_t) st.st_size != map_len) &&
+	     (ftruncate (spool->fd, (off_t) map_len) != 0))) {
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to size spool file %s\n", path));
+		close (spool->fd);
+		free (spool);
+		return NULL;
+	}
+	map = mmap (NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, spool->fd, 0);
+	if (MAP_FAILED == map) {
+		*oserr = errno;
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to map spool file %s\n", path));
+		close (spool->fd);
+		free (spool);
+		return NULL;
+	}
+	pthread_mutex_init (&spool->mutex, NULL);
+	spool->drop_oldest = drop_oldest;
+	spool->map_len = map_len;
+	spool->hdr = (spool_header_t *) map;
+	spool->data = (uint8_t *) map + sizeof(spool_header_t);
+	recover (spool, (uint64_t) max_bytes);
+	return spool;
+}
+
+void libpd_spool_close (libpd_spool_t *spool)
+{
+	if (NULL == spool)
+		return;
+	msync ((void *) spool->hdr, spool->map_len, MS_ASYNC);
+	munmap ((void *) spool->hdr, spool->map_len);
+	close (spool->fd);
+	pthread_mutex_destroy (&spool->mutex);
+	free (spool);
+}
+
+// drops the oldest msg. Called with the lock held.
+static void drop_head (libpd_spool_t *spool)
+{
+	spool_header_t *hdr = spool->hdr;
+
+	hdr->head += LEN_SIZE + msg_len_at (spool, hdr->head);
+	hdr->head_seq++;
+	hdr->count--;
+}
+
+int libpd_spool_append (libpd_spool_t *spool, const void *msg, size_t len,
+	unsigned *dropped)
+{
+	spool_header_t *hdr = spool->hdr;
+	uint32_t len32 = (uint32_t) len;
+
+	*dropped = 0;
+	if ((len == 0) || (len > hdr->capacity - LEN_SIZE))
+		return -1;
+	pthread_mutex_lock (&spool->mutex);
+	while (hdr->capacity - (hdr->tail - hdr->head) < LEN_SIZE + len) {
+		if (!spool->drop_oldest) {
+			pthread_mutex_unlock (&spool->mutex);
+			return 1;
+		}
+		drop_head (spool);
+		(*dropped)++;
+	}
+	ring_write (spool, hdr->tail, &len32, LEN_SIZE);
+	ring_write (spool, hdr->tail + LEN_SIZE, msg, len);
+	// the msg is only in the spool once tail moves past it
+	__atomic_store_n (&hdr->tail, hdr->tail + LEN_SIZE + len, __ATOMIC_RELEASE);
+	hdr->count++;
+	pthread_mutex_unlock (&spool->mutex);
+	return 0;
+}
+
+int libpd_spool_peek (libpd_spool_t *spool, void **msg, size_t *len,
+	uint64_t *seq)
+{
+	spool_header_t *hdr = spool->hdr;
+
+	*msg = NULL;
+	*len = 0;
+	pthread_mutex_lock (&spool->mutex);
+	if (hdr->count == 0) {
+		pthread_mutex_unlock (&spool->mutex);
+		return 1;
+	}
+	*len = msg_len_at (spool, hdr->head);
+	*msg = malloc (*len);
+	if (NULL == *msg) {
+		pthread_mutex_unlock (&spool->mutex);
+		return -1;
+	}
+	ring_read (spool, hdr->head + LEN_SIZE, *msg, *len);
+	*seq = hdr->head_seq;
+	pthread_mutex_unlock (&spool->mutex);
+	return 0;
+}
+
+bool libpd_spool_remove (libpd_spool_t *spool, uint64_t seq)
+{
+	bool removed = false;
+
+	pthread_mutex_lock (&spool->mutex);
+	if ((spool->hdr->count > 0) && (spool->hdr->head_seq == seq)) {
+		drop_head (spool);
+		removed = true;
+	}
+	pthread_mutex_unlock (&spool->mutex);
+	return removed;
+}
+
+unsigned libpd_spool_count (libpd_spool_t *spool)
+{
+	unsigned count;
+
+	if (NULL == spool)
+		return 0;
+	pthread_mutex_lock (&spool->mutex);
+	count = spool->hdr->count;
+	pthread_mutex_unlock (&spool->mutex);
+	return count;
+}
@@ -0,0 +1,98 @@
+/**
+ * Copyright 2016 Comcast Cable Communications Management, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+#ifndef  _LIBPARODUS_SPOOL_H
+#define  _LIBPARODUS_SPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * Bounded spool of encoded msgs in a memory mapped file.
+ * Msgs are appended at the tail and taken from the head, in order.
+ * The file is a ring, so the spool never grows past its size,
+ * and msgs still spooled when the process ends are there when the
+ * file is opened again.
+ * All functions may be called from many threads at once.
+ */
+typedef struct libpd_spool libpd_spool_t;
+
+/**
+ * Open a spool file, creating it if needed.
+ * An existing file made with a different max_bytes, or not a spool
+ * file, is started over empty. Msgs cut short by a crash are dropped.
+ *
+ * @param path  file name
+ * @param max_bytes  size of the msg space, including 4 bytes per msg
+ * @param drop_oldest  when full, drop the oldest msgs to make room,
+ * instead of refusing the new msg
+ * @param oserr  set to errno on error
+ * @return the spool, or NULL on error
+ */
+libpd_spool_t *libpd_spool_open (const char *path, size_t max_bytes,
+	bool drop_oldest, int *oserr);
+
+/**
+ * Close a spool. Msgs still in it stay in the file.
+ *
+ * @param spool  spool, may be NULL
+ */
+void libpd_spool_close (libpd_spool_t *spool);
+
+/**
+ * Append a msg
+ *
+ * @param spool  spool
+ * @param msg  encoded msg, copied
+ * @param len  length of msg
+ * @param dropped  set to the number of old msgs dropped to make room
+ * @return 0 on success, 1 if full, -1 if the msg can never fit
+ */
+int libpd_spool_append (libpd_spool_t *spool, const void *msg, size_t len,
+	unsigned *dropped);
+
+/**
+ * Get a copy of the oldest msg, leaving it in the spool
+ *
+ * @param spool  spool
+ * @param msg  set to the copy, to be freed with free
+ * @param len  set to the length of msg
+ * @param seq  set to the sequence number of the msg, for libpd_spool_remove
+ * @return 0 on success, 1 if empty, -1 if out of memory
+ */
+int libpd_spool_peek (libpd_spool_t *spool, void **msg, size_t *len,
+	uint64_t *seq);
+
+/**
+ * Remove the oldest msg, if it is still the one with sequence number seq.
+ * It is not when it was dropped to make room since libpd_spool_peek.
+ *
+ * @param spool  spool
+ * @param seq  sequence number from libpd_spool_peek
+ * @return true if removed
+ */
+bool libpd_spool_remove (libpd_spool_t *spool, uint64_t seq);
+
+/**
+ * Get the number of msgs in the spool
+ *
+ * @param spool  spool, may be NULL
+ * @return number of msgs
+ */
+unsigned libpd_spool_count (libpd_spool_t *spool);
+
+#endif
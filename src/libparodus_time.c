@@ -133,26 +133,68 @@ int make_current_timestamp (char *timestamp)
 	return 0;
 }
 
-int get_expire_time (uint32_t ms, struct timespec *ts)
+// The clock used for timed cond waits. 
+// pthread_condattr_setclock is not available on mac.
+#ifdef __APPLE__
+#define TIMED_COND_CLOCK CLOCK_REALTIME
+#else
+#define TIMED_COND_CLOCK CLOCK_MONOTONIC
+#endif
+
+int get_expire_time_ns (uint64_t ns, struct timespec *ts)
 {
-	struct timeval tv;
-	int err = gettimeofday (&tv, NULL);
+	struct timespec now;
+	int err = clock_gettime (TIMED_COND_CLOCK, &now);
 	if (err != 0) {
-		libpd_log_err (LEVEL_ERROR, errno, ("Error getting time of day\n"));
+		err = errno;
+		libpd_log_err (LEVEL_ERROR, err, ("Error getting clock time\n"));
 		return err;
 	}
-	tv.tv_sec += ms/1000;
-	tv.tv_usec += (ms%1000) * 1000;
-	if (tv.tv_usec >= 1000000) {
-		tv.tv_sec += 1;
-		tv.tv_usec -= 1000000;
+	ts->tv_sec = now.tv_sec + (time_t) (ns / 1000000000ULL);
+	ts->tv_nsec = now.tv_nsec + (long) (ns % 1000000000ULL);
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec += 1;
+		ts->tv_nsec -= 1000000000L;
 	}
-
-	ts->tv_sec = tv.tv_sec;
-	ts->tv_nsec = tv.tv_usec * 1000L;
 	return 0;
 }
 
+int get_expire_time (uint32_t ms, struct timespec *ts)
+{
+	return get_expire_time_ns ((uint64_t) ms * 1000000ULL, ts);
+}
+
+int init_timed_cond (pthread_cond_t *cond)
+{
+#ifdef __APPLE__
+	return pthread_cond_init (cond, NULL);
+#else
+	int err;
+	pthread_condattr_t attr;
+
+	err = pthread_condattr_init (&attr);
+	if (err != 0)
+		return err;
+	err = pthread_condattr_setclock (&attr, TIMED_COND_CLOCK);
+	if (err == 0)
+		err = pthread_cond_init (cond, &attr);
+	pthread_condattr_destroy (&attr);
+	return err;
+#endif
+}
+
+uint64_t get_monotonic_ns (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t get_monotonic_ms (void)
+{
+	return get_monotonic_ns () / NS_PER_MS;
+}
+
 void delay_ms(unsigned msecs)
 {
   struct timespec ts;
@@ -19,6 +19,7 @@
 
 #include <time.h>
 #include <sys/time.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -27,6 +28,8 @@
 
 #define NONE_TIME "00000000-000000-000"
 
+#define NS_PER_MS 1000000ULL
+
 /*
  * 	timestamps are stored as 19 byte character strings:
  *  YYYYMMDD-HHMMSS-mmm
@@ -80,13 +83,53 @@ int make_current_timestamp (char *timestamp);
 /**
  * Get absolute expiration timespec, given delay in ms
  *
- * @param timestamp 20 byte buffer (19 byte time + ending null)
+ * The expiration time is on the monotonic clock (where supported), 
+ * for use with a cond var created by init_timed_cond.
+ *
  * @param ms  delay in msecs
  * @param ts  expiration time
  * @return 0 on success, valid errno otherwise.
  */
 int get_expire_time (uint32_t ms, struct timespec *ts);
 
+/**
+ * Get absolute expiration timespec, given delay in ns
+ *
+ * Same as get_expire_time, with nanosecond precision.
+ *
+ * @param ns  delay in nsecs
+ * @param ts  expiration time
+ * @return 0 on success, valid errno otherwise.
+ */
+int get_expire_time_ns (uint64_t ns, struct timespec *ts);
+
+/**
+ * Initialize a cond var whose timed waits use the get_expire_time clock,
+ * so they are not affected by changes to the time of day.
+ *
+ * @param cond  cond var to initialize
+ * @return 0 on success, valid errno otherwise.
+ */
+int init_timed_cond (pthread_cond_t *cond);
+
+/**
+ * Get the monotonic clock time in nsecs
+ *
+ * For measuring intervals. Not affected by changes to the time of day.
+ *
+ * @return monotonic time in nsecs
+ */
+uint64_t get_monotonic_ns (void);
+
+/**
+ * Get the monotonic clock time in msecs
+ *
+ * For measuring intervals. Not affected by changes to the time of day.
+ *
+ * @return monotonic time in msecs
+ */
+uint64_t get_monotonic_ms (void);
+
 /**
  * Delay
  *
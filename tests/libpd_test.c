@@ -24,13 +24,20 @@
 #include <ctype.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <poll.h>
 #include <CUnit/Basic.h>
+#include <nanomsg/nn.h>
+#include <nanomsg/pipeline.h>
 #include <stdbool.h>
 
 #include "../src/libparodus.h"
 #include "../src/libparodus_private.h"
 #include "../src/libparodus_time.h"
 #include "../src/libparodus_queues.h"
+#include "../src/libparodus_msgpack.h"
+#include "../src/libparodus_hist.h"
+#include "../src/libparodus_reqs.h"
+#include "../src/libparodus_spool.h"
 #include <pthread.h>
 
 #define MOCK_MSG_COUNT 10
@@ -56,6 +63,10 @@
 #define BAD_PARODUS_URL "tcp://127.0.0.1:x007"
 #define GOOD_PARODUS_URL "tcp://127.0.0.1:6666"
 #define CONNECT_ON_EVERY_SEND_URL "test:tcp://127.0.0.1:6666"
+// used by the tests that stand in for parodus themselves
+#define TEST_PARODUS_URL "tcp://127.0.0.1:6668"
+#define TEST_CLIENT_URL "tcp://127.0.0.1:6669"
+#define TEST_PARODUS_DEST "mac:112233445566/iot"
 //#define CLIENT_URL "ipc:///tmp/parodus_client.ipc"
 
 static char current_dir_buf[256];
@@ -110,14 +121,19 @@ static libpd_instance_t test_instance2;
 // libparodus functions to be tested
 extern void test_set_cfg (libpd_cfg_t *new_cfg);
 extern int flush_wrp_queue (libpd_mq_t wrp_queue, uint32_t delay_ms, int *oserr);
-extern int connect_receiver 
-	(const char *rcv_url, int keepalive_timeout_secs, int *oserr);
-extern int connect_sender (const char *send_url, int *oserr);
+extern void *test_create_zc_pool (void);
+extern void test_release_zc_pool (void *pool);
+extern int test_decode_zc_msg (void *pool, void *nn_buf, int len, wrp_msg_t **msg);
+extern void test_free_zc_msg (wrp_msg_t *msg);
+extern int connect_receiver (const char *rcv_url, int *oserr);
+extern int connect_sender (const char *send_url, int send_timeout_ms, int *oserr);
 extern void shutdown_socket (int *sock);
 
 extern bool is_auth_received (void);
 extern int libparodus_receive__ (libpd_mq_t wrp_queue, 
 	wrp_msg_t **msg, uint32_t ms, int *oserr);
+extern int libparodus_receive_batch__ (libpd_mq_t wrp_queue, wrp_msg_t **msgs, 
+	size_t max_msgs, uint32_t ms, size_t *count, int *oserr);
 
 // libparodus_log functions to be tested
 extern int get_valid_file_num (const char *file_name, const char *date);
@@ -131,6 +147,7 @@ extern int  test_close_receiver (libpd_instance_t instance, int *oserr);
 extern void test_send_wrp_queue_ok (libpd_mq_t wrp_queue, int *oserr);
 extern void test_get_counts (libpd_instance_t instance, 
 	int *keep_alive_count, int *reconnect_count);
+extern uint32_t test_reconnect_delay_ms (unsigned attempts, unsigned *seed);
 
 
 #if TEST_ENVIRONMENT==2
@@ -409,6 +426,64 @@ int send_event_msgs (unsigned *msg_num, unsigned *event_num, int count,
 	return 0;
 }
 
+int send_event_batch (unsigned *event_num, size_t count)
+{
+	int rtn;
+	size_t i, sent = 0;
+	wrp_msg_t *msgs[100];
+
+#ifndef SEND_EVENT_MSGS
+	return 0;
+#endif
+	if (count > 100)
+		return -1;
+	for (i=0; i<count; i++) {
+		(*event_num)++;
+		msgs[i] = (wrp_msg_t *) malloc (sizeof (wrp_msg_t));
+		if (NULL == msgs[i])
+			return -1;
+		memset ((void*) msgs[i], 0, sizeof(wrp_msg_t));
+		msgs[i]->msg_type = WRP_MSG_TYPE__EVENT;
+		msgs[i]->u.event.source = new_str ("---LIBPARODUS---");
+		msgs[i]->u.event.dest = new_str ("---ParodusService---");
+		msgs[i]->u.event.payload = (void*) new_str ("---EventMessagePayload####");
+		insert_number_into_buf ((char *) msgs[i]->u.event.payload, *event_num);
+		msgs[i]->u.event.payload_size = 
+			strlen ((char *) msgs[i]->u.event.payload) + 1;
+	}
+	libpd_log (LEVEL_INFO, ("Sending batch of %zu event msgs\n", count));
+	rtn = libparodus_send_batch (test_instance1, msgs, count, &sent);
+	for (i=0; i<count; i++)
+		wrp_free_struct (msgs[i]);
+	if ((rtn == 0) && (sent != count))
+		return -1;
+	return rtn;
+}
+
+int send_event_timed (unsigned *event_num, uint32_t timeout_ms)
+{
+	int rtn;
+	wrp_msg_t msg;
+	char *payload_buf;
+
+#ifndef SEND_EVENT_MSGS
+	return 0;
+#endif
+	(*event_num)++;
+	memset ((void*) &msg, 0, sizeof(msg));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = "---LIBPARODUS---";
+	msg.u.event.dest = "---ParodusService---";
+	payload_buf = new_str ("---EventMessagePayload####");
+	insert_number_into_buf (payload_buf, *event_num);
+	msg.u.event.payload = (void*) payload_buf;
+	msg.u.event.payload_size = strlen (payload_buf) + 1;
+	libpd_log (LEVEL_INFO, ("Sending timed event msg %u\n", *event_num));
+	rtn = libparodus_send_timed (test_instance1, &msg, timeout_ms);
+	free (payload_buf);
+	return rtn;
+}
+
 void test_send_blocking (void)
 {
 	unsigned event_num = 0;
@@ -677,6 +752,1988 @@ void test_queues (void)
 	CU_ASSERT (flush_queue_count == 0);
 }
 
+void test_spsc_queue (void)
+{
+	test_queue_info_t qinfo;
+	libpd_qcfg_t qcfg;
+	int i, rtn, exterr;
+	void *msg;
+	pthread_t sender_test_tid;
+
+	memset ((void*) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = 3;	// rounded up to 4
+	qcfg.flags = LIBPD_QFLAG_SPSC;
+	qinfo.send_interval_ms = 500;
+
+	CU_ASSERT (libpd_qcreate_cfg (&qinfo.queue, "//TEST_SPSC_QUEUE", 
+		&qcfg, &exterr) == 0);
+	for (i=0; i< 4; i++)
+		test_queue_send_msg (qinfo.queue, qinfo.send_interval_ms, i);
+	CU_ASSERT (libpd_qsend (qinfo.queue, "extra message", 
+		qinfo.send_interval_ms, &exterr) == 1); // timed out
+	for (i=0; i< 4; i++)
+		test_queue_rcv_msg (qinfo.queue, qinfo.send_interval_ms, i);
+	CU_ASSERT (libpd_qreceive (qinfo.queue, &msg, 
+		qinfo.send_interval_ms, &exterr) == 1); // timed out
+	for (i=0; i< 4; i++)
+		test_queue_send_msg (qinfo.queue, qinfo.send_interval_ms, i);
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdestroy (&qinfo.queue, &qfree) == 0);
+	CU_ASSERT (flush_queue_count == 4);
+
+	// sender blocks on a full ring, receiver blocks on an empty ring
+	CU_ASSERT (libpd_qcreate_cfg (&qinfo.queue, "//TEST_SPSC_QUEUE", 
+		&qcfg, &exterr) == 0);
+	qinfo.initial_wait_ms = 1000;
+	qinfo.num_msgs = 200;
+	qinfo.send_interval_ms = 5000;
+	rtn = pthread_create 
+		(&sender_test_tid, NULL, test_queue_sender_thread, (void*) &qinfo);
+	CU_ASSERT (rtn == 0);
+	if (rtn == 0) {
+		for (i=0; i< (int)qinfo.num_msgs; i++)
+			test_queue_rcv_msg (qinfo.queue, 4000, i);
+		pthread_join (sender_test_tid, NULL);
+	}
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdestroy (&qinfo.queue, &qfree) == 0);
+	CU_ASSERT (flush_queue_count == 0);
+}
+
+void test_mpsc_queue (void)
+{
+	#define NUM_MPSC_SENDERS 3
+	test_queue_info_t qinfo;
+	libpd_qcfg_t qcfg;
+	int i, exterr;
+	int threads_started = 0;
+	void *msg;
+	pthread_t sender_test_tids[NUM_MPSC_SENDERS];
+
+	memset ((void*) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = 4;
+	qcfg.flags = LIBPD_QFLAG_MPSC;
+	qinfo.initial_wait_ms = 0;
+	qinfo.num_msgs = 20;
+	qinfo.send_interval_ms = 5000;
+
+	CU_ASSERT (libpd_qcreate_cfg (&qinfo.queue, "//TEST_MPSC_QUEUE", 
+		&qcfg, &exterr) == 0);
+	CU_ASSERT (libpd_qsend (qinfo.queue, "extra message", 0, &exterr) == 0);
+	CU_ASSERT (libpd_qreceive (qinfo.queue, &msg, 0, &exterr) == 0);
+	for (i=0; i<NUM_MPSC_SENDERS; i++) {
+		if (pthread_create (&sender_test_tids[i], NULL, 
+				test_queue_sender_thread, (void*) &qinfo) != 0)
+			break;
+		threads_started++;
+	}
+	CU_ASSERT (threads_started == NUM_MPSC_SENDERS);
+	for (i=0; i< (int)qinfo.num_msgs * threads_started; i++)
+		test_queue_rcv_msg (qinfo.queue, 4000, -1);
+	for (i=0; i<threads_started; i++)
+		pthread_join (sender_test_tids[i], NULL);
+	flush_queue_count = 0;
+	CU_ASSERT (libpd_qdestroy (&qinfo.queue, &qfree) == 0);
+	CU_ASSERT (flush_queue_count == 0);
+}
+
+void test_queue_batch (unsigned qflags)
+{
+	libpd_mq_t q;
+	libpd_qcfg_t qcfg;
+	int i, exterr;
+	unsigned count;
+	void *msgs[8];
+
+	memset ((void*) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = 8;
+	qcfg.flags = qflags;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_BATCH_QUEUE", &qcfg, &exterr) == 0);
+	CU_ASSERT (libpd_qreceive_batch (q, msgs, 0, 100, &count, &exterr) 
+		== LIBPD_QERR_RCV_BATCH_SZ);
+	CU_ASSERT (libpd_qreceive_batch (q, msgs, 8, 100, &count, &exterr) == 1);
+	CU_ASSERT (count == 0);
+	for (i=0; i< 5; i++)
+		test_queue_send_msg (q, 500, i);
+	CU_ASSERT (libpd_qreceive_batch (q, msgs, 3, 100, &count, &exterr) == 0);
+	CU_ASSERT (count == 3);
+	for (i=0; i< (int)count; i++) {
+		CU_ASSERT (get_msg_num ((char*)msgs[i]) == i);
+		free (msgs[i]);
+	}
+	CU_ASSERT (libpd_qreceive_batch (q, msgs, 8, 100, &count, &exterr) == 0);
+	CU_ASSERT (count == 2);
+	for (i=0; i< (int)count; i++) {
+		CU_ASSERT (get_msg_num ((char*)msgs[i]) == i+3);
+		free (msgs[i]);
+	}
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+}
+
+static uint64_t elapsed_ns (const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (uint64_t) (now.tv_sec - start->tv_sec) * 1000000000ULL
+		+ (uint64_t) now.tv_nsec - (uint64_t) start->tv_nsec;
+}
+
+void test_queue_timeout_ns (unsigned qflags)
+{
+	libpd_mq_t q;
+	libpd_qcfg_t qcfg;
+	struct timespec start;
+	uint64_t ns;
+	int i, exterr;
+	void *msg;
+
+	memset ((void*) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = 2;
+	qcfg.flags = qflags;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_TIMEOUT_NS_QUEUE", &qcfg, &exterr) == 0);
+	CU_ASSERT (libpd_qreceive_ns (q, &msg, 0, &exterr) == 1);
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	CU_ASSERT (libpd_qreceive_ns (q, &msg, 20000000, &exterr) == 1);
+	ns = elapsed_ns (&start);
+	printf ("LIBPD_TEST: 20ms receive timeout took %llu ns\n", 
+		(unsigned long long) ns);
+	CU_ASSERT ((ns >= 20000000) && (ns < 1000000000));
+	for (i=0; i<2; i++)
+		test_queue_send_msg (q, 500, i);
+	msg = (void *) strdup ("Test Message # 2\n");
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	CU_ASSERT (libpd_qsend_ns (q, msg, 20000000, &exterr) == 1);
+	ns = elapsed_ns (&start);
+	CU_ASSERT ((ns >= 20000000) && (ns < 1000000000));
+	free (msg);
+	CU_ASSERT (libpd_qreceive_ns (q, &msg, 20000000, &exterr) == 0);
+	CU_ASSERT (get_msg_num ((char*)msg) == 0);
+	free (msg);
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+}
+
+void test_queue_stamp (unsigned qflags)
+{
+	libpd_mq_t q;
+	libpd_qcfg_t qcfg;
+	libpd_qstamp_t stamps[4];
+	void *msgs[4];
+	unsigned count;
+	uint64_t before_ns;
+	int i, exterr;
+
+	memset ((void*) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = 4;
+	qcfg.flags = qflags | LIBPD_QFLAG_STAMP;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_STAMP_QUEUE", &qcfg, &exterr) == 0);
+	before_ns = get_monotonic_ns ();
+	CU_ASSERT (libpd_qsend_stamp (q, strdup ("Test Message # 0\n"), 12345, 0, &exterr) == 0);
+	test_queue_send_msg (q, 500, 1);
+	CU_ASSERT (libpd_qreceive_stamp (q, msgs, stamps, 4, 0, &count, &exterr) == 0);
+	CU_ASSERT (count == 2);
+	CU_ASSERT (stamps[0].sent_ns == 12345);
+	CU_ASSERT (stamps[1].sent_ns == 0);
+	for (i=0; i< (int)count; i++) {
+		CU_ASSERT (get_msg_num ((char*)msgs[i]) == i);
+		CU_ASSERT (stamps[i].queued_ns >= before_ns);
+		free (msgs[i]);
+	}
+	CU_ASSERT (libpd_qreceive_stamp (q, msgs, stamps, 4, 0, &count, &exterr) == 1);
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+}
+
+// priority is the tens digit of the msg number, 90 and up are kept
+static int test_msg_prio (void *msg)
+{
+	int num = get_msg_num ((char*)msg);
+	return (num >= 90) ? LIBPD_QPRIO_KEEP : num / 10;
+}
+
+// send msg n with libpd_qsend_evict, returning the evicted msg number or -1
+static int test_queue_evict_msg (libpd_mq_t q, int n, int expected_rtn)
+{
+	char msgbuf[100];
+	void *msg, *evicted;
+	int rtn, exterr, num = -1;
+
+	sprintf (msgbuf, "Test Message # %d\n", n);
+	msg = (void *) strdup (msgbuf);
+	CU_ASSERT_FATAL (msg != NULL);
+	rtn = libpd_qsend_evict (q, msg, (uint64_t) n, 20000000, &evicted, &exterr);
+	CU_ASSERT (rtn == expected_rtn);
+	if (rtn != 0)
+		free (msg);
+	if (NULL != evicted) {
+		num = get_msg_num ((char*)evicted);
+		free (evicted);
+	}
+	return num;
+}
+
+void test_queue_overflow (void)
+{
+	libpd_mq_t q;
+	libpd_qcfg_t qcfg;
+	libpd_qstamp_t stamps[4];
+	void *msgs[4];
+	unsigned count;
+	struct timespec start;
+	int i, exterr;
+
+	memset ((void*) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = 3;
+	qcfg.overflow = 4;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_OVERFLOW_QUEUE", &qcfg, &exterr) 
+		== LIBPD_QERR_CREATE_OVERFLOW);
+	qcfg.overflow = LIBPD_QOVERFLOW_DROP_PRIORITY;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_OVERFLOW_QUEUE", &qcfg, &exterr) 
+		== LIBPD_QERR_CREATE_OVERFLOW);
+	qcfg.overflow = LIBPD_QOVERFLOW_DROP_OLDEST;
+	qcfg.flags = LIBPD_QFLAG_SPSC;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_OVERFLOW_QUEUE", &qcfg, &exterr) 
+		== LIBPD_QERR_CREATE_OVERFLOW);
+
+	// drop newest doesn't wait
+	qcfg.flags = 0;
+	qcfg.overflow = LIBPD_QOVERFLOW_DROP_NEWEST;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_OVERFLOW_QUEUE", &qcfg, &exterr) == 0);
+	for (i=0; i<3; i++)
+		CU_ASSERT (test_queue_evict_msg (q, i, 0) == -1);
+	clock_gettime (CLOCK_MONOTONIC, &start);
+	CU_ASSERT (test_queue_evict_msg (q, 3, 1) == -1);
+	CU_ASSERT (elapsed_ns (&start) < 20000000);
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+
+	// drop oldest, unless it is kept
+	qcfg.overflow = LIBPD_QOVERFLOW_DROP_OLDEST;
+	qcfg.prio_func = test_msg_prio;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_OVERFLOW_QUEUE", &qcfg, &exterr) == 0);
+	CU_ASSERT (test_queue_evict_msg (q, 90, 0) == -1);
+	CU_ASSERT (test_queue_evict_msg (q, 1, 0) == -1);
+	CU_ASSERT (test_queue_evict_msg (q, 2, 0) == -1);
+	CU_ASSERT (test_queue_evict_msg (q, 3, 1) == -1);
+	test_queue_rcv_msg (q, 0, 90);
+	CU_ASSERT (test_queue_evict_msg (q, 3, 0) == -1);
+	CU_ASSERT (test_queue_evict_msg (q, 4, 0) == 1);
+	for (i=2; i<5; i++)
+		test_queue_rcv_msg (q, 0, i);
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+
+	// drop oldest of lower priority, stamps move with their msgs
+	qcfg.flags = LIBPD_QFLAG_STAMP;
+	qcfg.overflow = LIBPD_QOVERFLOW_DROP_PRIORITY;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_OVERFLOW_QUEUE", &qcfg, &exterr) == 0);
+	CU_ASSERT (test_queue_evict_msg (q, 0, 0) == -1);
+	CU_ASSERT (test_queue_evict_msg (q, 15, 0) == -1);
+	CU_ASSERT (test_queue_evict_msg (q, 1, 0) == -1);
+	CU_ASSERT (test_queue_evict_msg (q, 16, 0) == 0);
+	CU_ASSERT (test_queue_evict_msg (q, 2, 1) == -1);
+	CU_ASSERT (test_queue_evict_msg (q, 20, 0) == 15);
+	CU_ASSERT (libpd_qreceive_stamp (q, msgs, stamps, 4, 0, &count, &exterr) == 0);
+	CU_ASSERT (count == 3);
+	if (count == 3) {
+		CU_ASSERT (get_msg_num ((char*)msgs[0]) == 1);
+		CU_ASSERT (get_msg_num ((char*)msgs[1]) == 16);
+		CU_ASSERT (get_msg_num ((char*)msgs[2]) == 20);
+	}
+	for (i=0; i< (int)count; i++) {
+		CU_ASSERT ((int) stamps[i].sent_ns == get_msg_num ((char*)msgs[i]));
+		free (msgs[i]);
+	}
+	// plain sends still wait
+	for (i=0; i<3; i++)
+		test_queue_send_msg (q, 500, i);
+	msgs[0] = (void *) strdup ("Test Message # 30\n");
+	CU_ASSERT (libpd_qsend (q, msgs[0], 20, &exterr) == 1);
+	free (msgs[0]);
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+}
+
+static size_t test_msg_size (void *msg)
+{
+	return strlen ((char*)msg) + 1;
+}
+
+void test_queue_limits (void)
+{
+	libpd_mq_t q;
+	libpd_qcfg_t qcfg;
+	char msgbuf[100];
+	void *msg;
+	int i, exterr;
+
+	memset ((void*) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = 2;
+	qcfg.grow_max_msgs = 8;
+	qcfg.flags = LIBPD_QFLAG_SPSC;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_LIMITS_QUEUE", &qcfg, &exterr) 
+		== LIBPD_QERR_CREATE_LIMITS);
+	qcfg.flags = LIBPD_QFLAG_STAMP;
+	qcfg.max_bytes = 40;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_LIMITS_QUEUE", &qcfg, &exterr) 
+		== LIBPD_QERR_CREATE_LIMITS);
+
+	// grows when full, shrinks when a quarter full
+	qcfg.max_bytes = 0;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_LIMITS_QUEUE", &qcfg, &exterr) == 0);
+	CU_ASSERT (libpd_qcapacity (q) == 2);
+	for (i=0; i<8; i++)
+		test_queue_send_msg (q, 0, i);
+	CU_ASSERT (libpd_qcapacity (q) == 8);
+	msg = (void *) strdup ("Test Message # 8\n");
+	CU_ASSERT (libpd_qsend (q, msg, 0, &exterr) == 1);
+	free (msg);
+	for (i=0; i<6; i++)
+		test_queue_rcv_msg (q, 0, i);
+	CU_ASSERT (libpd_qcapacity (q) == 4);
+	test_queue_send_msg (q, 0, 8);
+	test_queue_rcv_msg (q, 0, 6);
+	test_queue_rcv_msg (q, 0, 7);
+	CU_ASSERT (libpd_qcapacity (q) == 2);
+	test_queue_rcv_msg (q, 0, 8);
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+
+	// byte limit, each msg is 18 bytes
+	qcfg.flags = 0;
+	qcfg.grow_max_msgs = 0;
+	qcfg.max_msgs = 8;
+	qcfg.max_bytes = 40;
+	qcfg.size_func = test_msg_size;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_LIMITS_QUEUE", &qcfg, &exterr) == 0);
+	test_queue_send_msg (q, 0, 0);
+	test_queue_send_msg (q, 0, 1);
+	msg = (void *) strdup ("Test Message # 2\n");
+	CU_ASSERT (libpd_qsend (q, msg, 0, &exterr) == 1);
+	test_queue_rcv_msg (q, 0, 0);
+	CU_ASSERT (libpd_qsend (q, msg, 0, &exterr) == 0);
+	test_queue_rcv_msg (q, 0, 1);
+	test_queue_rcv_msg (q, 0, 2);
+	// a msg bigger than max_bytes still goes on an empty queue
+	memset (msgbuf, 'x', 60);
+	strcpy (msgbuf+60, "Test Message # 3\n");
+	test_queue_send_msg (q, 0, 3);
+	msg = (void *) strdup (msgbuf);
+	CU_ASSERT (libpd_qsend (q, msg, 0, &exterr) == 1);
+	test_queue_rcv_msg (q, 0, 3);
+	CU_ASSERT (libpd_qsend (q, msg, 0, &exterr) == 0);
+	test_queue_rcv_msg (q, 0, 3);
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+}
+
+// lane is the tens digit of the msg number
+static unsigned test_msg_lane (void *msg, void *lane_arg)
+{
+	(void) lane_arg;
+	return (unsigned) get_msg_num ((char*)msg) / 10;
+}
+
+void test_queue_lanes (void)
+{
+	libpd_mq_t q;
+	libpd_qcfg_t qcfg;
+	void *msgs[10];
+	unsigned count;
+	int i, exterr;
+	const int strict_in[] = {20, 21, 10, 0, 35, 11, 1};
+	const int strict_out[] = {0, 1, 10, 11, 20, 21, 35};
+	const int weighted_in[] = {0, 1, 2, 3, 10, 11, 20, 21};
+	const int weighted_out[] = {0, 1, 10, 20, 2, 3, 11, 21};
+
+	memset ((void*) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = 10;
+	qcfg.lanes = LIBPD_QMAX_LANES + 1;
+	qcfg.lane_func = test_msg_lane;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_LANES_QUEUE", &qcfg, &exterr) 
+		== LIBPD_QERR_CREATE_LANES);
+	qcfg.lanes = 3;
+	qcfg.flags = LIBPD_QFLAG_MPSC;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_LANES_QUEUE", &qcfg, &exterr) 
+		== LIBPD_QERR_CREATE_LANES);
+
+	// strict priority, msgs past the last lane go in the last lane
+	qcfg.flags = 0;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_LANES_QUEUE", &qcfg, &exterr) == 0);
+	for (i=0; i<7; i++)
+		test_queue_send_msg (q, 0, strict_in[i]);
+	for (i=0; i<7; i++)
+		test_queue_rcv_msg (q, 0, strict_out[i]);
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+
+	// weighted
+	qcfg.lane_weights[0] = 2;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_LANES_QUEUE", &qcfg, &exterr) == 0);
+	for (i=0; i<8; i++)
+		test_queue_send_msg (q, 0, weighted_in[i]);
+	CU_ASSERT (libpd_qreceive_batch (q, msgs, 10, 0, &count, &exterr) == 0);
+	CU_ASSERT (count == 8);
+	for (i=0; i< (int)count; i++) {
+		CU_ASSERT (get_msg_num ((char*)msgs[i]) == weighted_out[i]);
+		free (msgs[i]);
+	}
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+}
+
+void test_hist (void)
+{
+	libpd_hist_t *hist = libpd_hist_create ();
+	libpd_hist_summary_t summary;
+	const double pcts[4] = {50.0, 90.0, 99.0, 99.9};
+	uint64_t values[4];
+	uint64_t i;
+
+	CU_ASSERT_FATAL (hist != NULL);
+	libpd_hist_read (hist, &summary, pcts, values, 4);
+	CU_ASSERT ((summary.count == 0) && (values[0] == 0));
+	for (i=1; i<=1000; i++)
+		libpd_hist_record (hist, i * 1000);
+	libpd_hist_read (hist, &summary, pcts, values, 4);
+	CU_ASSERT (summary.count == 1000);
+	CU_ASSERT (summary.min == 1000);
+	CU_ASSERT (summary.max == 1000000);
+	CU_ASSERT (summary.mean == 500500);
+	// within the 6% bucket error
+	CU_ASSERT ((values[0] >= 500000) && (values[0] <= 530000));
+	CU_ASSERT ((values[1] >= 900000) && (values[1] <= 954000));
+	CU_ASSERT (values[2] == 1000000);	// capped at max
+	CU_ASSERT (values[3] == 1000000);
+	libpd_hist_destroy (hist);
+}
+
+static int req_done_status;
+static void *req_done_resp;
+static unsigned req_done_count;
+
+static void test_req_done (void *resp, int status, void *arg)
+{
+	req_done_status = status;
+	req_done_resp = resp;
+	req_done_count += *(unsigned *) arg;
+}
+
+void test_reqs (void)
+{
+	libpd_reqs_t *reqs = libpd_reqs_create ();
+	libpd_req_t *req;
+	unsigned one = 1;
+	char resp[] = "response";
+	void *got;
+	int err;
+
+	CU_ASSERT_FATAL (reqs != NULL);
+	CU_ASSERT (libpd_reqs_next_expiry_ms (reqs) == -1);
+	req = libpd_reqs_add (reqs, "uuid-1", 6, 1000, NULL, NULL, &err);
+	CU_ASSERT_FATAL ((req != NULL) && (err == 0));
+	CU_ASSERT (libpd_reqs_add (reqs, "uuid-1", 6, 1000, NULL, NULL, &err) == NULL);
+	CU_ASSERT (err == 1);
+	CU_ASSERT (!libpd_reqs_answer (reqs, "uuid-2", 6, resp));
+	CU_ASSERT (libpd_reqs_answer (reqs, "uuid-1", 6, resp));
+	CU_ASSERT (libpd_reqs_wait (reqs, req, &got) == LIBPD_REQ_ANSWERED);
+	CU_ASSERT (got == resp);
+	CU_ASSERT (!libpd_reqs_answer (reqs, "uuid-1", 6, resp));
+
+	req = libpd_reqs_add (reqs, "uuid-1", 6, 20, NULL, NULL, &err);
+	CU_ASSERT_FATAL (req != NULL);
+	CU_ASSERT (libpd_reqs_wait (reqs, req, &got) == LIBPD_REQ_TIMEDOUT);
+	CU_ASSERT (got == NULL);
+
+	req = libpd_reqs_add (reqs, "uuid-3", 6, 1000, test_req_done, &one, &err);
+	CU_ASSERT_FATAL (req != NULL);
+	// the first on the timer wheel
+	CU_ASSERT (err == 2);
+	CU_ASSERT (libpd_reqs_next_expiry_ms (reqs) >= 0);
+	CU_ASSERT (libpd_reqs_answer (reqs, "uuid-3", 6, resp));
+	CU_ASSERT ((req_done_count == 1) && (req_done_status == LIBPD_REQ_ANSWERED));
+	CU_ASSERT (req_done_resp == resp);
+	CU_ASSERT (libpd_reqs_next_expiry_ms (reqs) == -1);
+
+	req = libpd_reqs_add (reqs, "uuid-4", 6, 1000, test_req_done, &one, &err);
+	CU_ASSERT_FATAL (req != NULL);
+	CU_ASSERT (libpd_reqs_remove (reqs, req));
+	CU_ASSERT (req_done_count == 1);
+
+	CU_ASSERT (libpd_reqs_add (reqs, "uuid-5", 6, 10, test_req_done, &one, &err) != NULL);
+	CU_ASSERT (libpd_reqs_add (reqs, "uuid-6", 6, 60000, test_req_done, &one, &err) != NULL);
+	CU_ASSERT (err == 0);
+	CU_ASSERT (libpd_reqs_expire (reqs) == 0);
+	delay_ms (50);
+	CU_ASSERT (libpd_reqs_expire (reqs) == 1);
+	CU_ASSERT ((req_done_count == 2) && (req_done_status == LIBPD_REQ_TIMEDOUT));
+	CU_ASSERT (req_done_resp == NULL);
+	CU_ASSERT (!libpd_reqs_answer (reqs, "uuid-5", 6, resp));
+	libpd_reqs_cancel_all (reqs);
+	CU_ASSERT ((req_done_count == 3) && (req_done_status == LIBPD_REQ_CANCELLED));
+	CU_ASSERT (libpd_reqs_next_expiry_ms (reqs) == -1);
+	libpd_reqs_destroy (reqs);
+}
+
+bool event_fd_readable (int fd)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return (poll (&pfd, 1, 0) == 1) && (pfd.revents & POLLIN);
+}
+
+void test_queue_event_fd (unsigned qflags)
+{
+	libpd_mq_t q;
+	libpd_qcfg_t qcfg;
+	int exterr, fd;
+	void *msg;
+
+	memset ((void*) &qcfg, 0, sizeof(qcfg));
+	qcfg.max_msgs = 8;
+	qcfg.flags = qflags;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_EVENT_FD_QUEUE", &qcfg, &exterr) == 0);
+	CU_ASSERT (libpd_qevent_fd (q) == -1);
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+
+	qcfg.flags = qflags | LIBPD_QFLAG_EVENT_FD;
+	CU_ASSERT (libpd_qcreate_cfg (&q, "//TEST_EVENT_FD_QUEUE", &qcfg, &exterr) == 0);
+	fd = libpd_qevent_fd (q);
+	CU_ASSERT_FATAL (fd >= 0);
+	CU_ASSERT (!event_fd_readable (fd));
+	test_queue_send_msg (q, 500, 0);
+	CU_ASSERT (event_fd_readable (fd));
+	test_queue_send_msg (q, 500, 1);
+	CU_ASSERT (event_fd_readable (fd));
+	CU_ASSERT (libpd_qreceive (q, &msg, 100, &exterr) == 0);
+	free (msg);
+	CU_ASSERT (event_fd_readable (fd));
+	CU_ASSERT (libpd_qreceive (q, &msg, 100, &exterr) == 0);
+	free (msg);
+	CU_ASSERT (!event_fd_readable (fd));
+	CU_ASSERT (libpd_qreceive (q, &msg, 100, &exterr) == 1);
+	CU_ASSERT (!event_fd_readable (fd));
+	test_queue_send_msg (q, 500, 2);
+	CU_ASSERT (event_fd_readable (fd));
+	CU_ASSERT (libpd_qdestroy (&q, &qfree) == 0);
+}
+
+void test_wrp_peek (void)
+{
+	wrp_msg_t msg;
+	void *bytes;
+	ssize_t len;
+	const uint8_t *val;
+	size_t val_len;
+	libpd_wrp_peek_t peek;
+	char *dest = "event:device-status/iot/x";
+	char *payload = "peek payload";
+	char *end_msg = "---END-PARODUS---\n";
+
+	memset ((void*) &msg, 0, sizeof(msg));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = "mac:112233445566/lmlite";
+	msg.u.event.dest = dest;
+	msg.u.event.payload = (void*) payload;
+	msg.u.event.payload_size = strlen (payload);
+	len = wrp_struct_to (&msg, WRP_BYTES, &bytes);
+	CU_ASSERT_FATAL (len > 0);
+	CU_ASSERT (libpd_wrp_peek (bytes, (size_t) len, &peek) == 0);
+	CU_ASSERT (peek.msg_type == WRP_MSG_TYPE__EVENT);
+	CU_ASSERT (peek.dest_len == strlen (dest));
+	if (peek.dest_len == strlen (dest))
+		CU_ASSERT (memcmp (peek.dest, dest, peek.dest_len) == 0);
+	CU_ASSERT (peek.source_len == strlen (msg.u.event.source));
+	if (peek.source_len == strlen (msg.u.event.source))
+		CU_ASSERT (memcmp (peek.source, msg.u.event.source, peek.source_len) == 0);
+	CU_ASSERT (libpd_mp_find_key (bytes, (size_t) len, "source", &val, &val_len) == 0);
+	CU_ASSERT (libpd_mp_find_key (bytes, (size_t) len, "no_such_key", &val, &val_len) == 1);
+	CU_ASSERT (libpd_wrp_peek (bytes, (size_t) len - 1, &peek) == -1);
+	CU_ASSERT (libpd_wrp_peek (bytes, 0, &peek) == -1);
+	free (bytes);
+
+	memset ((void*) &msg, 0, sizeof(msg));
+	msg.msg_type = WRP_MSG_TYPE__SVC_ALIVE;
+	len = wrp_struct_to (&msg, WRP_BYTES, &bytes);
+	CU_ASSERT_FATAL (len > 0);
+	CU_ASSERT (libpd_wrp_peek (bytes, (size_t) len, &peek) == 0);
+	CU_ASSERT (peek.msg_type == WRP_MSG_TYPE__SVC_ALIVE);
+	CU_ASSERT (peek.dest == NULL);
+	CU_ASSERT (peek.source == NULL);
+	free (bytes);
+
+	CU_ASSERT (libpd_wrp_peek (end_msg, strlen (end_msg), &peek) == -1);
+}
+
+void test_mp_write_map (void)
+{
+	static const int ints[] = {0, 127, -32, -33, 128, 255, -128, -129, 256,
+		65535, -32768, -32769, 65536, INT32_MAX, INT32_MIN};
+	libpd_mp_kv_t kvs[5];
+	uint8_t buf[160];
+	char big_key[40];
+	const uint8_t *val;
+	size_t val_len, len;
+	const char *str;
+	libpd_wrp_peek_t peek;
+	wrp_msg_t *msg;
+	unsigned i;
+
+	// every int size, read back as the msg_type
+	kvs[0].key = "msg_type";
+	kvs[0].type = LIBPD_MP_INT;
+	for (i = 0; i < sizeof (ints) / sizeof (ints[0]); i++) {
+		kvs[0].ival = ints[i];
+		len = libpd_mp_map_len (kvs, 1);
+		CU_ASSERT_FATAL (len <= sizeof (buf));
+		libpd_mp_write_map (kvs, 1, buf);
+		CU_ASSERT (libpd_wrp_peek (buf, len, &peek) == 0);
+		CU_ASSERT (peek.msg_type == ints[i]);
+		val = buf;
+		CU_ASSERT (libpd_mp_skip (&val, buf + len) == 0);
+		CU_ASSERT (val == buf + len);
+	}
+
+	// str and bin values, with a key over 31 bytes
+	memset (big_key, 'k', 39);
+	big_key[39] = 0;
+	kvs[0].ival = WRP_MSG_TYPE__REQ;
+	kvs[1].key = "transaction_uuid";
+	kvs[1].type = LIBPD_MP_STR;
+	kvs[1].val = "write-map-uuid";
+	kvs[1].len = strlen ("write-map-uuid");
+	kvs[2].key = "payload";
+	kvs[2].type = LIBPD_MP_BIN;
+	kvs[2].val = "";
+	kvs[2].len = 0;
+	kvs[3].key = big_key;
+	kvs[3].type = LIBPD_MP_STR;
+	kvs[3].val = "x";
+	kvs[3].len = 1;
+	len = libpd_mp_map_len (kvs, 4);
+	CU_ASSERT_FATAL (len <= sizeof (buf));
+	libpd_mp_write_map (kvs, 4, buf);
+	CU_ASSERT (libpd_mp_find_key (buf, len, "transaction_uuid", &val, &val_len) == 0);
+	CU_ASSERT (libpd_mp_read_str (&val, val + val_len, &str, &val_len) == 0);
+	CU_ASSERT ((val_len == 14) && (memcmp (str, "write-map-uuid", 14) == 0));
+	CU_ASSERT (libpd_mp_find_key (buf, len, "payload", &val, &val_len) == 0);
+	CU_ASSERT ((val_len == 2) && (val[0] == 0xC4) && (val[1] == 0));
+	CU_ASSERT (libpd_mp_find_key (buf, len, big_key, &val, &val_len) == 0);
+	CU_ASSERT (libpd_mp_find_key (buf, len - 1, big_key, &val, &val_len) == -1);
+
+	// wrp-c decodes it
+	kvs[2].val = "write map";
+	kvs[2].len = 9;
+	kvs[3].key = "source";
+	kvs[3].val = "dns:webpa.comcast.com/test";
+	kvs[3].len = strlen (kvs[3].val);
+	kvs[4] = kvs[3];
+	kvs[4].key = "dest";
+	kvs[4].val = TEST_PARODUS_DEST;
+	kvs[4].len = strlen (TEST_PARODUS_DEST);
+	len = libpd_mp_map_len (kvs, 5);
+	CU_ASSERT_FATAL (len <= sizeof (buf));
+	libpd_mp_write_map (kvs, 5, buf);
+	CU_ASSERT_FATAL (wrp_to_struct (buf, len, WRP_BYTES, &msg) > 0);
+	CU_ASSERT (msg->msg_type == WRP_MSG_TYPE__REQ);
+	CU_ASSERT (strcmp (msg->u.req.transaction_uuid, "write-map-uuid") == 0);
+	CU_ASSERT (strcmp (msg->u.req.dest, TEST_PARODUS_DEST) == 0);
+	CU_ASSERT ((msg->u.req.payload_size == 9) && 
+		(memcmp (msg->u.req.payload, "write map", 9) == 0));
+	wrp_free_struct (msg);
+}
+
+void test_wrp_template (void)
+{
+	wrp_msg_t msg;
+	wrp_msg_t *decoded;
+	libpd_wrp_template_t *tmpl;
+	void *bytes;
+	ssize_t len;
+	size_t i;
+	char *payload;
+	size_t sizes[] = {0, 31, 32, 255, 256, 65535, 65536};
+
+	payload = (char *) malloc (65536);
+	CU_ASSERT_FATAL (NULL != payload);
+	memset (payload, 'p', 65536);
+	memset ((void*) &msg, 0, sizeof(msg));
+	msg.msg_type = WRP_MSG_TYPE__REQ;
+	msg.u.req.source = "mac:112233445566/iot";
+	msg.u.req.dest = "dns:cloud/config";
+	msg.u.req.transaction_uuid = "template-uuid";
+	tmpl = libparodus_template_create (&msg);
+	CU_ASSERT_FATAL (NULL != tmpl);
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		len = libparodus_template_encode (tmpl, "uuid-1234", payload,
+			sizes[i], &bytes);
+		CU_ASSERT_FATAL (len > 0);
+		CU_ASSERT_FATAL (wrp_to_struct (bytes, (size_t) len, WRP_BYTES,
+			&decoded) > 0);
+		CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__REQ);
+		CU_ASSERT (strcmp (decoded->u.req.source, msg.u.req.source) == 0);
+		CU_ASSERT (strcmp (decoded->u.req.dest, msg.u.req.dest) == 0);
+		CU_ASSERT (strcmp (decoded->u.req.transaction_uuid, "uuid-1234") == 0);
+		CU_ASSERT (decoded->u.req.payload_size == sizes[i]);
+		if (sizes[i] && decoded->u.req.payload_size == sizes[i])
+			CU_ASSERT (memcmp (decoded->u.req.payload, payload, sizes[i]) == 0);
+		wrp_free_struct (decoded);
+		free (bytes);
+	}
+	CU_ASSERT (libparodus_template_encode (tmpl, NULL, payload, 1, &bytes) == -1);
+	libparodus_template_destroy (tmpl);
+
+	memset ((void*) &msg, 0, sizeof(msg));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = "mac:112233445566/iot";
+	msg.u.event.dest = "event:device-status/iot";
+	tmpl = libparodus_template_create (&msg);
+	CU_ASSERT_FATAL (NULL != tmpl);
+	len = libparodus_template_encode (tmpl, NULL, payload, 300, &bytes);
+	CU_ASSERT_FATAL (len > 0);
+	CU_ASSERT_FATAL (wrp_to_struct (bytes, (size_t) len, WRP_BYTES,
+		&decoded) > 0);
+	CU_ASSERT (decoded->msg_type == WRP_MSG_TYPE__EVENT);
+	CU_ASSERT (strcmp (decoded->u.event.dest, msg.u.event.dest) == 0);
+	CU_ASSERT (decoded->u.event.payload_size == 300);
+	wrp_free_struct (decoded);
+	free (bytes);
+	libparodus_template_destroy (tmpl);
+
+	msg.msg_type = WRP_MSG_TYPE__SVC_ALIVE;
+	CU_ASSERT (libparodus_template_create (&msg) == NULL);
+	free (payload);
+}
+
+void test_spool (void)
+{
+	char path[] = "/tmp/libpd_spool_XXXXXX";
+	int fd, oserr, i;
+	libpd_spool_t *spool;
+	char msg[32];
+	void *got;
+	size_t len;
+	uint64_t seq;
+	unsigned dropped;
+
+	fd = mkstemp (path);
+	CU_ASSERT_FATAL (fd >= 0);
+	close (fd);
+	CU_ASSERT (libpd_spool_open (path, 16, false, &oserr) == NULL);
+	CU_ASSERT (oserr == EINVAL);
+	spool = libpd_spool_open (path, 256, false, &oserr);
+	CU_ASSERT_FATAL (NULL != spool);
+	CU_ASSERT (libpd_spool_count (spool) == 0);
+	CU_ASSERT (libpd_spool_peek (spool, &got, &len, &seq) == 1);
+	CU_ASSERT (libpd_spool_append (spool, msg, 300, &dropped) == -1);
+	// 20 byte msgs, 24 bytes each in the spool, so 10 fit in 256
+	for (i = 0; i < 10; i++) {
+		memset (msg, 'a' + i, 20);
+		CU_ASSERT (libpd_spool_append (spool, msg, 20, &dropped) == 0);
+	}
+	CU_ASSERT (libpd_spool_append (spool, msg, 20, &dropped) == 1);
+	CU_ASSERT (libpd_spool_count (spool) == 10);
+	CU_ASSERT_FATAL (libpd_spool_peek (spool, &got, &len, &seq) == 0);
+	CU_ASSERT (len == 20);
+	CU_ASSERT (((char *) got)[0] == 'a');
+	free (got);
+	CU_ASSERT (libpd_spool_remove (spool, seq));
+	CU_ASSERT (!libpd_spool_remove (spool, seq));
+	libpd_spool_close (spool);
+
+	// msgs are still there when opened again, and now drop the oldest
+	spool = libpd_spool_open (path, 256, true, &oserr);
+	CU_ASSERT_FATAL (NULL != spool);
+	CU_ASSERT (libpd_spool_count (spool) == 9);
+	memset (msg, 'z', 20);
+	for (i = 0; i < 3; i++)
+		CU_ASSERT (libpd_spool_append (spool, msg, 20, &dropped) == 0);
+	CU_ASSERT (dropped == 1);
+	CU_ASSERT (libpd_spool_count (spool) == 10);
+	CU_ASSERT_FATAL (libpd_spool_peek (spool, &got, &len, &seq) == 0);
+	CU_ASSERT (((char *) got)[0] == 'd');
+	free (got);
+	for (i = 0; i < 10; i++) {
+		CU_ASSERT_FATAL (libpd_spool_peek (spool, &got, &len, &seq) == 0);
+		free (got);
+		CU_ASSERT (libpd_spool_remove (spool, seq));
+	}
+	CU_ASSERT (libpd_spool_count (spool) == 0);
+	libpd_spool_close (spool);
+
+	// a different size starts over
+	spool = libpd_spool_open (path, 512, false, &oserr);
+	CU_ASSERT_FATAL (NULL != spool);
+	CU_ASSERT (libpd_spool_count (spool) == 0);
+	libpd_spool_close (spool);
+	unlink (path);
+}
+
+void test_zero_copy_decode (void)
+{
+	wrp_msg_t msg;
+	wrp_msg_t *zc_msg;
+	wrp_msg_t *prev_zc_msg;
+	void *pool;
+	void *bytes;
+	char *nn_buf;
+	ssize_t len;
+	char payload[1000];
+	char *source = "mac:112233445566/lmlite";
+	char *dest = "event:device-status/iot";
+
+	pool = test_create_zc_pool ();
+	CU_ASSERT_FATAL (NULL != pool);
+	memset (payload, 'z', sizeof(payload));
+	memset ((void*) &msg, 0, sizeof(msg));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = source;
+	msg.u.event.dest = dest;
+	msg.u.event.payload = (void*) payload;
+	msg.u.event.payload_size = sizeof(payload);
+	len = wrp_struct_to (&msg, WRP_BYTES, &bytes);
+	CU_ASSERT_FATAL (len > 0);
+	nn_buf = (char *) nn_allocmsg ((size_t) len, 0);
+	CU_ASSERT_FATAL (NULL != nn_buf);
+	memcpy (nn_buf, bytes, (size_t) len);
+	free (bytes);
+	CU_ASSERT_FATAL (test_decode_zc_msg (pool, nn_buf, (int) len, &zc_msg) == 0);
+	CU_ASSERT (zc_msg->msg_type == WRP_MSG_TYPE__EVENT);
+	CU_ASSERT (strcmp (zc_msg->u.event.source, source) == 0);
+	CU_ASSERT (strcmp (zc_msg->u.event.dest, dest) == 0);
+	CU_ASSERT (zc_msg->u.event.payload_size == sizeof(payload));
+	// the payload is not copied
+	CU_ASSERT ((char *) zc_msg->u.event.payload > nn_buf);
+	CU_ASSERT ((char *) zc_msg->u.event.payload < nn_buf + len);
+	CU_ASSERT (memcmp (zc_msg->u.event.payload, payload, sizeof(payload)) == 0);
+	test_free_zc_msg (zc_msg);
+	prev_zc_msg = zc_msg;
+
+	memset ((void*) &msg, 0, sizeof(msg));
+	msg.msg_type = WRP_MSG_TYPE__SVC_ALIVE;
+	len = wrp_struct_to (&msg, WRP_BYTES, &bytes);
+	CU_ASSERT_FATAL (len > 0);
+	nn_buf = (char *) nn_allocmsg ((size_t) len, 0);
+	CU_ASSERT_FATAL (NULL != nn_buf);
+	memcpy (nn_buf, bytes, (size_t) len);
+	free (bytes);
+	CU_ASSERT_FATAL (test_decode_zc_msg (pool, nn_buf, (int) len, &zc_msg) == 0);
+	CU_ASSERT (zc_msg->msg_type == WRP_MSG_TYPE__SVC_ALIVE);
+	// the freed msg is reused
+	CU_ASSERT (zc_msg == prev_zc_msg);
+	// the pool is freed after its last msg
+	test_release_zc_pool (pool);
+	test_free_zc_msg (zc_msg);
+}
+
+// Stands in for parodus in the tests that need to see what an instance
+// sends, or to send it msgs at a given time.
+typedef struct {
+	int rcv_sock;	// bound to TEST_PARODUS_URL, gets what instances send
+	int send_sock;	// connected to the instance client url
+} test_parodus_t;
+
+static int test_parodus_open (test_parodus_t *tp, const char *client_url)
+{
+	int timeout_ms = 2000;
+
+	tp->send_sock = -1;
+	tp->rcv_sock = nn_socket (AF_SP, NN_PULL);
+	if (tp->rcv_sock < 0)
+		return -1;
+	if (nn_bind (tp->rcv_sock, TEST_PARODUS_URL) < 0) {
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to bind test parodus\n"));
+		nn_close (tp->rcv_sock);
+		return -1;
+	}
+	if (NULL == client_url)
+		return 0;
+	tp->send_sock = nn_socket (AF_SP, NN_PUSH);
+	if ((tp->send_sock < 0) ||
+	    (nn_setsockopt (tp->send_sock, NN_SOL_SOCKET, NN_SNDTIMEO, 
+			&timeout_ms, sizeof (timeout_ms)) < 0) ||
+	    (nn_connect (tp->send_sock, client_url) < 0)) {
+		libpd_log_err (LEVEL_ERROR, errno, ("Unable to connect test parodus\n"));
+		if (tp->send_sock >= 0)
+			nn_close (tp->send_sock);
+		nn_close (tp->rcv_sock);
+		return -1;
+	}
+	return 0;
+}
+
+static void test_parodus_close (test_parodus_t *tp)
+{
+	if (tp->send_sock >= 0)
+		nn_close (tp->send_sock);
+	nn_close (tp->rcv_sock);
+}
+
+// returns 0 and the msg received, or -1 if none within timeout_ms
+static int test_parodus_receive (test_parodus_t *tp, wrp_msg_t **msg, 
+	int timeout_ms)
+{
+	char *buf = NULL;
+	int len;
+
+	nn_setsockopt (tp->rcv_sock, NN_SOL_SOCKET, NN_RCVTIMEO, 
+		&timeout_ms, sizeof (timeout_ms));
+	len = nn_recv (tp->rcv_sock, &buf, NN_MSG, 0);
+	if (len < 0)
+		return -1;
+	len = (wrp_to_struct (buf, (size_t) len, WRP_BYTES, msg) > 0) ? 0 : -1;
+	nn_freemsg (buf);
+	return len;
+}
+
+static int test_parodus_send (test_parodus_t *tp, wrp_msg_t *msg)
+{
+	void *bytes;
+	ssize_t len = wrp_struct_to (msg, WRP_BYTES, &bytes);
+	int rtn;
+
+	if (len <= 0)
+		return -1;
+	rtn = nn_send (tp->send_sock, bytes, (size_t) len, 0);
+	free (bytes);
+	return (rtn == (int) len) ? 0 : -1;
+}
+
+// sends a request from source to dest, with uuid also as payload
+static int test_parodus_send_req_to (test_parodus_t *tp, const char *source,
+	const char *dest, const char *uuid)
+{
+	wrp_msg_t msg;
+
+	memset ((void*) &msg, 0, sizeof(msg));
+	msg.msg_type = WRP_MSG_TYPE__REQ;
+	msg.u.req.source = (char *) source;
+	msg.u.req.dest = (char *) dest;
+	msg.u.req.transaction_uuid = (char *) uuid;
+	msg.u.req.payload = (void *) uuid;
+	msg.u.req.payload_size = strlen (uuid);
+	return test_parodus_send (tp, &msg);
+}
+
+// sends a request for service_name1, with uuid also as payload
+static int test_parodus_send_req (test_parodus_t *tp, const char *uuid)
+{
+	return test_parodus_send_req_to (tp, "dns:webpa.comcast.com/test", 
+		TEST_PARODUS_DEST, uuid);
+}
+
+// sends a request for service_name1 without a source, with uuid also 
+// as payload. It is encoded here, since wrp-c always packs a source.
+static int test_parodus_send_req_no_source (test_parodus_t *tp, 
+	const char *uuid)
+{
+	libpd_mp_kv_t kvs[4];
+	uint8_t buf[256];
+	size_t len;
+
+	kvs[0].key = "msg_type";
+	kvs[0].type = LIBPD_MP_INT;
+	kvs[0].ival = WRP_MSG_TYPE__REQ;
+	kvs[1].key = "dest";
+	kvs[1].type = LIBPD_MP_STR;
+	kvs[1].val = TEST_PARODUS_DEST;
+	kvs[1].len = strlen (TEST_PARODUS_DEST);
+	kvs[2].key = "transaction_uuid";
+	kvs[2].type = LIBPD_MP_STR;
+	kvs[2].val = uuid;
+	kvs[2].len = strlen (uuid);
+	kvs[3].key = "payload";
+	kvs[3].type = LIBPD_MP_BIN;
+	kvs[3].val = uuid;
+	kvs[3].len = strlen (uuid);
+	len = libpd_mp_map_len (kvs, 4);
+	if (len > sizeof (buf))
+		return -1;
+	libpd_mp_write_map (kvs, 4, buf);
+	return (nn_send (tp->send_sock, buf, len, 0) == (int) len) ? 0 : -1;
+}
+
+// takes a registration msg an instance sends at init
+static void test_parodus_check_service (test_parodus_t *tp, 
+	const char *service_name)
+{
+	wrp_msg_t *msg;
+
+	CU_ASSERT_FATAL (test_parodus_receive (tp, &msg, 2000) == 0);
+	CU_ASSERT (msg->msg_type == WRP_MSG_TYPE__SVC_REGISTRATION);
+	if (msg->msg_type == WRP_MSG_TYPE__SVC_REGISTRATION)
+		CU_ASSERT (strcmp (msg->u.reg.service_name, service_name) == 0);
+	wrp_free_struct (msg);
+}
+
+static void test_parodus_check_registration (test_parodus_t *tp)
+{
+	test_parodus_check_service (tp, service_name1);
+}
+
+static bool payload_is (wrp_msg_t *msg, const char *str)
+{
+	return (msg->msg_type == WRP_MSG_TYPE__REQ) &&
+		(msg->u.req.payload_size == strlen (str)) &&
+		(memcmp (msg->u.req.payload, str, strlen (str)) == 0);
+}
+
+static pthread_t test_main_thread;
+static unsigned rcv_func_count;
+static unsigned rcv_func_errs;
+
+static void test_rcv_func_cb (libpd_instance_t instance, wrp_msg_t *msg)
+{
+	char uuid[32];
+
+	sprintf (uuid, "rcv-func-%u", rcv_func_count);
+	if (pthread_equal (pthread_self (), test_main_thread) || 
+	    !payload_is (msg, uuid))
+		rcv_func_errs++;
+	__atomic_add_fetch (&rcv_func_count, 1, __ATOMIC_SEQ_CST);
+	libparodus_free_msg (instance, msg);
+}
+
+static void wait_count (unsigned *count, unsigned expected, int timeout_ms)
+{
+	while ((__atomic_load_n (count, __ATOMIC_SEQ_CST) < expected) && 
+	    (timeout_ms > 0)) {
+		usleep (10000);
+		timeout_ms -= 10;
+	}
+}
+
+void test_rcv_func (void)
+{
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = true, .keepalive_timeout_secs = 0,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL,
+		.rcv_func = test_rcv_func_cb};
+	libpd_instance_t instance;
+	libpd_stats_t stats;
+	wrp_msg_t *msg;
+	wrp_msg_t *msgs[2];
+	size_t count;
+	char uuid[32];
+	unsigned i;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test rcv_func\n"));
+	test_main_thread = pthread_self ();
+	rcv_func_count = 0;
+	rcv_func_errs = 0;
+	CU_ASSERT_FATAL (test_parodus_open (&tp, TEST_CLIENT_URL) == 0);
+	CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+	test_parodus_check_registration (&tp);
+	for (i = 0; i < 10; i++) {
+		sprintf (uuid, "rcv-func-%u", i);
+		CU_ASSERT (test_parodus_send_req (&tp, uuid) == 0);
+	}
+	wait_count (&rcv_func_count, 10, 5000);
+	CU_ASSERT (rcv_func_count == 10);
+	CU_ASSERT (rcv_func_errs == 0);
+	CU_ASSERT (libparodus_receive (instance, &msg, 0) == LIBPD_ERROR_RCV_CFG);
+	CU_ASSERT (libparodus_receive_batch (instance, msgs, 2, 0, &count) 
+		== LIBPD_ERROR_RCV_CFG);
+	CU_ASSERT (libparodus_close_receiver (instance) == LIBPD_ERROR_CLOSE_RCV_CFG);
+	CU_ASSERT (libparodus_get_rcv_fd (instance) == LIBPD_ERROR_RCV_CFG);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.msgs_delivered == 10);
+	// no receive queue
+	CU_ASSERT (stats.rcv_queue_capacity == 0);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	test_parodus_close (&tp);
+}
+
+// receives a msg for service_name within timeout_ms, and checks its payload
+static void check_rcv_service (libpd_instance_t instance, 
+	const char *service_name, const char *uuid, uint32_t timeout_ms)
+{
+	wrp_msg_t *msg;
+
+	CU_ASSERT_FATAL (libparodus_receive_service (instance, service_name, 
+		&msg, timeout_ms) == 0);
+	CU_ASSERT (payload_is (msg, uuid));
+	wrp_free_struct (msg);
+}
+
+void test_extra_services (void)
+{
+	static const char *extra_services[] = {"svc2", NULL};
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = true, .keepalive_timeout_secs = 0,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL,
+		.extra_services = extra_services};
+	libpd_instance_t instance;
+	libpd_stats_t stats;
+	wrp_msg_t *msg;
+	const char *source = "dns:webpa.comcast.com/test";
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test extra services\n"));
+	CU_ASSERT_FATAL (test_parodus_open (&tp, TEST_CLIENT_URL) == 0);
+	CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+	test_parodus_check_registration (&tp);
+	test_parodus_check_service (&tp, "svc2");
+
+	CU_ASSERT (test_parodus_send_req_to (&tp, source, 
+		"mac:112233445566/svc2", "svc2-0") == 0);
+	check_rcv_service (instance, "svc2", "svc2-0", 2000);
+	CU_ASSERT (libparodus_receive (instance, &msg, 0) == 1);
+
+	// an unregistered service, and a prefix of service_name1
+	CU_ASSERT (test_parodus_send_req_to (&tp, source, 
+		"mac:112233445566/nosuch", "nosuch-0") == 0);
+	CU_ASSERT (test_parodus_send_req_to (&tp, source, 
+		"mac:112233445566/io", "io-0") == 0);
+	CU_ASSERT (test_parodus_send_req_to (&tp, source, 
+		"mac:112233445566/iot/some/path", "iot-0") == 0);
+	CU_ASSERT (test_parodus_send_req (&tp, "iot-1") == 0);
+	check_rcv_service (instance, service_name1, "iot-0", 2000);
+	CU_ASSERT_FATAL (libparodus_receive (instance, &msg, 2000) == 0);
+	CU_ASSERT (payload_is (msg, "iot-1"));
+	wrp_free_struct (msg);
+	CU_ASSERT (libparodus_receive_service (instance, "svc2", &msg, 0) == 1);
+	CU_ASSERT (libparodus_receive_service (instance, "nosuch", &msg, 0) 
+		== LIBPD_ERROR_RCV_SERVICE);
+	CU_ASSERT (libparodus_receive_service (instance, "io", &msg, 0) 
+		== LIBPD_ERROR_RCV_SERVICE);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.drops_service == 2);
+	CU_ASSERT (stats.msgs_delivered == 3);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	test_parodus_close (&tp);
+}
+
+#define DEC_TEST_SOURCES 3	// plus msgs without a source
+#define DEC_TEST_ROUNDS 20
+#define DEC_TEST_FLOOD 100
+
+static const char *dec_test_sources[DEC_TEST_SOURCES] = {
+	"dns:a.webpa.comcast.com/test", "dns:b.webpa.comcast.com/test",
+	"dns:c.webpa.comcast.com/test"};
+// next seq expected, and the thread delivering, for each source
+static unsigned dec_test_next[DEC_TEST_SOURCES+1];
+static pthread_t dec_test_thread[DEC_TEST_SOURCES+1];
+static unsigned dec_test_count;
+static unsigned dec_test_errs;
+static bool dec_test_blocked;
+static bool dec_test_release;
+static pthread_mutex_t dec_test_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dec_test_cond = PTHREAD_COND_INITIALIZER;
+
+// the decode thread queue_raw_msg picks for a source, by its FNV-1a hash
+static unsigned dec_test_decoder (const char *source, unsigned threads)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*source) {
+		hash ^= (uint8_t) *source++;
+		hash *= 16777619u;
+	}
+	return hash % threads;
+}
+
+// uuids are "dec-<source>-<seq>". Seqs from a source must increase, and
+// all be delivered by one thread. "dec-block" waits for dec_test_release.
+static void test_decode_cb (libpd_instance_t instance, wrp_msg_t *msg)
+{
+	unsigned src, seq;
+
+	pthread_mutex_lock (&dec_test_mutex);
+	if (payload_is (msg, "dec-block")) {
+		dec_test_blocked = true;
+		pthread_cond_broadcast (&dec_test_cond);
+		while (!dec_test_release)
+			pthread_cond_wait (&dec_test_cond, &dec_test_mutex);
+	} else if ((sscanf (msg->u.req.transaction_uuid, "dec-%u-%u", 
+			&src, &seq) != 2) || (src > DEC_TEST_SOURCES) ||
+	    (seq < dec_test_next[src])) {
+		dec_test_errs++;
+	} else {
+		if (dec_test_next[src] == 0)
+			dec_test_thread[src] = pthread_self ();
+		else if (!pthread_equal (dec_test_thread[src], pthread_self ()))
+			dec_test_errs++;
+		dec_test_next[src] = seq + 1;
+	}
+	pthread_mutex_unlock (&dec_test_mutex);
+	__atomic_add_fetch (&dec_test_count, 1, __ATOMIC_SEQ_CST);
+	libparodus_free_msg (instance, msg);
+}
+
+static int dec_test_send (test_parodus_t *tp, unsigned src, unsigned seq)
+{
+	char uuid[32];
+
+	sprintf (uuid, "dec-%u-%u", src, seq);
+	if (src == DEC_TEST_SOURCES)
+		return test_parodus_send_req_no_source (tp, uuid);
+	return test_parodus_send_req_to (tp, dec_test_sources[src], 
+		TEST_PARODUS_DEST, uuid);
+}
+
+void test_decode_threads (void)
+{
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = true, .keepalive_timeout_secs = 0,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL,
+		.rcv_func = test_decode_cb, .rcv_decode_threads = 2};
+	libpd_instance_t instance;
+	libpd_stats_t stats;
+	unsigned src, seq, other = DEC_TEST_SOURCES;
+	unsigned delivered;
+	int timeout_ms;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test decode threads\n"));
+	memset ((void *) dec_test_next, 0, sizeof (dec_test_next));
+	dec_test_count = 0;
+	dec_test_errs = 0;
+	dec_test_blocked = false;
+	dec_test_release = false;
+	CU_ASSERT_FATAL (test_parodus_open (&tp, TEST_CLIENT_URL) == 0);
+	CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+	test_parodus_check_registration (&tp);
+
+	// interleaved sources, each delivered in order by its own decoder
+	for (seq = 0; seq < DEC_TEST_ROUNDS; seq++)
+		for (src = 0; src <= DEC_TEST_SOURCES; src++)
+			CU_ASSERT (dec_test_send (&tp, src, seq) == 0);
+	wait_count (&dec_test_count, DEC_TEST_ROUNDS * (DEC_TEST_SOURCES+1), 5000);
+	CU_ASSERT (dec_test_count == DEC_TEST_ROUNDS * (DEC_TEST_SOURCES+1));
+	CU_ASSERT (dec_test_errs == 0);
+	for (src = 0; src <= DEC_TEST_SOURCES; src++)
+		CU_ASSERT (dec_test_next[src] == DEC_TEST_ROUNDS);
+	// msgs without a source are decoded by decoder 0
+	for (src = 0; src < DEC_TEST_SOURCES; src++) {
+		if (dec_test_decoder (dec_test_sources[src], 2) == 0) {
+			CU_ASSERT (pthread_equal (dec_test_thread[src], 
+				dec_test_thread[DEC_TEST_SOURCES]));
+		} else {
+			CU_ASSERT (!pthread_equal (dec_test_thread[src], 
+				dec_test_thread[DEC_TEST_SOURCES]));
+			other = src;
+		}
+	}
+	CU_ASSERT_FATAL (other < DEC_TEST_SOURCES);
+
+	// while decoder 0 is stuck, msgs for it fill its queue and are 
+	// dropped, and the other decoder keeps delivering
+	dec_test_count = 0;
+	CU_ASSERT (test_parodus_send_req_no_source (&tp, "dec-block") == 0);
+	pthread_mutex_lock (&dec_test_mutex);
+	for (timeout_ms = 2000; !dec_test_blocked && (timeout_ms > 0); 
+			timeout_ms -= 10) {
+		pthread_mutex_unlock (&dec_test_mutex);
+		usleep (10000);
+		pthread_mutex_lock (&dec_test_mutex);
+	}
+	CU_ASSERT (dec_test_blocked);
+	pthread_mutex_unlock (&dec_test_mutex);
+	for (seq = 0; seq < DEC_TEST_FLOOD; seq++)
+		CU_ASSERT (dec_test_send (&tp, DEC_TEST_SOURCES, 
+			DEC_TEST_ROUNDS + seq) == 0);
+	CU_ASSERT (dec_test_send (&tp, other, DEC_TEST_ROUNDS) == 0);
+	wait_count (&dec_test_count, 1, 5000);
+	CU_ASSERT (dec_test_count == 1);
+	CU_ASSERT (dec_test_next[other] == DEC_TEST_ROUNDS + 1);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.drops_decode_queue > 0);
+	CU_ASSERT (stats.drops_decode_queue < DEC_TEST_FLOOD);
+
+	pthread_mutex_lock (&dec_test_mutex);
+	dec_test_release = true;
+	pthread_cond_broadcast (&dec_test_cond);
+	pthread_mutex_unlock (&dec_test_mutex);
+	delivered = 2 + DEC_TEST_FLOOD - (unsigned) stats.drops_decode_queue;
+	wait_count (&dec_test_count, delivered, 5000);
+	CU_ASSERT (dec_test_count == delivered);
+	CU_ASSERT (dec_test_errs == 0);
+	// the queued msgs were delivered, the later ones dropped
+	CU_ASSERT (dec_test_next[DEC_TEST_SOURCES] == 
+		DEC_TEST_ROUNDS + delivered - 2);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.drops_decode == 0);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	test_parodus_close (&tp);
+}
+
+// The receiver thread waits for msgs without a socket timeout, and is
+// woken only by shutdown. An END msg from parodus is just a bad msg.
+void test_rcv_wake (void)
+{
+	static const char end_msg[] = "---END-PARODUS---";
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = true, .keepalive_timeout_secs = 60,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL};
+	libpd_instance_t instance;
+	libpd_stats_t stats;
+	wrp_msg_t *msg;
+	uint64_t start_ns;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test receiver wake\n"));
+	CU_ASSERT_FATAL (test_parodus_open (&tp, TEST_CLIENT_URL) == 0);
+	CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+	test_parodus_check_registration (&tp);
+	CU_ASSERT (nn_send (tp.send_sock, end_msg, sizeof (end_msg) - 1, 0) 
+		== (int) sizeof (end_msg) - 1);
+	CU_ASSERT (test_parodus_send_req (&tp, "rcv-wake-0") == 0);
+	CU_ASSERT_FATAL (libparodus_receive (instance, &msg, 2000) == 0);
+	CU_ASSERT (payload_is (msg, "rcv-wake-0"));
+	wrp_free_struct (msg);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.drops_decode == 1);
+	usleep (100000);	// let the receiver go back to waiting
+	start_ns = get_monotonic_ns ();
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	CU_ASSERT (get_monotonic_ns () - start_ns < 500 * 1000000ULL);
+	test_parodus_close (&tp);
+}
+
+void test_reconnect_delay (void)
+{
+	unsigned seed = 1;
+	unsigned attempts, i;
+	uint32_t delay, low, high, min, max;
+
+	CU_ASSERT (test_reconnect_delay_ms (0, &seed) == 100);
+	for (attempts = 1; attempts <= 10; attempts++) {
+		high = (attempts <= 6) ? (1000u << (attempts - 1)) : 63000u;
+		low = high / 2;
+		min = UINT32_MAX;
+		max = 0;
+		for (i = 0; i < 100; i++) {
+			delay = test_reconnect_delay_ms (attempts, &seed);
+			if (delay < min)
+				min = delay;
+			if (delay > max)
+				max = delay;
+		}
+		CU_ASSERT (min >= low);
+		CU_ASSERT (max <= high);
+		CU_ASSERT (min < max);	// jittered
+	}
+}
+
+#define CONN_TEST_MAX_STATES 8
+
+static int conn_test_states[CONN_TEST_MAX_STATES];
+static unsigned conn_test_count;
+static bool conn_test_hold_url;
+static int conn_test_hold_sock = -1;
+
+static void test_conn_cb (libpd_instance_t instance, int state)
+{
+	(void) instance;
+	if (conn_test_count < CONN_TEST_MAX_STATES)
+		conn_test_states[conn_test_count] = state;
+	// hold the client url, so reconnect attempts fail and back off
+	if ((LIBPD_CONN_DOWN == state) && conn_test_hold_url) {
+		conn_test_hold_sock = nn_socket (AF_SP, NN_PULL);
+		if (conn_test_hold_sock >= 0)
+			nn_bind (conn_test_hold_sock, TEST_CLIENT_URL);
+	}
+	__atomic_add_fetch (&conn_test_count, 1, __ATOMIC_SEQ_CST);
+}
+
+void test_reconnect (void)
+{
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = true, .keepalive_timeout_secs = 0,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL,
+		.conn_func = test_conn_cb};
+	libpd_instance_t instance;
+	libpd_stats_t stats;
+	libpd_liveness_t liveness;
+	wrp_msg_t *msg;
+	uint64_t start_ns;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test reconnect\n"));
+	conn_test_count = 0;
+	conn_test_hold_url = false;
+	CU_ASSERT_FATAL (test_parodus_open (&tp, TEST_CLIENT_URL) == 0);
+	CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+	test_parodus_check_registration (&tp);
+
+	CU_ASSERT (libparodus_reconnect (instance) == 0);
+	wait_count (&conn_test_count, 2, 2000);
+	CU_ASSERT_FATAL (conn_test_count == 2);
+	CU_ASSERT (conn_test_states[0] == LIBPD_CONN_DOWN);
+	CU_ASSERT (conn_test_states[1] == LIBPD_CONN_UP);
+	test_parodus_check_registration (&tp);
+	CU_ASSERT (test_parodus_send_req (&tp, "reconnect-0") == 0);
+	CU_ASSERT_FATAL (libparodus_receive (instance, &msg, 2000) == 0);
+	CU_ASSERT (payload_is (msg, "reconnect-0"));
+	wrp_free_struct (msg);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.reconnects == 1);
+
+	// attempts fail while the url is held, and shutdown 
+	// does not wait out the backoff
+	conn_test_hold_url = true;
+	CU_ASSERT (libparodus_reconnect (instance) == 0);
+	wait_count (&conn_test_count, 3, 2000);
+	CU_ASSERT_FATAL (conn_test_count == 3);
+	CU_ASSERT (conn_test_states[2] == LIBPD_CONN_DOWN);
+	usleep (200000);
+	CU_ASSERT (libparodus_get_liveness (instance, &liveness) == 0);
+	CU_ASSERT (liveness.state == LIBPD_LIVENESS_DOWN);
+	start_ns = get_monotonic_ns ();
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	CU_ASSERT (get_monotonic_ns () - start_ns < 500 * 1000000ULL);
+	CU_ASSERT (conn_test_count == 3);
+	shutdown_socket (&conn_test_hold_sock);
+	test_parodus_close (&tp);
+}
+
+// waits up to timeout_ms for the liveness state
+static int wait_liveness (libpd_instance_t instance, int state, int timeout_ms)
+{
+	libpd_liveness_t liveness;
+
+	while (true) {
+		if (libparodus_get_liveness (instance, &liveness) != 0)
+			return -1;
+		if ((liveness.state == state) || (timeout_ms <= 0))
+			return liveness.state;
+		usleep (10000);
+		timeout_ms -= 10;
+	}
+}
+
+void test_liveness (void)
+{
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = true, .keepalive_timeout_secs = 1,
+		.liveness_grace_secs = 3, .liveness_probe = true,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL};
+	libpd_instance_t instance;
+	libpd_liveness_t liveness;
+	libpd_stats_t stats;
+	wrp_msg_t auth_msg;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test liveness\n"));
+	CU_ASSERT_FATAL (test_parodus_open (&tp, TEST_CLIENT_URL) == 0);
+	CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+	test_parodus_check_registration (&tp);
+	CU_ASSERT (libparodus_get_liveness (instance, &liveness) == 0);
+	CU_ASSERT (liveness.state == LIBPD_LIVENESS_ALIVE);
+	// quiet for keepalive_timeout_secs
+	CU_ASSERT (wait_liveness (instance, LIBPD_LIVENESS_SUSPECT, 3000) 
+		== LIBPD_LIVENESS_SUSPECT);
+	CU_ASSERT (libparodus_get_liveness (instance, &liveness) == 0);
+	CU_ASSERT (liveness.idle_ms >= 1000);
+	// the probe is a registration msg
+	test_parodus_check_registration (&tp);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.liveness_probes == 1);
+	CU_ASSERT (stats.reconnects == 0);
+	// parodus answers the probe
+	memset ((void*) &auth_msg, 0, sizeof(auth_msg));
+	auth_msg.msg_type = WRP_MSG_TYPE__AUTH;
+	auth_msg.u.auth.status = 200;
+	CU_ASSERT (test_parodus_send (&tp, &auth_msg) == 0);
+	CU_ASSERT (wait_liveness (instance, LIBPD_LIVENESS_ALIVE, 1000) 
+		== LIBPD_LIVENESS_ALIVE);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.reconnects == 0);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	test_parodus_close (&tp);
+}
+
+// a probe parodus does not take must not hold up the receiver thread
+void test_liveness_probe_error (void)
+{
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = true, .keepalive_timeout_secs = 1,
+		.liveness_grace_secs = 3, .liveness_probe = true,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL};
+	libpd_instance_t instance;
+	libpd_stats_t stats;
+	int timeout_ms;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test liveness probe error\n"));
+	CU_ASSERT_FATAL (test_parodus_open (&tp, TEST_CLIENT_URL) == 0);
+	CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+	test_parodus_check_registration (&tp);
+	test_parodus_close (&tp);	// nothing takes the probe
+	CU_ASSERT (wait_liveness (instance, LIBPD_LIVENESS_SUSPECT, 3000) 
+		== LIBPD_LIVENESS_SUSPECT);
+	// well within the send timeout
+	for (timeout_ms = 500; timeout_ms > 0; timeout_ms -= 10) {
+		CU_ASSERT_FATAL (libparodus_get_stats (instance, &stats) == 0);
+		if (stats.liveness_probe_errors != 0)
+			break;
+		usleep (10000);
+	}
+	CU_ASSERT (stats.liveness_probes == 1);
+	CU_ASSERT (stats.liveness_probe_errors == 1);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.reconnects == 0);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+}
+
+// answers one request received by the test parodus
+static void *test_parodus_responder (void *arg)
+{
+	test_parodus_t *tp = (test_parodus_t *) arg;
+	wrp_msg_t *msg;
+
+	if (test_parodus_receive (tp, &msg, 2000) != 0)
+		return NULL;
+	if (msg->msg_type == WRP_MSG_TYPE__REQ)
+		test_parodus_send_req (tp, msg->u.req.transaction_uuid);
+	wrp_free_struct (msg);
+	return NULL;
+}
+
+static void make_test_req (wrp_msg_t *msg, const char *uuid)
+{
+	memset ((void*) msg, 0, sizeof(wrp_msg_t));
+	msg->msg_type = WRP_MSG_TYPE__REQ;
+	msg->u.req.source = TEST_PARODUS_DEST;
+	msg->u.req.dest = "dns:webpa.comcast.com/test";
+	msg->u.req.transaction_uuid = (char *) uuid;
+	msg->u.req.payload = "get";
+	msg->u.req.payload_size = 3;
+}
+
+static unsigned resp_func_count;
+static int resp_func_status;
+static bool resp_func_on_main;
+
+static void test_resp_func (libpd_instance_t instance, int status,
+	wrp_msg_t *resp, void *arg)
+{
+	(void) arg;
+	resp_func_status = status;
+	resp_func_on_main = pthread_equal (pthread_self (), test_main_thread);
+	if (NULL != resp)
+		libparodus_free_msg (instance, resp);
+	__atomic_add_fetch (&resp_func_count, 1, __ATOMIC_SEQ_CST);
+}
+
+void test_request (void)
+{
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = true, .keepalive_timeout_secs = 0,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL};
+	libpd_instance_t instance;
+	libpd_stats_t stats;
+	pthread_t responder;
+	wrp_msg_t req, *resp;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test request\n"));
+	test_main_thread = pthread_self ();
+	CU_ASSERT_FATAL (test_parodus_open (&tp, TEST_CLIENT_URL) == 0);
+	CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+	test_parodus_check_registration (&tp);
+
+	CU_ASSERT_FATAL (pthread_create (&responder, NULL, 
+		test_parodus_responder, &tp) == 0);
+	make_test_req (&req, "req-answered");
+	CU_ASSERT (libparodus_request (instance, &req, &resp, 2000) == 0);
+	CU_ASSERT (NULL != resp);
+	if (NULL != resp) {
+		CU_ASSERT (payload_is (resp, "req-answered"));
+		libparodus_free_msg (instance, resp);
+	}
+	pthread_join (responder, NULL);
+
+	make_test_req (&req, "req-unanswered");
+	CU_ASSERT (libparodus_request (instance, &req, &resp, 100) == 1);
+	CU_ASSERT (NULL == resp);
+	make_test_req (&req, NULL);
+	CU_ASSERT (libparodus_request (instance, &req, &resp, 100) 
+		== LIBPD_ERROR_REQ_WRP_MSG);
+
+	// timed out by the receiver thread
+	resp_func_count = 0;
+	make_test_req (&req, "req-async");
+	CU_ASSERT (libparodus_request_async (instance, &req, test_resp_func, 
+		NULL, 100) == 0);
+	CU_ASSERT (libparodus_request_async (instance, &req, test_resp_func, 
+		NULL, 100) == LIBPD_ERROR_REQ_DUP_ID);
+	wait_count (&resp_func_count, 1, 2000);
+	CU_ASSERT (resp_func_count == 1);
+	CU_ASSERT (resp_func_status == 1);
+	CU_ASSERT (!resp_func_on_main);
+	CU_ASSERT (libparodus_get_stats (instance, &stats) == 0);
+	CU_ASSERT (stats.responses == 1);
+	CU_ASSERT (stats.request_timeouts == 2);
+
+	// cancelled by shutdown
+	resp_func_count = 0;
+	make_test_req (&req, "req-pending");
+	CU_ASSERT (libparodus_request_async (instance, &req, test_resp_func, 
+		NULL, 60000) == 0);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	CU_ASSERT (resp_func_count == 1);
+	CU_ASSERT (resp_func_status == 2);
+	test_parodus_close (&tp);
+}
+
+void test_send_bytes (void)
+{
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = false, .keepalive_timeout_secs = 0,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL};
+	libpd_instance_t instance;
+	libpd_wrp_template_t *tmpl;
+	wrp_msg_t msg, *rcvd;
+	void *bytes;
+	ssize_t len;
+	char uuid[32];
+	int i;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test send bytes\n"));
+	make_test_req (&msg, "template");
+	tmpl = libparodus_template_create (&msg);
+	CU_ASSERT_FATAL (NULL != tmpl);
+	CU_ASSERT_FATAL (test_parodus_open (&tp, NULL) == 0);
+	// the second time with the async sender
+	for (i = 0; i < 2; i++) {
+		CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+		sprintf (uuid, "send-bytes-%d", i);
+		len = libparodus_template_encode (tmpl, uuid, uuid, strlen (uuid), 
+			&bytes);
+		CU_ASSERT_FATAL (len > 0);
+		CU_ASSERT (libparodus_send_bytes (instance, bytes, (size_t) len) == 0);
+		free (bytes);
+		CU_ASSERT (libparodus_send_flush (instance, 2000) == 0);
+		CU_ASSERT_FATAL (test_parodus_receive (&tp, &rcvd, 2000) == 0);
+		CU_ASSERT (payload_is (rcvd, uuid));
+		if (rcvd->msg_type == WRP_MSG_TYPE__REQ)
+			CU_ASSERT (strcmp (rcvd->u.req.transaction_uuid, uuid) == 0);
+		wrp_free_struct (rcvd);
+		CU_ASSERT (libparodus_send_bytes (instance, "*** Invalid WRP message\n", 24)
+			== LIBPD_ERROR_SEND_WRP_MSG);
+		CU_ASSERT (libparodus_send_bytes (instance, NULL, 10)
+			== LIBPD_ERROR_SEND_WRP_MSG);
+		CU_ASSERT (libparodus_shutdown (&instance) == 0);
+		cfg.async_send_queue_size = 8;
+	}
+	CU_ASSERT (libparodus_send_bytes (NULL, "", 0) == LIBPD_ERROR_SEND_NULL_INST);
+	libparodus_template_destroy (tmpl);
+	test_parodus_close (&tp);
+}
+
+static const void *send_done_bytes;
+
+static void save_send_done (libpd_instance_t instance, int status,
+	const void *msg_bytes, size_t msg_len)
+{
+	(void) instance; (void) msg_len;
+	if (status == 0)
+		send_done_bytes = msg_bytes;
+}
+
+// sends a request with uuid also as payload, and checks that the
+// test parodus gets it
+static void check_send_req (test_parodus_t *tp, libpd_instance_t instance,
+	wrp_msg_t *msg, const char *uuid)
+{
+	wrp_msg_t *rcvd;
+
+	msg->u.req.transaction_uuid = (char *) uuid;
+	msg->u.req.payload = (void *) uuid;
+	msg->u.req.payload_size = strlen (uuid);
+	CU_ASSERT (libparodus_send (instance, msg) == 0);
+	CU_ASSERT (libparodus_send_flush (instance, 2000) == 0);
+	CU_ASSERT_FATAL (test_parodus_receive (tp, &rcvd, 2000) == 0);
+	CU_ASSERT (payload_is (rcvd, uuid));
+	if (rcvd->msg_type == WRP_MSG_TYPE__REQ) {
+		CU_ASSERT (strcmp (rcvd->u.req.transaction_uuid, uuid) == 0);
+		CU_ASSERT (strcmp (rcvd->u.req.source, TEST_PARODUS_DEST) == 0);
+		if (NULL != msg->u.req.content_type)
+			CU_ASSERT ((NULL != rcvd->u.req.content_type) &&
+				(strcmp (rcvd->u.req.content_type, msg->u.req.content_type) == 0));
+	}
+	wrp_free_struct (rcvd);
+}
+
+void test_send_encode (void)
+{
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = false, .keepalive_timeout_secs = 0,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL};
+	libpd_instance_t instance;
+	wrp_msg_t msg, *rcvd;
+	headers_t *headers;
+	const void *item_bytes = NULL;
+	char *big;
+	char uuid[32];
+	int i;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test send encode\n"));
+	CU_ASSERT_FATAL (test_parodus_open (&tp, NULL) == 0);
+	CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+	make_test_req (&msg, "encode");
+	msg.u.req.content_type = "application/json";
+	check_send_req (&tp, instance, &msg, "encode-req");
+
+	// headers are left to wrp-c
+	headers = (headers_t *) malloc (sizeof (headers_t) + sizeof (char *));
+	CU_ASSERT_FATAL (NULL != headers);
+	headers->count = 1;
+	headers->headers[0] = "X-Test: encode";
+	msg.u.req.headers = headers;
+	check_send_req (&tp, instance, &msg, "encode-headers");
+	msg.u.req.headers = NULL;
+	free (headers);
+
+	memset ((void*) &msg, 0, sizeof(msg));
+	msg.msg_type = WRP_MSG_TYPE__EVENT;
+	msg.u.event.source = TEST_PARODUS_DEST;
+	msg.u.event.dest = "event:device-status";
+	msg.u.event.content_type = "text/plain";
+	msg.u.event.payload = "encode-event";
+	msg.u.event.payload_size = strlen ("encode-event");
+	CU_ASSERT (libparodus_send (instance, &msg) == 0);
+	CU_ASSERT_FATAL (test_parodus_receive (&tp, &rcvd, 2000) == 0);
+	CU_ASSERT (rcvd->msg_type == WRP_MSG_TYPE__EVENT);
+	if (rcvd->msg_type == WRP_MSG_TYPE__EVENT) {
+		CU_ASSERT (strcmp (rcvd->u.event.dest, "event:device-status") == 0);
+		CU_ASSERT ((NULL != rcvd->u.event.content_type) &&
+			(strcmp (rcvd->u.event.content_type, "text/plain") == 0));
+		CU_ASSERT ((rcvd->u.event.payload_size == 12) &&
+			(memcmp (rcvd->u.event.payload, "encode-event", 12) == 0));
+	}
+	wrp_free_struct (rcvd);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+
+	// one msg at a time, the async sender reuses the same item and buffer
+	cfg.async_send_queue_size = 2;
+	cfg.send_done_func = save_send_done;
+	CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+	make_test_req (&msg, "encode");
+	for (i = 0; i < 3; i++) {
+		sprintf (uuid, "encode-async-%d", i);
+		check_send_req (&tp, instance, &msg, uuid);
+		if (i > 0)
+			CU_ASSERT (send_done_bytes == item_bytes);
+		item_bytes = send_done_bytes;
+	}
+	// a big msg still gets through, then small ones again
+	big = (char *) malloc (8193);
+	CU_ASSERT_FATAL (NULL != big);
+	memset (big, 'b', 8192);
+	big[8192] = 0;
+	check_send_req (&tp, instance, &msg, big);
+	free (big);
+	check_send_req (&tp, instance, &msg, "encode-async-small");
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	test_parodus_close (&tp);
+}
+
+#define BATCH_TEST_MSGS 70	// more than one chunk
+
+// sends a batch of requests, some left to wrp-c, and receives them in order
+static void check_send_batch (test_parodus_t *tp, libpd_instance_t instance,
+	unsigned round, headers_t *headers)
+{
+	wrp_msg_t msgs[BATCH_TEST_MSGS];
+	wrp_msg_t *msg_ptrs[BATCH_TEST_MSGS];
+	char uuids[BATCH_TEST_MSGS][32];
+	wrp_msg_t *rcvd;
+	size_t sent;
+	unsigned i;
+
+	for (i = 0; i < BATCH_TEST_MSGS; i++) {
+		sprintf (uuids[i], "batch-%u-%u", round, i);
+		make_test_req (&msgs[i], uuids[i]);
+		msgs[i].u.req.payload = uuids[i];
+		msgs[i].u.req.payload_size = strlen (uuids[i]);
+		if ((i % 7) == 3)
+			msgs[i].u.req.headers = headers;
+		msg_ptrs[i] = &msgs[i];
+	}
+	CU_ASSERT (libparodus_send_batch (instance, msg_ptrs, BATCH_TEST_MSGS, 
+		&sent) == 0);
+	CU_ASSERT (sent == BATCH_TEST_MSGS);
+	for (i = 0; i < BATCH_TEST_MSGS; i++) {
+		CU_ASSERT_FATAL (test_parodus_receive (tp, &rcvd, 2000) == 0);
+		CU_ASSERT (payload_is (rcvd, uuids[i]));
+		if (rcvd->msg_type == WRP_MSG_TYPE__REQ)
+			CU_ASSERT (strcmp (rcvd->u.req.transaction_uuid, uuids[i]) == 0);
+		wrp_free_struct (rcvd);
+	}
+}
+
+void test_send_batch_encode (void)
+{
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = false, .keepalive_timeout_secs = 0,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL};
+	libpd_instance_t instance;
+	wrp_msg_t msgs[3];
+	wrp_msg_t *msg_ptrs[3] = {&msgs[0], NULL, &msgs[2]};
+	wrp_msg_t *rcvd;
+	headers_t *headers;
+	size_t sent;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test send batch encode\n"));
+	headers = (headers_t *) malloc (sizeof (headers_t) + sizeof (char *));
+	CU_ASSERT_FATAL (NULL != headers);
+	headers->count = 1;
+	headers->headers[0] = "X-Test: batch";
+	CU_ASSERT_FATAL (test_parodus_open (&tp, NULL) == 0);
+	CU_ASSERT_FATAL (libparodus_init (&instance, &cfg) == 0);
+	// the second batch encodes into the arena kept from the first
+	check_send_batch (&tp, instance, 0, headers);
+	check_send_batch (&tp, instance, 1, headers);
+	// a null msg ends the batch after the msgs before it
+	make_test_req (&msgs[0], "batch-null-0");
+	make_test_req (&msgs[2], "batch-null-2");
+	CU_ASSERT (libparodus_send_batch (instance, msg_ptrs, 3, &sent) 
+		== LIBPD_ERROR_SEND_WRP_MSG);
+	CU_ASSERT (sent == 1);
+	CU_ASSERT_FATAL (test_parodus_receive (&tp, &rcvd, 2000) == 0);
+	CU_ASSERT ((rcvd->msg_type == WRP_MSG_TYPE__REQ) &&
+		(strcmp (rcvd->u.req.transaction_uuid, "batch-null-0") == 0));
+	wrp_free_struct (rcvd);
+	CU_ASSERT (test_parodus_receive (&tp, &rcvd, 100) != 0);
+	CU_ASSERT (libparodus_shutdown (&instance) == 0);
+	test_parodus_close (&tp);
+	free (headers);
+}
+
+void test_send_would_block (void)
+{
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = false, .keepalive_timeout_secs = 0,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL};
+	libpd_stats_t stats;
+	wrp_msg_t *rcvd;
+	unsigned event_num = 0;
+	unsigned i;
+	int rtn = 0;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test send would block\n"));
+	// nothing takes the msgs until the test parodus is opened
+	CU_ASSERT_FATAL (libparodus_init (&test_instance1, &cfg) == 0);
+	CU_ASSERT (send_event_timed (&event_num, 0) == LIBPD_ERROR_SEND_WOULD_BLOCK);
+	CU_ASSERT (send_event_timed (&event_num, 100) == LIBPD_ERROR_SEND_WOULD_BLOCK);
+	CU_ASSERT (libparodus_get_stats (test_instance1, &stats) == 0);
+	CU_ASSERT (stats.send_errors_timeout == 2);
+	CU_ASSERT (stats.send_errors_socket == 0);
+	CU_ASSERT (stats.msgs_sent == 0);
+	CU_ASSERT_FATAL (test_parodus_open (&tp, NULL) == 0);
+	CU_ASSERT (send_event_timed (&event_num, 1000) == 0);
+	CU_ASSERT_FATAL (test_parodus_receive (&tp, &rcvd, 2000) == 0);
+	wrp_free_struct (rcvd);
+	CU_ASSERT (libparodus_shutdown (&test_instance1) == 0);
+	test_parodus_close (&tp);
+
+	// a full async send queue would block too
+	cfg.async_send_queue_size = 2;
+	cfg.send_timeout_ms = 100;
+	CU_ASSERT_FATAL (libparodus_init (&test_instance1, &cfg) == 0);
+	for (i = 0; (i < 4) && (rtn == 0); i++)
+		rtn = send_event_timed (&event_num, 0);
+	CU_ASSERT (rtn == LIBPD_ERROR_SEND_WOULD_BLOCK);
+	CU_ASSERT (libparodus_get_stats (test_instance1, &stats) == 0);
+	CU_ASSERT (stats.send_errors_queue_full == 1);
+	CU_ASSERT (libparodus_shutdown (&test_instance1) == 0);
+}
+
+static bool event_payload_is (wrp_msg_t *msg, unsigned event_num)
+{
+	char *expected = new_str ("---EventMessagePayload####");
+	bool same;
+
+	insert_number_into_buf (expected, event_num);
+	same = (msg->msg_type == WRP_MSG_TYPE__EVENT) &&
+		(msg->u.event.payload_size == strlen (expected) + 1) &&
+		(memcmp (msg->u.event.payload, expected, strlen (expected)) == 0);
+	free (expected);
+	return same;
+}
+
+void test_send_spool (void)
+{
+	char path[] = "/tmp/libpd_spool_XXXXXX";
+	test_parodus_t tp;
+	libpd_cfg_t cfg = {.service_name = service_name1,
+		.receive = false, .keepalive_timeout_secs = 0,
+		.parodus_url = TEST_PARODUS_URL, .client_url = TEST_CLIENT_URL,
+		.send_timeout_ms = 100, .send_spool_max_bytes = 1024};
+	libpd_stats_t stats;
+	wrp_msg_t *rcvd;
+	unsigned event_num = 0;
+	unsigned timed_num, spooled;
+	int fd, rtn = 0;
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test send spool\n"));
+	fd = mkstemp (path);
+	CU_ASSERT_FATAL (fd >= 0);
+	close (fd);
+	cfg.send_spool_path = path;
+	// nothing takes the msgs until the test parodus is opened
+	CU_ASSERT_FATAL (libparodus_init (&test_instance1, &cfg) == 0);
+	for (spooled = 0; spooled < 3; spooled++)
+		CU_ASSERT (send_event_msg ("---LIBPARODUS---", "---ParodusService---",
+			"---EventMessagePayload####", ++event_num, 0) == 0);
+	// timed sends don't spool
+	CU_ASSERT (send_event_timed (&event_num, 0) == LIBPD_ERROR_SEND_WOULD_BLOCK);
+	timed_num = event_num;
+	// let the spool thread fail a few replays
+	delay_ms (300);
+	CU_ASSERT (libparodus_get_stats (test_instance1, &stats) == 0);
+	CU_ASSERT (stats.spooled == 3);
+	CU_ASSERT (stats.spool_depth == 3);
+	CU_ASSERT (stats.spool_replays == 0);
+	CU_ASSERT (stats.spool_replay_errors >= 1);
+	CU_ASSERT (stats.send_errors_timeout == 1);
+	CU_ASSERT (stats.send_errors_socket == 0);
+	CU_ASSERT (stats.msgs_sent == 0);
+
+	// the default overflow policy fails the send
+	while (spooled < 100) {
+		rtn = send_event_msg ("---LIBPARODUS---", "---ParodusService---",
+			"---EventMessagePayload####", ++event_num, 0);
+		if (rtn != 0)
+			break;
+		spooled++;
+	}
+	CU_ASSERT (rtn == LIBPD_ERROR_SEND_SPOOL_FULL);
+	CU_ASSERT (libparodus_get_stats (test_instance1, &stats) == 0);
+	CU_ASSERT (stats.spooled == spooled);
+	CU_ASSERT (stats.spool_depth == spooled);
+	CU_ASSERT (stats.spool_drops == 1);
+	CU_ASSERT (libparodus_shutdown (&test_instance1) == 0);
+
+	// the spooled msgs are sent in order after the next init
+	CU_ASSERT_FATAL (libparodus_init (&test_instance1, &cfg) == 0);
+	CU_ASSERT_FATAL (test_parodus_open (&tp, NULL) == 0);
+	for (event_num = 1; event_num <= spooled + 1; event_num++) {
+		if (event_num == timed_num)
+			continue;
+		CU_ASSERT_FATAL (test_parodus_receive (&tp, &rcvd, 2000) == 0);
+		CU_ASSERT (event_payload_is (rcvd, event_num));
+		wrp_free_struct (rcvd);
+	}
+	CU_ASSERT (libparodus_get_stats (test_instance1, &stats) == 0);
+	CU_ASSERT (stats.spool_replays == spooled);
+	CU_ASSERT (stats.spool_depth == 0);
+	CU_ASSERT (stats.msgs_sent == spooled);
+
+	// with the spool empty, msgs are sent directly again
+	CU_ASSERT (send_event_msg ("---LIBPARODUS---", "---ParodusService---",
+		"---EventMessagePayload####", ++event_num, 0) == 0);
+	CU_ASSERT_FATAL (test_parodus_receive (&tp, &rcvd, 2000) == 0);
+	CU_ASSERT (event_payload_is (rcvd, event_num));
+	wrp_free_struct (rcvd);
+	CU_ASSERT (libparodus_get_stats (test_instance1, &stats) == 0);
+	CU_ASSERT (stats.spooled == 0);
+	CU_ASSERT (libparodus_shutdown (&test_instance1) == 0);
+	test_parodus_close (&tp);
+	unlink (path);
+}
+
 void wait_auth_received (void)
 {
 	if (!is_auth_received ()) {
@@ -690,6 +2747,16 @@ void wait_auth_received (void)
 	CU_ASSERT (is_auth_received ());
 }
 
+static int async_send_ok_count = 0;
+
+static void count_async_send (libpd_instance_t instance, int status,
+	const void *msg_bytes, size_t msg_len)
+{
+	(void) instance; (void) msg_bytes; (void) msg_len;
+	if (status == 0)
+		async_send_ok_count++;
+}
+
 void test_send_only (void)
 {
 	unsigned event_num = 0;
@@ -700,17 +2767,36 @@ void test_send_only (void)
 	CU_ASSERT (libparodus_init(&test_instance1, &cfg1) == 0);
 	CU_ASSERT (libparodus_init(&test_instance2, &cfg2) == 0);
 	CU_ASSERT (send_event_msgs (NULL, &event_num, 200, true) == 0);
+	CU_ASSERT (send_event_batch (&event_num, 100) == 0);
+	CU_ASSERT (send_event_timed (&event_num, 1000) == 0);
 	CU_ASSERT (libparodus_shutdown (&test_instance1) == 0);
 	CU_ASSERT (libparodus_shutdown (&test_instance2) == 0);
 
 	cfg1.test_flags |= CFG_TEST_CONNECT_ON_EVERY_SEND;
 	cfg2.test_flags |= CFG_TEST_CONNECT_ON_EVERY_SEND;
+	cfg1.send_timeout_ms = 5000;
+	CU_ASSERT (libparodus_init(&test_instance1, &cfg1) == 0);
+	CU_ASSERT (libparodus_init(&test_instance2, &cfg2) == 0);
+	CU_ASSERT (send_event_msgs (NULL, &event_num, 200, true) == 0);
+	CU_ASSERT (send_event_timed (&event_num, 1000) == 0);
+	CU_ASSERT (libparodus_shutdown (&test_instance1) == 0);
+	CU_ASSERT (libparodus_shutdown (&test_instance2) == 0);
+
+	cfg1.async_send_queue_size = 64;
+	cfg1.send_done_func = count_async_send;
+	async_send_ok_count = 0;
 	CU_ASSERT (libparodus_init(&test_instance1, &cfg1) == 0);
 	CU_ASSERT (libparodus_init(&test_instance2, &cfg2) == 0);
 	CU_ASSERT (send_event_msgs (NULL, &event_num, 200, true) == 0);
+	CU_ASSERT (libparodus_send_flush (test_instance1, 10000) == 0);
+	CU_ASSERT (async_send_ok_count == 200);
+	CU_ASSERT (send_event_batch (&event_num, 50) == 0);
+	CU_ASSERT (libparodus_send_flush (test_instance1, 10000) == 0);
+	CU_ASSERT (async_send_ok_count == 250);
 	CU_ASSERT (libparodus_shutdown (&test_instance1) == 0);
 	CU_ASSERT (libparodus_shutdown (&test_instance2) == 0);
 
+	test_send_spool ();
 }
 
 void test_multiple_inits (void)
@@ -795,17 +2881,23 @@ void test_1(void)
 	unsigned timeout_cnt = 0;
 	unsigned reply_error_count = 0;
 	int reconnect_count, keep_alive_count;
+	libpd_stats_t stats;
+	libpd_latency_t latency;
+	libpd_liveness_t liveness;
 	int rtn, oserr;
 	int test_sock, dup_sock;
 	libpd_mq_t test_queue;
 	extra_err_info_t err_info;
 	wrp_msg_t *wrp_msg;
+	wrp_msg_t *batch_msgs[3];
+	size_t batch_count;
 	unsigned event_num = 0;
 	unsigned msg_num = 0;
 	libpd_instance_t current_instance;
 	libpd_instance_t null_instance = NULL;
+	const char *dup_services[] = {service_name2, service_name1, NULL};
 	libpd_cfg_t cfg1 = {.service_name = service_name1,
-		.receive = true, .keepalive_timeout_secs = 0};
+		.receive = true, .keepalive_timeout_secs = 0, .latency_histograms = true};
 	libpd_cfg_t cfg2 = {.service_name = service_name2,
 		.receive = true, .keepalive_timeout_secs = 0};
 
@@ -814,33 +2906,53 @@ void test_1(void)
 	CU_ASSERT_FATAL (check_current_dir() == 0);
 
 	test_queues ();
+	test_spsc_queue ();
+	test_queue_batch (0);
+	test_queue_batch (LIBPD_QFLAG_SPSC);
+	test_mpsc_queue ();
+	test_queue_event_fd (0);
+	test_queue_event_fd (LIBPD_QFLAG_SPSC);
+	test_queue_timeout_ns (0);
+	test_queue_timeout_ns (LIBPD_QFLAG_SPSC);
+	test_queue_stamp (0);
+	test_queue_stamp (LIBPD_QFLAG_SPSC);
+	test_hist ();
+	test_reqs ();
+	test_queue_overflow ();
+	test_queue_limits ();
+	test_queue_lanes ();
+	test_wrp_peek ();
+	test_mp_write_map ();
+	test_wrp_template ();
+	test_spool ();
+	test_zero_copy_decode ();
 
 	//test_set_cfg (&cfg);
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test connect receiver, good IP\n"));
-	test_sock = connect_receiver (TEST_RCV_URL, 20, &oserr);
+	test_sock = connect_receiver (TEST_RCV_URL, &oserr);
 	CU_ASSERT (test_sock >= 0) ;
 	if (test_sock >= 0)
 		shutdown_socket(&test_sock);
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test connect receiver, bad IP\n"));
-	test_sock = connect_receiver (BAD_RCV_URL, 0, &oserr);
+	test_sock = connect_receiver (BAD_RCV_URL, &oserr);
 	CU_ASSERT (test_sock < 0);
 	CU_ASSERT (oserr == EINVAL);
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test connect receiver, good IP\n"));
-	test_sock = connect_receiver (TEST_RCV_URL, 20, &oserr);
+	test_sock = connect_receiver (TEST_RCV_URL, &oserr);
 	CU_ASSERT (test_sock >= 0) ;
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test connect duplicate receiver\n"));
-	dup_sock = connect_receiver (TEST_RCV_URL, 20, &oserr);
+	dup_sock = connect_receiver (TEST_RCV_URL, &oserr);
 	CU_ASSERT (dup_sock < 0);
 	CU_ASSERT (oserr == EADDRINUSE);
 	if (test_sock >= 0)
 		shutdown_socket(&test_sock);
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test connect sender, good IP\n"));
-	test_sock = connect_sender (TEST_SEND_URL, &oserr);
+	test_sock = connect_sender (TEST_SEND_URL, 2000, &oserr);
 	CU_ASSERT (test_sock >= 0) ;
 	if (test_sock >= 0)
 		shutdown_socket(&test_sock);
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test connect sender, bad IP\n"));
-	test_sock = connect_sender (BAD_SEND_URL, &oserr);
+	test_sock = connect_sender (BAD_SEND_URL, 2000, &oserr);
 	CU_ASSERT (test_sock < 0);
 	CU_ASSERT (oserr == EINVAL);
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test create wrp queue\n"));
@@ -861,6 +2973,23 @@ void test_1(void)
 	test_close_receiver (test_queue, &oserr);
 	CU_ASSERT (flush_wrp_queue (test_queue, 500, &oserr) == 3);
 
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test libparodus receive batch\n"));
+	test_send_wrp_queue_ok (test_queue, &oserr);
+	test_send_wrp_queue_ok (test_queue, &oserr);
+	CU_ASSERT (libparodus_receive_batch__ (test_queue, batch_msgs, 
+		3, 500, &batch_count, &oserr) == 0);
+	CU_ASSERT (batch_count == 2);
+	while (batch_count > 0)
+		wrp_free_struct (batch_msgs[--batch_count]);
+	test_send_wrp_queue_ok (test_queue, &oserr);
+	test_close_receiver (test_queue, &oserr);
+	test_send_wrp_queue_ok (test_queue, &oserr);
+	CU_ASSERT (libparodus_receive_batch__ (test_queue, batch_msgs, 
+		3, 500, &batch_count, &oserr) == 2);
+	CU_ASSERT (batch_count == 1);
+	while (batch_count > 0)
+		wrp_free_struct (batch_msgs[--batch_count]);
+
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: test libparodus receive timeout\n"));
 	CU_ASSERT (libparodus_receive__ (test_queue, &wrp_msg, 500, &oserr) == 1);
 	CU_ASSERT (test_close_receiver (test_queue, &oserr) == 0);
@@ -886,8 +3015,38 @@ void test_1(void)
 			"Error on libparodus close receiver. Null instance given.") == 0);
 	rtn = libparodus_send (null_instance, wrp_msg);
 	CU_ASSERT (rtn == LIBPD_ERROR_SEND_NULL_INST);
+	CU_ASSERT (libparodus_send_batch (null_instance, &wrp_msg, 1, NULL) 
+		== LIBPD_ERROR_SEND_NULL_INST);
+	CU_ASSERT (libparodus_send_timed (null_instance, wrp_msg, 0) 
+		== LIBPD_ERROR_SEND_NULL_INST);
+  CU_ASSERT (strcmp (libparodus_strerror (LIBPD_ERROR_SEND_WOULD_BLOCK), 
+			"Error on libparodus send. Send would block.") == 0);
+  CU_ASSERT (strcmp (libparodus_strerror (LIBPD_ERROR_INIT_SPOOL), 
+			"Error on libparodus init. Could not open send spool.") == 0);
   CU_ASSERT (strcmp (libparodus_strerror (rtn), 
 			"Error on libparodus send. Null instance given.") == 0);
+	rtn = libparodus_get_stats (null_instance, &stats);
+	CU_ASSERT (rtn == LIBPD_ERROR_STATS_NULL_INST);
+  CU_ASSERT (strcmp (libparodus_strerror (rtn), 
+			"Error on libparodus get stats. Null instance given.") == 0);
+	rtn = libparodus_get_latency (null_instance, LIBPD_HIST_SEND, &latency);
+	CU_ASSERT (rtn == LIBPD_ERROR_STATS_NULL_INST);
+  CU_ASSERT (strcmp (libparodus_strerror (LIBPD_ERROR_STATS_CFG), 
+			"Error on libparodus get latency. Histograms not configured or invalid histogram.") == 0);
+	rtn = libparodus_receive_service (null_instance, service_name1, &wrp_msg, 500);
+	CU_ASSERT (rtn == LIBPD_ERROR_RCV_NULL_INST);
+  CU_ASSERT (strcmp (libparodus_strerror (LIBPD_ERROR_RCV_SERVICE), 
+			"Error on libparodus receive. Unknown service name.") == 0);
+	CU_ASSERT (libparodus_reconnect (null_instance) == LIBPD_ERROR_RCV_NULL_INST);
+	CU_ASSERT (libparodus_get_liveness (null_instance, &liveness) == LIBPD_ERROR_RCV_NULL_INST);
+	CU_ASSERT (libparodus_request (null_instance, NULL, &wrp_msg, 0) == LIBPD_ERROR_REQ_NULL_INST);
+
+	libpd_log (LEVEL_INFO, ("LIBPD_TEST: libparodus_init duplicate extra service\n"));
+	cfg1.extra_services = dup_services;
+	CU_ASSERT (libparodus_init_dbg (&test_instance1, &cfg1, &err_info) == LIBPD_ERROR_INIT_CFG);
+	CU_ASSERT (err_info.err_detail == LIBPD_ERR_INIT_SERVICES);
+	CU_ASSERT (libparodus_shutdown (&test_instance1) == 0);
+	cfg1.extra_services = NULL;
 	
 	libpd_log (LEVEL_INFO, ("LIBPD_TEST: libparodus_init bad parodus ip\n"));
 	cfg1.receive = true;
@@ -905,6 +3064,19 @@ void test_1(void)
 	//CU_ASSERT (exterr == EINVAL);
 	CU_ASSERT (libparodus_shutdown (&test_instance1) == 0);
 	cfg1.client_url = GOOD_CLIENT_URL;
+	test_rcv_func ();
+	test_extra_services ();
+	test_decode_threads ();
+	test_rcv_wake ();
+	test_reconnect_delay ();
+	test_reconnect ();
+	test_liveness ();
+	test_liveness_probe_error ();
+	test_request ();
+	test_send_bytes ();
+	test_send_encode ();
+	test_send_batch_encode ();
+	test_send_would_block ();
 	//cfg1.service_name = "VeryVeryVeryVeryVeryVeryVeryVeryVeryVeryVeryVeryLongService";
 	//libpd_log (LEVEL_INFO, ("LIBPD_TEST: libparodus_init service name too long\n"));
 	//CU_ASSERT (libparodus_init (&test_instance1, &cfg1) == LIBPD_ERROR_INIT_INST);
@@ -938,6 +3110,9 @@ void test_1(void)
 	CU_ASSERT (send_event_msgs (NULL, &event_num, 5, false) == 0);
 	CU_ASSERT (libparodus_receive 
 		(test_instance1, &wrp_msg, 500) == LIBPD_ERROR_RCV_CFG);
+	CU_ASSERT (libparodus_reconnect (test_instance1) == LIBPD_ERROR_RCV_CFG);
+	CU_ASSERT (libparodus_get_liveness (test_instance1, &liveness) == LIBPD_ERROR_RCV_CFG);
+	CU_ASSERT (libparodus_request (test_instance1, NULL, &wrp_msg, 0) == LIBPD_ERROR_REQ_CFG);
 	if (do_send_blocking_test)
 		test_send_blocking ();
 	else if (do_send_disconnect_test)
@@ -972,6 +3147,7 @@ void test_1(void)
 	if (do_multiple_inst_test)  {
 		cfg2.receive = true;
 		cfg2.client_url = GOOD_CLIENT_URL2;
+		cfg2.rcv_decode_threads = 2;
 		rtn = libparodus_init(&test_instance2, &cfg2);
 		CU_ASSERT_FATAL (rtn == 0);
 		libpd_log (LEVEL_INFO, ("LIBPD_TEST: libparodus_init 2 successful\n"));
@@ -1039,6 +3215,27 @@ void test_1(void)
 		test_get_counts (test_instance1, &keep_alive_count, &reconnect_count);
 		CU_ASSERT (keep_alive_count == NUM_KEEP_ALIVE_MSGS);
 		CU_ASSERT (reconnect_count == 1);
+		CU_ASSERT (libparodus_get_stats (test_instance1, &stats) == 0);
+		CU_ASSERT (stats.keep_alives == NUM_KEEP_ALIVE_MSGS);
+		CU_ASSERT (stats.reconnects == 1);
+		CU_ASSERT (stats.reconnect_ms > 0);
+		CU_ASSERT (stats.msgs_delivered >= (uint64_t) msgs_received_count);
+		CU_ASSERT (stats.msgs_received >= stats.msgs_delivered);
+		CU_ASSERT (stats.bytes_in > 0);
+		CU_ASSERT (stats.msgs_sent > 0);
+		CU_ASSERT (stats.bytes_out > 0);
+		CU_ASSERT (stats.drops_queue_full == 0);
+		CU_ASSERT (stats.drops_decode_queue == 0);
+		CU_ASSERT (libparodus_get_latency (test_instance1, LIBPD_HIST_RCV_LATENCY, 
+			&latency) == 0);
+		CU_ASSERT (latency.count >= msgs_received_count);
+		CU_ASSERT (latency.p50_ns <= latency.p99_ns);
+		CU_ASSERT (latency.p99_ns <= latency.max_ns);
+		CU_ASSERT (libparodus_get_latency (test_instance1, LIBPD_HIST_SEND, 
+			&latency) == 0);
+		CU_ASSERT (latency.count > 0);
+		CU_ASSERT (libparodus_get_latency (test_instance1, LIBPD_NUM_HISTS, 
+			&latency) == LIBPD_ERROR_STATS_CFG);
 #ifdef MOCK_MSG_COUNT
 		bool close_pipe = (msgs_received_count < MOCK_MSG_COUNT);
 #else